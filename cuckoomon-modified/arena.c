@@ -0,0 +1,333 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compat.h"
+#include "arena.h"
+
+typedef struct _arena_free_t {
+	struct _arena_free_t *next;
+} arena_free_t;
+
+#define ROUND_UP(value, align) (((value) + (align) - 1) & ~((uintptr_t)(align) - 1))
+
+void arena_init(arena_t *a, arena_reserve_t reserve, arena_release_t release,
+	size_t granularity)
+{
+	memset(a, 0, sizeof(*a));
+	a->reserve = reserve;
+	a->release = release;
+	a->granularity = granularity;
+}
+
+void arena_destroy(arena_t *a)
+{
+	arena_chunk_t *chunk, *next;
+
+	for (chunk = a->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		if (a->release != NULL)
+			a->release(chunk->base, chunk->size);
+		free(chunk);
+	}
+	a->chunks = NULL;
+	memset(a->free_lists, 0, sizeof(a->free_lists));
+	a->reserved = a->allocated = 0;
+}
+
+int arena_in_reach(const void *near, const void *ptr, size_t size)
+{
+	uintptr_t lo, hi;
+
+	if (near == NULL)
+		return 1;
+
+#if UINTPTR_MAX > 0xffffffff
+	lo = (uintptr_t)near < (uintptr_t)ptr ? (uintptr_t)near : (uintptr_t)ptr;
+	hi = (uintptr_t)ptr + size;
+	if (hi < (uintptr_t)near)
+		hi = (uintptr_t)near;
+	return hi - lo <= ARENA_REACH;
+#else
+	// rel32 wraps around, the entire address space is reachable
+	(void)ptr; (void)size;
+	return 1;
+#endif
+}
+
+static int size_class(size_t size)
+{
+	size_t cls = size / ARENA_MIN_ALIGN - 1;
+	return cls < ARENA_SIZE_CLASSES ? (int)cls : -1;
+}
+
+static void push_free(arena_t *a, void *ptr, size_t size)
+{
+	int cls = size_class(size);
+	arena_free_t *block = (arena_free_t *)ptr;
+
+	// blocks too large for any class are simply lost, which is fine as
+	// trampolines are hardly ever freed
+	if (cls < 0)
+		return;
+
+	block->next = a->free_lists[cls];
+	a->free_lists[cls] = block;
+}
+
+static void *pop_free(arena_t *a, const void *near, size_t size, size_t align)
+{
+	int cls = size_class(size);
+	arena_free_t **prev, *block;
+
+	if (cls < 0)
+		return NULL;
+
+	for (prev = (arena_free_t **)&a->free_lists[cls]; *prev != NULL;
+			prev = &(*prev)->next) {
+		block = *prev;
+		if (((uintptr_t)block & (align - 1)) == 0 &&
+				arena_in_reach(near, block, size)) {
+			*prev = block->next;
+			return block;
+		}
+	}
+	return NULL;
+}
+
+static void *chunk_alloc(arena_t *a, arena_chunk_t *chunk, const void *near,
+	size_t size, size_t align)
+{
+	uintptr_t start = (uintptr_t)chunk->base + chunk->used;
+	uintptr_t aligned = ROUND_UP(start, align);
+	size_t offset = aligned - (uintptr_t)chunk->base;
+
+	if (offset + size > chunk->size || !arena_in_reach(near, (void *)aligned, size))
+		return NULL;
+
+	// alignment gaps are left unused, they'd otherwise be filled with
+	// unrelated blocks in between the aligned (hot) ones
+	chunk->used = offset + size;
+	return (void *)aligned;
+}
+
+static unsigned char *try_reserve(arena_t *a, uintptr_t addr, size_t size)
+{
+	unsigned char *ret;
+
+	a->reserve_attempts++;
+	ret = (unsigned char *)a->reserve((void *)addr, size);
+	if (ret != NULL && ret != (unsigned char *)addr) {
+		if (a->release != NULL)
+			a->release(ret, size);
+		return NULL;
+	}
+	return ret;
+}
+
+// reserve a new chunk, for which we search outwards from the given address
+// one allocation granularity at a time
+static arena_chunk_t *new_chunk(arena_t *a, const void *near, size_t size)
+{
+	size_t gran = a->granularity;
+	size_t chunk_size = ROUND_UP(size, gran);
+	unsigned char *base = NULL;
+	arena_chunk_t *chunk;
+
+	if (near == NULL) {
+		a->reserve_attempts++;
+		base = (unsigned char *)a->reserve(NULL, chunk_size);
+	}
+	else if (chunk_size < ARENA_REACH) {
+		uintptr_t center = (uintptr_t)near & ~((uintptr_t)gran - 1);
+		uintptr_t steps = (ARENA_REACH - chunk_size) / gran;
+
+		for (uintptr_t i = 1; i < steps && base == NULL; i++) {
+			uintptr_t delta = i * gran;
+
+			// never try the null page
+			if (center > delta)
+				base = try_reserve(a, center - delta, chunk_size);
+			if (base == NULL && center + delta + chunk_size > center)
+				base = try_reserve(a, center + delta, chunk_size);
+		}
+	}
+
+	if (base == NULL)
+		return NULL;
+
+	chunk = (arena_chunk_t *)malloc(sizeof(arena_chunk_t));
+	if (chunk == NULL) {
+		if (a->release != NULL)
+			a->release(base, chunk_size);
+		return NULL;
+	}
+
+	chunk->base = base;
+	chunk->size = chunk_size;
+	chunk->used = 0;
+
+	// newest chunk first, subsequent hooks are likely in the same module
+	chunk->next = a->chunks;
+	a->chunks = chunk;
+	a->reserved += chunk_size;
+	return chunk;
+}
+
+void *arena_alloc(arena_t *a, const void *near, size_t size, size_t align)
+{
+	arena_chunk_t *chunk;
+	void *ret;
+
+	if (size == 0)
+		return NULL;
+
+	if (align < ARENA_MIN_ALIGN)
+		align = ARENA_MIN_ALIGN;
+	size = ROUND_UP(size, ARENA_MIN_ALIGN);
+
+	spin_lock(&a->lock);
+
+	ret = pop_free(a, near, size, align);
+
+	for (chunk = a->chunks; ret == NULL && chunk != NULL; chunk = chunk->next)
+		ret = chunk_alloc(a, chunk, near, size, align);
+
+	if (ret == NULL) {
+		chunk = new_chunk(a, near, size + align);
+		if (chunk != NULL)
+			ret = chunk_alloc(a, chunk, near, size, align);
+	}
+
+	if (ret != NULL)
+		a->allocated += size;
+
+	spin_unlock(&a->lock);
+	return ret;
+}
+
+void arena_free(arena_t *a, void *ptr, size_t size)
+{
+	if (ptr == NULL)
+		return;
+
+	size = ROUND_UP(size, ARENA_MIN_ALIGN);
+
+	spin_lock(&a->lock);
+	push_free(a, ptr, size);
+	a->allocated -= size;
+	spin_unlock(&a->lock);
+}
+
+// returns the tail of an allocation, used when its final size is only known
+// after it has been written to (e.g., trampolines)
+void arena_shrink(arena_t *a, void *ptr, size_t size, size_t new_size)
+{
+	arena_chunk_t *chunk;
+	unsigned char *tail;
+
+	size = ROUND_UP(size, ARENA_MIN_ALIGN);
+	new_size = ROUND_UP(new_size, ARENA_MIN_ALIGN);
+	if (ptr == NULL || new_size >= size)
+		return;
+
+	tail = (unsigned char *)ptr + new_size;
+
+	spin_lock(&a->lock);
+
+	for (chunk = a->chunks; chunk != NULL; chunk = chunk->next) {
+		if (chunk->base + chunk->used == (unsigned char *)ptr + size) {
+			// the last allocation in this chunk, simply hand it back
+			chunk->used -= size - new_size;
+			tail = NULL;
+			break;
+		}
+	}
+
+	if (tail != NULL)
+		push_free(a, tail, size - new_size);
+
+	a->allocated -= size - new_size;
+	spin_unlock(&a->lock);
+}
+
+static int cmp_uintptr(const void *a, const void *b)
+{
+	uintptr_t x = *(const uintptr_t *)a, y = *(const uintptr_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static unsigned int count_units(uintptr_t *units, unsigned int count)
+{
+	unsigned int ret = 0;
+
+	qsort(units, count, sizeof(uintptr_t), &cmp_uintptr);
+	for (unsigned int i = 0; i < count; i++) {
+		if (i == 0 || units[i] != units[i - 1])
+			ret++;
+	}
+	return ret;
+}
+
+static unsigned int collect_units(uintptr_t *units, void *const *blocks,
+	const size_t *sizes, unsigned int count, uintptr_t unit)
+{
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; i < count; i++) {
+		uintptr_t start = (uintptr_t)blocks[i];
+		if (start == 0 || sizes[i] == 0)
+			continue;
+		for (uintptr_t u = start / unit; u <= (start + sizes[i] - 1) / unit; u++)
+			units[n++] = u;
+	}
+	return n;
+}
+
+// fills in how many distinct cache lines and pages the given blocks cover,
+// returns -1 if we're out of memory
+int arena_layout(arena_layout_t *out, void *const *blocks, const size_t *sizes,
+	unsigned int count)
+{
+	unsigned int max_units = 0;
+	uintptr_t *units;
+
+	memset(out, 0, sizeof(*out));
+
+	for (unsigned int i = 0; i < count; i++) {
+		if (blocks[i] == NULL || sizes[i] == 0)
+			continue;
+		out->blocks++;
+		out->bytes += sizes[i];
+		max_units += (unsigned int)(sizes[i] / ARENA_CACHE_LINE) + 2;
+	}
+
+	if (max_units == 0)
+		return 0;
+
+	units = (uintptr_t *)malloc(max_units * sizeof(uintptr_t));
+	if (units == NULL)
+		return -1;
+
+	out->lines = count_units(units,
+		collect_units(units, blocks, sizes, count, ARENA_CACHE_LINE));
+	out->pages = count_units(units,
+		collect_units(units, blocks, sizes, count, ARENA_PAGE_SIZE));
+
+	free(units);
+	return 0;
+}
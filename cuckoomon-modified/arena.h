@@ -0,0 +1,97 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Executable Arena API
+//
+// Trampolines and pre-trampolines are allocated from chunks of executable
+// memory which are reserved as close as possible to the hooked function, so
+// the function can reach its pre-trampoline with a 5-byte rel32 jump, also
+// on x64.  Allocations are packed densely, instead of every hook getting its
+// own allocation granularity sized region or an RWX page in the heap.
+//
+// The bookkeeping doesn't depend on the Windows API; the actual reservation
+// of memory at a given address is done through the reserve callback.
+//
+
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include "compat.h"
+
+// every allocation is aligned and rounded up to this
+#define ARENA_MIN_ALIGN 16
+
+// freed blocks are kept in a list per size, 16 up to 1024 bytes
+#define ARENA_SIZE_CLASSES 64
+
+// maximum distance for a rel32 jmp/call, with some slack
+#define ARENA_REACH 0x7fff0000
+
+#define ARENA_CACHE_LINE 64
+#define ARENA_PAGE_SIZE 0x1000
+
+// should map size bytes of RWX memory at exactly addr, or anywhere if addr
+// is NULL; returns NULL on failure
+typedef void *(*arena_reserve_t)(void *addr, size_t size);
+typedef void (*arena_release_t)(void *addr, size_t size);
+
+typedef struct _arena_chunk_t {
+	struct _arena_chunk_t *next;
+	unsigned char *base;
+	size_t size;
+	size_t used;
+} arena_chunk_t;
+
+typedef struct _arena_t {
+	arena_reserve_t reserve;
+	arena_release_t release;
+	size_t granularity;
+
+	arena_chunk_t *chunks;
+	void *free_lists[ARENA_SIZE_CLASSES];
+	spinlock_t lock;
+
+	// statistics
+	size_t reserved;
+	size_t allocated;
+	unsigned int reserve_attempts;
+} arena_t;
+
+// how many cache lines and pages a set of blocks touches
+typedef struct _arena_layout_t {
+	unsigned int blocks;
+	size_t bytes;
+	unsigned int lines;
+	unsigned int pages;
+} arena_layout_t;
+
+void arena_init(arena_t *a, arena_reserve_t reserve, arena_release_t release,
+	size_t granularity);
+void arena_destroy(arena_t *a);
+
+void *arena_alloc(arena_t *a, const void *near, size_t size, size_t align);
+void arena_free(arena_t *a, void *ptr, size_t size);
+void arena_shrink(arena_t *a, void *ptr, size_t size, size_t new_size);
+
+int arena_in_reach(const void *near, const void *ptr, size_t size);
+
+int arena_layout(arena_layout_t *out, void *const *blocks, const size_t *sizes,
+	unsigned int count);
+
+#endif
@@ -0,0 +1,248 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compat.h"
+#include "cfgblob.h"
+
+static const struct {
+	uint16_t id;
+	const char *name;
+} g_keys[] = {
+	{CFGBLOB_PIPE, "pipe"},
+	{CFGBLOB_RESULTS, "results"},
+	{CFGBLOB_FILE_OF_INTEREST, "file-of-interest"},
+	{CFGBLOB_ANALYZER, "analyzer"},
+	{CFGBLOB_SHUTDOWN_MUTEX, "shutdown-mutex"},
+	{CFGBLOB_FIRST_PROCESS, "first-process"},
+	{CFGBLOB_STARTUP_TIME, "startup-time"},
+	{CFGBLOB_HOST_IP, "host-ip"},
+	{CFGBLOB_HOST_PORT, "host-port"},
+	{CFGBLOB_FORCE_SLEEPSKIP, "force-sleepskip"},
+	{CFGBLOB_TERMINATE_EVENT, "terminate-event"},
+	{CFGBLOB_HOT_HOOKS, "hot-hooks"},
+	{CFGBLOB_HOOK_LAYOUT, "hook-layout"},
+	{CFGBLOB_IGNORE_LIST, "ignore-list"},
+	{CFGBLOB_RAW_PATHS, "raw-paths"},
+	{CFGBLOB_PIPE_BATCH, "pipe-batch"},
+	{CFGBLOB_HOOK_CONTROL, "hook-control"},
+	{CFGBLOB_FILE_HASHES, "file-hashes"},
+	{CFGBLOB_WRITE_RANGES, "write-ranges"},
+	{CFGBLOB_PAYLOAD_STREAM, "payload-stream"},
+	{CFGBLOB_PAYLOAD_CAP, "payload-cap"},
+	{CFGBLOB_PAYLOAD_TOTAL, "payload-total"},
+	{CFGBLOB_TIME_DILATION, "time-dilation"},
+};
+
+#define KEY_COUNT (sizeof(g_keys) / sizeof(g_keys[0]))
+
+static uint16_t get_u16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u16(uint8_t *p, uint16_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+	p[2] = (uint8_t)(value >> 16);
+	p[3] = (uint8_t)(value >> 24);
+}
+
+// size of a section with a value of the given length, the caller makes
+// sure this doesn't overflow
+static uint32_t section_size(uint32_t length)
+{
+	return (CFGBLOB_SECTION_SIZE + length + 1 + 3) & ~3;
+}
+
+int cfgblob_open(cfgblob_t *b, const void *data, uint32_t size)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	uint32_t length, count, off;
+
+	memset(b, 0, sizeof(*b));
+
+	if (p == NULL || size < CFGBLOB_HEADER_SIZE)
+		return -1;
+	if (memcmp(p, CFGBLOB_MAGIC, 4) || get_u16(p + 4) != CFGBLOB_VERSION)
+		return -1;
+
+	// anything after the blob is ignored, e.g., when the file was
+	// preallocated
+	length = get_u32(p + 8);
+	count = get_u32(p + 12);
+	if (length < CFGBLOB_HEADER_SIZE || length > size ||
+			length > CFGBLOB_MAX_SIZE)
+		return -1;
+
+	off = CFGBLOB_HEADER_SIZE;
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t value_length;
+
+		if (length - off < CFGBLOB_SECTION_SIZE)
+			return -1;
+
+		// the value and its terminator have to fit, the padding is
+		// checked below; length is at most CFGBLOB_MAX_SIZE so none of
+		// this overflows
+		value_length = get_u32(p + off + 4);
+		if (value_length >= length - off - CFGBLOB_SECTION_SIZE)
+			return -1;
+		if (p[off + CFGBLOB_SECTION_SIZE + value_length] != 0)
+			return -1;
+		if (section_size(value_length) > length - off)
+			return -1;
+
+		off += section_size(value_length);
+	}
+
+	// the sections have to account for the whole blob
+	if (off != length)
+		return -1;
+
+	b->data = p;
+	b->length = length;
+	b->count = count;
+	b->minor = get_u16(p + 6);
+	return 0;
+}
+
+int cfgblob_next(const cfgblob_t *b, uint32_t *offset, cfgblob_section_t *s)
+{
+	uint32_t off = *offset;
+
+	if (off == 0)
+		off = CFGBLOB_HEADER_SIZE;
+	if (b->data == NULL || off >= b->length)
+		return 0;
+
+	s->id = get_u16(b->data + off);
+	s->length = get_u32(b->data + off + 4);
+	s->value = (const char *)b->data + off + CFGBLOB_SECTION_SIZE;
+
+	*offset = off + section_size(s->length);
+	return 1;
+}
+
+const char *cfgblob_find(const cfgblob_t *b, uint16_t id, uint32_t *length)
+{
+	cfgblob_section_t s;
+	const char *ret = NULL;
+	uint32_t off = 0;
+
+	while (cfgblob_next(b, &off, &s)) {
+		if (s.id == id) {
+			ret = s.value;
+			if (length != NULL)
+				*length = s.length;
+		}
+	}
+	return ret;
+}
+
+uint16_t cfgblob_key_id(const char *name, uint32_t length)
+{
+	for (uint32_t i = 0; i < KEY_COUNT; i++) {
+		if (strlen(g_keys[i].name) == length &&
+				!memcmp(g_keys[i].name, name, length))
+			return g_keys[i].id;
+	}
+	return 0;
+}
+
+const char *cfgblob_key_name(uint16_t id)
+{
+	for (uint32_t i = 0; i < KEY_COUNT; i++) {
+		if (g_keys[i].id == id)
+			return g_keys[i].name;
+	}
+	return NULL;
+}
+
+int cfgblob_writer_init(cfgblob_writer_t *w)
+{
+	memset(w, 0, sizeof(*w));
+	w->size = 1024;
+	w->buf = (uint8_t *)calloc(1, w->size);
+	if (w->buf == NULL)
+		return -1;
+	w->length = CFGBLOB_HEADER_SIZE;
+	return 0;
+}
+
+void cfgblob_writer_free(cfgblob_writer_t *w)
+{
+	free(w->buf);
+	memset(w, 0, sizeof(*w));
+}
+
+int cfgblob_write(cfgblob_writer_t *w, uint16_t id, const char *value,
+	uint32_t length)
+{
+	uint32_t size;
+
+	if (length > CFGBLOB_MAX_SIZE - CFGBLOB_HEADER_SIZE - CFGBLOB_SECTION_SIZE - 4)
+		return -1;
+
+	size = section_size(length);
+	if (w->length + size > CFGBLOB_MAX_SIZE)
+		return -1;
+
+	if (w->length + size > w->size) {
+		uint32_t newsize = w->size;
+		uint8_t *buf;
+
+		while (newsize < w->length + size)
+			newsize *= 2;
+		buf = (uint8_t *)realloc(w->buf, newsize);
+		if (buf == NULL)
+			return -1;
+		w->buf = buf;
+		w->size = newsize;
+	}
+
+	// the terminator and the padding are zero as well
+	memset(w->buf + w->length, 0, size);
+	put_u16(w->buf + w->length, id);
+	put_u32(w->buf + w->length + 4, length);
+	memcpy(w->buf + w->length + CFGBLOB_SECTION_SIZE, value, length);
+
+	w->length += size;
+	w->count++;
+	return 0;
+}
+
+void cfgblob_finish(cfgblob_writer_t *w)
+{
+	memcpy(w->buf, CFGBLOB_MAGIC, 4);
+	put_u16(w->buf + 4, CFGBLOB_VERSION);
+	put_u16(w->buf + 6, CFGBLOB_MINOR);
+	put_u32(w->buf + 8, w->length);
+	put_u32(w->buf + 12, w->count);
+}
@@ -0,0 +1,130 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Binary Config
+//
+// Compact alternative to the C:\<pid>.ini file.  The analyzer writes a
+// blob of length-prefixed sections, the monitor maps it and reads the
+// values in place.  Every value is followed by a terminating zero, so it
+// can be used as a C string straight from the mapping.
+//
+// All integers are little endian.
+//
+// header (16 bytes)
+//   char     magic[4]   "CMCF"
+//   uint16_t version    CFGBLOB_VERSION, blobs with another one are rejected
+//   uint16_t minor      bumped when keys are added, readers skip unknown keys
+//   uint32_t length     size of the whole blob, including the header
+//   uint32_t count      amount of sections
+//
+// section (8 bytes + value)
+//   uint16_t id         one of CFGBLOB_*, see cfgblob_key_id()
+//   uint16_t reserved   written as zero
+//   uint32_t length     length of the value, without the terminating zero
+//   value, a zero byte and padding up to a multiple of four bytes
+//
+// Unlike the INI file, values may contain newlines, e.g., a hook-control
+// section may hold one command per line.
+//
+
+#ifndef __CFGBLOB_H
+#define __CFGBLOB_H
+
+#include "compat.h"
+
+#define CFGBLOB_MAGIC "CMCF"
+#define CFGBLOB_VERSION 1
+#define CFGBLOB_MINOR 0
+
+#define CFGBLOB_HEADER_SIZE 16
+#define CFGBLOB_SECTION_SIZE 8
+
+// anything larger is not a config we wrote
+#define CFGBLOB_MAX_SIZE (1024 * 1024)
+
+// section identifiers, never renumber these
+#define CFGBLOB_PIPE                1
+#define CFGBLOB_RESULTS             2
+#define CFGBLOB_FILE_OF_INTEREST    3
+#define CFGBLOB_ANALYZER            4
+#define CFGBLOB_SHUTDOWN_MUTEX      5
+#define CFGBLOB_FIRST_PROCESS       6
+#define CFGBLOB_STARTUP_TIME        7
+#define CFGBLOB_HOST_IP             8
+#define CFGBLOB_HOST_PORT           9
+#define CFGBLOB_FORCE_SLEEPSKIP     10
+#define CFGBLOB_TERMINATE_EVENT     11
+#define CFGBLOB_HOT_HOOKS           12
+#define CFGBLOB_HOOK_LAYOUT         13
+#define CFGBLOB_IGNORE_LIST         14
+#define CFGBLOB_RAW_PATHS           15
+#define CFGBLOB_PIPE_BATCH          16
+#define CFGBLOB_HOOK_CONTROL        17
+#define CFGBLOB_FILE_HASHES         18
+#define CFGBLOB_WRITE_RANGES        19
+#define CFGBLOB_PAYLOAD_STREAM      20
+#define CFGBLOB_PAYLOAD_CAP         21
+#define CFGBLOB_PAYLOAD_TOTAL       22
+#define CFGBLOB_TIME_DILATION       23
+
+typedef struct _cfgblob_t {
+	const uint8_t *data;
+	uint32_t length;
+	uint32_t count;
+	uint16_t minor;
+} cfgblob_t;
+
+typedef struct _cfgblob_section_t {
+	uint16_t id;
+	uint32_t length;
+	const char *value;
+} cfgblob_section_t;
+
+// validates the whole blob up front, afterwards the sections can be walked
+// without further checks; returns -1 if the blob is malformed
+int cfgblob_open(cfgblob_t *b, const void *data, uint32_t size);
+
+// *offset starts out as zero, returns 0 after the last section
+int cfgblob_next(const cfgblob_t *b, uint32_t *offset, cfgblob_section_t *s);
+
+// value of the last section with the given id, or NULL
+const char *cfgblob_find(const cfgblob_t *b, uint16_t id, uint32_t *length);
+
+// maps the INI key names onto section identifiers and back, returns 0 and
+// NULL respectively for unknown ones
+uint16_t cfgblob_key_id(const char *name, uint32_t length);
+const char *cfgblob_key_name(uint16_t id);
+
+// encoder, used by the host side tools
+typedef struct _cfgblob_writer_t {
+	uint8_t *buf;
+	uint32_t length;
+	uint32_t size;
+	uint32_t count;
+} cfgblob_writer_t;
+
+int cfgblob_writer_init(cfgblob_writer_t *w);
+void cfgblob_writer_free(cfgblob_writer_t *w);
+int cfgblob_write(cfgblob_writer_t *w, uint16_t id, const char *value,
+	uint32_t length);
+
+// fills in the header, the blob is then w->buf[0..w->length)
+void cfgblob_finish(cfgblob_writer_t *w);
+
+#endif
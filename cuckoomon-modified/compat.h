@@ -0,0 +1,188 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Portability layer
+//
+// Modules that include this header instead of ntapi.h don't depend on any
+// Windows API, so they can be built and unit tested natively on Linux (see
+// tests/linux).  Inside cuckoomon.dll we still pull in ntapi.h, which makes
+// malloc() and friends allocate from our private heap.
+//
+
+#ifndef __COMPAT_H
+#define __COMPAT_H
+
+#ifdef _WIN32
+#include "ntapi.h"
+#else
+#include <stdint.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// 64-bit counters are bumped from any thread, without taking a lock, and
+// read in one piece even on 32-bit x86
+#ifdef _MSC_VER
+#define atomic_add64(ptr, val) \
+	InterlockedExchangeAdd64((volatile LONGLONG *)(ptr), (LONGLONG)(val))
+#define atomic_add32(ptr, val) \
+	InterlockedExchangeAdd((volatile LONG *)(ptr), (LONG)(val))
+#define atomic_cas32(ptr, oldval, newval) \
+	((uint32_t)InterlockedCompareExchange((volatile LONG *)(ptr), \
+		(LONG)(newval), (LONG)(oldval)) == (uint32_t)(oldval))
+#define memory_barrier() MemoryBarrier()
+#define atomic_read64(ptr) \
+	InterlockedCompareExchange64((volatile LONGLONG *)(ptr), 0, 0)
+#else
+#define atomic_add64(ptr, val) __sync_fetch_and_add((ptr), (val))
+#define atomic_add32(ptr, val) __sync_fetch_and_add((ptr), (val))
+#define atomic_cas32(ptr, oldval, newval) \
+	__sync_bool_compare_and_swap((ptr), (oldval), (newval))
+#define memory_barrier() __sync_synchronize()
+#define atomic_read64(ptr) __sync_val_compare_and_swap((ptr), 0, 0)
+#endif
+
+// one round of waiting for another thread; pauses the cpu for the first
+// SPIN_LIMIT rounds and then gives up the time slice, so a waiter doesn't
+// starve the thread it waits for when that one got preempted.  Yielding is
+// done with SwitchToThread() as Sleep(0) would go through our own
+// NtDelayExecution hook
+#define SPIN_LIMIT 64
+
+static __inline void spin_wait(uint32_t *spins)
+{
+	if (*spins < SPIN_LIMIT) {
+		(*spins)++;
+#if defined(_MSC_VER) || defined(_WIN32)
+		YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+		__builtin_ia32_pause();
+#endif
+		return;
+	}
+#ifdef _WIN32
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+// cheap spinlock for rarely taken locks in portable code, which can't use
+// a CRITICAL_SECTION
+typedef volatile uint32_t spinlock_t;
+
+static __inline void spin_lock(spinlock_t *lock)
+{
+	uint32_t spins = 0;
+	while (!atomic_cas32(lock, 0, 1))
+		spin_wait(&spins);
+}
+
+static __inline void spin_unlock(spinlock_t *lock)
+{
+	atomic_cas32(lock, 1, 0);
+}
+
+// readers/writer spinlock for data that is read often and changed rarely,
+// holds the amount of readers or RWLOCK_WRITER
+typedef volatile uint32_t rwlock_t;
+
+#define RWLOCK_WRITER 0xffffffff
+
+static __inline void read_lock(rwlock_t *lock)
+{
+	uint32_t spins = 0;
+	while (1) {
+		uint32_t value = *lock;
+		if (value != RWLOCK_WRITER && atomic_cas32(lock, value, value + 1))
+			break;
+		spin_wait(&spins);
+	}
+}
+
+static __inline void read_unlock(rwlock_t *lock)
+{
+	atomic_add32(lock, -1);
+}
+
+static __inline void write_lock(rwlock_t *lock)
+{
+	uint32_t spins = 0;
+	while (!atomic_cas32(lock, 0, RWLOCK_WRITER))
+		spin_wait(&spins);
+}
+
+static __inline void write_unlock(rwlock_t *lock)
+{
+	atomic_cas32(lock, RWLOCK_WRITER, 0);
+}
+
+// one-time initialization that may be triggered from any thread; the
+// caller runs it if once_begin() returns 1 and then calls once_end(),
+// threads coming in meanwhile wait for it to finish
+typedef volatile uint32_t once_t;
+
+#define ONCE_RUNNING 1
+#define ONCE_DONE 2
+
+static __inline int once_begin(once_t *once)
+{
+	uint32_t spins = 0;
+
+	if (*once == ONCE_DONE)
+		return 0;
+	if (atomic_cas32(once, 0, ONCE_RUNNING))
+		return 1;
+	// the initializer may take a while (26 QueryDosDeviceW calls for the
+	// drive letter map), so this mostly ends up yielding
+	while (*once != ONCE_DONE)
+		spin_wait(&spins);
+	return 0;
+}
+
+static __inline void once_end(once_t *once)
+{
+	memory_barrier();
+	*once = ONCE_DONE;
+}
+
+// timestamp counter, only used for relative cost accounting
+static __inline uint64_t read_cycles(void)
+{
+#if defined(_MSC_VER)
+	return __rdtsc();
+#elif defined(__i386__) || defined(__x86_64__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+#endif
@@ -20,8 +20,172 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "ntapi.h"
 #include "config.h"
 #include "misc.h"
+#include "hookctl.h"
+#include "cfgblob.h"
 
-int read_config(void)
+// applies a single setting, value is a zero-terminated string of length
+// bytes, both for the INI and the binary config
+static void set_config_value(uint16_t id, const char *value, unsigned int length)
+{
+	switch (id) {
+	case CFGBLOB_PIPE:
+		strncpy(g_config.pipe_name, value, ARRAYSIZE(g_config.pipe_name));
+		break;
+	case CFGBLOB_RESULTS:
+		strncpy(g_config.results, value, ARRAYSIZE(g_config.results));
+		break;
+	case CFGBLOB_FILE_OF_INTEREST:
+		if (length > 1) {
+			if (value[1] == ':') {
+				// is a file
+				char *tmp = calloc(1, MAX_PATH);
+				wchar_t *utmp = calloc(1, MAX_PATH * sizeof(wchar_t));
+				unsigned int full_len;
+				ensure_absolute_ascii_path(tmp, value);
+				full_len = (unsigned int)strlen(tmp);
+				for (unsigned int i = 0; i < full_len; i++)
+					utmp[i] = (wchar_t)(unsigned short)tmp[i];
+				free(tmp);
+
+				g_config.file_of_interest = utmp;
+				// if the file of interest is our own executable, then don't do any special handling
+				if (wcsicmp(our_process_path, utmp))
+					g_config.suspend_logging = TRUE;
+			}
+			else {
+				// is a URL
+				wchar_t *utmp = calloc(1, 512 * sizeof(wchar_t));
+				unsigned int url_len = MIN(length, 511);
+				for (unsigned int i = 0; i < url_len; i++)
+					utmp[i] = (wchar_t)(unsigned short)value[i];
+				g_config.url_of_interest = utmp;
+				g_config.suspend_logging = TRUE;
+			}
+		}
+		break;
+	case CFGBLOB_ANALYZER:
+		strncpy(g_config.analyzer, value, ARRAYSIZE(g_config.analyzer));
+		for (unsigned int i = 0; i < ARRAYSIZE(g_config.analyzer); i++)
+			g_config.dllpath[i] = (wchar_t)(unsigned short)g_config.analyzer[i];
+		if (wcslen(g_config.dllpath) < ARRAYSIZE(g_config.dllpath) - 5)
+			wcscat(g_config.dllpath, L"\\dll\\");
+		break;
+	case CFGBLOB_SHUTDOWN_MUTEX:
+		strncpy(g_config.shutdown_mutex, value, ARRAYSIZE(g_config.shutdown_mutex));
+		break;
+	case CFGBLOB_FIRST_PROCESS:
+		g_config.first_process = value[0] == '1';
+		break;
+	case CFGBLOB_STARTUP_TIME:
+		g_config.startup_time = atoi(value);
+		break;
+	case CFGBLOB_HOST_IP:
+		g_config.host_ip = inet_addr(value);
+		break;
+	case CFGBLOB_HOST_PORT:
+		g_config.host_port = atoi(value);
+		break;
+	case CFGBLOB_FORCE_SLEEPSKIP:
+		g_config.force_sleepskip = value[0] == '1';
+		break;
+	case CFGBLOB_TERMINATE_EVENT:
+		strncpy(g_config.terminate_event_name, value,
+			ARRAYSIZE(g_config.terminate_event_name));
+		break;
+	case CFGBLOB_HOT_HOOKS:
+		strncpy(g_config.hot_hooks, value, ARRAYSIZE(g_config.hot_hooks) - 1);
+		break;
+	case CFGBLOB_HOOK_LAYOUT:
+		g_config.hook_layout_report = value[0] == '1';
+		break;
+	case CFGBLOB_IGNORE_LIST:
+		strncpy(g_config.ignore_list, value, ARRAYSIZE(g_config.ignore_list) - 1);
+		break;
+	case CFGBLOB_RAW_PATHS:
+		g_config.raw_paths = value[0] == '1';
+		break;
+	case CFGBLOB_PIPE_BATCH:
+		g_config.pipe_batch = value[0] == '1';
+		break;
+	case CFGBLOB_HOOK_CONTROL:
+		// e.g. hook-control=hook-disable category:registry;hook-disable NtDelayExecution
+		hookctl_commands(value, length);
+		break;
+	case CFGBLOB_FILE_HASHES:
+		g_config.file_hashes = value[0] == '1';
+		break;
+	case CFGBLOB_WRITE_RANGES:
+		g_config.write_ranges = value[0] == '1';
+		break;
+	case CFGBLOB_PAYLOAD_STREAM:
+		g_config.payload_stream = value[0] == '1';
+		break;
+	case CFGBLOB_PAYLOAD_CAP:
+		g_config.payload_cap = strtoul(value, NULL, 10);
+		break;
+	case CFGBLOB_PAYLOAD_TOTAL:
+		g_config.payload_total = strtoul(value, NULL, 10);
+		break;
+	case CFGBLOB_TIME_DILATION:
+		g_config.time_dilation = strtoul(value, NULL, 10);
+		break;
+	}
+}
+
+// C:\<pid>.cfg, written by the analyzer in the format described in
+// cfgblob.h; the values are read straight from the mapped file
+static int read_binary_config(void)
+{
+	char config_fname[MAX_PATH];
+	HANDLE file, mapping;
+	const void *view;
+	DWORD size;
+	cfgblob_t blob;
+	cfgblob_section_t section;
+	uint32_t off = 0;
+	int ret = 0;
+
+	sprintf(config_fname, "C:\\%u.cfg", GetCurrentProcessId());
+
+	file = CreateFileA(config_fname, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return 0;
+
+	size = GetFileSize(file, NULL);
+	if (size == INVALID_FILE_SIZE || size < CFGBLOB_HEADER_SIZE) {
+		CloseHandle(file);
+		return 0;
+	}
+
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		CloseHandle(file);
+		return 0;
+	}
+
+	view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view != NULL) {
+		// a malformed blob leaves g_config untouched, so we can still fall
+		// back to the INI file
+		if (cfgblob_open(&blob, view, size) == 0) {
+			g_config.force_sleepskip = -1;
+			while (cfgblob_next(&blob, &off, &section))
+				set_config_value(section.id, section.value, section.length);
+			ret = 1;
+		}
+		UnmapViewOfFile(view);
+	}
+
+	CloseHandle(mapping);
+	CloseHandle(file);
+
+	if (ret)
+		DeleteFileA(config_fname);
+	return ret;
+}
+
+static int read_ini_config(void)
 {
     // TODO unicode support
     char buf[512], config_fname[MAX_PATH];
@@ -45,85 +209,29 @@ int read_config(void)
         if(p != NULL) {
             *p = 0;
 
-            const char *key = buf, *value = p + 1;
-
-            if(!strcmp(key, "pipe")) {
-                strncpy(g_config.pipe_name, value,
-                    ARRAYSIZE(g_config.pipe_name));
-            }
-            else if(!strcmp(key, "results")) {
-                strncpy(g_config.results, value,
-                    ARRAYSIZE(g_config.results));
-            }
-			else if (!strcmp(key, "file-of-interest")) {
-				unsigned int len = (unsigned int)strlen(value);
-				if (len > 1) {
-					if (value[1] == ':') {
-						// is a file
-						char *tmp = calloc(1, MAX_PATH);
-						wchar_t *utmp = calloc(1, MAX_PATH * sizeof(wchar_t));
-						unsigned int full_len;
-						ensure_absolute_ascii_path(tmp, value);
-						full_len = (unsigned int)strlen(tmp);
-						for (unsigned int i = 0; i < full_len; i++)
-							utmp[i] = (wchar_t)(unsigned short)tmp[i];
-						free(tmp);
-
-						g_config.file_of_interest = utmp;
-						// if the file of interest is our own executable, then don't do any special handling
-						if (wcsicmp(our_process_path, utmp))
-							g_config.suspend_logging = TRUE;
-					}
-					else {
-						// is a URL
-						wchar_t *utmp = calloc(1, 512 * sizeof(wchar_t));
-						unsigned int url_len = (unsigned int)strlen(value);
-						for (unsigned int i = 0; i < url_len; i++)
-							utmp[i] = (wchar_t)(unsigned short)value[i];
-						g_config.url_of_interest = utmp;
-						g_config.suspend_logging = TRUE;
-					}
-				}
-			}
-			else if (!strcmp(key, "analyzer")) {
-                strncpy(g_config.analyzer, value,
-                    ARRAYSIZE(g_config.analyzer));
-				for (unsigned int i = 0; i < ARRAYSIZE(g_config.analyzer); i++)
-					g_config.dllpath[i] = (wchar_t)(unsigned short)g_config.analyzer[i];
-				if (wcslen(g_config.dllpath) < ARRAYSIZE(g_config.dllpath) - 5)
-					wcscat(g_config.dllpath, L"\\dll\\");
-            }
-            else if(!strcmp(key, "shutdown-mutex")) {
-                strncpy(g_config.shutdown_mutex, value,
-                    ARRAYSIZE(g_config.shutdown_mutex));
-            }
-            else if(!strcmp(key, "first-process")) {
-                g_config.first_process = value[0] == '1';
-            }
-            else if(!strcmp(key, "startup-time")) {
-                g_config.startup_time = atoi(value);
-            }
-            else if(!strcmp(key, "host-ip")) {
-                g_config.host_ip = inet_addr(value);
-            }
-            else if(!strcmp(key, "host-port")) {
-                g_config.host_port = atoi(value);
-            }
-            else if(!strcmp(key, "force-sleepskip")) {
-                g_config.force_sleepskip = value[0] == '1';
-            }
-			else if (!strcmp(key, "terminate-event")) {
-				strncpy(g_config.terminate_event_name, value,
-					ARRAYSIZE(g_config.terminate_event_name));
-			}
+            const char *value = p + 1;
+			uint16_t id = cfgblob_key_id(buf, (uint32_t)(p - buf));
+
+			if (id != 0)
+				set_config_value(id, value, (unsigned int)strlen(value));
         }
     }
 
+	fclose(fp);
+    DeleteFile(config_fname);
+	return 1;
+}
+
+int read_config(void)
+{
+	// the binary config takes precedence, the INI file stays supported for
+	// analyzers which don't write one
+	if (!read_binary_config() && !read_ini_config())
+		return 0;
+
 	/* don't suspend logging if this isn't the first process */
 	if (!g_config.first_process)
 		g_config.suspend_logging = FALSE;
 
-	fclose(fp);
-    DeleteFile(config_fname);
 	return 1;
 }
@@ -52,11 +52,50 @@ struct _g_config {
     // do we force sleep-skipping despite threads?
     int force_sleepskip;
 
+	// sleeps and timed waits past the sleep skipping take this many times
+	// less real time, with the virtual clock making up for the difference;
+	// zero or one disables it
+	unsigned int time_dilation;
+
     // server ip and port
     unsigned int host_ip;
     unsigned short host_port;
 
 	BOOLEAN suspend_logging;
+
+	// comma-separated list of the most called hooks (e.g., taken from the
+	// hook-stats of an earlier analysis), their trampolines are kept together
+	char hot_hooks[512];
+
+	// report how the trampolines are laid out in memory
+	int hook_layout_report;
+
+	// send queued notifications to the analyzer in batches over a single
+	// connection, the analyzer has to understand "BATCH:" messages
+	int pipe_batch;
+
+	// file with additional paths not to dump, one per line, a trailing *
+	// matches everything starting with the path
+	char ignore_list[MAX_PATH];
+
+	// log file paths as passed to the API, the host normalizes them
+	int raw_paths;
+
+	// hash the data written to new files and report it along with their
+	// FILE_NEW notification, the analyzer has to understand "path|sha256"
+	int file_hashes;
+
+	// report which byte ranges of a file were written through a handle
+	// when it's closed, as "FILE_RANGES:path|start-end,..."
+	int write_ranges;
+
+	// send socket, internet and crypto buffers in full on a stream of their
+	// own next to the events (see payload.h), the host has to understand
+	// "BSONMUX"; the caps are in KB, per direction of every connection and
+	// for all of them together, zero means the default
+	int payload_stream;
+	unsigned int payload_cap;
+	unsigned int payload_total;
 };
 
 extern struct _g_config g_config;
@@ -29,6 +29,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "hook_sleep.h"
 #include "config.h"
 #include "unhook.h"
+#include "phasetimer.h"
 #include "bson.h"
 
 // Allow debug mode to be turned on at compilation time.
@@ -353,7 +354,15 @@ static hook_t g_hooks[] = {
     HOOK(kernel32, GetSystemTime),
 	HOOK(kernel32, GetSystemTimeAsFileTime),
 	HOOK(kernel32, GetTickCount),
+	HOOK(kernel32, QueryPerformanceCounter),
+	HOOK(kernel32, GetTickCount64),
+	// kernel32's QueryPerformanceCounter ends up in these, our own hooks
+	// call them without going through the hooks a second time
+	HOOK(ntdll, NtQueryPerformanceCounter),
+	HOOK(ntdll, RtlQueryPerformanceCounter),
     HOOK(ntdll, NtQuerySystemTime),
+	HOOK(ntdll, NtWaitForSingleObject),
+	HOOK(ntdll, NtWaitForMultipleObjects),
 	HOOK(user32, GetLastInputInfo),
 	HOOK(winmm, timeGetTime),
 
@@ -418,35 +427,58 @@ static hook_t g_hooks[] = {
 //#define HOOKTYPE randint(HOOK_NOP_JMP_DIRECT, HOOK_MOV_EAX_INDIRECT_PUSH_RETN)
 // error testing with hook_jmp_direct only
 #ifdef _WIN64
-#define HOOKTYPE HOOK_JMP_INDIRECT
+#define HOOKTYPE HOOK_JMP_DIRECT
 #else
 #define HOOKTYPE HOOK_HOTPATCH_JMP_INDIRECT
 #endif
 
 void set_hooks_dll(const wchar_t *library)
 {
+	int acquired = 0;
+
     for (int i = 0; i < ARRAYSIZE(g_hooks); i++) {
         if(!wcsicmp(g_hooks[i].library, library)) {
+			// most DLLs aren't hooked at all, no need for capstone then
+			if (!acquired) {
+				capstone_acquire();
+				acquired = 1;
+			}
 			if (hook_api(&g_hooks[i], HOOKTYPE) < 0)
 				pipe("WARNING:Unable to hook %z", g_hooks[i].funcname);
         }
     }
+
+	if (acquired)
+		capstone_release();
 }
 
-void set_hooks()
+// hooks named in the hot-hooks option are placed before all others, so
+// their trampolines end up next to each other in the same cache lines/pages
+static void mark_hot_hooks(void)
 {
-    // the hooks contain executable code as well, so they have to be RWX
-    DWORD old_protect;
-    VirtualProtect(g_hooks, sizeof(g_hooks), PAGE_EXECUTE_READWRITE,
-        &old_protect);
+	char *p = g_config.hot_hooks;
+
+	while (*p) {
+		char *end = strchr(p, ',');
+		unsigned int len = end ? (unsigned int)(end - p) : (unsigned int)strlen(p);
 
-	// before modifying any DLLs, let's first freeze all other threads in our process
-	// otherwise our racy modifications can cause the task to crash prematurely
-	// This code itself is racy as additional threads could be created while we're
-	// processing the list, but the risk is at least greatly reduced
+		for (int i = 0; i < ARRAYSIZE(g_hooks); i++) {
+			if (!strncmp(g_hooks[i].funcname, p, len) && g_hooks[i].funcname[len] == 0)
+				g_hooks[i].is_hot = 1;
+		}
+		p += len;
+		if (*p == ',')
+			p++;
+	}
+}
+
+// before modifying any DLLs, let's first freeze all other threads in our process
+// otherwise our racy modifications can cause the task to crash prematurely
+// This code itself is racy as additional threads could be created while we're
+// processing the list, but the risk is at least greatly reduced
+static PHANDLE suspend_other_threads(DWORD *num_suspended_threads)
+{
 	PHANDLE suspended_threads = (PHANDLE)calloc(4096, sizeof(HANDLE));
-	DWORD num_suspended_threads = 0;
-	DWORD i;
 	HANDLE hSnapShot;
 	THREADENTRY32 threadInfo;
 	DWORD our_tid = GetCurrentThreadId();
@@ -454,33 +486,65 @@ void set_hooks()
 	memset(&threadInfo, 0, sizeof(threadInfo));
 	threadInfo.dwSize = sizeof(threadInfo);
 
-	hook_disable();
+	*num_suspended_threads = 0;
+	if (suspended_threads == NULL)
+		return NULL;
 
 	hSnapShot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
 	Thread32First(hSnapShot, &threadInfo);
 	do {
-		if (threadInfo.th32OwnerProcessID != our_pid || threadInfo.th32ThreadID == our_tid || num_suspended_threads >= 4096)
+		if (threadInfo.th32OwnerProcessID != our_pid || threadInfo.th32ThreadID == our_tid || *num_suspended_threads >= 4096)
 			continue;
-		suspended_threads[num_suspended_threads] = OpenThread(THREAD_SUSPEND_RESUME, FALSE, threadInfo.th32ThreadID);
-		if (suspended_threads[num_suspended_threads]) {
-			SuspendThread(suspended_threads[num_suspended_threads]);
-			num_suspended_threads++;
+		suspended_threads[*num_suspended_threads] = OpenThread(THREAD_SUSPEND_RESUME, FALSE, threadInfo.th32ThreadID);
+		if (suspended_threads[*num_suspended_threads]) {
+			SuspendThread(suspended_threads[*num_suspended_threads]);
+			(*num_suspended_threads)++;
 		}
 	} while (Thread32Next(hSnapShot, &threadInfo));
+	CloseHandle(hSnapShot);
 
-    // now, hook each api :)
-    for (int i = 0; i < ARRAYSIZE(g_hooks); i++) {
-		//pipe("INFO:Hooking %z", g_hooks[i].funcname);
-		if (hook_api(&g_hooks[i], HOOKTYPE) < 0)
-			pipe("WARNING:Unable to hook %z", g_hooks[i].funcname);
-    }
+	return suspended_threads;
+}
 
-	for (i = 0; i < num_suspended_threads; i++) {
+static void resume_threads(PHANDLE suspended_threads, DWORD num_suspended_threads)
+{
+	for (DWORD i = 0; i < num_suspended_threads; i++) {
 		ResumeThread(suspended_threads[i]);
 		CloseHandle(suspended_threads[i]);
 	}
 
 	free(suspended_threads);
+}
+
+// the other threads have to be suspended by the caller
+void set_hooks()
+{
+    // the hooks contain executable code as well, so they have to be RWX
+    DWORD old_protect;
+    VirtualProtect(g_hooks, sizeof(g_hooks), PAGE_EXECUTE_READWRITE,
+        &old_protect);
+
+	hook_disable();
+
+	capstone_acquire();
+
+	mark_hot_hooks();
+
+    // now, hook each api :) the hot ones first
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < ARRAYSIZE(g_hooks); i++) {
+			if (g_hooks[i].is_hot != (pass == 0))
+				continue;
+			//pipe("INFO:Hooking %z", g_hooks[i].funcname);
+			if (hook_api(&g_hooks[i], HOOKTYPE) < 0)
+				pipe("WARNING:Unable to hook %z", g_hooks[i].funcname);
+		}
+	}
+
+	capstone_release();
+
+	if (g_config.hook_layout_report)
+		report_hook_layout(g_hooks, ARRAYSIZE(g_hooks));
 
 	hook_enable();
 }
@@ -511,6 +575,7 @@ LONG WINAPI cuckoomon_exception_handler(
 	get_lasterrors(&lasterror);
 
 	log_flush();
+	pipe_flush();
 
 	dllname = convert_address_to_dll_name_and_offset(eip, &offset);
 
@@ -605,8 +670,58 @@ void init_private_heap(void)
 
 BOOLEAN g_dll_main_complete;
 
+// how long every step in DllMain takes, reported in the process record
+static phasetimer_t g_startup_phases;
+
+static uint64_t startup_counter(void)
+{
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+}
+
+static void startup_phase(const char *name)
+{
+	phasetimer_mark(&g_startup_phases, name, startup_counter());
+}
+
+// work that doesn't have to be done before the hooks are in place, this
+// thread only starts running once DllMain returns; if a hook needs any of
+// it earlier, it's done right there and then
+static DWORD WINAPI _startup_thread(LPVOID param)
+{
+	hook_disable();
+
+	specialname_map_init();
+	hkcu_init();
+	return 0;
+}
+
 DWORD g_tls_hook_index;
 
+#ifdef _WIN64
+// a plain jmp rel32 might as well be a forwarding stub, so follow the same
+// stubs hook_api() does and check for the push rax/rcx/rdx/rbx that starts
+// our pre-trampoline
+static int is_our_hook(PUCHAR addr)
+{
+	for (int i = 0; i < 3; i++) {
+		if (addr[0] == 0xe9)
+			addr += 5 + *(int *)(addr + 1);
+		else if (addr[0] == 0xeb)
+			addr += 2 + *(char *)(addr + 1);
+		else if (addr[0] == 0xff && addr[1] == 0x25)
+			addr = *(PUCHAR *)(addr + 6 + *(int *)(addr + 2));
+		else
+			return 0;
+
+		if (!memcmp(addr, "\x50\x51\x52\x53", 4))
+			return 1;
+	}
+	return 0;
+}
+#endif
+
 BOOL APIENTRY DllMain(HANDLE hModule, DWORD dwReason, LPVOID lpReserved)
 {
 	lasterror_t lasterror;
@@ -617,16 +732,21 @@ BOOL APIENTRY DllMain(HANDLE hModule, DWORD dwReason, LPVOID lpReserved)
 		unsigned int i;
 		DWORD pids[MAX_PROTECTED_PIDS];
 		unsigned int length = sizeof(pids);
+		PHANDLE suspended_threads;
+		DWORD num_suspended_threads;
+		LARGE_INTEGER frequency;
+		char startup_phases[512];
+		HANDLE startup_thread;
 
 		/* we can sometimes be injected twice into a process, say if we queued up an APC that we timed out waiting to
 		   complete, and then did a successful createremotethread, so just do a cheap check for our hooks and fake that
 		   we loaded successfully
 		*/
 #ifdef _WIN64
-#if HOOKTYPE != HOOK_JMP_INDIRECT
+#if HOOKTYPE != HOOK_JMP_DIRECT
 #error Update hook check
 #endif
-		if (((PUCHAR)ReadProcessMemory)[0] == 0xff && ((PUCHAR)ReadProcessMemory)[1] == 0x25) {
+		if (is_our_hook((PUCHAR)ReadProcessMemory)) {
 			notify_successful_load();
 			goto out;
 		}
@@ -640,18 +760,21 @@ BOOL APIENTRY DllMain(HANDLE hModule, DWORD dwReason, LPVOID lpReserved)
 		}
 #endif
 
+		phasetimer_start(&g_startup_phases, startup_counter());
+
 		g_our_dll_base = (ULONG_PTR)hModule;
 		g_our_dll_size = get_image_size(g_our_dll_base);
 		
 		resolve_runtime_apis();
+		startup_phase("resolve_runtime_apis");
 
 		init_private_heap();
-
-		init_capstone();
+		startup_phase("init_private_heap");
 
 		set_os_bitness();
 
 		get_our_process_path();
+		startup_phase("get_our_process_path");
 
 		g_tls_hook_index = TlsAlloc();
 		if (g_tls_hook_index == TLS_OUT_OF_INDEXES)
@@ -673,6 +796,7 @@ BOOL APIENTRY DllMain(HANDLE hModule, DWORD dwReason, LPVOID lpReserved)
 		// hide our module from peb
         hide_module_from_peb(hModule);
 #endif
+		startup_phase("add_all_dlls_to_dll_ranges");
 
         // initialize file stuff
         file_init();
@@ -686,23 +810,39 @@ BOOL APIENTRY DllMain(HANDLE hModule, DWORD dwReason, LPVOID lpReserved)
 			goto out;
 #endif
         g_pipe_name = g_config.pipe_name;
+		startup_phase("read_config");
+
+		// notifications which need no answer are sent from a thread of their own
+		if (pipe_init(g_config.pipe_batch) < 0)
+			pipe("WARNING:Unable to queue notifications, sending them synchronously");
 
 		// obtain all protected pids
         pipe2(pids, &length, "GETPIDS");
         for (i = 0; i < length / sizeof(pids[0]); i++) {
             add_protected_pid(pids[i]);
         }
+		startup_phase("get_protected_pids");
+
+		// the drive mappings and our SID are only needed by the hooks
+		startup_thread = CreateThread(NULL, 0, &_startup_thread, NULL, 0, NULL);
+		if (startup_thread != NULL)
+			CloseHandle(startup_thread);
 
-		hkcu_init();
+		// build the matcher for files we don't dump
+		if (ignore_init(g_config.ignore_list) < 0)
+			pipe("WARNING:Unable to build the list of ignored files");
+		startup_phase("ignore_init");
 
         // initialize the log file
         log_init(g_config.host_ip, g_config.host_port, CUCKOODBG);
+		startup_phase("log_init");
 
         // initialize the Sleep() skipping stuff
         init_sleep_skip(g_config.first_process);
 
         // we skip a random given amount of milliseconds each run
         init_startup_time(g_config.startup_time);
+		startup_phase("init_sleep_skip");
 
         // disable the retaddr check if the user wants so
         //if(g_config.retaddr_check == 0) {
@@ -714,9 +854,25 @@ BOOL APIENTRY DllMain(HANDLE hModule, DWORD dwReason, LPVOID lpReserved)
 
 		// initialize terminate notification event
 		terminate_event_init();
+		startup_phase("unhook_init_detection");
+
+		suspended_threads = suspend_other_threads(&num_suspended_threads);
+		startup_phase("suspend_other_threads");
 
 		// initialize all hooks
         set_hooks();
+		startup_phase("set_hooks");
+
+		// the process record goes out before any other thread gets to log,
+		// and without the calls made for it showing up in the log
+		QueryPerformanceFrequency(&frequency);
+		phasetimer_format(&g_startup_phases, frequency.QuadPart, startup_phases,
+			sizeof(startup_phases));
+		hook_disable();
+		log_announce(startup_phases);
+		hook_enable();
+
+		resume_threads(suspended_threads, num_suspended_threads);
 
 		// initialize context watchdog
 		//init_watchdog();
@@ -724,6 +880,7 @@ BOOL APIENTRY DllMain(HANDLE hModule, DWORD dwReason, LPVOID lpReserved)
 		notify_successful_load();
     }
     else if(dwReason == DLL_PROCESS_DETACH) {
+		pipe_flush();
         log_free();
     }
 
@@ -0,0 +1,63 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compat.h"
+#include "filehash.h"
+
+void filehash_init(filehash_t *h)
+{
+	sha256_init(&h->sha);
+	h->length = 0;
+	h->valid = 1;
+}
+
+void filehash_invalidate(filehash_t *h)
+{
+	h->valid = 0;
+}
+
+void filehash_write(filehash_t *h, uint64_t offset, const void *data,
+	size_t length)
+{
+	if (h->valid == 0 || length == 0)
+		return;
+
+	// rewriting data which has already been hashed, or leaving a hole
+	if (offset != h->length) {
+		h->valid = 0;
+		return;
+	}
+
+	sha256_update(&h->sha, data, length);
+	h->length += length;
+}
+
+int filehash_final(filehash_t *h, uint64_t file_size, char *out)
+{
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	sha256_t sha;
+
+	if (h->valid == 0 || h->length != file_size)
+		return -1;
+
+	// finalize a copy, the handle may still be written to afterwards
+	sha = h->sha;
+	sha256_final(&sha, digest);
+	sha256_hex(digest, out);
+	return 0;
+}
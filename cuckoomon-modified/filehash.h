@@ -0,0 +1,56 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Per-handle hashing of written file data
+//
+// A running SHA-256 over the data written through a file handle.  It only
+// stays usable while the writes extend the hashed data contiguously from
+// offset zero; anything else (seeking back, holes, writes of unknown
+// placement) spoils it for good, in which case the host falls back to
+// fetching the file.  At close the hash is only reported if it covers
+// exactly the final size of the file.
+//
+
+#ifndef __FILEHASH_H
+#define __FILEHASH_H
+
+#include "compat.h"
+#include "sha256.h"
+
+#define FILEHASH_HEX_SIZE (SHA256_DIGEST_SIZE * 2 + 1)
+
+typedef struct _filehash_t {
+	sha256_t sha;
+	// amount of bytes hashed, i.e., the offset of the next expected write
+	uint64_t length;
+	int valid;
+} filehash_t;
+
+void filehash_init(filehash_t *h);
+void filehash_invalidate(filehash_t *h);
+
+// feeds a write of length bytes which landed at offset
+void filehash_write(filehash_t *h, uint64_t offset, const void *data,
+	size_t length);
+
+// writes the hex digest to out and returns 0 if the hashed data is the
+// whole file of file_size bytes, returns -1 otherwise
+int filehash_final(filehash_t *h, uint64_t file_size, char *out);
+
+#endif
@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <wincrypt.h>
 #include "hooking.h"
 #include "log.h"
+#include "payload.h"
 
 HOOKDEF(BOOL, WINAPI, CryptAcquireContextA,
 	_Out_	  HCRYPTPROV *phProv,
@@ -114,6 +115,9 @@ HOOKDEF(BOOL, WINAPI, CryptDecrypt,
         pdwDataLen);
 	LOQ_bool("crypto", "ppBi", "CryptKey", hKey, "CryptHash", hHash,
         "Buffer", pdwDataLen, pbData, "Final", Final);
+    if (ret && pdwDataLen != NULL)
+        log_payload(PAYLOAD_CRYPTO, (ULONG_PTR)hKey, PAYLOAD_IN, pbData,
+            *pdwDataLen);
     return ret;
 }
 
@@ -129,6 +133,10 @@ HOOKDEF(BOOL, WINAPI, CryptEncrypt,
     BOOL ret = 1;
 	LOQ_bool("crypto", "ppbi", "CryptKey", hKey, "CryptHash", hHash,
         "Buffer", dwBufLen, pbData, "Final", Final);
+    // the plaintext is encrypted in place
+    if (pdwDataLen != NULL)
+        log_payload(PAYLOAD_CRYPTO, (ULONG_PTR)hKey, PAYLOAD_OUT, pbData,
+            *pdwDataLen);
     return Old_CryptEncrypt(hKey, hHash, Final, dwFlags, pbData, pdwDataLen,
         dwBufLen);
 }
@@ -27,6 +27,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "ignore.h"
 #include "lookup.h"
 #include "config.h"
+#include "filehash.h"
+#include "rangeset.h"
 
 #define DUMP_FILE_MASK (GENERIC_WRITE | FILE_GENERIC_WRITE | \
     FILE_WRITE_DATA | FILE_APPEND_DATA | STANDARD_RIGHTS_WRITE | \
@@ -37,16 +39,31 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 typedef struct _file_record_t {
     unsigned int attributes;
+
+    // with file-hashes or write-ranges the record is kept until the handle
+    // is closed, so FILE_NEW has only been sent once announced is set
+    int announced;
+    // opened with FILE_APPEND_DATA but not FILE_WRITE_DATA, every write
+    // lands at the end of the file whatever offset it asks for
+    int append_only;
+    spinlock_t lock;
+    filehash_t hash;
+    rangeset_t ranges;
+
     size_t length;
     wchar_t filename[0];
 } file_record_t;
 
 static lookup_t g_files;
 
-void file_init()
+// whether we follow the writes to a file until it's closed
+static int tracking_writes(void)
 {
-	specialname_map_init();
+	return g_config.file_hashes || g_config.write_ranges;
+}
 
+void file_init()
+{
     lookup_init(&g_files);
 }
 
@@ -84,6 +101,27 @@ static void new_file(const UNICODE_STRING *obj)
     }
 }
 
+typedef struct _invalidate_t {
+	unsigned int skip;
+	const wchar_t *filename;
+	int count;
+} invalidate_t;
+
+// drops the hash of every other handle we follow on the same file
+static void invalidate_same_file(unsigned int id, void *data, void *context)
+{
+	file_record_t *r = (file_record_t *)data;
+	invalidate_t *inv = (invalidate_t *)context;
+
+	if (id == inv->skip || wcsicmp(r->filename, inv->filename) != 0)
+		return;
+
+	spin_lock(&r->lock);
+	filehash_invalidate(&r->hash);
+	spin_unlock(&r->lock);
+	inv->count++;
+}
+
 static void cache_file(HANDLE file_handle, const wchar_t *path,
     unsigned int length_in_chars, unsigned int attributes)
 {
@@ -95,10 +133,82 @@ static void cache_file(HANDLE file_handle, const wchar_t *path,
         .length     = length_in_chars,
     };
 
+    filehash_init(&r->hash);
+    rangeset_init(&r->ranges);
+	// without file-hashes only the ranges are followed
+	if (!g_config.file_hashes)
+		filehash_invalidate(&r->hash);
+
+	// the access that was granted, with any generic rights mapped
+	if (tracking_writes()) {
+		FILE_ACCESS_INFORMATION access;
+		IO_STATUS_BLOCK iosb;
+
+		if (NT_SUCCESS(Old_NtQueryInformationFile(file_handle, &iosb,
+				&access, sizeof(access), FileAccessInformation)))
+			r->append_only = (access.AccessFlags & FILE_APPEND_DATA) &&
+				!(access.AccessFlags & FILE_WRITE_DATA);
+		else
+			r->append_only = -1;
+	}
+
     wcsncpy(r->filename, path, r->length + 1);
+
+	// with a second handle writing to the same file neither of them sees
+	// all of the data
+	if (g_config.file_hashes) {
+		invalidate_t inv = { (unsigned int)file_handle, r->filename, 0 };
+		lookup_foreach(&g_files, &invalidate_same_file, &inv);
+		if (inv.count != 0) {
+			spin_lock(&r->lock);
+			filehash_invalidate(&r->hash);
+			spin_unlock(&r->lock);
+		}
+	}
+}
+
+// returns the offset a write on file_handle is going to land at, or -1 if
+// we're not following the writes to this file (anymore) or can't tell
+static int64_t file_write_offset(HANDLE file_handle,
+	const LARGE_INTEGER *byte_offset)
+{
+	FILE_POSITION_INFORMATION position;
+	FILE_STANDARD_INFORMATION standard;
+	IO_STATUS_BLOCK iosb;
+	file_record_t *r;
+	lasterror_t lasterror;
+	int64_t offset = -1;
+
+	r = lookup_get(&g_files, (unsigned int)file_handle, NULL);
+	if (r == NULL || (r->hash.valid == 0 && r->ranges.valid == 0) ||
+			r->append_only < 0)
+		return -1;
+
+	if (r->append_only == 0 && byte_offset != NULL &&
+			byte_offset->HighPart != -1)
+		return byte_offset->QuadPart;
+
+	get_lasterrors(&lasterror);
+
+	if (r->append_only != 0 || (byte_offset != NULL &&
+			byte_offset->LowPart == FILE_WRITE_TO_END_OF_FILE)) {
+		if (NT_SUCCESS(Old_NtQueryInformationFile(file_handle, &iosb,
+				&standard, sizeof(standard), FileStandardInformation)))
+			offset = standard.EndOfFile.QuadPart;
+	}
+	else if (byte_offset == NULL ||
+			byte_offset->LowPart == FILE_USE_FILE_POINTER_POSITION) {
+		if (NT_SUCCESS(Old_NtQueryInformationFile(file_handle, &iosb,
+				&position, sizeof(position), FilePositionInformation)))
+			offset = position.CurrentByteOffset.QuadPart;
+	}
+
+	set_lasterrors(&lasterror);
+	return offset;
 }
 
-static void file_write(HANDLE file_handle)
+static void file_write(HANDLE file_handle, NTSTATUS status, int64_t offset,
+	const void *buffer, ULONG_PTR length)
 {
 	file_record_t *r;
 	lasterror_t lasterror;
@@ -106,7 +216,7 @@ static void file_write(HANDLE file_handle)
 	get_lasterrors(&lasterror);
 
 	r = lookup_get(&g_files, (unsigned int)file_handle, NULL);
-    if(r != NULL) {
+    if(r != NULL && r->announced == 0) {
         UNICODE_STRING str = {
             // microsoft actually meant "size"
             .Length         = (USHORT)r->length * sizeof(wchar_t),
@@ -116,14 +226,69 @@ static void file_write(HANDLE file_handle)
 
         // we do in fact want to dump this file because it was written to
         new_file(&str);
-
-        // delete the file record from the list
-        lookup_del(&g_files, (unsigned int) file_handle);
+        r->announced = 1;
+
+        // delete the file record from the list, unless we keep following
+        // the writes
+        if (!tracking_writes()) {
+            lookup_del(&g_files, (unsigned int) file_handle);
+            r = NULL;
+        }
     }
 
+	if (r != NULL) {
+		spin_lock(&r->lock);
+		// the data of an asynchronous write hasn't necessarily been
+		// written yet
+		if (status == STATUS_PENDING || offset < 0)
+			filehash_invalidate(&r->hash);
+		else
+			filehash_write(&r->hash, (uint64_t)offset, buffer, length);
+
+		// for pending writes we add the requested length, which may be
+		// more than ends up being written
+		if (g_config.write_ranges) {
+			if (offset < 0)
+				rangeset_invalidate(&r->ranges);
+			else
+				rangeset_add(&r->ranges, (uint64_t)offset, length);
+		}
+		spin_unlock(&r->lock);
+	}
+
 	set_lasterrors(&lasterror);
 }
 
+// reports the hash of a written file once it's about to be closed, as long
+// as everything that's in the file went through this handle.  We notice a
+// second write handle or a writable section within this process, but not
+// writes from other processes or through a duplicated handle, so the hash
+// is advisory: the analyzer should still hash what it fetches
+static void file_report_hash(HANDLE file_handle)
+{
+	FILE_STANDARD_INFORMATION standard;
+	IO_STATUS_BLOCK iosb;
+	char hex[FILEHASH_HEX_SIZE];
+	file_record_t *r;
+	int ret = -1;
+
+	r = lookup_get(&g_files, (unsigned int)file_handle, NULL);
+	if (r == NULL || r->announced == 0 || r->hash.valid == 0)
+		return;
+
+	if (NT_SUCCESS(Old_NtQueryInformationFile(file_handle, &iosb,
+			&standard, sizeof(standard), FileStandardInformation)) &&
+			!standard.DeletePending) {
+		spin_lock(&r->lock);
+		ret = filehash_final(&r->hash, standard.EndOfFile.QuadPart, hex);
+		spin_unlock(&r->lock);
+	}
+
+	// '|' can't be part of a path
+	if (ret == 0 && isalpha(r->filename[0]) != 0 && r->filename[1] == ':')
+		pipe("FILE_NEW:%S|%s", (int)r->length, r->filename, -1, hex);
+}
+
 static void check_for_logging_resumption(const OBJECT_ATTRIBUTES *obj)
 {
 	lasterror_t lasterror;
@@ -181,6 +346,72 @@ static void handle_new_file(HANDLE file_handle, const OBJECT_ATTRIBUTES *obj)
 	set_lasterrors(&lasterror);
 }
 
+// reports the parts of the file that were written through this handle, so
+// the analyzer can fetch just those from large files
+static void file_report_ranges(HANDLE file_handle)
+{
+	file_record_t *r;
+	char *ranges;
+	int len;
+
+	r = lookup_get(&g_files, (unsigned int)file_handle, NULL);
+	if (r == NULL || r->announced == 0 || r->ranges.valid == 0 ||
+			isalpha(r->filename[0]) == 0 || r->filename[1] != ':')
+		return;
+
+	// 64 ranges of two 20 digit numbers
+	ranges = malloc(RANGESET_MAX * 42 + 1);
+	if (ranges == NULL)
+		return;
+
+	spin_lock(&r->lock);
+	len = rangeset_format(&r->ranges, ranges, RANGESET_MAX * 42 + 1);
+	spin_unlock(&r->lock);
+
+	if (len > 0)
+		pipe("FILE_RANGES:%S|%s", (int)r->length, r->filename, len, ranges);
+
+	free(ranges);
+}
+
+void file_close_prepare(HANDLE file_handle)
+{
+	lasterror_t lasterror;
+
+	if (!tracking_writes())
+		return;
+
+	get_lasterrors(&lasterror);
+	if (g_config.file_hashes)
+		file_report_hash(file_handle);
+	if (g_config.write_ranges)
+		file_report_ranges(file_handle);
+	set_lasterrors(&lasterror);
+}
+
+// writes through a view of a section never pass NtWriteFile, so a file
+// that got a writable section can't be hashed from the writes anymore
+void file_section(HANDLE file_handle, ULONG protection)
+{
+	lasterror_t lasterror;
+	file_record_t *r;
+
+	if (!g_config.file_hashes || file_handle == NULL ||
+			!(protection & (PAGE_READWRITE | PAGE_EXECUTE_READWRITE)))
+		return;
+
+	get_lasterrors(&lasterror);
+	r = lookup_get(&g_files, (unsigned int)file_handle, NULL);
+	if (r != NULL) {
+		invalidate_t inv = { (unsigned int)file_handle, r->filename, 0 };
+		spin_lock(&r->lock);
+		filehash_invalidate(&r->hash);
+		spin_unlock(&r->lock);
+		lookup_foreach(&g_files, &invalidate_same_file, &inv);
+	}
+	set_lasterrors(&lasterror);
+}
+
 void file_close(HANDLE file_handle)
 {
 	lasterror_t lasterror;
@@ -277,7 +508,13 @@ HOOKDEF(NTSTATUS, WINAPI, NtWriteFile,
     __in_opt  PLARGE_INTEGER ByteOffset,
     __in_opt  PULONG Key
 ) {
-    NTSTATUS ret = Old_NtWriteFile(FileHandle, Event, ApcRoutine, ApcContext,
+	NTSTATUS ret;
+	int64_t offset = -1;
+
+	if (tracking_writes())
+		offset = file_write_offset(FileHandle, ByteOffset);
+
+    ret = Old_NtWriteFile(FileHandle, Event, ApcRoutine, ApcContext,
         IoStatusBlock, Buffer, Length, ByteOffset, Key);
 	wchar_t *fname = calloc(32768, sizeof(wchar_t));
 
@@ -289,7 +526,8 @@ HOOKDEF(NTSTATUS, WINAPI, NtWriteFile,
 	free(fname);
 	
 	if(NT_SUCCESS(ret)) {
-        file_write(FileHandle);
+        file_write(FileHandle, ret, offset, Buffer,
+            ret == STATUS_PENDING ? Length : IoStatusBlock->Information);
     }
     return ret;
 }
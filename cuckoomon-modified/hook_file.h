@@ -17,4 +17,6 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 void file_init();
+void file_close_prepare(HANDLE file_handle);
 void file_close(HANDLE file_handle);
+void file_section(HANDLE file_handle, ULONG protection);
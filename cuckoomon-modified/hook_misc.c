@@ -224,7 +224,11 @@ HOOKDEF(BOOL, WINAPI, LookupPrivilegeValueW,
 HOOKDEF(NTSTATUS, WINAPI, NtClose,
     __in    HANDLE Handle
 ) {
-    NTSTATUS ret = Old_NtClose(Handle);
+    NTSTATUS ret;
+
+    file_close_prepare(Handle);
+
+    ret = Old_NtClose(Handle);
     LOQ_ntstatus("system", "p", "Handle", Handle);
     if(NT_SUCCESS(ret)) {
         file_close(Handle);
@@ -306,19 +310,20 @@ HOOKDEF(BOOL, WINAPI, GetCursorPos,
     _Out_ LPPOINT lpPoint
 ) {
     BOOL ret = Old_GetCursorPos(lpPoint);
-	static LARGE_INTEGER last_skipped = { .QuadPart = 0ULL };
+	static int64_t last_skipped;
+	int64_t skipped = vclock_skipped(&g_vclock);
 
 	/* work around the fact that skipping sleeps prevents the human module from making the system look active */
-	if (lpPoint && time_skipped.QuadPart != last_skipped.QuadPart) {
+	if (lpPoint && skipped != last_skipped) {
 		int xres, yres;
 		xres = GetSystemMetrics(0);
 		yres = GetSystemMetrics(1);
 		lpPoint->x = random() % xres;
 		lpPoint->y = random() % yres;
-		last_skipped.QuadPart = time_skipped.QuadPart;
+		last_skipped = skipped;
 	}
-	else if (last_skipped.QuadPart == 0) {
-		last_skipped.QuadPart = time_skipped.QuadPart;
+	else if (last_skipped == 0) {
+		last_skipped = skipped;
 	}
 
 	LOQ_bool("misc", "ii", "x", lpPoint != NULL ? lpPoint->x : 0,
@@ -24,6 +24,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "log.h"
 #include "pipe.h"
 #include "config.h"
+#include "payload.h"
 
 HOOKDEF(HINTERNET, WINAPI, WinHttpOpen,
 	_In_opt_ LPCWSTR pwszUserAgent,
@@ -346,6 +347,9 @@ HOOKDEF(BOOL, WINAPI, HttpSendRequestA,
     LOQ_bool("network", "pSb", "RequestHandle", hRequest,
         "Headers", dwHeadersLength, lpszHeaders,
         "PostData", dwOptionalLength, lpOptional);
+    if (ret)
+        log_payload(PAYLOAD_INTERNET, (ULONG_PTR)hRequest, PAYLOAD_OUT,
+            lpOptional, dwOptionalLength);
     return ret;
 }
 
@@ -361,6 +365,9 @@ HOOKDEF(BOOL, WINAPI, HttpSendRequestW,
     LOQ_bool("network", "pUb", "RequestHandle", hRequest,
         "Headers", dwHeadersLength, lpszHeaders,
         "PostData", dwOptionalLength, lpOptional);
+    if (ret)
+        log_payload(PAYLOAD_INTERNET, (ULONG_PTR)hRequest, PAYLOAD_OUT,
+            lpOptional, dwOptionalLength);
     return ret;
 }
 
@@ -374,6 +381,9 @@ HOOKDEF(BOOL, WINAPI, InternetReadFile,
         lpdwNumberOfBytesRead);
     LOQ_bool("network", "pB", "InternetHandle", hFile,
         "Buffer", lpdwNumberOfBytesRead, lpBuffer);
+    if (ret && lpdwNumberOfBytesRead != NULL)
+        log_payload(PAYLOAD_INTERNET, (ULONG_PTR)hFile, PAYLOAD_IN,
+            lpBuffer, *lpdwNumberOfBytesRead);
     return ret;
 }
 
@@ -387,6 +397,9 @@ HOOKDEF(BOOL, WINAPI, InternetWriteFile,
         lpdwNumberOfBytesWritten);
     LOQ_bool("network", "pB", "InternetHandle", hFile,
         "Buffer", lpdwNumberOfBytesWritten, lpBuffer);
+    if (ret && lpdwNumberOfBytesWritten != NULL)
+        log_payload(PAYLOAD_INTERNET, (ULONG_PTR)hFile, PAYLOAD_OUT,
+            lpBuffer, *lpdwNumberOfBytesWritten);
     return ret;
 }
 
@@ -395,6 +408,8 @@ HOOKDEF(BOOL, WINAPI, InternetCloseHandle,
 ) {
     BOOL ret = Old_InternetCloseHandle(hInternet);
     LOQ_bool("network", "p", "InternetHandle", hInternet);
+    if (ret)
+        log_payload_close(PAYLOAD_INTERNET, (ULONG_PTR)hInternet);
     return ret;
 }
 
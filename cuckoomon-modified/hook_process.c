@@ -25,6 +25,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "misc.h"
 #include "ignore.h"
 #include "hook_sleep.h"
+#include "hook_file.h"
 #include "unhook.h"
 
 HOOKDEF(HANDLE, WINAPI, CreateToolhelp32Snapshot,
@@ -275,6 +276,8 @@ HOOKDEF(NTSTATUS, WINAPI, NtCreateSection,
     LOQ_ntstatus("process", "Phop", "SectionHandle", SectionHandle,
         "DesiredAccess", DesiredAccess, "ObjectAttributes", ObjectAttributes ? ObjectAttributes->ObjectName : NULL,
         "FileHandle", FileHandle);
+    if (NT_SUCCESS(ret))
+        file_section(FileHandle, SectionPageProtection);
     return ret;
 }
 
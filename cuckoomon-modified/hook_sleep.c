@@ -31,12 +31,65 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 static int sleep_skip_active = 1;
 
 // the amount of time skipped, in 100-nanosecond
-LARGE_INTEGER time_skipped;
+vclock_t g_vclock;
 static LARGE_INTEGER time_start;
 
+// QueryPerformanceFrequency() never changes while the system is running
+static LONGLONG g_counter_frequency;
+
 static int num_skipped = 0;
 static int num_small = 0;
 
+// KSYSTEM_TIME values in KUSER_SHARED_DATA, 100-nanosecond units; reading
+// them doesn't go through any of our hooks
+#define KUSER_INTERRUPT_TIME 0x7ffe0008
+#define KUSER_SYSTEM_TIME 0x7ffe0014
+
+static int64_t kuser_time(ULONG_PTR addr)
+{
+	volatile ULONG *p = (volatile ULONG *)addr;
+	ULONG low, high;
+
+	// LowPart, High1Time, High2Time; the kernel writes High2Time first and
+	// High1Time last, so a torn read shows up as a mismatch
+	do {
+		high = p[1];
+		low = p[0];
+	} while (high != p[2]);
+
+	return ((int64_t)high << 32) | low;
+}
+
+// the interval a wait asked for, or zero if it shouldn't be dilated
+static int64_t wait_interval(PLARGE_INTEGER Timeout)
+{
+	int64_t interval;
+
+	if (g_config.time_dilation <= 1 || Timeout == NULL)
+		return 0;
+
+	if (Timeout->QuadPart < 0)
+		return -Timeout->QuadPart;
+
+	// absolute deadlines are based on the system time the sample sees
+	interval = Timeout->QuadPart -
+		vclock_time(&g_vclock, kuser_time(KUSER_SYSTEM_TIME));
+	return interval > 0 ? interval : 0;
+}
+
+// the virtual clock runs faster while any dilated wait is in progress
+static void dilated_wait_begin(void)
+{
+	vclock_wait_begin(&g_vclock, kuser_time(KUSER_INTERRUPT_TIME),
+		g_config.time_dilation);
+}
+
+static void dilated_wait_end(void)
+{
+	vclock_wait_end(&g_vclock, kuser_time(KUSER_INTERRUPT_TIME),
+		g_config.time_dilation);
+}
+
 void disable_sleep_skip()
 {
 	if (sleep_skip_active && g_config.force_sleepskip < 1) {
@@ -52,6 +105,7 @@ HOOKDEF(NTSTATUS, WINAPI, NtDelayExecution,
     NTSTATUS ret = 0;
 	LONGLONG interval = -DelayInterval->QuadPart;
 	unsigned long milli = (unsigned long)(interval / 10000);
+	int64_t dilated;
 	lasterror_t lasterror;
 
 	get_lasterrors(&lasterror);
@@ -65,7 +119,7 @@ HOOKDEF(NTSTATUS, WINAPI, NtDelayExecution,
 
         // check if we're still within the hardcoded limit
         if(sleep_skip_active && (li.QuadPart < time_start.QuadPart + MAX_SLEEP_SKIP_DIFF * 10000)) {
-            time_skipped.QuadPart += interval;
+            vclock_skip(&g_vclock, interval);
 
 			if (num_skipped < 20) {
 				// notify how much we've skipped
@@ -78,17 +132,19 @@ HOOKDEF(NTSTATUS, WINAPI, NtDelayExecution,
 			}
             goto skipcall;
 		}
-		/* clamp sleeps between 30 seconds and 1 hour down to 10 seconds  as long as we didn't force off sleep skipping */
-		else if (milli >= 30000 && milli <= 3600000 && g_config.force_sleepskip != 0) {
+		/* clamp sleeps between 30 seconds and 1 hour down to 10 seconds  as long as we didn't force off sleep skipping,
+		   unless they get dilated below */
+		else if (milli >= 30000 && milli <= 3600000 && g_config.force_sleepskip != 0 &&
+			g_config.time_dilation <= 1) {
 			LARGE_INTEGER newint;
 			newint.QuadPart = -(10000 * 10000);
-			time_skipped.QuadPart -= interval - (10000 * 10000);
+			vclock_skip(&g_vclock, interval - (10000 * 10000));
 			LOQ_ntstatus("system", "is", "Milliseconds", milli, "Status", "Skipped");
 			set_lasterrors(&lasterror);
 			return Old_NtDelayExecution(Alertable, &newint);
 		}
 		else if (g_config.force_sleepskip > 0) {
-			time_skipped.QuadPart += interval;
+			vclock_skip(&g_vclock, interval);
 			LOQ_ntstatus("system", "is", "Milliseconds", milli, "Status", "Skipped");
 			goto skipcall;
 		}
@@ -109,6 +165,19 @@ HOOKDEF(NTSTATUS, WINAPI, NtDelayExecution,
 	else {
 		LOQ_ntstatus("system", "i", "Milliseconds", milli);
 	}
+
+	dilated = wait_interval(DelayInterval);
+	if (dilated != 0) {
+		LARGE_INTEGER newint;
+
+		newint.QuadPart = -vclock_dilate(dilated, g_config.time_dilation);
+		dilated_wait_begin();
+		ret = Old_NtDelayExecution(Alertable, &newint);
+		dilated_wait_end();
+		set_lasterrors(&lasterror);
+		return ret;
+	}
+
 	set_lasterrors(&lasterror);
 	return Old_NtDelayExecution(Alertable, DelayInterval);
 skipcall:
@@ -129,7 +198,7 @@ HOOKDEF(void, WINAPI, GetLocalTime,
 	SystemTimeToFileTime(lpSystemTime, &ft);
     li.HighPart = ft.dwHighDateTime;
     li.LowPart = ft.dwLowDateTime;
-    li.QuadPart += time_skipped.QuadPart;
+    li.QuadPart = vclock_time(&g_vclock, li.QuadPart);
     ft.dwHighDateTime = li.HighPart;
     ft.dwLowDateTime = li.LowPart;
     FileTimeToSystemTime(&ft, lpSystemTime);
@@ -151,7 +220,7 @@ HOOKDEF(void, WINAPI, GetSystemTime,
     SystemTimeToFileTime(lpSystemTime, &ft);
     li.HighPart = ft.dwHighDateTime;
     li.LowPart = ft.dwLowDateTime;
-    li.QuadPart += time_skipped.QuadPart;
+    li.QuadPart = vclock_time(&g_vclock, li.QuadPart);
     ft.dwHighDateTime = li.HighPart;
     ft.dwLowDateTime = li.LowPart;
     FileTimeToSystemTime(&ft, lpSystemTime);
@@ -162,12 +231,8 @@ HOOKDEF(void, WINAPI, GetSystemTime,
 HOOKDEF(DWORD, WINAPI, GetTickCount,
     void
 ) {
-    DWORD ret = Old_GetTickCount();
-
     // add the time we've skipped
-    ret += (DWORD)(time_skipped.QuadPart / 10000);
-
-    return ret;
+    return vclock_ticks(&g_vclock, Old_GetTickCount());
 }
 
 HOOKDEF(NTSTATUS, WINAPI, NtQuerySystemTime,
@@ -175,7 +240,7 @@ HOOKDEF(NTSTATUS, WINAPI, NtQuerySystemTime,
 ) {
     NTSTATUS ret = Old_NtQuerySystemTime(SystemTime);
     if(NT_SUCCESS(ret)) {
-        SystemTime->QuadPart += time_skipped.QuadPart;
+        SystemTime->QuadPart = vclock_time(&g_vclock, SystemTime->QuadPart);
     }
     return 0;
 }
@@ -183,12 +248,8 @@ HOOKDEF(NTSTATUS, WINAPI, NtQuerySystemTime,
 HOOKDEF(DWORD, WINAPI, timeGetTime,
 	void
 ) {
-	DWORD ret = Old_timeGetTime();
-
 	// add the time we've skipped
-	ret += (DWORD)(time_skipped.QuadPart / 10000);
-
-	return ret;
+	return vclock_ticks(&g_vclock, Old_timeGetTime());
 }
 
 HOOKDEF(void, WINAPI, GetSystemTimeAsFileTime,
@@ -200,7 +261,7 @@ HOOKDEF(void, WINAPI, GetSystemTimeAsFileTime,
 
 	li.HighPart = ft.dwHighDateTime;
 	li.LowPart = ft.dwLowDateTime;
-	li.QuadPart += time_skipped.QuadPart;
+	li.QuadPart = vclock_time(&g_vclock, li.QuadPart);
 	ft.dwHighDateTime = li.HighPart;
 	ft.dwLowDateTime = li.LowPart;
 
@@ -209,6 +270,102 @@ HOOKDEF(void, WINAPI, GetSystemTimeAsFileTime,
 	return;
 }
 
+HOOKDEF(BOOL, WINAPI, QueryPerformanceCounter,
+	_Out_ LARGE_INTEGER *lpPerformanceCount
+) {
+	BOOL ret = Old_QueryPerformanceCounter(lpPerformanceCount);
+
+	if (ret && g_counter_frequency != 0)
+		lpPerformanceCount->QuadPart = vclock_counter(&g_vclock,
+			lpPerformanceCount->QuadPart, g_counter_frequency);
+
+	return ret;
+}
+
+HOOKDEF(ULONGLONG, WINAPI, GetTickCount64,
+	void
+) {
+	// add the time we've skipped
+	return vclock_ticks64(&g_vclock, Old_GetTickCount64());
+}
+
+HOOKDEF(NTSTATUS, WINAPI, NtQueryPerformanceCounter,
+	_Out_ PLARGE_INTEGER PerformanceCounter,
+	_Out_opt_ PLARGE_INTEGER PerformanceFrequency
+) {
+	LARGE_INTEGER frequency;
+	NTSTATUS ret;
+
+	// scale by the frequency of this very counter, which the caller
+	// doesn't necessarily ask for
+	if (PerformanceFrequency == NULL)
+		PerformanceFrequency = &frequency;
+
+	ret = Old_NtQueryPerformanceCounter(PerformanceCounter,
+		PerformanceFrequency);
+	if (NT_SUCCESS(ret) && PerformanceFrequency->QuadPart != 0)
+		PerformanceCounter->QuadPart = vclock_counter(&g_vclock,
+			PerformanceCounter->QuadPart, PerformanceFrequency->QuadPart);
+
+	return ret;
+}
+
+HOOKDEF(BOOLEAN, WINAPI, RtlQueryPerformanceCounter,
+	_Out_ PLARGE_INTEGER PerformanceCounter
+) {
+	BOOLEAN ret = Old_RtlQueryPerformanceCounter(PerformanceCounter);
+
+	// RtlQueryPerformanceFrequency() is what QueryPerformanceFrequency()
+	// returns
+	if (ret && g_counter_frequency != 0)
+		PerformanceCounter->QuadPart = vclock_counter(&g_vclock,
+			PerformanceCounter->QuadPart, g_counter_frequency);
+
+	return ret;
+}
+
+HOOKDEF(NTSTATUS, WINAPI, NtWaitForSingleObject,
+	__in HANDLE Handle,
+	__in BOOLEAN Alertable,
+	__in_opt PLARGE_INTEGER Timeout
+) {
+	int64_t interval = wait_interval(Timeout);
+	LARGE_INTEGER newint;
+	NTSTATUS ret;
+
+	if (interval == 0)
+		return Old_NtWaitForSingleObject(Handle, Alertable, Timeout);
+
+	newint.QuadPart = -vclock_dilate(interval, g_config.time_dilation);
+	dilated_wait_begin();
+	ret = Old_NtWaitForSingleObject(Handle, Alertable, &newint);
+	dilated_wait_end();
+	return ret;
+}
+
+HOOKDEF(NTSTATUS, WINAPI, NtWaitForMultipleObjects,
+	__in ULONG Count,
+	__in PHANDLE Handles,
+	__in ULONG WaitType,
+	__in BOOLEAN Alertable,
+	__in_opt PLARGE_INTEGER Timeout
+) {
+	int64_t interval = wait_interval(Timeout);
+	LARGE_INTEGER newint;
+	NTSTATUS ret;
+
+	if (interval == 0)
+		return Old_NtWaitForMultipleObjects(Count, Handles, WaitType,
+			Alertable, Timeout);
+
+	newint.QuadPart = -vclock_dilate(interval, g_config.time_dilation);
+	dilated_wait_begin();
+	ret = Old_NtWaitForMultipleObjects(Count, Handles, WaitType, Alertable,
+		&newint);
+	dilated_wait_end();
+	return ret;
+}
+
 static int lastinput_called;
 
 HOOKDEF(BOOL, WINAPI, GetLastInputInfo,
@@ -222,7 +379,7 @@ HOOKDEF(BOOL, WINAPI, GetLastInputInfo,
 
 	/* fake recent user activity */
 	if (lastinput_called > 2 && plii && plii->cbSize == 8)
-		plii->dwTime = GetTickCount() + (DWORD)(time_skipped.QuadPart / 10000);
+		plii->dwTime = vclock_ticks(&g_vclock, GetTickCount());
 
 	return ret;
 }
@@ -230,10 +387,15 @@ HOOKDEF(BOOL, WINAPI, GetLastInputInfo,
 void init_sleep_skip(int first_process)
 {
     FILETIME ft;
+    LARGE_INTEGER frequency;
+
     GetSystemTimeAsFileTime(&ft);
     time_start.HighPart = ft.dwHighDateTime;
     time_start.LowPart = ft.dwLowDateTime;
 
+    if (QueryPerformanceFrequency(&frequency))
+        g_counter_frequency = frequency.QuadPart;
+
     // we don't want to skip sleep calls in child processes
     if(first_process == 0) {
         disable_sleep_skip();
@@ -242,5 +404,5 @@ void init_sleep_skip(int first_process)
 
 void init_startup_time(unsigned int startup_time)
 {
-    time_skipped.QuadPart += (unsigned __int64) startup_time * 10000;
+    vclock_skip(&g_vclock, (int64_t)startup_time * VCLOCK_UNITS_PER_MS);
 }
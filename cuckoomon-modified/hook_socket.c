@@ -22,7 +22,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "hooking.h"
 #include "log.h"
 #include "config.h"
-
+#include "payload.h"
 
 static PVOID alloc_combined_wsabuf(LPWSABUF buf, DWORD count, DWORD *outlen)
 {
@@ -48,6 +48,27 @@ static PVOID alloc_combined_wsabuf(LPWSABUF buf, DWORD count, DWORD *outlen)
 	return retbuf;
 }
 
+// queues the first length bytes held by a WSABUF array on the payload
+// stream
+static void log_wsabuf_payload(SOCKET s, int direction, const WSABUF *buf,
+	DWORD count, DWORD length)
+{
+	for (DWORD i = 0; i < count && length != 0; i++) {
+		DWORD n = min(buf[i].len, length);
+		log_payload(PAYLOAD_SOCKET, (ULONG_PTR)s, direction, buf[i].buf, n);
+		length -= n;
+	}
+}
+
+// the amount of bytes an overlapped send is going to put on the wire
+static DWORD wsabuf_length(const WSABUF *buf, DWORD count)
+{
+	DWORD length = 0;
+	for (DWORD i = 0; i < count; i++)
+		length += buf[i].len;
+	return length;
+}
+
 static void get_ip_port(const struct sockaddr *addr,
     const char **ip, int *port)
 {
@@ -119,6 +140,8 @@ HOOKDEF(int, WSAAPI, send,
 ) {
     int ret = Old_send(s, buf, len, flags);
     LOQ_sockerr("network", "ib", "socket", s, "buffer", ret < 1 ? len : ret, buf);
+    if (ret > 0)
+        log_payload(PAYLOAD_SOCKET, (ULONG_PTR)s, PAYLOAD_OUT, buf, ret);
     return ret;
 }
 
@@ -137,6 +160,8 @@ HOOKDEF(int, WSAAPI, sendto,
     }
     LOQ_sockerr("network", "ibsi", "socket", s, "buffer", ret < 1 ? len : ret, buf,
         "ip", ip, "port", port);
+    if (ret > 0)
+        log_payload(PAYLOAD_SOCKET, (ULONG_PTR)s, PAYLOAD_OUT, buf, ret);
     return ret;
 }
 
@@ -148,6 +173,8 @@ HOOKDEF(int, WSAAPI, recv,
 ) {
     int ret = Old_recv(s, buf, len, flags);
     LOQ_sockerr("network", "ib", "socket", s, "buffer", ret < 1 ? 0 : ret, buf);
+    if (ret > 0)
+        log_payload(PAYLOAD_SOCKET, (ULONG_PTR)s, PAYLOAD_IN, buf, ret);
     return ret;
 }
 
@@ -166,6 +193,8 @@ HOOKDEF(int, WSAAPI, recvfrom,
     }
     LOQ_sockerr("network", "ibsi", "socket", s, "buffer", ret < 1 ? 0 : ret, buf,
         "ip", ip, "port", port);
+    if (ret > 0)
+        log_payload(PAYLOAD_SOCKET, (ULONG_PTR)s, PAYLOAD_IN, buf, ret);
     return ret;
 }
 
@@ -251,6 +280,8 @@ HOOKDEF(int, WSAAPI, closesocket,
 ) {
     int ret = Old_closesocket(s);
     LOQ_sockerr("network", "i", "socket", s);
+    if (ret == 0)
+        log_payload_close(PAYLOAD_SOCKET, (ULONG_PTR)s);
     return ret;
 }
 
@@ -303,6 +334,8 @@ HOOKDEF(int, WSAAPI, WSARecv,
 		LOQ_sockerr("network", "iBI", "socket", s, "Buffer", lpNumberOfBytesRecvd, buf, "NumberOfBytesReceived", lpNumberOfBytesRecvd);
 		if (buf)
 			free(buf);
+		if (ret == 0 && lpNumberOfBytesRecvd != NULL)
+			log_wsabuf_payload(s, PAYLOAD_IN, lpBuffers, dwBufferCount, *lpNumberOfBytesRecvd);
 	}
 	else {
 		// TODO: handle completion routine case
@@ -333,6 +366,8 @@ HOOKDEF(int, WSAAPI, WSARecvFrom,
 		LOQ_sockerr("network", "isiBI", "socket", s, "ip", ip, "port", port, "Buffer", lpNumberOfBytesRecvd, buf, "NumberOfBytesReceived", lpNumberOfBytesRecvd);
 		if (buf)
 			free(buf);
+		if (ret == 0 && lpNumberOfBytesRecvd != NULL)
+			log_wsabuf_payload(s, PAYLOAD_IN, lpBuffers, dwBufferCount, *lpNumberOfBytesRecvd);
 	}
 	else {
 		// TODO: handle completion routine case
@@ -358,6 +393,11 @@ HOOKDEF(int, WSAAPI, WSASend,
 	LOQ_sockerr("network", "ib", "Socket", s, "Buffer", outlen, buf);
 	if (buf)
 		free(buf);
+	if (ret == 0 && lpOverlapped == NULL && lpNumberOfBytesSent != NULL)
+		log_wsabuf_payload(s, PAYLOAD_OUT, lpBuffers, dwBufferCount, *lpNumberOfBytesSent);
+	else if (ret == 0 || WSAGetLastError() == WSA_IO_PENDING)
+		log_wsabuf_payload(s, PAYLOAD_OUT, lpBuffers, dwBufferCount,
+			wsabuf_length(lpBuffers, dwBufferCount));
     return ret;
 }
 
@@ -383,6 +423,11 @@ HOOKDEF(int, WSAAPI, WSASendTo,
 	LOQ_sockerr("network", "isib", "socket", s, "ip", ip, "port", port, "Buffer", outlen, buf);
 	if (buf)
 		free(buf);
+	if (ret == 0 && lpOverlapped == NULL && lpNumberOfBytesSent != NULL)
+		log_wsabuf_payload(s, PAYLOAD_OUT, lpBuffers, dwBufferCount, *lpNumberOfBytesSent);
+	else if (ret == 0 || WSAGetLastError() == WSA_IO_PENDING)
+		log_wsabuf_payload(s, PAYLOAD_OUT, lpBuffers, dwBufferCount,
+			wsabuf_length(lpBuffers, dwBufferCount));
     return ret;
 }
 
@@ -0,0 +1,427 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compat.h"
+#include "hookctl.h"
+
+static hookctl_entry_t g_entries[HOOKCTL_MAX_HOOKS];
+static volatile uint32_t g_entry_count;
+
+// categories for which logging was disabled, also applied to hooks which
+// are seen for the first time later on
+static char g_nolog_categories[HOOKCTL_MAX_CATEGORIES][HOOKCTL_MAX_NAME];
+static unsigned int g_nolog_category_count;
+static int g_nolog_all;
+
+// capture settings for categories and "*", also applied to hooks which are
+// seen for the first time later on
+typedef struct _capture_rule_t {
+	char category[HOOKCTL_MAX_NAME];
+	uint32_t limit;
+	uint32_t flags;
+} capture_rule_t;
+
+static capture_rule_t g_capture_categories[HOOKCTL_MAX_CATEGORIES];
+static unsigned int g_capture_category_count;
+static capture_rule_t g_capture_all;
+static int g_capture_all_set;
+
+#define CAPTURE_ALL 1
+#define CAPTURE_CATEGORY 2
+#define CAPTURE_HOOK 3
+
+// only taken when adding entries or handling commands, never while
+// accounting
+static spinlock_t g_lock;
+
+static void copy_name(char *out, const char *in, unsigned int length)
+{
+	if (length > HOOKCTL_MAX_NAME - 1)
+		length = HOOKCTL_MAX_NAME - 1;
+	memcpy(out, in, length);
+	out[length] = 0;
+}
+
+static int find_entry(const char *funcname)
+{
+	for (uint32_t i = 0; i < g_entry_count; i++) {
+		if (!strncmp(g_entries[i].funcname, funcname, HOOKCTL_MAX_NAME - 1))
+			return (int)i;
+	}
+	return -1;
+}
+
+static int find_nolog_category(const char *category)
+{
+	for (unsigned int i = 0; i < g_nolog_category_count; i++) {
+		if (!strncmp(g_nolog_categories[i], category, HOOKCTL_MAX_NAME - 1))
+			return (int)i;
+	}
+	return -1;
+}
+
+static int find_capture_category(const char *category)
+{
+	for (unsigned int i = 0; i < g_capture_category_count; i++) {
+		if (!strncmp(g_capture_categories[i].category, category, HOOKCTL_MAX_NAME - 1))
+			return (int)i;
+	}
+	return -1;
+}
+
+static void set_capture(hookctl_entry_t *e, uint32_t level, uint32_t limit,
+	uint32_t flags)
+{
+	if (e->capture_level > level)
+		return;
+	e->capture_limit = limit;
+	e->capture_flags = flags;
+	e->capture_level = level;
+}
+
+static int add_entry(const char *funcname)
+{
+	hookctl_entry_t *e;
+
+	if (g_entry_count == HOOKCTL_MAX_HOOKS)
+		return -1;
+
+	e = &g_entries[g_entry_count];
+	copy_name(e->funcname, funcname, (unsigned int)strlen(funcname));
+	e->category[0] = 0;
+	e->flags = g_nolog_all ? HOOKCTL_FLAG_NOLOG : 0;
+	e->capture_limit = 0;
+	e->capture_flags = 0;
+	e->capture_level = 0;
+	if (g_capture_all_set)
+		set_capture(e, CAPTURE_ALL, g_capture_all.limit, g_capture_all.flags);
+
+	// publish the entry only after it has been fully initialized
+	memory_barrier();
+	return (int)g_entry_count++;
+}
+
+static void set_flag(hookctl_entry_t *e, int enable)
+{
+	if (enable)
+		e->flags &= ~HOOKCTL_FLAG_NOLOG;
+	else
+		e->flags |= HOOKCTL_FLAG_NOLOG;
+}
+
+int hookctl_bind(const char *funcname, const char *category)
+{
+	int slot;
+
+	if (funcname == NULL)
+		return -1;
+
+	spin_lock(&g_lock);
+
+	slot = find_entry(funcname);
+	if (slot < 0)
+		slot = add_entry(funcname);
+
+	if (slot >= 0 && category != NULL && g_entries[slot].category[0] == 0) {
+		hookctl_entry_t *e = &g_entries[slot];
+		int idx;
+
+		copy_name(e->category, category, (unsigned int)strlen(category));
+		if (find_nolog_category(e->category) >= 0)
+			set_flag(e, 0);
+
+		idx = find_capture_category(e->category);
+		if (idx >= 0)
+			set_capture(e, CAPTURE_CATEGORY, g_capture_categories[idx].limit,
+				g_capture_categories[idx].flags);
+	}
+
+	spin_unlock(&g_lock);
+	return slot;
+}
+
+hookctl_entry_t *hookctl_entry(int slot)
+{
+	if (slot < 0 || (uint32_t)slot >= g_entry_count)
+		return NULL;
+	return &g_entries[slot];
+}
+
+int hookctl_count(void)
+{
+	return (int)g_entry_count;
+}
+
+static int set_category_logging(const char *category, int enable)
+{
+	int idx = find_nolog_category(category);
+
+	if (enable && idx >= 0) {
+		g_nolog_category_count--;
+		memcpy(g_nolog_categories[idx], g_nolog_categories[g_nolog_category_count],
+			HOOKCTL_MAX_NAME);
+	}
+	else if (!enable && idx < 0) {
+		if (g_nolog_category_count == HOOKCTL_MAX_CATEGORIES)
+			return -1;
+		copy_name(g_nolog_categories[g_nolog_category_count++], category,
+			(unsigned int)strlen(category));
+	}
+
+	for (uint32_t i = 0; i < g_entry_count; i++) {
+		if (!strncmp(g_entries[i].category, category, HOOKCTL_MAX_NAME - 1))
+			set_flag(&g_entries[i], enable);
+	}
+	return 0;
+}
+
+int hookctl_set_logging(const char *name, int enable)
+{
+	int ret = 0;
+
+	if (name == NULL || *name == 0)
+		return -1;
+
+	spin_lock(&g_lock);
+
+	if (!strcmp(name, "*")) {
+		g_nolog_all = !enable;
+		if (enable)
+			g_nolog_category_count = 0;
+		for (uint32_t i = 0; i < g_entry_count; i++)
+			set_flag(&g_entries[i], enable);
+	}
+	else if (!strncmp(name, "category:", 9)) {
+		ret = set_category_logging(name + 9, enable);
+	}
+	else {
+		// the hook may not have been called yet, in which case we create
+		// its entry right away so the setting sticks
+		int slot = find_entry(name);
+		if (slot < 0)
+			slot = add_entry(name);
+		if (slot < 0)
+			ret = -1;
+		else
+			set_flag(&g_entries[slot], enable);
+	}
+
+	spin_unlock(&g_lock);
+	return ret;
+}
+
+int hookctl_set_capture(const char *name, uint32_t limit, uint32_t flags)
+{
+	int ret = 0;
+
+	if (name == NULL || *name == 0)
+		return -1;
+
+	spin_lock(&g_lock);
+
+	if (!strcmp(name, "*")) {
+		g_capture_all.limit = limit;
+		g_capture_all.flags = flags;
+		g_capture_all_set = 1;
+		for (uint32_t i = 0; i < g_entry_count; i++)
+			set_capture(&g_entries[i], CAPTURE_ALL, limit, flags);
+	}
+	else if (!strncmp(name, "category:", 9)) {
+		const char *category = name + 9;
+		int idx = find_capture_category(category);
+
+		if (idx < 0 && g_capture_category_count < HOOKCTL_MAX_CATEGORIES) {
+			idx = (int)g_capture_category_count++;
+			copy_name(g_capture_categories[idx].category, category,
+				(unsigned int)strlen(category));
+		}
+
+		if (idx < 0)
+			ret = -1;
+		else {
+			g_capture_categories[idx].limit = limit;
+			g_capture_categories[idx].flags = flags;
+			for (uint32_t i = 0; i < g_entry_count; i++) {
+				if (!strncmp(g_entries[i].category, category, HOOKCTL_MAX_NAME - 1))
+					set_capture(&g_entries[i], CAPTURE_CATEGORY, limit, flags);
+			}
+		}
+	}
+	else {
+		// like hookctl_set_logging(), the setting sticks before the hook
+		// is ever called
+		int slot = find_entry(name);
+		if (slot < 0)
+			slot = add_entry(name);
+		if (slot < 0)
+			ret = -1;
+		else
+			set_capture(&g_entries[slot], CAPTURE_HOOK, limit, flags);
+	}
+
+	spin_unlock(&g_lock);
+	return ret;
+}
+
+void hookctl_capture(int slot, uint32_t default_limit, uint64_t length,
+	hookctl_capture_t *c)
+{
+	hookctl_entry_t *e = hookctl_entry(slot);
+	uint32_t limit = default_limit;
+
+	c->flags = 0;
+	if (e != NULL) {
+		if (e->capture_limit != 0)
+			limit = e->capture_limit;
+		c->flags = e->capture_flags;
+	}
+
+	if (length <= limit) {
+		c->head = (uint32_t)length;
+		c->tail = 0;
+	}
+	else if (c->flags & HOOKCTL_CAPTURE_HEAD_TAIL) {
+		c->head = limit - limit / 2;
+		c->tail = limit / 2;
+	}
+	else {
+		c->head = limit;
+		c->tail = 0;
+	}
+}
+
+// "<name> <bytes> [head-tail] [hash]"
+static int capture_command(char *arg)
+{
+	char *name = arg, *p;
+	uint32_t limit = 0, flags = 0;
+
+	p = strchr(arg, ' ');
+	if (p == NULL)
+		return HOOKCTL_CMD_ERROR;
+	*p++ = 0;
+
+	while (*p == ' ')
+		p++;
+	if (*p < '0' || *p > '9')
+		return HOOKCTL_CMD_ERROR;
+	while (*p >= '0' && *p <= '9') {
+		if (limit > (0xffffffff - 9) / 10)
+			return HOOKCTL_CMD_ERROR;
+		limit = limit * 10 + (*p++ - '0');
+	}
+
+	while (*p != 0) {
+		char *option;
+
+		if (*p == ' ') {
+			p++;
+			continue;
+		}
+
+		option = p;
+		while (*p != 0 && *p != ' ')
+			p++;
+		if (p - option == 9 && !strncmp(option, "head-tail", 9))
+			flags |= HOOKCTL_CAPTURE_HEAD_TAIL;
+		else if (p - option == 4 && !strncmp(option, "hash", 4))
+			flags |= HOOKCTL_CAPTURE_HASH;
+		else
+			return HOOKCTL_CMD_ERROR;
+	}
+
+	return hookctl_set_capture(name, limit, flags) < 0 ?
+		HOOKCTL_CMD_ERROR : HOOKCTL_CMD_OK;
+}
+
+void hookctl_reset(void)
+{
+	for (uint32_t i = 0; i < g_entry_count; i++) {
+		g_entries[i].calls = 0;
+		g_entries[i].suppressed = 0;
+		g_entries[i].cycles = 0;
+	}
+}
+
+int hookctl_command(const char *cmd, unsigned int length)
+{
+	char buf[16 + HOOKCTL_MAX_NAME + 16];
+	char *arg;
+
+	// strip surrounding whitespace, commands may come with \r\n attached
+	while (length != 0 && (*cmd == ' ' || *cmd == '\t')) {
+		cmd++;
+		length--;
+	}
+	while (length != 0 && (cmd[length - 1] == '\r' || cmd[length - 1] == '\n' ||
+		cmd[length - 1] == ' ' || cmd[length - 1] == '\t'))
+		length--;
+
+	if (length == 0)
+		return HOOKCTL_CMD_OK;
+	if (length >= sizeof(buf))
+		return HOOKCTL_CMD_ERROR;
+
+	memcpy(buf, cmd, length);
+	buf[length] = 0;
+
+	arg = strchr(buf, ' ');
+	if (arg != NULL) {
+		*arg++ = 0;
+		while (*arg == ' ')
+			arg++;
+	}
+
+	if (!strcmp(buf, "hook-disable") && arg != NULL)
+		return hookctl_set_logging(arg, 0) < 0 ? HOOKCTL_CMD_ERROR : HOOKCTL_CMD_OK;
+	else if (!strcmp(buf, "hook-enable") && arg != NULL)
+		return hookctl_set_logging(arg, 1) < 0 ? HOOKCTL_CMD_ERROR : HOOKCTL_CMD_OK;
+	else if (!strcmp(buf, "hook-stats"))
+		return HOOKCTL_CMD_STATS;
+	else if (!strcmp(buf, "hook-reset")) {
+		hookctl_reset();
+		return HOOKCTL_CMD_OK;
+	}
+	else if (!strcmp(buf, "capture-limit") && arg != NULL)
+		return capture_command(arg);
+
+	return HOOKCTL_CMD_ERROR;
+}
+
+// handles a list of commands separated by newlines or semicolons, returns
+// HOOKCTL_CMD_STATS if any of them requested the statistics
+int hookctl_commands(const char *cmds, unsigned int length)
+{
+	int ret = HOOKCTL_CMD_OK;
+	unsigned int start = 0;
+
+	for (unsigned int i = 0; i <= length; i++) {
+		int r;
+
+		if (i != length && cmds[i] != '\n' && cmds[i] != ';')
+			continue;
+
+		if (i != start) {
+			r = hookctl_command(cmds + start, i - start);
+			if (r == HOOKCTL_CMD_STATS || (r == HOOKCTL_CMD_ERROR && ret == HOOKCTL_CMD_OK))
+				ret = r;
+		}
+		start = i + 1;
+	}
+	return ret;
+}
@@ -0,0 +1,123 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Hook Control API
+//
+// Every logged API gets a slot in the control table the first time loq()
+// sees it.  The slot carries runtime flags (e.g., logging disabled) and the
+// cost counters for that hook, so the host can shed the noisiest hooks in
+// the middle of an analysis without touching the trampolines.
+//
+// The following commands are understood by hookctl_command():
+// hook-disable <name>  -> stop logging <name>
+// hook-enable <name>   -> resume logging <name>
+// hook-stats           -> caller should report the counters
+// hook-reset           -> zero all counters
+// capture-limit <name> <bytes> [head-tail] [hash]
+//                      -> log at most <bytes> of every buffer argument of
+//                         <name>, zero restores the default of the format
+//                         specifier; head-tail keeps both ends of a longer
+//                         buffer instead of its start, hash reports the
+//                         sha256 of the whole buffer if it was cut short
+//
+// <name> is either an API name (e.g., NtReadFile), "category:<category>"
+// (e.g., category:registry) or "*" for all hooks.  For the capture limits
+// a setting for the API beats one for its category, which beats "*".
+//
+
+#ifndef __HOOKCTL_H
+#define __HOOKCTL_H
+
+#include "compat.h"
+
+#define HOOKCTL_MAX_HOOKS 512
+#define HOOKCTL_MAX_NAME 64
+#define HOOKCTL_MAX_CATEGORIES 32
+
+// logging has been disabled for this hook
+#define HOOKCTL_FLAG_NOLOG 1
+
+// capture flags
+#define HOOKCTL_CAPTURE_HEAD_TAIL 1
+#define HOOKCTL_CAPTURE_HASH 2
+
+// return values of hookctl_command()
+#define HOOKCTL_CMD_ERROR -1
+#define HOOKCTL_CMD_OK 0
+#define HOOKCTL_CMD_STATS 1
+
+typedef struct _hookctl_entry_t {
+	char funcname[HOOKCTL_MAX_NAME];
+	char category[HOOKCTL_MAX_NAME];
+	volatile uint32_t flags;
+
+	// amount of calls seen, and how many of those were not logged
+	volatile uint64_t calls;
+	volatile uint64_t suppressed;
+
+	// timestamp counter cycles spent logging this hook
+	volatile uint64_t cycles;
+
+	// buffer capture limit in bytes (zero for the default) and flags, and
+	// whether they were set for the hook (3), its category (2) or all
+	// hooks (1)
+	volatile uint32_t capture_limit;
+	volatile uint32_t capture_flags;
+	uint32_t capture_level;
+} hookctl_entry_t;
+
+// which part of a buffer gets logged, head bytes from its start followed
+// by tail bytes from its end
+typedef struct _hookctl_capture_t {
+	uint32_t head;
+	uint32_t tail;
+	uint32_t flags;
+} hookctl_capture_t;
+
+int hookctl_bind(const char *funcname, const char *category);
+hookctl_entry_t *hookctl_entry(int slot);
+int hookctl_count(void);
+
+int hookctl_set_logging(const char *name, int enable);
+int hookctl_set_capture(const char *name, uint32_t limit, uint32_t flags);
+void hookctl_capture(int slot, uint32_t default_limit, uint64_t length,
+	hookctl_capture_t *c);
+int hookctl_command(const char *cmd, unsigned int length);
+int hookctl_commands(const char *cmds, unsigned int length);
+void hookctl_reset(void);
+
+static __inline int hookctl_is_logging(int slot)
+{
+	hookctl_entry_t *e = hookctl_entry(slot);
+	return e == NULL || (e->flags & HOOKCTL_FLAG_NOLOG) == 0;
+}
+
+static __inline void hookctl_account(int slot, uint64_t cycles, int logged)
+{
+	hookctl_entry_t *e = hookctl_entry(slot);
+	if (e == NULL)
+		return;
+	atomic_add64(&e->calls, 1);
+	if (logged)
+		atomic_add64(&e->cycles, cycles);
+	else
+		atomic_add64(&e->suppressed, 1);
+}
+
+#endif
@@ -26,6 +26,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "unhook.h"
 #include "misc.h"
 #include "pipe.h"
+#include "arena.h"
 
 extern DWORD g_tls_hook_index;
 
@@ -42,6 +43,135 @@ void emit_rel(unsigned char *buf, unsigned char *source, unsigned char *target)
 	*(DWORD *)buf = (DWORD)(target - (source + 4));
 }
 
+// executable memory for the trampolines, see arena.h
+static arena_t g_hook_arena;
+
+static void *reserve_hook_memory(void *addr, size_t size)
+{
+	PVOID BaseAddress = addr;
+	SIZE_T RegionSize = size;
+
+	if (pNtAllocateVirtualMemory(GetCurrentProcess(), &BaseAddress, 0, &RegionSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE) < 0)
+		return NULL;
+	return BaseAddress;
+}
+
+static void release_hook_memory(void *addr, size_t size)
+{
+	PVOID BaseAddress = addr;
+	SIZE_T RegionSize = 0;
+
+	pNtFreeVirtualMemory(GetCurrentProcess(), &BaseAddress, &RegionSize, MEM_RELEASE);
+}
+
+void *alloc_hook_memory(void *near, size_t size, size_t align)
+{
+	// the first hooks are placed by set_hooks() before any other thread
+	// can get here
+	if (g_hook_arena.reserve == NULL) {
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		arena_init(&g_hook_arena, &reserve_hook_memory, &release_hook_memory,
+			si.dwAllocationGranularity);
+	}
+	return arena_alloc(&g_hook_arena, near, size, align);
+}
+
+void free_hook_memory(void *ptr, size_t size)
+{
+	arena_free(&g_hook_arena, ptr, size);
+}
+
+hook_data_t *alloc_hookdata_near(void *addr, int hot)
+{
+	hook_data_t *ret = calloc(1, sizeof(hook_data_t));
+
+	if (ret == NULL)
+		return NULL;
+
+	// hot hooks start at a cache line, their pre-trampoline follows right
+	// after the trampoline, so they touch as few lines as possible
+	ret->func = addr;
+	ret->tramp_size = TRAMP_MAX_SIZE;
+	ret->tramp = alloc_hook_memory(addr, TRAMP_MAX_SIZE, hot ? ARENA_CACHE_LINE : 0);
+	if (ret->tramp == NULL) {
+		free(ret);
+		return NULL;
+	}
+	return ret;
+}
+
+// to be called once the trampoline has been built, returns -1 if we ran out
+// of memory
+int finish_tramp(hook_data_t *hookdata, unsigned int tramp_size)
+{
+	arena_shrink(&g_hook_arena, hookdata->tramp, hookdata->tramp_size, tramp_size);
+	hookdata->tramp_size = tramp_size;
+
+	hookdata->hook_data = alloc_hook_memory(hookdata->func, HOOK_DATA_SIZE, 0);
+	if (hookdata->hook_data == NULL)
+		return -1;
+	memset(hookdata->hook_data, 0, HOOK_DATA_SIZE);
+	return 0;
+}
+
+unsigned char *alloc_pre_tramp(hook_data_t *hookdata, unsigned int size)
+{
+	hookdata->pre_tramp = alloc_hook_memory(hookdata->func, size, 0);
+	if (hookdata->pre_tramp != NULL)
+		hookdata->pre_tramp_size = size;
+	return hookdata->pre_tramp;
+}
+
+void free_hookdata(hook_data_t *hookdata)
+{
+	free_hook_memory(hookdata->tramp, hookdata->tramp_size);
+	free_hook_memory(hookdata->hook_data, HOOK_DATA_SIZE);
+	free_hook_memory(hookdata->pre_tramp, hookdata->pre_tramp_size);
+	free(hookdata);
+}
+
+static void layout_hooks(arena_layout_t *out, hook_t *hooks, unsigned int count,
+	int hot_only)
+{
+	void **blocks = calloc(count * 3, sizeof(void *));
+	size_t *sizes = calloc(count * 3, sizeof(size_t));
+	unsigned int n = 0;
+
+	memset(out, 0, sizeof(*out));
+
+	if (blocks != NULL && sizes != NULL) {
+		for (unsigned int i = 0; i < count; i++) {
+			hook_data_t *hd = hooks[i].hookdata;
+			if (!hooks[i].is_hooked || hd == NULL || (hot_only && !hooks[i].is_hot))
+				continue;
+			blocks[n] = hd->tramp;
+			sizes[n++] = hd->tramp_size;
+			blocks[n] = hd->hook_data;
+			sizes[n++] = HOOK_DATA_SIZE;
+			blocks[n] = hd->pre_tramp;
+			sizes[n++] = hd->pre_tramp_size;
+		}
+		arena_layout(out, blocks, sizes, n);
+	}
+
+	free(blocks);
+	free(sizes);
+}
+
+void report_hook_layout(hook_t *hooks, unsigned int count)
+{
+	arena_layout_t all, hot;
+
+	layout_hooks(&all, hooks, count, 0);
+	layout_hooks(&hot, hooks, count, 1);
+
+	pipe("INFO:Hook layout: %d hooks in %d bytes, %d cache lines, %d pages; "
+		"%d hot hooks in %d cache lines, %d pages; %d bytes reserved",
+		all.blocks / 3, (int)all.bytes, all.lines, all.pages,
+		hot.blocks / 3, hot.lines, hot.pages, (int)g_hook_arena.reserved);
+}
+
 // need to be very careful about what we call in here, as it can be called in the context of any hook
 // including those that hold the loader lock
 
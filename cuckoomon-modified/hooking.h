@@ -18,6 +18,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "ntapi.h"
 #include <Windows.h>
+#include "vclock.h"
 
 enum {
 	UWOP_PUSH_NONVOL = 0,
@@ -62,15 +63,39 @@ typedef struct _hook_info_t {
 	ULONG_PTR frame_pointer;
 	ULONG_PTR main_caller_retaddr;
 	ULONG_PTR parent_caller_retaddr;
+
+	// the path context last logged for this thread, see log_path_context()
+	wchar_t *cwd;
+	unsigned int cwd_length;
+	int redirection_disabled;
 } hook_info_t;
 
+// room for a trampoline while it's being built, the unused part is handed
+// back to the arena afterwards
+#define TRAMP_MAX_SIZE 128
+
+// the indirect jump hook types store the address of the pre-trampoline here
+#define HOOK_DATA_SIZE 16
+
+// the code of a hook lives in the executable arena (see arena.h), laid out
+// as trampoline, hook data and pre-trampoline right after each other; this
+// bookkeeping lives in the heap
 typedef struct _hook_data_t {
-	unsigned char tramp[128];
-	unsigned char pre_tramp[148];
-	//unsigned char our_handler[128];
-	unsigned char hook_data[32];
+	// the hooked function, everything below has to be within its reach
+	unsigned char *func;
+
+	unsigned char *tramp;
+	unsigned int tramp_size;
+
+	unsigned char *hook_data;
 
-	UNWIND_INFO unwind_info;
+	// on x64 the unwind information follows the code
+	unsigned char *pre_tramp;
+	unsigned int pre_tramp_size;
+
+#ifdef _WIN64
+	RUNTIME_FUNCTION functable;
+#endif
 } hook_data_t;
 
 typedef struct _addr_map_t {
@@ -100,6 +125,10 @@ typedef struct _hook_t {
     int is_hooked;
 
 	hook_data_t *hookdata;
+
+	// called often enough to deserve cache line aligned trampolines, which
+	// are placed before all others
+	int is_hot;
 } hook_t;
 
 typedef struct _lasterror_t {
@@ -108,9 +137,17 @@ typedef struct _lasterror_t {
 } lasterror_t;
 
 int lde(void *addr);
-void init_capstone(void);
-
-hook_data_t *alloc_hookdata_near(void *addr);
+// lde() and hook_api() may only be used in between these
+void capstone_acquire(void);
+void capstone_release(void);
+
+void *alloc_hook_memory(void *near, size_t size, size_t align);
+void free_hook_memory(void *ptr, size_t size);
+hook_data_t *alloc_hookdata_near(void *addr, int hot);
+int finish_tramp(hook_data_t *hookdata, unsigned int tramp_size);
+unsigned char *alloc_pre_tramp(hook_data_t *hookdata, unsigned int size);
+void free_hookdata(hook_data_t *hookdata);
+void report_hook_layout(hook_t *hooks, unsigned int count);
 
 int hook_api(hook_t *h, int type);
 
@@ -125,7 +162,8 @@ int WINAPI enter_hook(uint8_t is_special_hook, ULONG_PTR _ebp, ULONG_PTR retaddr
 void emit_rel(unsigned char *buf, unsigned char *source, unsigned char *target);
 int operate_on_backtrace(ULONG_PTR retaddr, ULONG_PTR _ebp, int(*func)(ULONG_PTR));
 
-extern LARGE_INTEGER time_skipped;
+// the time skipped by the sleep hooks
+extern vclock_t g_vclock;
 
 #define HOOK_BACKTRACE_DEPTH 40
 
@@ -154,7 +192,8 @@ enum {
 #else
 enum {
 	HOOK_NATIVE_JMP_INDIRECT,
-	HOOK_JMP_INDIRECT
+	HOOK_JMP_INDIRECT,
+	HOOK_JMP_DIRECT
 };
 #endif
 
@@ -28,6 +28,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "unhook.h"
 #include "misc.h"
 #include "pipe.h"
+#include "compat.h"
 
 extern DWORD g_tls_hook_index;
 
@@ -35,10 +36,28 @@ extern DWORD g_tls_hook_index;
 #define TLS_LAST_ERROR 0x34
 
 static csh capstone;
+static unsigned int capstone_users;
+static spinlock_t capstone_lock;
 
-void init_capstone(void)
+// capstone is only needed while hooks are being placed, i.e., in DllMain and
+// when a DLL we hook gets loaded later on, so the handle is opened for that
+// and closed again afterwards
+void capstone_acquire(void)
 {
-	cs_open(CS_ARCH_X86, CS_MODE_32, &capstone);
+	spin_lock(&capstone_lock);
+	if (capstone_users++ == 0) {
+		if (cs_open(CS_ARCH_X86, CS_MODE_32, &capstone) != CS_ERR_OK)
+			capstone = 0;
+	}
+	spin_unlock(&capstone_lock);
+}
+
+void capstone_release(void)
+{
+	spin_lock(&capstone_lock);
+	if (--capstone_users == 0 && capstone != 0)
+		cs_close(&capstone);
+	spin_unlock(&capstone_lock);
 }
 
 // length disassembler engine
@@ -195,7 +214,7 @@ static int hook_create_trampoline(unsigned char *addr, int len,
 // engine "once inside a hook, don't hook further API calls" by setting the
 // allow_hook_recursion flag to false. The example above is what happens when
 // the hook recursion is not allowed.
-static void hook_create_pre_tramp(hook_t *h)
+static int hook_create_pre_tramp(hook_t *h)
 {
 	unsigned char *p;
 	unsigned int off;
@@ -242,7 +261,10 @@ static void hook_create_pre_tramp(hook_t *h)
 	emit_rel(pre_tramp1 + 1, h->pre_tramp + 1, h->tramp);
 #endif
 
-	p = h->hookdata->pre_tramp;
+	p = alloc_pre_tramp(h->hookdata, sizeof(pre_tramp1) + sizeof(pre_tramp2) + sizeof(pre_tramp3));
+	if (p == NULL)
+		return -1;
+
 	off = sizeof(pre_tramp1) - sizeof(unsigned int);
 	emit_rel(pre_tramp1 + off, p + off, (unsigned char *)&enter_hook);
 	memcpy(p, pre_tramp1, sizeof(pre_tramp1));
@@ -256,6 +278,7 @@ static void hook_create_pre_tramp(hook_t *h)
 	off = sizeof(pre_tramp3) - sizeof(unsigned int);
 	emit_rel(pre_tramp3 + off, p + off, h->new_func);
 	memcpy(p, pre_tramp3, sizeof(pre_tramp3));
+	return 0;
 }
 
 static int hook_api_jmp_direct(hook_t *h, unsigned char *from,
@@ -449,16 +472,6 @@ static int hook_api_native_jmp_indirect(hook_t *h, unsigned char *from,
 	return hook_api_jmp_indirect(h, from, to);
 }
 
-hook_data_t *alloc_hookdata_near(void *addr)
-{
-	DWORD oldprot;
-	hook_data_t *ret = calloc(1, sizeof(hook_data_t));
-
-	VirtualProtect(ret, sizeof(hook_data_t), PAGE_EXECUTE_READWRITE, &oldprot);
-
-	return ret;
-}
-
 int hook_api(hook_t *h, int type)
 {
     // table with all possible hooking types
@@ -565,15 +578,17 @@ int hook_api(hook_t *h, int type)
 	if (VirtualProtect(addr, hook_types[type].len, PAGE_EXECUTE_READWRITE,
 		&old_protect)) {
 
-		h->hookdata = alloc_hookdata_near(addr);
+		int tramp_size = 0;
 
-		if (h->hookdata && hook_create_trampoline(addr, hook_types[type].len, h->hookdata->tramp)) {
+		h->hookdata = alloc_hookdata_near(addr, h->is_hot);
+		if (h->hookdata)
+			tramp_size = hook_create_trampoline(addr, hook_types[type].len, h->hookdata->tramp);
+
+		if (tramp_size && !finish_tramp(h->hookdata, tramp_size) && !hook_create_pre_tramp(h)) {
 			//hook_store_exception_info(h);
 			uint8_t orig[16];
 			memcpy(orig, addr, 16);
 
-			hook_create_pre_tramp(h);
-
 			// insert the hook (jump from the api to the
 			// pre-trampoline)
 			ret = hook_types[type].hook(h, addr, h->hookdata->pre_tramp);
@@ -592,6 +607,10 @@ int hook_api(hook_t *h, int type)
 			}
 		}
 		else {
+			if (h->hookdata) {
+				free_hookdata(h->hookdata);
+				h->hookdata = NULL;
+			}
 			pipe("WARNING:Unable to place hook on %z", h->funcname);
 		}
 
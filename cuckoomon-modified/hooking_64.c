@@ -27,6 +27,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "unhook.h"
 #include "misc.h"
 #include "pipe.h"
+#include "compat.h"
 
 extern DWORD g_tls_hook_index;
 
@@ -34,11 +35,30 @@ extern DWORD g_tls_hook_index;
 #define TLS_LAST_ERROR 0x34
 
 static csh capstone;
+static unsigned int capstone_users;
+static spinlock_t capstone_lock;
 
-void init_capstone(void)
+// capstone is only needed while hooks are being placed, i.e., in DllMain and
+// when a DLL we hook gets loaded later on, so the handle is opened for that
+// and closed again afterwards
+void capstone_acquire(void)
 {
-	cs_open(CS_ARCH_X86, CS_MODE_64, &capstone);
-	cs_option(capstone, CS_OPT_DETAIL, CS_OPT_ON);
+	spin_lock(&capstone_lock);
+	if (capstone_users++ == 0) {
+		if (cs_open(CS_ARCH_X86, CS_MODE_64, &capstone) != CS_ERR_OK)
+			capstone = 0;
+		else
+			cs_option(capstone, CS_OPT_DETAIL, CS_OPT_ON);
+	}
+	spin_unlock(&capstone_lock);
+}
+
+void capstone_release(void)
+{
+	spin_lock(&capstone_lock);
+	if (--capstone_users == 0 && capstone != 0)
+		cs_close(&capstone);
+	spin_unlock(&capstone_lock);
 }
 
 int lde(void *addr)
@@ -285,10 +305,10 @@ error:
 // engine "once inside a hook, don't hook further API calls" by setting the
 // allow_hook_recursion flag to false. The example above is what happens when
 // the hook recursion is not allowed.
-static void hook_create_pre_tramp(hook_t *h)
+static int hook_create_pre_tramp(hook_t *h)
 {
 	unsigned char *p;
-	unsigned int off;
+	unsigned int off, code_size, unwind_off;
 
 	unsigned char pre_tramp1[] = {
 #if DISABLE_HOOK_CONTENT
@@ -351,7 +371,14 @@ static void hook_create_pre_tramp(hook_t *h)
 	*(ULONG_PTR *)(pre_tramp1 + 6) = (ULONG_PTR)h->tramp;
 #endif
 
-	p = h->hookdata->pre_tramp;
+	// the unwind information lives right behind the code
+	code_size = sizeof(pre_tramp1) + sizeof(pre_tramp2) + sizeof(pre_tramp3);
+	unwind_off = (code_size + 3) & ~3;
+
+	p = alloc_pre_tramp(h->hookdata, unwind_off + sizeof(UNWIND_INFO));
+	if (p == NULL)
+		return -1;
+
 	off = sizeof(pre_tramp1) - sizeof(ULONG_PTR);
 	*(ULONG_PTR *)(pre_tramp1 + off) = (ULONG_PTR)&enter_hook;
 	memcpy(p, pre_tramp1, sizeof(pre_tramp1));
@@ -376,12 +403,12 @@ static void hook_create_pre_tramp(hook_t *h)
 	   times with the same pointer value, you'll end up with completely broken unwind information that fails
 	   in spectacular ways.
 	 */
-	RUNTIME_FUNCTION *functable = malloc(sizeof(RUNTIME_FUNCTION));
-	UNWIND_INFO *unwindinfo = &h->hookdata->unwind_info;
+	RUNTIME_FUNCTION *functable = &h->hookdata->functable;
+	UNWIND_INFO *unwindinfo = (UNWIND_INFO *)(h->hookdata->pre_tramp + unwind_off);
 
-	functable->BeginAddress = offsetof(hook_data_t, pre_tramp);
-	functable->EndAddress = offsetof(hook_data_t, pre_tramp) + sizeof(h->hookdata->pre_tramp);
-	functable->UnwindData = offsetof(hook_data_t, unwind_info);
+	functable->BeginAddress = 0;
+	functable->EndAddress = code_size;
+	functable->UnwindData = unwind_off;
 
 	unwindinfo->Version = 1;
 	unwindinfo->Flags = UNW_FLAG_NHANDLER;
@@ -409,7 +436,8 @@ static void hook_create_pre_tramp(hook_t *h)
 		unwindinfo->UnwindCode[5 + i].OpInfo = regs2[i];
 	}
 
-	RtlAddFunctionTable(functable, 1, (DWORD64)h->hookdata);
+	RtlAddFunctionTable(functable, 1, (DWORD64)h->hookdata->pre_tramp);
+	return 0;
 }
 
 static int hook_api_jmp_indirect(hook_t *h, unsigned char *from,
@@ -426,6 +454,15 @@ static int hook_api_jmp_indirect(hook_t *h, unsigned char *from,
 	return 0;
 }
 
+static int hook_api_jmp_direct(hook_t *h, unsigned char *from,
+	unsigned char *to)
+{
+	// jmp rel32, the pre-trampoline is allocated within 2GB of the function
+	*from++ = 0xe9;
+	emit_rel(from, from, to);
+	return 0;
+}
+
 static int hook_api_native_jmp_indirect(hook_t *h, unsigned char *from,
 	unsigned char *to)
 {
@@ -435,26 +472,6 @@ static int hook_api_native_jmp_indirect(hook_t *h, unsigned char *from,
 	return hook_api_jmp_indirect(h, from, to);
 }
 
-hook_data_t *alloc_hookdata_near(void *addr)
-{
-	PVOID BaseAddress;
-	int offset = -(1024 * 1024 * 1024);
-	SIZE_T RegionSize = sizeof(hook_data_t);
-	LONG status;
-
-	do {
-		if (offset < 0 && (ULONG_PTR)addr < (ULONG_PTR)-offset)
-			offset = 0x10000;
-		BaseAddress = (PCHAR)addr + offset;
-		status = pNtAllocateVirtualMemory(GetCurrentProcess(), &BaseAddress, 0, &RegionSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
-		if (status >= 0)
-			return (hook_data_t *)BaseAddress;
-		offset += 0x10000;
-	} while (status < 0 && offset <= (1024 * 1024 * 1024));
-
-	return NULL;
-}
-
 int hook_api(hook_t *h, int type)
 {
 	// table with all possible hooking types
@@ -464,6 +481,7 @@ int hook_api(hook_t *h, int type)
 	} hook_types[] = {
 		/* HOOK_NATIVE_JMP_INDIRECT */{ &hook_api_native_jmp_indirect, 14 },
 		/* HOOK_JMP_INDIRECT */{ &hook_api_jmp_indirect, 6 },
+		/* HOOK_JMP_DIRECT */{ &hook_api_jmp_direct, 5 },
 	};
 
 	// is this address already hooked?
@@ -527,15 +545,17 @@ int hook_api(hook_t *h, int type)
 	if (VirtualProtect(addr, hook_types[type].len, PAGE_EXECUTE_READWRITE,
 		&old_protect)) {
 
-		h->hookdata = alloc_hookdata_near(addr);
+		int tramp_size = 0;
+
+		h->hookdata = alloc_hookdata_near(addr, h->is_hot);
+		if (h->hookdata)
+			tramp_size = hook_create_trampoline(addr, hook_types[type].len, h->hookdata->tramp);
 
-		if (h->hookdata && hook_create_trampoline(addr, hook_types[type].len, h->hookdata->tramp)) {
+		if (tramp_size && !finish_tramp(h->hookdata, tramp_size) && !hook_create_pre_tramp(h)) {
 			//hook_store_exception_info(h);
 			uint8_t orig[16];
 			memcpy(orig, addr, 16);
 
-			hook_create_pre_tramp(h);
-
 			// insert the hook (jump from the api to the
 			// pre-trampoline)
 			ret = hook_types[type].hook(h, addr, h->hookdata->pre_tramp);
@@ -554,6 +574,10 @@ int hook_api(hook_t *h, int type)
 			}
 		}
 		else {
+			if (h->hookdata) {
+				free_hookdata(h->hookdata);
+				h->hookdata = NULL;
+			}
 			pipe("WARNING:Unable to place hook on %z", h->funcname);
 		}
 
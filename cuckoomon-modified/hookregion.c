@@ -0,0 +1,258 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compat.h"
+#include "hookregion.h"
+
+int region_init(region_table_t *t, uint32_t capacity, uint32_t pool_size,
+	uint32_t names_size, unsigned int min_interval, unsigned int max_interval)
+{
+	memset(t, 0, sizeof(*t));
+
+	t->addr = (uint8_t **)calloc(capacity, sizeof(uint8_t *));
+	t->length = (uint16_t *)calloc(capacity, sizeof(uint16_t));
+	t->offset = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+	t->name = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+	t->reported = (uint8_t *)calloc(capacity, sizeof(uint8_t));
+	t->sorted = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+	t->orig = (uint8_t *)malloc(pool_size);
+	t->our = (uint8_t *)malloc(pool_size);
+	t->names = (char *)calloc(names_size, 1);
+
+	if (t->addr == NULL || t->length == NULL || t->offset == NULL ||
+			t->name == NULL || t->reported == NULL || t->sorted == NULL || t->orig == NULL ||
+			t->our == NULL || t->names == NULL || names_size == 0 ||
+			pagescan_init(&t->scan, capacity, min_interval, max_interval) < 0) {
+		region_free(t);
+		return -1;
+	}
+
+	t->capacity = capacity;
+	t->pool_size = pool_size;
+	t->names_size = names_size;
+	t->names_used = 1;
+	return 0;
+}
+
+void region_free(region_table_t *t)
+{
+	free(t->addr);
+	free(t->length);
+	free(t->offset);
+	free(t->name);
+	free(t->reported);
+	free(t->sorted);
+	free(t->orig);
+	free(t->our);
+	free(t->names);
+	pagescan_free(&t->scan);
+	memset(t, 0, sizeof(*t));
+}
+
+static int intern_name(region_table_t *t, const char *funcname)
+{
+	uint32_t length, off;
+
+	if (funcname == NULL || *funcname == 0)
+		return 0;
+
+	// most of the time it's the name of the region added last
+	if (t->count != 0 && !strcmp(t->names + t->name[t->count - 1], funcname))
+		return (int)t->name[t->count - 1];
+
+	for (off = 1; off < t->names_used; off += (uint32_t)strlen(t->names + off) + 1) {
+		if (!strcmp(t->names + off, funcname))
+			return (int)off;
+	}
+
+	length = (uint32_t)strlen(funcname) + 1;
+	if (t->names_used + length > t->names_size)
+		return -1;
+
+	off = t->names_used;
+	memcpy(t->names + off, funcname, length);
+	t->names_used += length;
+	return (int)off;
+}
+
+// first position in the sorted index with an address of at least addr
+static uint32_t lower_bound(region_table_t *t, uintptr_t addr)
+{
+	uint32_t lo = 0, hi = t->sorted_count;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if ((uintptr_t)t->addr[t->sorted[mid]] < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void index_region(region_table_t *t, uint32_t idx)
+{
+	uint32_t pos;
+
+	write_lock(&t->sorted_lock);
+	pos = lower_bound(t, (uintptr_t)t->addr[idx]);
+	memmove(&t->sorted[pos + 1], &t->sorted[pos],
+		(t->sorted_count - pos) * sizeof(uint32_t));
+	t->sorted[pos] = idx;
+	t->sorted_count++;
+	write_unlock(&t->sorted_lock);
+}
+
+// returns the index of the new region, or -1 if the table is full
+int region_add(region_table_t *t, const char *funcname, uint8_t *addr,
+	const uint8_t *orig, const uint8_t *our, uint32_t length)
+{
+	uint32_t idx = t->count;
+	int name;
+
+	length = MIN(length, REGION_MAX_LENGTH);
+
+	if (idx == t->capacity || length == 0 ||
+			t->pool_used + length > t->pool_size)
+		return -1;
+
+	name = intern_name(t, funcname);
+	if (name < 0)
+		return -1;
+
+	t->addr[idx] = addr;
+	t->length[idx] = (uint16_t)length;
+	t->offset[idx] = t->pool_used;
+	t->name[idx] = (uint32_t)name;
+	t->reported[idx] = 0;
+	memcpy(t->orig + t->pool_used, orig, length);
+	memcpy(t->our + t->pool_used, our, length);
+	t->pool_used += length;
+
+	// the scanner expects our contents to be in place already
+	pagescan_add(&t->scan, idx, addr, length);
+
+	// stubs we merely watch have nothing to restore
+	if (memcmp(orig, our, length))
+		index_region(t, idx);
+
+	memory_barrier();
+	t->count++;
+	return (int)idx;
+}
+
+// reports a region which is no longer what we made it, once
+void region_check(region_table_t *t, uint32_t idx, region_report_t report,
+	void *ctx)
+{
+	const uint8_t *addr = t->addr[idx];
+	uint32_t length = t->length[idx];
+
+	// Check whether this memory region still equals what we made it.
+	if (!memcmp(addr, region_our(t, idx), length))
+		return;
+
+	if (t->reported[idx] == 0) {
+		// If the memory region matches the original contents, then it
+		// has been restored to its original state.
+		if (!memcmp(addr, region_orig(t, idx), length))
+			report(ctx, idx, REGION_REMOVED);
+		else
+			report(ctx, idx, REGION_MODIFIED);
+		t->reported[idx] = 1;
+	}
+}
+
+typedef struct _scan_ctx_t {
+	region_table_t *t;
+	region_report_t report;
+	void *ctx;
+} scan_ctx_t;
+
+static void scan_changed(void *ctx, uint32_t idx)
+{
+	scan_ctx_t *c = (scan_ctx_t *)ctx;
+
+	// the scanner may see a region before the table does
+	if (idx < c->t->count)
+		region_check(c->t, idx, c->report, c->ctx);
+}
+
+unsigned int region_scan(region_table_t *t, region_report_t report, void *ctx)
+{
+	scan_ctx_t c;
+
+	c.t = t;
+	c.report = report;
+	c.ctx = ctx;
+	return pagescan_scan(&t->scan, &scan_changed, &c);
+}
+
+// the sorted position to start looking for regions at or after start
+uint32_t region_range_begin(region_table_t *t, uintptr_t start)
+{
+	uint32_t pos;
+
+	read_lock(&t->sorted_lock);
+	pos = lower_bound(t, start);
+	read_unlock(&t->sorted_lock);
+	return pos;
+}
+
+// stores up to max restorable regions from sorted position *pos on which
+// lie entirely within [.., end) in out, ordered by address, and moves *pos
+// past the ones looked at; to get the next batch call again with the same
+// *pos.  Regions added meanwhile only move the rest further up, so one may
+// come up twice but none is skipped.  The memory of the regions isn't
+// touched, so this can't fault
+unsigned int region_find_range(region_table_t *t, uint32_t *pos,
+	uintptr_t end, uint32_t *out, unsigned int max)
+{
+	unsigned int ret = 0;
+	uint32_t p = *pos;
+
+	read_lock(&t->sorted_lock);
+
+	for (; p < t->sorted_count && ret < max; p++) {
+		uint32_t idx = t->sorted[p];
+		uintptr_t addr = (uintptr_t)t->addr[idx];
+
+		if (addr >= end)
+			break;
+		if (addr + t->length[idx] <= end)
+			out[ret++] = idx;
+	}
+
+	read_unlock(&t->sorted_lock);
+	*pos = p;
+	return ret;
+}
+
+// puts our contents back if the region has been restored to its original
+// contents, returns 1 if it was
+int region_restore(region_table_t *t, uint32_t idx)
+{
+	uint8_t *addr = t->addr[idx];
+	uint32_t length = t->length[idx];
+
+	if (memcmp(region_orig(t, idx), addr, length))
+		return 0;
+
+	memcpy(addr, region_our(t, idx), length);
+	return 1;
+}
@@ -0,0 +1,113 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Hook Region API
+//
+// The memory regions covered by our hooks (and the stubs leading to them),
+// together with their original contents and the contents after hooking.
+// The unhook detection compares the regions against our contents, and
+// restore_hooks_on_range() puts our contents back when somebody restored
+// the original ones.
+//
+// Regions we can restore are also kept in an index sorted by address, so
+// the protection changes that have nothing to do with our hooks (i.e.,
+// nearly all of them) are dismissed with a binary search.
+//
+// The table is a structure of arrays; the original and our bytes live back
+// to back in two byte pools (typically 16 bytes per region), and function
+// names are interned as most hooks add several regions.
+//
+
+#ifndef __HOOKREGION_H
+#define __HOOKREGION_H
+
+#include "compat.h"
+#include "pagescan.h"
+
+#define REGION_MAX_LENGTH 256
+
+// what happened to a region, passed to the report callback
+enum {
+	REGION_MODIFIED,
+	REGION_REMOVED,
+};
+
+typedef void (*region_report_t)(void *ctx, uint32_t idx, int what);
+
+typedef struct _region_table_t {
+	uint32_t capacity;
+	volatile uint32_t count;
+
+	// per region
+	uint8_t **addr;
+	uint16_t *length;
+	uint32_t *offset;
+	uint32_t *name;
+	uint8_t *reported;
+
+	// contents before and after hooking, at the same offset
+	uint8_t *orig;
+	uint8_t *our;
+	uint32_t pool_size;
+	uint32_t pool_used;
+
+	// NUL separated function names, the first one is empty
+	char *names;
+	uint32_t names_size;
+	uint32_t names_used;
+
+	// restorable regions sorted by address
+	uint32_t *sorted;
+	uint32_t sorted_count;
+	rwlock_t sorted_lock;
+
+	pagescan_t scan;
+} region_table_t;
+
+int region_init(region_table_t *t, uint32_t capacity, uint32_t pool_size,
+	uint32_t names_size, unsigned int min_interval, unsigned int max_interval);
+void region_free(region_table_t *t);
+
+int region_add(region_table_t *t, const char *funcname, uint8_t *addr,
+	const uint8_t *orig, const uint8_t *our, uint32_t length);
+
+unsigned int region_scan(region_table_t *t, region_report_t report, void *ctx);
+void region_check(region_table_t *t, uint32_t idx, region_report_t report,
+	void *ctx);
+uint32_t region_range_begin(region_table_t *t, uintptr_t start);
+unsigned int region_find_range(region_table_t *t, uint32_t *pos,
+	uintptr_t end, uint32_t *out, unsigned int max);
+int region_restore(region_table_t *t, uint32_t idx);
+
+static __inline const char *region_name(region_table_t *t, uint32_t idx)
+{
+	return t->names + t->name[idx];
+}
+
+static __inline const uint8_t *region_orig(region_table_t *t, uint32_t idx)
+{
+	return t->orig + t->offset[idx];
+}
+
+static __inline const uint8_t *region_our(region_table_t *t, uint32_t idx)
+{
+	return t->our + t->offset[idx];
+}
+
+#endif
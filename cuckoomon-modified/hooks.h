@@ -1617,6 +1617,37 @@ extern HOOKDEF(void, WINAPI, GetSystemTimeAsFileTime,
 	_Out_ LPFILETIME lpSystemTimeAsFileTime
 );
 
+extern HOOKDEF(BOOL, WINAPI, QueryPerformanceCounter,
+	_Out_ LARGE_INTEGER *lpPerformanceCount
+);
+
+extern HOOKDEF(ULONGLONG, WINAPI, GetTickCount64,
+	void
+);
+
+extern HOOKDEF(NTSTATUS, WINAPI, NtQueryPerformanceCounter,
+	_Out_ PLARGE_INTEGER PerformanceCounter,
+	_Out_opt_ PLARGE_INTEGER PerformanceFrequency
+);
+
+extern HOOKDEF(BOOLEAN, WINAPI, RtlQueryPerformanceCounter,
+	_Out_ PLARGE_INTEGER PerformanceCounter
+);
+
+extern HOOKDEF(NTSTATUS, WINAPI, NtWaitForSingleObject,
+	__in HANDLE Handle,
+	__in BOOLEAN Alertable,
+	__in_opt PLARGE_INTEGER Timeout
+);
+
+extern HOOKDEF(NTSTATUS, WINAPI, NtWaitForMultipleObjects,
+	__in ULONG Count,
+	__in PHANDLE Handles,
+	__in ULONG WaitType,
+	__in BOOLEAN Alertable,
+	__in_opt PLARGE_INTEGER Timeout
+);
+
 //
 // Socket Hooks
 //
@@ -21,29 +21,36 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "ignore.h"
 #include "misc.h"
 #include "pipe.h"
+#include "pidset.h"
+#include "pathtrie.h"
 
 //
 // Protected Processes
 //
 
-static DWORD g_pids[MAX_PROTECTED_PIDS];
-static DWORD g_pid_count;
+static pidset_t g_protected_pids;
 
 void add_protected_pid(DWORD pid)
 {
-    g_pids[g_pid_count++] = pid;
+	if (pidset_add(&g_protected_pids, pid) < 0)
+		pipe("WARNING:Unable to protect pid %d", pid);
+}
+
+void remove_protected_pid(DWORD pid)
+{
+	pidset_remove(&g_protected_pids, pid);
 }
 
 int is_protected_pid(DWORD pid)
 {
-	DWORD i;
+	return pidset_contains(&g_protected_pids, pid);
+}
 
-    for (i = 0; i < g_pid_count; i++) {
-        if(pid == g_pids[i]) {
-            return 1;
-        }
-    }
-    return 0;
+// pid-protect and pid-unprotect commands from the analyzer, returns 0 if
+// cmd is not one of those
+int protected_pid_command(const char *cmd, unsigned int length)
+{
+	return pidset_command(&g_protected_pids, cmd, length);
 }
 
 //
@@ -68,9 +75,66 @@ static struct _ignored_file_t {
     S("\\Device\\", FLAG_BEGINS_WITH),
 };
 
+// the built-in list plus the one handed to us by the host
+static pathtrie_t g_ignored_file_trie;
+static int g_ignored_file_trie_ready;
+
+static int load_ignore_list(const char *listfile)
+{
+	HANDLE file;
+	DWORD size, read;
+	char *list;
+	int ret = -1;
+
+	file = CreateFileA(listfile, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return -1;
+
+	size = GetFileSize(file, NULL);
+	list = malloc(size + 1);
+	if (size != INVALID_FILE_SIZE && list != NULL &&
+			ReadFile(file, list, size, &read, NULL) && read == size)
+		ret = pathtrie_load(&g_ignored_file_trie, list, size);
+
+	free(list);
+	CloseHandle(file);
+	return ret;
+}
+
+int ignore_init(const char *listfile)
+{
+	if (pathtrie_init(&g_ignored_file_trie) < 0)
+		return -1;
+
+	for (unsigned int i = 0; i < ARRAYSIZE(g_ignored_files); i++) {
+		struct _ignored_file_t *f = &g_ignored_files[i];
+		if (pathtrie_add(&g_ignored_file_trie, f->unicode, f->length,
+				f->flags == FLAG_BEGINS_WITH ? PATHTRIE_BEGINS_WITH : PATHTRIE_EXACT) < 0) {
+			pathtrie_free(&g_ignored_file_trie);
+			return -1;
+		}
+	}
+
+	// don't go live with half a list, fall back to the built-in one instead
+	if (listfile != NULL && *listfile != 0 && load_ignore_list(listfile) < 0) {
+		pipe("WARNING:Unable to load the list of ignored files %z", listfile);
+		pathtrie_free(&g_ignored_file_trie);
+		return 0;
+	}
+
+	g_ignored_file_trie_ready = 1;
+	return 0;
+}
+
 int is_ignored_file_unicode(const wchar_t *fname, unsigned int length)
 {
     struct _ignored_file_t *f = g_ignored_files;
+
+	if (g_ignored_file_trie_ready)
+		return pathtrie_match(&g_ignored_file_trie, fname, length);
+
+	// only the built-in list without the trie
     for (unsigned int i = 0; i < ARRAYSIZE(g_ignored_files); i++, f++) {
         if(f->flags == FLAG_NONE && length == f->length &&
                 !wcsnicmp(fname, f->unicode, length)) {
@@ -16,12 +16,17 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+// the amount of pids the analyzer hands out on GETPIDS
 #define MAX_PROTECTED_PIDS 32
 
 #include "ntapi.h"
 
 void add_protected_pid(DWORD pid);
+void remove_protected_pid(DWORD pid);
 int is_protected_pid(DWORD pid);
+int protected_pid_command(const char *cmd, unsigned int length);
+
+int ignore_init(const char *listfile);
 
 int is_ignored_file_ascii(const char *fname, unsigned int length);
 int is_ignored_file_unicode(const wchar_t *fname, unsigned int length);
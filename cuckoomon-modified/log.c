@@ -27,11 +27,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "bson.h"
 #include "pipe.h"
 #include "config.h"
+#include "hookctl.h"
+#include "ignore.h"
+#include "specialname.h"
+#include "payload.h"
+#include "logenc.h"
 
 // the size of the logging buffer
 #define BUFFERSIZE 16 * 1024 * 1024
-#define BUFFER_LOG_MAX 256
-#define LARGE_BUFFER_LOG_MAX 64 * 1024
 #define BUFFER_REGVAL_MAX 512
 
 static CRITICAL_SECTION g_mutex;
@@ -44,16 +47,24 @@ static volatile int g_idx;
 
 // current to-be-logged API call
 static bson g_bson[1];
+static logenc_t g_enc;
 static char g_istr[4];
 
 static char logtbl_explained[256] = {0};
 
+// hook control slot + 1 for each index, 0 if the index has no slot
+static unsigned short logtbl_slot[256];
+
 #define LOG_ID_PROCESS 0
 #define LOG_ID_THREAD 1
 #define LOG_ID_ANOMALY 2
 #define LOG_ID_ANOMALY_EXTRA 3
+#define LOG_ID_HOOK_STATS 4
+#define LOG_ID_PATH_MAP 5
+#define LOG_ID_PATH_CONTEXT 6
+#define LOG_ID_FIRST_API 10
 
-int g_log_index = 10;  // index must start after the special IDs (see defines)
+int g_log_index = LOG_ID_FIRST_API;  // index must start after the special IDs (see defines)
 
 //
 // Log API
@@ -61,32 +72,64 @@ int g_log_index = 10;  // index must start after the special IDs (see defines)
 
 static HANDLE g_log_thread_handle;
 static HANDLE g_logwatcher_thread_handle;
+static HANDLE g_log_command_thread_handle;
 static HANDLE g_log_flush;
 
-// snprintf can end up acquiring the process' heap lock which will be unsafe in the context of a hooked
-// NtAllocate/FreeVirtualMemory
-static void num_to_string(char *buf, unsigned int buflen, unsigned int num)
-{
-	unsigned int dec = 1000000000;
-	unsigned int i = 0;
+// with payload-stream everything goes out in frames (see payload.h), the
+// events in pieces of at most LOG_EVENTS_CHUNK and the payloads in
+// batches of at most LOG_PAYLOAD_BATCH
+#define LOG_EVENTS_CHUNK (64 * 1024)
+#define LOG_PAYLOAD_BATCH (64 * 1024)
+#define LOG_PAYLOAD_QUEUE (4 * 1024 * 1024)
 
-	if (!buflen)
-		return;
+static int g_mux;
+static payload_t *g_payload;
+static uint8_t *g_payload_batch;
 
-	while (dec) {
-		if (!i && ((num / dec) || dec == 1))
-			buf[i++] = '0' + (num / dec);
-		else if (i)
-			buf[i++] = '0' + (num / dec);
-		if (i == buflen - 1)
-			break;
-		num = num % dec;
-		dec /= 10;
+extern int process_shutting_down;
+
+static int send_all(const char *buf, int length)
+{
+	while (length > 0) {
+		int written = send(g_sock, buf, length, 0);
+		if (written <= 0)
+			return -1;
+		buf += written;
+		length -= written;
 	}
-	buf[i] = '\0';
+	return 0;
 }
 
-extern int process_shutting_down;
+// sends the next piece of the event stream as a frame, returns the amount
+// of event bytes consumed
+static int send_events_frame(void)
+{
+	uint8_t header[PAYLOAD_HEADER_SIZE];
+	int length = min(g_idx, LOG_EVENTS_CHUNK);
+
+	payload_events_header(header, length);
+	if (send_all((const char *)header, sizeof(header)) < 0 ||
+			send_all(g_buffer, length) < 0)
+		return -1;
+	return length;
+}
+
+// sends one batch of payload frames, returns 0 once there's nothing left
+static int send_payloads(void)
+{
+	uint32_t length;
+
+	if (g_sock == INVALID_SOCKET)
+		return 0;
+
+	length = payload_take(g_payload, g_payload_batch, LOG_PAYLOAD_BATCH);
+	if (length == 0)
+		return 0;
+
+	// the frames are lost either way, there's no point in retrying
+	send_all((const char *)g_payload_batch, length);
+	return 1;
+}
 
 static DWORD WINAPI _log_thread(LPVOID param)
 {
@@ -102,7 +145,7 @@ static DWORD WINAPI _log_thread(LPVOID param)
 				char filename[64];
 				char pid[8];
 				strcpy(filename, "c:\\debug");
-				num_to_string(pid, sizeof(pid), GetCurrentProcessId());
+				logenc_num(pid, sizeof(pid), GetCurrentProcessId());
 				strcat(filename, pid);
 				strcat(filename, ".log");
 				// will happen when we're in debug mode
@@ -120,6 +163,12 @@ static DWORD WINAPI _log_thread(LPVOID param)
 				g_idx = 0;
 				continue;
 			}
+			else if (g_mux) {
+				written = send_events_frame();
+				// a partial frame leaves the stream unusable anyway
+				if (written < 0)
+					written = g_idx;
+			}
 			else {
 				written = send(g_sock, g_buffer, g_idx, 0);
 			}
@@ -137,6 +186,12 @@ static DWORD WINAPI _log_thread(LPVOID param)
 			g_idx -= written;
 		}
 		LeaveCriticalSection(&g_writing_log_buffer_mutex);
+
+		// payloads only go out while no events are waiting, a batch at a
+		// time; this thread is the only one sending, so the socket doesn't
+		// need the lock
+		while (g_mux && g_idx == 0 && send_payloads() != 0)
+			;
 	}
 }
 
@@ -164,7 +219,8 @@ void log_flush()
 	*/
 	if (g_dll_main_complete) {
 		SetEvent(g_log_flush);
-		while (g_idx && (g_sock != INVALID_SOCKET || !process_shutting_down)) raw_sleep(50);
+		while ((g_idx || (g_mux && !payload_empty(g_payload))) &&
+			(g_sock != INVALID_SOCKET || !process_shutting_down)) raw_sleep(50);
 	}
 }
 
@@ -215,99 +271,10 @@ static int bson_append_ptr(bson *b, const char *name, ULONG_PTR ptr)
 		return bson_append_int(b, name, (int)ptr);
 }
 
-static void log_int32(int value)
-{
-    bson_append_int( g_bson, g_istr, value );
-}
-
-static void log_int64(int64_t value)
-{
-	bson_append_long(g_bson, g_istr, value);
-}
-
-static void log_ptr(void *value)
-{
-	if (sizeof(ULONG_PTR) == 8)
-		log_int64((int64_t)value);
-	else
-		log_int32((int)value);
-}
-
-static void log_string(const char *str, int length)
-{
-    if (str == NULL) {
-        bson_append_string_n( g_bson, g_istr, "", 0 );
-        return;
-    }
-    int ret;
-    char * utf8s = utf8_string(str, length);
-    int utf8len = * (int *) utf8s;
-    ret = bson_append_binary( g_bson, g_istr, BSON_BIN_BINARY, utf8s+4, utf8len );
-    if (ret == BSON_ERROR) {
-		bson_append_string_n(g_bson, g_istr, "", 0);
-	}
-    free(utf8s);
-}
-
-static void log_wstring(const wchar_t *str, int length)
-{
-    if (str == NULL) {
-        bson_append_string_n( g_bson, g_istr, "", 0 );
-        return;
-    }
-    int ret;
-    char * utf8s = utf8_wstring(str, length);
-    int utf8len = * (int *) utf8s;
-    ret = bson_append_binary( g_bson, g_istr, BSON_BIN_BINARY, utf8s+4, utf8len );
-    if (ret == BSON_ERROR) {
-		bson_append_string_n(g_bson, g_istr, "", 0);
-	}
-    free(utf8s);
-}
-
-static void log_argv(int argc, const char ** argv) {
-    bson_append_start_array( g_bson, g_istr );
-
-    for (int i=0; i<argc; i++) {
-		num_to_string(g_istr, 4, i);
-        log_string(argv[i], -1);
-    }
-    bson_append_finish_array( g_bson );
-}
-
-static void log_wargv(int argc, const wchar_t ** argv) {
-    bson_append_start_array( g_bson, g_istr );
-
-    for (int i=0; i<argc; i++) {
-		num_to_string(g_istr, 4, i);
-		log_wstring(argv[i], -1);
-    }
-
-    bson_append_finish_array( g_bson );
-}
-
-static void log_buffer(const char *buf, size_t length) {
-    size_t trunclength = min(length, BUFFER_LOG_MAX);
-
-    if (buf == NULL) {
-        trunclength = 0;
-    }
-
-    bson_append_binary( g_bson, g_istr, BSON_BIN_BINARY, buf, trunclength );
-}
-
-static void log_large_buffer(const char *buf, size_t length) {
-	size_t trunclength = min(length, LARGE_BUFFER_LOG_MAX);
-
-	if (buf == NULL) {
-		trunclength = 0;
-	}
-
-	bson_append_binary(g_bson, g_istr, BSON_BIN_BINARY, buf, trunclength);
-}
-
 static lastlog_t lastlog;
 
+static void log_path_context(void);
+
 void loq(int index, const char *category, const char *name,
     int is_success, ULONG_PTR return_value, const char *fmt, ...)
 {
@@ -315,15 +282,25 @@ void loq(int index, const char *category, const char *name,
     const char * fmtbak = fmt;
     int argnum = 2;
     int count = 1; char key = 0;
-	unsigned int repeat_offset = 0;
 	unsigned int compare_offset = 0;
+	uint64_t start_cycles;
+	int slot;
 	lasterror_t lasterror;
 
 	if (index >= LOG_ID_ANOMALY && g_config.suspend_logging)
 		return;
 
+	// hooks disabled through the hook control table only get counted
+	slot = (int)logtbl_slot[index] - 1;
+	if (slot >= 0 && !hookctl_is_logging(slot)) {
+		hookctl_account(slot, 0, 0);
+		return;
+	}
+
 	get_lasterrors(&lasterror);
 
+	start_cycles = read_cycles();
+
 	EnterCriticalSection(&g_mutex);
 
 	if(logtbl_explained[index] == 0) {
@@ -331,6 +308,9 @@ void loq(int index, const char *category, const char *name,
         const char * pname;
         bson b[1];
 
+		if (index >= LOG_ID_FIRST_API)
+			logtbl_slot[index] = (unsigned short)(hookctl_bind(name, category) + 1);
+
 		va_start(args, fmt);
 
 		bson_init( b );
@@ -357,11 +337,18 @@ void loq(int index, const char *category, const char *name,
             }
 
             pname = va_arg(args, const char *);
-			num_to_string(g_istr, 4, argnum);
+			logenc_num(g_istr, 4, argnum);
             argnum++;
 
             //on certain formats, we need to tell cuckoo about them for nicer display / matching
-            if (key == 'p' || key == 'P' || key == 'h' || key == 'H') {
+			if ((key == 'F' || key == 'O') && g_config.raw_paths) {
+				// not normalized, see log_path_context()
+				bson_append_start_array( b, g_istr );
+				bson_append_string( b, "0", pname );
+				bson_append_string( b, "1", "path" );
+				bson_append_finish_array( b );
+			}
+            else if (key == 'p' || key == 'P' || key == 'h' || key == 'H') {
 				const char *typestr;
 				if (key == 'h' || key == 'H' || sizeof(ULONG_PTR) != 8)
 					typestr = "h";
@@ -423,6 +410,9 @@ void loq(int index, const char *category, const char *name,
 			else if (key == 'p' || key == 'P') {
 				(void)va_arg(args, void *);
 			}
+			else if (key == 'q') {
+				(void)va_arg(args, uint64_t);
+			}
 			else if (key == 'o') {
                 (void) va_arg(args, UNICODE_STRING *);
             }
@@ -453,13 +443,27 @@ void loq(int index, const char *category, const char *name,
         bson_destroy( b );
         // log_flush();
 		va_end(args);
+
+		slot = (int)logtbl_slot[index] - 1;
+		if (!hookctl_is_logging(slot)) {
+			LeaveCriticalSection(&g_mutex);
+			hookctl_account(slot, 0, 0);
+			set_lasterrors(&lasterror);
+			return;
+		}
 	}
 
+	// the host needs to know what relative paths were relative to, in the
+	// same critical section so nothing gets logged in between
+	if (g_config.raw_paths && index >= LOG_ID_FIRST_API && strpbrk(fmtbak, "FO") != NULL)
+		log_path_context();
+
     fmt = fmtbak;
     va_start(args, fmt);
     count = 1; key = 0; argnum = 2;
 
     bson_init( g_bson );
+	logenc_begin(&g_enc, g_bson, slot);
     bson_append_int( g_bson, "I", index );
 	hook_info_t *hookinfo = hook_info();
 	bson_append_ptr(g_bson, "C", hookinfo->return_address);
@@ -473,8 +477,6 @@ void loq(int index, const char *category, const char *name,
 	bson_append_int(g_bson, "r", 0);
 
 	compare_offset = (unsigned int )(g_bson->cur - bson_data(g_bson));
-	// the repeated value is encoded immediately before the stream we want to compare
-	repeat_offset = compare_offset - 4;
 
 	bson_append_start_array(g_bson, "args");
     bson_append_int( g_bson, "0", is_success );
@@ -496,96 +498,43 @@ void loq(int index, const char *category, const char *name,
         }
         // pop the key and omit it
         (void) va_arg(args, const char *);
-		num_to_string(g_istr, 4, argnum);
+		logenc_key(&g_enc, argnum);
 		argnum++;
 
-        // log the value
-        if(key == 's') {
-            const char *s = va_arg(args, const char *);
-            if(s == NULL) s = "";
-            log_string(s, -1);
-        }
-		else if (key == 'f') {
+        // log the value, the portable specifiers are handled in logenc.c
+		if (logenc_arg(&g_enc, key, &args) == 0)
+			continue;
+
+		if (key == 'f') {
 			const char *s = va_arg(args, const char *);
 			char absolutepath[MAX_PATH];
 			if (s == NULL) s = "";
 			ensure_absolute_ascii_path(absolutepath, s);
 
-			log_string(absolutepath, -1);
+			logenc_string(&g_enc, absolutepath, -1);
 		}
-        else if(key == 'S') {
-            int len = va_arg(args, int);
-            const char *s = va_arg(args, const char *);
-            if(s == NULL) { s = ""; len = 0; }
-            log_string(s, len);
-        }
-        else if(key == 'u') {
-            const wchar_t *s = va_arg(args, const wchar_t *);
-            if(s == NULL) s = L"";
-            log_wstring(s, -1);
-        }
 		else if (key == 'F') {
 			const wchar_t *s = va_arg(args, const wchar_t *);
-			wchar_t *absolutepath = malloc(32768 * sizeof(wchar_t));
+			wchar_t *absolutepath = NULL;
 			if (s == NULL) s = L"";
-			if (absolutepath) {
+			if (g_config.raw_paths)
+				logenc_wstring(&g_enc, s, -1);
+			else if ((absolutepath = malloc(32768 * sizeof(wchar_t))) != NULL) {
 				ensure_absolute_unicode_path(absolutepath, s);
-				log_wstring(absolutepath, -1);
+				logenc_wstring(&g_enc, absolutepath, -1);
 				free(absolutepath);
 			}
 			else {
-				log_wstring(L"", -1);
+				logenc_wstring(&g_enc, L"", -1);
 			}
 		}
-		else if (key == 'U') {
-            int len = va_arg(args, int);
-            const wchar_t *s = va_arg(args, const wchar_t *);
-            if(s == NULL) { s = L""; len = 0; }
-            log_wstring(s, len);
-        }
-        else if(key == 'b') {
-            size_t len = va_arg(args, size_t);
-            const char *s = va_arg(args, const char *);
-            log_buffer(s, len);
-        }
-        else if(key == 'B') {
-            size_t *len = va_arg(args, size_t *);
-            const char *s = va_arg(args, const char *);
-            log_buffer(s, len == NULL ? 0 : *len);
-        }
-		else if (key == 'c') {
-			size_t len = va_arg(args, size_t);
-			const char *s = va_arg(args, const char *);
-			log_large_buffer(s, len);
-		}
-		else if (key == 'C') {
-			size_t *len = va_arg(args, size_t *);
-			const char *s = va_arg(args, const char *);
-			log_large_buffer(s, len == NULL ? 0 : *len);
-		}
-		else if (key == 'i' || key == 'h') {
-			int value = va_arg(args, int);
-            log_int32(value);
-        }
-        else if(key == 'I' || key == 'H') {
-            int *ptr = va_arg(args, int *);
-            log_int32(ptr != NULL ? *ptr : 0);
-        }
-		else if (key == 'l' || key == 'p') {
-			void *value = va_arg(args, void *);
-			log_ptr(value);
-		}
-		else if (key == 'L' || key == 'P') {
-			void **ptr = va_arg(args, void **);
-			log_ptr(ptr != NULL ? *ptr : NULL);
-		}
 		else if (key == 'e') {
 			HKEY reg = va_arg(args, HKEY);
 			const char *s = va_arg(args, const char *);
 			unsigned int allocsize = sizeof(KEY_NAME_INFORMATION) + MAX_KEY_BUFLEN;
 			PKEY_NAME_INFORMATION keybuf = malloc(allocsize);
 
-			log_wstring(get_full_key_pathA(reg, s, keybuf, allocsize), -1);
+			logenc_wstring(&g_enc, get_full_key_pathA(reg, s, keybuf, allocsize), -1);
 			free(keybuf);
 		}
 		else if (key == 'E') {
@@ -594,7 +543,7 @@ void loq(int index, const char *category, const char *name,
 			unsigned int allocsize = sizeof(KEY_NAME_INFORMATION) + MAX_KEY_BUFLEN;
 			PKEY_NAME_INFORMATION keybuf = malloc(allocsize);
 
-			log_wstring(get_full_key_pathW(reg, s, keybuf, allocsize), -1);
+			logenc_wstring(&g_enc, get_full_key_pathW(reg, s, keybuf, allocsize), -1);
 			free(keybuf);
 		}
 		else if (key == 'K') {
@@ -602,7 +551,7 @@ void loq(int index, const char *category, const char *name,
 			unsigned int allocsize = sizeof(KEY_NAME_INFORMATION) + MAX_KEY_BUFLEN;
 			PKEY_NAME_INFORMATION keybuf = malloc(allocsize);
 
-			log_wstring(get_key_path(obj, keybuf, allocsize), -1);
+			logenc_wstring(&g_enc, get_key_path(obj, keybuf, allocsize), -1);
 			free(keybuf);
 		}
 		else if (key == 'k') {
@@ -611,7 +560,7 @@ void loq(int index, const char *category, const char *name,
 			unsigned int allocsize = sizeof(KEY_NAME_INFORMATION) + MAX_KEY_BUFLEN;
 			PKEY_NAME_INFORMATION keybuf = malloc(allocsize);
 
-			log_wstring(get_full_keyvalue_pathUS(reg, s, keybuf, allocsize), -1);
+			logenc_wstring(&g_enc, get_full_keyvalue_pathUS(reg, s, keybuf, allocsize), -1);
 			free(keybuf);
 		}
 		else if (key == 'v') {
@@ -620,7 +569,7 @@ void loq(int index, const char *category, const char *name,
 			unsigned int allocsize = sizeof(KEY_NAME_INFORMATION) + MAX_KEY_BUFLEN;
 			PKEY_NAME_INFORMATION keybuf = malloc(allocsize);
 
-			log_wstring(get_full_keyvalue_pathA(reg, s, keybuf, allocsize), -1);
+			logenc_wstring(&g_enc, get_full_keyvalue_pathA(reg, s, keybuf, allocsize), -1);
 			free(keybuf);
 		}
 		else if (key == 'V') {
@@ -629,23 +578,28 @@ void loq(int index, const char *category, const char *name,
 			unsigned int allocsize = sizeof(KEY_NAME_INFORMATION) + MAX_KEY_BUFLEN;
 			PKEY_NAME_INFORMATION keybuf = malloc(allocsize);
 
-			log_wstring(get_full_keyvalue_pathW(reg, s, keybuf, allocsize), -1);
+			logenc_wstring(&g_enc, get_full_keyvalue_pathW(reg, s, keybuf, allocsize), -1);
 			free(keybuf);
 		}
 		else if (key == 'o') {
             UNICODE_STRING *str = va_arg(args, UNICODE_STRING *);
             if(str == NULL) {
-                log_string("", 0);
+                logenc_string(&g_enc, "", 0);
             }
             else {
-                log_wstring(str->Buffer, str->Length / sizeof(wchar_t));
+                logenc_wstring(&g_enc, str->Buffer, str->Length / sizeof(wchar_t));
             }
         }
         else if(key == 'O') {
             OBJECT_ATTRIBUTES *obj = va_arg(args, OBJECT_ATTRIBUTES *);
             if(obj == NULL) {
-                log_string("", 0);
+                logenc_string(&g_enc, "", 0);
             }
+			else if (g_config.raw_paths) {
+				wchar_t path[MAX_PATH_PLUS_TOLERANCE];
+				path_from_object_attributes(obj, path, MAX_PATH_PLUS_TOLERANCE);
+				logenc_wstring(&g_enc, path, -1);
+			}
 			else {
 				wchar_t path[MAX_PATH_PLUS_TOLERANCE];
 				wchar_t *absolutepath = malloc(32768 * sizeof(wchar_t));
@@ -653,59 +607,51 @@ void loq(int index, const char *category, const char *name,
 					path_from_object_attributes(obj, path, MAX_PATH_PLUS_TOLERANCE);
 
 					ensure_absolute_unicode_path(absolutepath, path);
-					log_wstring(absolutepath, -1);
+					logenc_wstring(&g_enc, absolutepath, -1);
 					free(absolutepath);
 				}
 				else {
-					log_wstring(L"", -1);
+					logenc_wstring(&g_enc, L"", -1);
 				}
             }
         }
-        else if(key == 'a') {
-            int argc = va_arg(args, int);
-            const char **argv = va_arg(args, const char **);
-            log_argv(argc, argv);
-        }
-        else if(key == 'A') {
-            int argc = va_arg(args, int);
-            const wchar_t **argv = va_arg(args, const wchar_t **);
-            log_wargv(argc, argv);
-        }
         else if(key == 'r' || key == 'R') {
             unsigned long type = va_arg(args, unsigned long);
             unsigned long size = va_arg(args, unsigned long);
             unsigned char *data = va_arg(args, unsigned char *);
 
-			if (size > BUFFER_REGVAL_MAX)
-				size = BUFFER_REGVAL_MAX;
+			hookctl_capture_t cap;
+
+			hookctl_capture(slot, BUFFER_REGVAL_MAX, size, &cap);
+			size = cap.head;
 			
 			// bson_append_start_object( g_bson, g_istr );
             // bson_append_int( g_bson, "type", type );
 
             // strncpy(g_istr, "val", 4);
             if(type == REG_NONE) {
-                log_string("", 0);
+                logenc_string(&g_enc, "", 0);
             }
             else if(type == REG_DWORD || type == REG_DWORD_LITTLE_ENDIAN) {
                 unsigned int value = *(unsigned int *) data;
-                log_int32(value);
+                logenc_int32(&g_enc, value);
             }
             else if(type == REG_DWORD_BIG_ENDIAN) {
                 unsigned int value = *(unsigned int *) data;
-                log_int32(htonl(value));
+                logenc_int32(&g_enc, htonl(value));
             }
             else if(type == REG_EXPAND_SZ || type == REG_SZ) {
 
                 if(data == NULL) {
-                    bson_append_binary(g_bson, g_istr, BSON_BIN_BINARY,
+                    bson_append_binary(g_bson, g_enc.key, BSON_BIN_BINARY,
                         (const char *) data, 0);
                 }
                 // ascii strings
                 else if(key == 'r') {
 					if (size >= 1 && data[size - 1] == '\0')
-						log_string(data, size - 1);
+						logenc_string(&g_enc, data, size - 1);
 					else
-						log_string(data, size);
+						logenc_string(&g_enc, data, size);
                     //bson_append_binary(g_bson, g_istr, BSON_BIN_BINARY,
                     //    (const char *) data, size);
                 }
@@ -713,14 +659,14 @@ void loq(int index, const char *category, const char *name,
                 else {
 					const wchar_t *wdata = (const wchar_t *)data;
 					if (size >= 2 && wdata[(size / sizeof(wchar_t)) - 1] == L'\0')
-						log_wstring(wdata, (size / sizeof(wchar_t)) - 1);
+						logenc_wstring(&g_enc, wdata, (size / sizeof(wchar_t)) - 1);
 					else
-						log_wstring(wdata, size / sizeof(wchar_t));
+						logenc_wstring(&g_enc, wdata, size / sizeof(wchar_t));
                     //bson_append_binary(g_bson, g_istr, BSON_BIN_BINARY,
                     //    (const char *) data, size);
                 }
             } else {
-                bson_append_binary(g_bson, g_istr, BSON_BIN_BINARY,
+                bson_append_binary(g_bson, g_enc.key, BSON_BIN_BINARY,
                     (const char *) data, 0);
             }
 
@@ -731,30 +677,16 @@ void loq(int index, const char *category, const char *name,
     va_end(args);
 
     bson_append_finish_array( g_bson );
+	logenc_finish(&g_enc);
     bson_finish( g_bson );
 
-	if (lastlog.buf) {
-		unsigned int our_len = bson_size(g_bson) - compare_offset;
-		if (lastlog.compare_len == our_len && !memcmp(lastlog.compare_ptr, bson_data(g_bson) + compare_offset, our_len)) {
-			// we're about to log a duplicate of the last log message, just increment the previous log's repeated count
-			(*lastlog.repeated_ptr)++;
-		}
-		else {
-			log_raw_direct(lastlog.buf, lastlog.len);
-			free(lastlog.buf);
-			lastlog.buf = NULL;
-		}
-	}
-	if (lastlog.buf == NULL) {
-		lastlog.len = bson_size(g_bson);
-		lastlog.buf = malloc(lastlog.len);
-		memcpy(lastlog.buf, bson_data(g_bson), lastlog.len);
-		lastlog.compare_len = lastlog.len - compare_offset;
-		lastlog.compare_ptr = lastlog.buf + compare_offset;
-		lastlog.repeated_ptr = (int *)(lastlog.buf + repeat_offset);
-	}
+	logenc_repeat(&lastlog, bson_data(g_bson), bson_size(g_bson), compare_offset,
+		&log_raw_direct);
 
     bson_destroy( g_bson );
+
+	hookctl_account(slot, read_cycles() - start_cycles, 1);
+
     LeaveCriticalSection(&g_mutex);
 
 	//log_flush();
@@ -765,24 +697,32 @@ void loq(int index, const char *category, const char *name,
 void announce_netlog()
 {
     char protoname[32];
+
+	// goes out ahead of the first frame, nothing has been logged yet
+	if (g_mux) {
+		send_all("BSONMUX\n", 8);
+		return;
+	}
+
     strcpy(protoname, "BSON\n");
     //sprintf(protoname+5, "logs/%lu.bson\n", GetCurrentProcessId());
     log_raw_direct(protoname, strlen(protoname));
 }
 
-void log_new_process()
+void log_new_process(const char *startup_phases)
 {
     g_starttick = GetTickCount();
 
     FILETIME st;
     GetSystemTimeAsFileTime(&st);
 
-    loq(LOG_ID_PROCESS, "__notification__", "__process__", 1, 0, "llllu",
+    loq(LOG_ID_PROCESS, "__notification__", "__process__", 1, 0, "llllus",
         "TimeLow", st.dwLowDateTime,
         "TimeHigh", st.dwHighDateTime,
         "ProcessIdentifier", GetCurrentProcessId(),
         "ParentProcessIdentifier", parent_process_id(),
-        "ModulePath", our_process_path);
+        "ModulePath", our_process_path,
+        "StartupPhases", startup_phases);
 }
 
 void log_new_thread()
@@ -844,6 +784,169 @@ void log_hook_restoration(const char *funcname)
 		"UnhookType", "restored");
 }
 
+void log_hook_stats(void)
+{
+	int count = hookctl_count();
+
+	for (int i = 0; i < count; i++) {
+		hookctl_entry_t *e = hookctl_entry(i);
+		loq(LOG_ID_HOOK_STATS, "__notification__", "__hookstats__", 1, 0, "ssqqq",
+			"FunctionName", e->funcname,
+			"Category", e->category,
+			"Calls", (uint64_t)atomic_read64(&e->calls),
+			"Suppressed", (uint64_t)atomic_read64(&e->suppressed),
+			"KiloCycles", (uint64_t)atomic_read64(&e->cycles) / 1000);
+	}
+	log_flush();
+}
+
+// with raw-paths set, file paths are logged the way the process passed them
+// and normalized by the host, which needs the drive mappings ...
+void log_path_map(void)
+{
+	const specialname_map_t *map = get_specialname_map();
+
+	for (uint32_t i = 0; i < map->count; i++) {
+		loq(LOG_ID_PATH_MAP, "__notification__", "__pathmap__", 1, 0, "uu",
+			"DeviceName", map->entries[i].target,
+			"DosName", map->entries[i].name);
+	}
+}
+
+// ... and the current directory and file system redirection state of the
+// thread, logged right before its next record with a path whenever they
+// changed; called by loq() with g_mutex held
+static void log_path_context(void)
+{
+	hook_info_t *info = hook_info();
+	PEB *peb = (PEB *)get_peb();
+	UNICODE_STRING *dir = &peb->ProcessParameters->CurrentDirectoryPath;
+	unsigned int length = min(dir->Length / sizeof(wchar_t), MAX_PATH_PLUS_TOLERANCE - 1);
+	int disabled = is_wow64_fs_redirection_disabled();
+
+	if (info->cwd == NULL) {
+		info->cwd = malloc(MAX_PATH_PLUS_TOLERANCE * sizeof(wchar_t));
+		if (info->cwd == NULL)
+			return;
+		info->cwd_length = (unsigned int)-1;
+	}
+
+	if (length == info->cwd_length && disabled == info->redirection_disabled &&
+			!memcmp(info->cwd, dir->Buffer, length * sizeof(wchar_t)))
+		return;
+
+	memcpy(info->cwd, dir->Buffer, length * sizeof(wchar_t));
+	info->cwd[length] = L'\0';
+	info->cwd_length = length;
+	info->redirection_disabled = disabled;
+	loq(LOG_ID_PATH_CONTEXT, "__notification__", "__pathcontext__", 1, 0, "lul",
+		"ThreadIdentifier", (ULONG_PTR)GetCurrentThreadId(),
+		"CurrentDirectory", info->cwd,
+		"Wow64RedirectionDisabled", (ULONG_PTR)disabled);
+}
+
+// one or more commands, separated like for hookctl_commands()
+void log_host_command(const char *cmds, unsigned int length)
+{
+	unsigned int start = 0;
+	int stats = 0;
+
+	for (unsigned int i = 0; i <= length; i++) {
+		if (i != length && cmds[i] != '\n' && cmds[i] != ';')
+			continue;
+
+		if (i != start && protected_pid_command(cmds + start, i - start) == 0 &&
+				hookctl_command(cmds + start, i - start) == HOOKCTL_CMD_STATS)
+			stats = 1;
+		start = i + 1;
+	}
+
+	if (stats)
+		log_hook_stats();
+}
+
+// the host may send newline-terminated commands back over the log socket
+static DWORD WINAPI _log_command_thread(LPVOID param)
+{
+	char buf[1024];
+	int used = 0, discarding = 0;
+
+	hook_disable();
+
+	while (1) {
+		int len = recv(g_sock, buf + used, sizeof(buf) - used, 0);
+		int start = 0;
+
+		if (len <= 0)
+			break;
+		used += len;
+
+		for (int i = 0; i < used; i++) {
+			if (buf[i] == '\n') {
+				if (!discarding)
+					log_host_command(buf + start, i - start);
+				discarding = 0;
+				start = i + 1;
+			}
+		}
+
+		// an overlong command can never complete, drop it up to and
+		// including its newline, or its tail would run as a command
+		if (start == 0 && used == sizeof(buf)) {
+			start = used;
+			discarding = 1;
+		}
+
+		memmove(buf, buf + start, used - start);
+		used -= start;
+	}
+	return 0;
+}
+
+
+static void payload_stream_init(void)
+{
+	uint64_t cap = g_config.payload_cap ? g_config.payload_cap : 1024;
+	uint64_t total = g_config.payload_total ? g_config.payload_total : 64 * 1024;
+
+	g_payload = malloc(sizeof(payload_t));
+	g_payload_batch = malloc(LOG_PAYLOAD_BATCH);
+	if (g_payload == NULL || g_payload_batch == NULL ||
+			payload_init(g_payload, LOG_PAYLOAD_QUEUE, cap * 1024, total * 1024) < 0) {
+		pipe("WARNING:Unable to set up the payload stream, sending plain BSON");
+		return;
+	}
+	g_mux = 1;
+}
+
+// queues the full buffer of a socket, internet or crypto call on the
+// payload stream, if there is one (see payload.h)
+void log_payload(unsigned int kind, ULONG_PTR handle, int direction,
+	const void *buf, size_t length)
+{
+	lasterror_t lasterror;
+
+	if (g_mux == 0 || buf == NULL || length == 0)
+		return;
+
+	get_lasterrors(&lasterror);
+	payload_data(g_payload, (uint16_t)kind, handle, direction, buf,
+		(uint32_t)min(length, 0xffffffff));
+	SetEvent(g_log_flush);
+	set_lasterrors(&lasterror);
+}
+
+void log_payload_close(unsigned int kind, ULONG_PTR handle)
+{
+	lasterror_t lasterror;
+
+	if (g_mux == 0)
+		return;
+
+	get_lasterrors(&lasterror);
+	payload_close(g_payload, (uint16_t)kind, handle);
+	set_lasterrors(&lasterror);
+}
 
 void log_init(unsigned int ip, unsigned short port, int debug)
 {
@@ -873,6 +976,12 @@ void log_init(unsigned int ip, unsigned short port, int debug)
 			closesocket(g_sock);
 			g_sock = DEBUG_SOCKET;
 		}
+		else {
+			g_log_command_thread_handle =
+				CreateThread(NULL, 0, &_log_command_thread, NULL, 0, NULL);
+			if (g_config.payload_stream)
+				payload_stream_init();
+		}
     }
 
 	g_log_thread_handle =
@@ -887,8 +996,16 @@ void log_init(unsigned int ip, unsigned short port, int debug)
 	}
 
 	announce_netlog();
-    log_new_process();
+}
+
+// writes the first records, once DllMain is done setting everything up, so
+// the process record can tell how long that took (see phasetimer.h)
+void log_announce(const char *startup_phases)
+{
+    log_new_process(startup_phases);
     log_new_thread();
+	if (g_config.raw_paths)
+		log_path_map();
     // flushing here so host can create files / keep timestamps
     log_flush();
 }
@@ -896,11 +1013,7 @@ void log_init(unsigned int ip, unsigned short port, int debug)
 void log_free()
 {
 	// racy: fix me later
-	if (lastlog.buf != NULL) {
-		log_raw_direct(lastlog.buf, lastlog.len);
-		free(lastlog.buf);
-		lastlog.buf = NULL;
-	}
+	logenc_repeat_flush(&lastlog, &log_raw_direct);
     log_flush();
 	if (g_sock != INVALID_SOCKET && g_sock != DEBUG_SOCKET) {
         closesocket(g_sock);
@@ -35,6 +35,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // L  -> (long *) -> pointer to a long integer
 // p  -> (void *) -> pointer (alias for l)
 // P  -> (void **) -> pointer to a handle (alias for L)
+// q  -> (uint64_t) -> 64-bit integer, also on 32-bit
 // o  -> (UNICODE_STRING *) -> unicode string
 // O  -> (OBJECT_ATTRIBUTES *) -> wrapper around a unicode string for filenames
 // K  -> (OBJECT_ATTRIBUTES *) -> wrapper around a unicode string for registry keys
@@ -64,15 +65,22 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 void loq(int index, const char *category, const char *name,
     int is_success, ULONG_PTR return_value, const char *fmt, ...);
-void log_new_process();
+void log_new_process(const char *startup_phases);
 void log_new_thread();
 void log_anomaly(const char *subcategory, int success,
     const char *funcname, const char *msg);
 void log_hook_modification(const char *funcname, const char *origbytes, const char *newbytes, unsigned int len);
 void log_hook_removal(const char *funcname);
 void log_hook_restoration(const char *funcname);
+void log_hook_stats(void);
+void log_path_map(void);
+void log_host_command(const char *cmds, unsigned int length);
+void log_payload(unsigned int kind, ULONG_PTR handle, int direction,
+	const void *buf, size_t length);
+void log_payload_close(unsigned int kind, ULONG_PTR handle);
 
 void log_init(unsigned int ip, unsigned short port, int debug);
+void log_announce(const char *startup_phases);
 void log_flush();
 void log_free();
 
@@ -128,10 +136,3 @@ extern int g_log_index;
 #define ENSURE_STRUCT(param, type) \
     type _##param; memset(&_##param, 0, sizeof(_##param)); if(param == NULL) param = &_##param
 
-typedef struct _lastlog_t {
-	unsigned char *buf;
-	unsigned int len;
-	unsigned int compare_len;
-	int *repeated_ptr;
-	unsigned char *compare_ptr;
-} lastlog_t;
\ No newline at end of file
@@ -0,0 +1,314 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "logenc.h"
+#include "hookctl.h"
+#include "utf8.h"
+
+void logenc_num(char *buf, unsigned int buflen, unsigned int num)
+{
+	unsigned int dec = 1000000000;
+	unsigned int i = 0;
+
+	if (!buflen)
+		return;
+
+	while (dec) {
+		if (!i && ((num / dec) || dec == 1))
+			buf[i++] = '0' + (num / dec);
+		else if (i)
+			buf[i++] = '0' + (num / dec);
+		if (i == buflen - 1)
+			break;
+		num = num % dec;
+		dec /= 10;
+	}
+	buf[i] = '\0';
+}
+
+void logenc_begin(logenc_t *e, bson *b, int slot)
+{
+	e->b = b;
+	e->slot = slot;
+	e->argnum = 0;
+	e->key[0] = 0;
+	e->truncated_count = 0;
+}
+
+void logenc_key(logenc_t *e, int argnum)
+{
+	e->argnum = argnum;
+	logenc_num(e->key, sizeof(e->key), argnum);
+}
+
+void logenc_int32(logenc_t *e, int value)
+{
+	bson_append_int(e->b, e->key, value);
+}
+
+void logenc_int64(logenc_t *e, int64_t value)
+{
+	bson_append_long(e->b, e->key, value);
+}
+
+void logenc_ptr(logenc_t *e, uintptr_t value)
+{
+	if (sizeof(uintptr_t) == 8)
+		logenc_int64(e, (int64_t)value);
+	else
+		logenc_int32(e, (int)value);
+}
+
+static void append_utf8(logenc_t *e, char *utf8s)
+{
+	int utf8len = *(int *)utf8s;
+
+	if (bson_append_binary(e->b, e->key, BSON_BIN_BINARY, utf8s + 4, utf8len) == BSON_ERROR)
+		bson_append_string_n(e->b, e->key, "", 0);
+	free(utf8s);
+}
+
+void logenc_string(logenc_t *e, const char *str, int length)
+{
+	if (str == NULL) {
+		bson_append_string_n(e->b, e->key, "", 0);
+		return;
+	}
+	append_utf8(e, utf8_string(str, length));
+}
+
+void logenc_wstring(logenc_t *e, const wchar_t *str, int length)
+{
+	if (str == NULL) {
+		bson_append_string_n(e->b, e->key, "", 0);
+		return;
+	}
+	append_utf8(e, utf8_wstring(str, length));
+}
+
+static void log_argv(logenc_t *e, int argc, const char **argv)
+{
+	bson_append_start_array(e->b, e->key);
+	for (int i = 0; i < argc; i++) {
+		logenc_num(e->key, sizeof(e->key), i);
+		logenc_string(e, argv[i], -1);
+	}
+	bson_append_finish_array(e->b);
+}
+
+static void log_wargv(logenc_t *e, int argc, const wchar_t **argv)
+{
+	bson_append_start_array(e->b, e->key);
+	for (int i = 0; i < argc; i++) {
+		logenc_num(e->key, sizeof(e->key), i);
+		logenc_wstring(e, argv[i], -1);
+	}
+	bson_append_finish_array(e->b);
+}
+
+static int hash_buffer(const char *buf, size_t length,
+	uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	sha256_t sha;
+
+	// we only ever looked at the head of the buffer so far, the caller's
+	// length may well be bogus
+#ifdef _MSC_VER
+	__try {
+#endif
+		sha256_init(&sha);
+		sha256_update(&sha, buf, length);
+#ifdef _MSC_VER
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER) {
+		return -1;
+	}
+#endif
+	sha256_final(&sha, digest);
+	return 0;
+}
+
+void logenc_buffer(logenc_t *e, uint32_t default_limit, const char *buf,
+	size_t length)
+{
+	hookctl_capture_t cap;
+
+	if (buf == NULL) {
+		bson_append_binary(e->b, e->key, BSON_BIN_BINARY, buf, 0);
+		return;
+	}
+
+	hookctl_capture(e->slot, default_limit, length, &cap);
+
+	// append head + tail bytes from the start of the buffer and move the
+	// tail in place afterwards, so there's no need for a copy
+	if (bson_append_binary(e->b, e->key, BSON_BIN_BINARY, buf,
+			cap.head + cap.tail) == BSON_ERROR)
+		return;
+	if (cap.tail != 0)
+		memcpy(e->b->cur - cap.tail, buf + length - cap.tail, cap.tail);
+
+	if (cap.flags != 0 && cap.head + cap.tail < length &&
+			e->truncated_count < LOGENC_MAX_TRUNCATED) {
+		logenc_truncated_t *t = &e->truncated[e->truncated_count++];
+
+		t->argnum = e->argnum;
+		t->length = length;
+		t->head = cap.head;
+		t->flags = cap.flags;
+		t->hashed = (cap.flags & HOOKCTL_CAPTURE_HASH) &&
+			hash_buffer(buf, length, t->digest) == 0;
+	}
+}
+
+int logenc_arg(logenc_t *e, int key, va_list *args)
+{
+	if (key == 's') {
+		const char *s = va_arg(*args, const char *);
+		if (s == NULL) s = "";
+		logenc_string(e, s, -1);
+	}
+	else if (key == 'S') {
+		int len = va_arg(*args, int);
+		const char *s = va_arg(*args, const char *);
+		if (s == NULL) { s = ""; len = 0; }
+		logenc_string(e, s, len);
+	}
+	else if (key == 'u') {
+		const wchar_t *s = va_arg(*args, const wchar_t *);
+		if (s == NULL) s = L"";
+		logenc_wstring(e, s, -1);
+	}
+	else if (key == 'U') {
+		int len = va_arg(*args, int);
+		const wchar_t *s = va_arg(*args, const wchar_t *);
+		if (s == NULL) { s = L""; len = 0; }
+		logenc_wstring(e, s, len);
+	}
+	else if (key == 'b' || key == 'c') {
+		size_t len = va_arg(*args, size_t);
+		const char *s = va_arg(*args, const char *);
+		logenc_buffer(e, key == 'b' ? LOGENC_BUFFER_MAX : LOGENC_LARGE_BUFFER_MAX,
+			s, len);
+	}
+	else if (key == 'B' || key == 'C') {
+		size_t *len = va_arg(*args, size_t *);
+		const char *s = va_arg(*args, const char *);
+		logenc_buffer(e, key == 'B' ? LOGENC_BUFFER_MAX : LOGENC_LARGE_BUFFER_MAX,
+			s, len == NULL ? 0 : *len);
+	}
+	else if (key == 'i' || key == 'h') {
+		int value = va_arg(*args, int);
+		logenc_int32(e, value);
+	}
+	else if (key == 'I' || key == 'H') {
+		int *ptr = va_arg(*args, int *);
+		logenc_int32(e, ptr != NULL ? *ptr : 0);
+	}
+	else if (key == 'l' || key == 'p') {
+		void *value = va_arg(*args, void *);
+		logenc_ptr(e, (uintptr_t)value);
+	}
+	else if (key == 'q') {
+		uint64_t value = va_arg(*args, uint64_t);
+		logenc_int64(e, (int64_t)value);
+	}
+	else if (key == 'L' || key == 'P') {
+		void **ptr = va_arg(*args, void **);
+		logenc_ptr(e, (uintptr_t)(ptr != NULL ? *ptr : NULL));
+	}
+	else if (key == 'a') {
+		int argc = va_arg(*args, int);
+		const char **argv = va_arg(*args, const char **);
+		log_argv(e, argc, argv);
+	}
+	else if (key == 'A') {
+		int argc = va_arg(*args, int);
+		const wchar_t **argv = va_arg(*args, const wchar_t **);
+		log_wargv(e, argc, argv);
+	}
+	else {
+		return -1;
+	}
+	return 0;
+}
+
+// { "<argnum>": { "size": <length>, "head": <bytes>, "sha256": <hex> } }
+void logenc_finish(logenc_t *e)
+{
+	char key[4], hex[SHA256_DIGEST_SIZE * 2 + 1];
+
+	if (e->truncated_count == 0)
+		return;
+
+	bson_append_start_object(e->b, "b");
+	for (unsigned int i = 0; i < e->truncated_count; i++) {
+		logenc_truncated_t *t = &e->truncated[i];
+
+		logenc_num(key, sizeof(key), t->argnum);
+		bson_append_start_object(e->b, key);
+		bson_append_long(e->b, "size", (int64_t)t->length);
+		if (t->flags & HOOKCTL_CAPTURE_HEAD_TAIL)
+			bson_append_int(e->b, "head", t->head);
+		if (t->hashed) {
+			sha256_hex(t->digest, hex);
+			bson_append_string(e->b, "sha256", hex);
+		}
+		bson_append_finish_object(e->b);
+	}
+	bson_append_finish_object(e->b);
+}
+
+void logenc_repeat(lastlog_t *last, const char *doc, unsigned int len,
+	unsigned int compare_offset, logenc_emit_t emit)
+{
+	if (last->buf) {
+		unsigned int our_len = len - compare_offset;
+		if (last->compare_len == our_len && !memcmp(last->compare_ptr, doc + compare_offset, our_len)) {
+			// we're about to log a duplicate of the last log message, just increment the previous log's repeated count
+			(*last->repeated_ptr)++;
+		}
+		else {
+			emit((const char *)last->buf, last->len);
+			free(last->buf);
+			last->buf = NULL;
+		}
+	}
+	if (last->buf == NULL) {
+		last->len = len;
+		last->buf = malloc(last->len);
+		if (last->buf == NULL) {
+			emit(doc, len);
+			return;
+		}
+		memcpy(last->buf, doc, last->len);
+		last->compare_len = last->len - compare_offset;
+		last->compare_ptr = last->buf + compare_offset;
+		// the repeated value is encoded immediately before the stream we want to compare
+		last->repeated_ptr = (int *)(last->buf + compare_offset - 4);
+	}
+}
+
+void logenc_repeat_flush(lastlog_t *last, logenc_emit_t emit)
+{
+	if (last->buf != NULL) {
+		emit((const char *)last->buf, last->len);
+		free(last->buf);
+		last->buf = NULL;
+	}
+}
@@ -0,0 +1,112 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Log Encoding
+//
+// The part of loq() which turns the arguments of an API call into BSON for
+// every format specifier that doesn't need the Windows API (see log.h for
+// the specifiers).  log.c handles the others (paths, registry keys and
+// values, object attributes); the Linux benchmark in tests/linux replays
+// calls through the same code.
+//
+// Repeated calls are folded as well: a document which only differs from
+// the previous one before compare_offset isn't sent again, instead the
+// previous one's repeat counter (the int32 right before compare_offset) is
+// increased.
+//
+
+#ifndef __LOGENC_H
+#define __LOGENC_H
+
+#include <stdarg.h>
+#include "compat.h"
+#include "bson.h"
+#include "sha256.h"
+
+// default capture limits of the buffer specifiers, see hookctl.h for
+// changing them per hook
+#define LOGENC_BUFFER_MAX 256
+#define LOGENC_LARGE_BUFFER_MAX (64 * 1024)
+
+// buffers that were cut short for a hook with capture flags set, reported
+// in the "b" document after the arguments
+#define LOGENC_MAX_TRUNCATED 8
+
+typedef struct _logenc_truncated_t {
+	int argnum;
+	size_t length;
+	uint32_t head;
+	uint32_t flags;
+	int hashed;
+	uint8_t digest[SHA256_DIGEST_SIZE];
+} logenc_truncated_t;
+
+typedef struct _logenc_t {
+	bson *b;
+
+	// hook control slot of the API, or -1
+	int slot;
+
+	// key of the current argument
+	int argnum;
+	char key[4];
+
+	unsigned int truncated_count;
+	logenc_truncated_t truncated[LOGENC_MAX_TRUNCATED];
+} logenc_t;
+
+typedef struct _lastlog_t {
+	unsigned char *buf;
+	unsigned int len;
+	unsigned int compare_len;
+	int *repeated_ptr;
+	unsigned char *compare_ptr;
+} lastlog_t;
+
+typedef void (*logenc_emit_t)(const char *buf, size_t length);
+
+// snprintf can end up acquiring the process' heap lock which will be
+// unsafe in the context of a hooked NtAllocate/FreeVirtualMemory
+void logenc_num(char *buf, unsigned int buflen, unsigned int num);
+
+void logenc_begin(logenc_t *e, bson *b, int slot);
+void logenc_key(logenc_t *e, int argnum);
+
+void logenc_int32(logenc_t *e, int value);
+void logenc_int64(logenc_t *e, int64_t value);
+void logenc_ptr(logenc_t *e, uintptr_t value);
+void logenc_string(logenc_t *e, const char *str, int length);
+void logenc_wstring(logenc_t *e, const wchar_t *str, int length);
+void logenc_buffer(logenc_t *e, uint32_t default_limit, const char *buf,
+	size_t length);
+
+// logs the next argument for specifier key, returns -1 if that's not one
+// of ours (args is untouched then)
+int logenc_arg(logenc_t *e, int key, va_list *args);
+
+// appends what follows the arguments array
+void logenc_finish(logenc_t *e);
+
+// takes the finished document of the next call, which goes out through
+// emit unless it repeats the previous one
+void logenc_repeat(lastlog_t *last, const char *doc, unsigned int len,
+	unsigned int compare_offset, logenc_emit_t emit);
+void logenc_repeat_flush(lastlog_t *last, logenc_emit_t emit);
+
+#endif
@@ -97,3 +97,13 @@ void lookup_del(lookup_t *d, unsigned int id)
     }
     LEAVE();
 }
+
+void lookup_foreach(lookup_t *d,
+    void (*cb)(unsigned int id, void *data, void *context), void *context)
+{
+    ENTER();
+    for (entry_t *p = d->root; p != NULL; p = p->next) {
+        cb(p->id, p->data, context);
+    }
+    LEAVE();
+}
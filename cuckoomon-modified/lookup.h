@@ -27,3 +27,7 @@ void lookup_init(lookup_t *d);
 void *lookup_add(lookup_t *d, unsigned int id, unsigned int size);
 void *lookup_get(lookup_t *d, unsigned int id, unsigned int *size);
 void lookup_del(lookup_t *d, unsigned int id);
+
+// calls cb for every entry, with the lookup locked
+void lookup_foreach(lookup_t *d,
+    void (*cb)(unsigned int id, void *data, void *context), void *context);
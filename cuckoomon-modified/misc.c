@@ -25,6 +25,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "hooking.h"
 #include "log.h"
 #include "config.h"
+#include "specialname.h"
 
 static _NtQueryInformationProcess pNtQueryInformationProcess;
 static _NtQueryInformationThread pNtQueryInformationThread;
@@ -381,8 +382,6 @@ uint32_t path_from_object_attributes(const OBJECT_ATTRIBUTES *obj,
 
 static char *system32dir_a;
 static char *sysnativedir_a;
-static wchar_t *system32dir_w;
-static wchar_t *sysnativedir_w;
 static unsigned int system32dir_len;
 static unsigned int sysnativedir_len;
 
@@ -398,6 +397,8 @@ char *ensure_absolute_ascii_path(char *out, const char *in)
 
 	get_lasterrors(&lasterror);
 
+	specialname_map_init();
+
 	if (!GetFullPathNameA(in, MAX_PATH, tmpout, NULL))
 		goto normal_copy;
 
@@ -437,130 +438,102 @@ out:
 	return out;
 }
 
+static specialname_map_t g_specialnames;
+
+// size in characters of the buffers ensure_absolute_unicode_path() works with
+#define ABSOLUTE_PATH_SIZE 32768
+
 wchar_t *ensure_absolute_unicode_path(wchar_t *out, const wchar_t *in)
 {
-	wchar_t *tmpout;
-	wchar_t *nonexistent;
-	unsigned int lenchars;
-	unsigned int nonexistentidx;
+	wchar_t *tmpout = NULL;
 	wchar_t *pathcomponent;
-	unsigned int pathcomponentlen;
 	const wchar_t *inadj;
 	unsigned int inlen;
-	int is_globalroot = 0;
+	unsigned int tail, end, i;
+	int is_globalroot;
 
 	lasterror_t lasterror;
 
 	get_lasterrors(&lasterror);
 
-	if (!wcsncmp(in, L"\\??\\", 4)) {
-		inadj = in + 4;
-		is_globalroot = 1;
-	}
-	else if (!wcsnicmp(in, L"\\\\?\\globalroot", 14)) {
-		inadj = in + 14;
-		is_globalroot = 1;
-	}
-	else
-		inadj = in;
+	specialname_map_init();
 
+	inadj = in + specialname_skip_prefix(in, &is_globalroot);
 	inlen = lstrlenW(inadj);
 
-	tmpout = malloc(32768 * sizeof(wchar_t));
-	nonexistent = malloc(32768 * sizeof(wchar_t));
+	tmpout = malloc(ABSOLUTE_PATH_SIZE * sizeof(wchar_t));
 
-	if (tmpout == NULL || nonexistent == NULL)
+	if (tmpout == NULL || inlen + 4 >= ABSOLUTE_PATH_SIZE)
 		goto normal_copy;
 
 	if (!wcsnicmp(inadj, L"\\device\\", 8) || !wcsnicmp(inadj, L"\\systemroot", 11)) {
-		// handle \\Device\\* and \\systemroot\\*
-		unsigned int matchlen;
-		wchar_t *tmpout2;
-		wchar_t *retstr = get_matching_unicode_specialname(inadj, &matchlen);
-		if (retstr == NULL)
-			goto normal_copy;
-		// rewrite \\Device\\HarddiskVolumeX etc to the appropriate drive letter
-		tmpout2 = malloc(32768 * sizeof(wchar_t));
-		if (tmpout2 == NULL)
+		// rewrite \\Device\\HarddiskVolumeX etc to the appropriate drive letter,
+		// out serves as scratch space until GetLongPathNameW() fills it
+		wcscpy(out, L"\\\\?\\");
+		memcpy(out + 4, inadj, (inlen + 1) * sizeof(wchar_t));
+		if (specialname_rewrite(&g_specialnames, out + 4, inlen, ABSOLUTE_PATH_SIZE - 4) < 0)
 			goto normal_copy;
-
-		wcscpy(tmpout2, L"\\\\?\\");
-		wcscat(tmpout2, retstr);
-		wcsncat(tmpout2, inadj + matchlen, 32768 - 4 - 3);
-		if (!GetFullPathNameW(tmpout2, 32768, tmpout, NULL)) {
-			free(tmpout2);
+		if (!GetFullPathNameW(out, ABSOLUTE_PATH_SIZE, tmpout, NULL))
 			goto normal_copy;
-		}
-		free(tmpout2);
 	}
 	else if (inlen > 1 && inadj[1] == L':') {
-		wchar_t *tmpout2;
-
-		tmpout2 = malloc(32768 * sizeof(wchar_t));
-		if (tmpout2 == NULL)
-			goto normal_copy;
-
-		wcscpy(tmpout2, L"\\\\?\\");
-		wcsncat(tmpout2, inadj, 32768 - 4);
-		if (!GetFullPathNameW(tmpout2, 32768, tmpout, NULL)) {
-			free(tmpout2);
+		wcscpy(out, L"\\\\?\\");
+		memcpy(out + 4, inadj, (inlen + 1) * sizeof(wchar_t));
+		if (!GetFullPathNameW(out, ABSOLUTE_PATH_SIZE, tmpout, NULL))
 			goto normal_copy;
-		}
-		free(tmpout2);
 	}
 	else if (is_globalroot) {
 		// handle \\??\\*\\*
 		goto globalroot_copy;
 	}
 	else {
-		if (!GetFullPathNameW(inadj, 32768, tmpout, NULL))
+		if (!GetFullPathNameW(inadj, ABSOLUTE_PATH_SIZE, tmpout, NULL))
 			goto normal_copy;
 	}
 
-	lenchars = 0;
-	nonexistentidx = 32767;
-	nonexistent[nonexistentidx] = L'\0';
-	while (lenchars == 0) {
-		lenchars = GetLongPathNameW(tmpout, out, 32768);
-		if (lenchars)
-			break;
+	// strip components off the end until the rest exists, they're put back
+	// behind the long path afterwards
+	end = tail = lstrlenW(tmpout);
+	while (GetLongPathNameW(tmpout, out, ABSOLUTE_PATH_SIZE) == 0) {
 		if (GetLastError() != ERROR_FILE_NOT_FOUND && GetLastError() != ERROR_PATH_NOT_FOUND && GetLastError() != ERROR_INVALID_NAME)
 			goto normal_copy;
 		pathcomponent = wcsrchr(tmpout, L'\\');
 		if (pathcomponent == NULL)
 			goto normal_copy;
-		pathcomponentlen = lstrlenW(pathcomponent);
-		nonexistentidx -= pathcomponentlen;
-		memcpy(nonexistent + nonexistentidx, pathcomponent, pathcomponentlen * sizeof(wchar_t));
 		*pathcomponent = L'\0';
+		tail = (unsigned int)(pathcomponent - tmpout);
+	}
+	if (tail != end) {
+		for (i = tail; i < end; i++) {
+			if (tmpout[i] == L'\0')
+				tmpout[i] = L'\\';
+		}
+		wcsncat(out, tmpout + tail, ABSOLUTE_PATH_SIZE - 1 - lstrlenW(out));
 	}
-	wcsncat(out, nonexistent + nonexistentidx, 32768 - lstrlenW(out));
 
 	if (!wcsncmp(out, L"\\\\?\\", 4))
 		memmove(out, out + 4, (lstrlenW(out) + 1 - 4) * sizeof(wchar_t));
 
-	if (is_wow64_fs_redirection_disabled() && !wcsnicmp(out, system32dir_w, system32dir_len)) {
-		memmove(out + system32dir_len + 1, out + system32dir_len, (lstrlenW(out + system32dir_len) + 1) * sizeof(wchar_t));
-		memcpy(out, sysnativedir_w, sysnativedir_len * sizeof(wchar_t));
-	}
+	if (is_wow64_fs_redirection_disabled())
+		specialname_sysnative(&g_specialnames, out, lstrlenW(out), ABSOLUTE_PATH_SIZE);
 
 	goto out;
 
 globalroot_copy:
 	wcscpy(out, L"\\??\\");
-	wcsncat(out, inadj, 32768 - 4);
+	wcsncat(out, inadj, ABSOLUTE_PATH_SIZE - 1 - 4);
 	goto out;
 
 normal_copy:
-	wcsncpy(out, inadj, 32768);
+	inlen = min(inlen, ABSOLUTE_PATH_SIZE - 1);
+	memcpy(out, inadj, inlen * sizeof(wchar_t));
+	out[inlen] = L'\0';
 	if (!wcsncmp(out, L"\\\\?\\", 4))
 		memmove(out, out + 4, (lstrlenW(out) + 1 - 4) * sizeof(wchar_t));
 out:
-	out[32767] = L'\0';
+	out[ABSOLUTE_PATH_SIZE - 1] = L'\0';
 	if (tmpout)
 		free(tmpout);
-	if (nonexistent)
-		free(nonexistent);
 	if (out[1] == L':' && out[2] == L'\\')
 		out[0] = toupper(out[0]);
 
@@ -769,6 +742,8 @@ wchar_t *get_key_path(POBJECT_ATTRIBUTES ObjectAttributes, PKEY_NAME_INFORMATION
 	}
 
 normal:
+	hkcu_init();
+
 	if (!wcsnicmp(keybuf->KeyName, g_hkcu.hkcu_string, g_hkcu.len) && (keybuf->KeyName[g_hkcu.len] == L'\\' || keybuf->KeyName[g_hkcu.len] == L'\0')) {
 		unsigned int ourlen = lstrlenW(L"HKEY_CURRENT_USER");
 		memcpy(keybuf->KeyName, L"HKEY_CURRENT_USER", ourlen * sizeof(WCHAR));
@@ -830,11 +805,22 @@ static PSID GetSID(void)
 	return userinfo->User.Sid;
 }
 
+static once_t g_hkcu_once;
+
+// only the registry hooks need our SID, so it's looked up the first time one
+// of them runs (or by the startup thread, whichever comes first)
 void hkcu_init(void)
 {
-	PSID sid = GetSID();
+	PSID sid;
 	LPWSTR sidstr;
+	lasterror_t lasterror;
+
+	if (!once_begin(&g_hkcu_once))
+		return;
 
+	get_lasterrors(&lasterror);
+
+	sid = GetSID();
 	ConvertSidToStringSidW(sid, &sidstr);
 
 	g_hkcu.len = lstrlenW(sidstr) + lstrlenW(L"\\REGISTRY\\USER\\");
@@ -842,6 +828,9 @@ void hkcu_init(void)
 	wcscpy(g_hkcu.hkcu_string, L"\\REGISTRY\\USER\\");
 	wcscat(g_hkcu.hkcu_string, sidstr);
 	LocalFree(sidstr);
+
+	set_lasterrors(&lasterror);
+	once_end(&g_hkcu_once);
 }
 
 extern int process_shutting_down;
@@ -869,82 +858,75 @@ int is_shutting_down()
     return ret;
 }
 
-static char *g_specialnames_a[27];
-static char *g_targetnames_a[27];
-
-static wchar_t *g_specialnames_w[27];
-static wchar_t *g_targetnames_w[27];
-static unsigned int g_num_specialnames;
+const specialname_map_t *get_specialname_map(void)
+{
+	specialname_map_init();
+	return &g_specialnames;
+}
 
 wchar_t *get_matching_unicode_specialname(const wchar_t *path, unsigned int *matchlen)
 {
-	unsigned int i;
-	for (i = 0; i < g_num_specialnames; i++) {
-		if (!wcsnicmp(path, g_targetnames_w[i], wcslen(g_targetnames_w[i]))) {
-			*matchlen = lstrlenW(g_targetnames_w[i]);
-			return g_specialnames_w[i];
-		}
-	}
-	return NULL;
+	const specialname_t *e;
+
+	specialname_map_init();
+	e = specialname_match(&g_specialnames, path, lstrlenW(path));
+	if (e == NULL)
+		return NULL;
+	*matchlen = e->target_length;
+	return e->name;
 }
 
-void specialname_map_init(void)
+static void build_specialname_map(void)
 {
-	char letter[3];
-	char buf[MAX_PATH];
-	char c;
-	unsigned int idx = 0;
-	unsigned int i, x;
+	wchar_t letter[3];
+	wchar_t buf[MAX_PATH];
+	char windir[MAX_PATH];
+	wchar_t c;
 	size_t len;
-	letter[1] = ':';
-	letter[2] = '\0';
-	for (c = 'A'; c <= 'Z'; c++) {
+
+	letter[1] = L':';
+	letter[2] = L'\0';
+	for (c = L'A'; c <= L'Z'; c++) {
 		letter[0] = c;
-		if (QueryDosDeviceA(letter, buf, MAX_PATH)) {
-			g_specialnames_a[idx] = strdup(letter);
-			g_targetnames_a[idx] = strdup(buf);
-			idx++;
-		}
+		if (QueryDosDeviceW(letter, buf, MAX_PATH))
+			specialname_add(&g_specialnames, buf, letter);
 	}
 
-	GetWindowsDirectoryA(buf, MAX_PATH);
-	g_targetnames_a[idx] = strdup("\\systemroot");
-	g_specialnames_a[idx] = strdup(buf);
-	idx++;
+	GetWindowsDirectoryW(buf, MAX_PATH);
+	specialname_set_windir(&g_specialnames, buf);
+
+	GetWindowsDirectoryA(windir, MAX_PATH);
 
-	len = strlen(buf) + strlen("\\system32");
+	len = strlen(windir) + strlen("\\system32");
 	system32dir_a = calloc(1, len + 1);
-	system32dir_w = calloc(1, (len + 1) * sizeof(wchar_t));
-	strcpy(system32dir_a, buf);
+	strcpy(system32dir_a, windir);
 	strcat(system32dir_a, "\\system32");
-	for (x = 0; x < len - strlen("\\system32"); x++)
-		system32dir_w[x] = (wchar_t)buf[x];
-	wcscat(system32dir_w, L"\\system32");
 	system32dir_len = (unsigned int)len;
 
-	len = strlen(buf) + strlen("\\sysnative");
+	len = strlen(windir) + strlen("\\sysnative");
 	sysnativedir_a = calloc(1, len + 1);
-	sysnativedir_w = calloc(1, (len + 1) * sizeof(wchar_t));
-	strcpy(sysnativedir_a, buf);
+	strcpy(sysnativedir_a, windir);
 	strcat(sysnativedir_a, "\\sysnative");
-	for (x = 0; x < len - strlen("\\sysnative"); x++)
-		sysnativedir_w[x] = (wchar_t)buf[x];
-	wcscat(sysnativedir_w, L"\\sysnative");
 	sysnativedir_len = (unsigned int)len;
+}
 
-	for (i = 0; i < idx; i++) {
-		len = strlen(g_specialnames_a[i]) + 1;
-		g_specialnames_w[i] = (wchar_t *)malloc(len * sizeof(wchar_t));
-		for (x = 0; x < len; x++)
-			g_specialnames_w[i][x] = (wchar_t)g_specialnames_a[i][x];
-		len = strlen(g_targetnames_a[i]) + 1;
-		g_targetnames_w[i] = (wchar_t *)malloc(len * sizeof(wchar_t));
-		for (x = 0; x < len; x++)
-			g_targetnames_w[i][x] = (wchar_t)g_targetnames_a[i][x];
-	}
+static once_t g_specialnames_once;
+
+// the 26 QueryDosDeviceW() calls are put off until the first path gets
+// normalized (or the startup thread gets to it), rather than holding up
+// DllMain
+void specialname_map_init(void)
+{
+	lasterror_t lasterror;
 
-	g_num_specialnames = idx;
+	if (!once_begin(&g_specialnames_once))
+		return;
+
+	get_lasterrors(&lasterror);
+	build_specialname_map();
+	set_lasterrors(&lasterror);
 
+	once_end(&g_specialnames_once);
 }
 
 int is_wow64_fs_redirection_disabled(void)
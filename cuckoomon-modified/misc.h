@@ -107,6 +107,7 @@ void add_all_dlls_to_dll_ranges(void);
 
 wchar_t *get_matching_unicode_specialname(const wchar_t *path, unsigned int *matchlen);
 void specialname_map_init(void);
+const struct _specialname_map_t *get_specialname_map(void);
 
 char *convert_address_to_dll_name_and_offset(ULONG_PTR addr, unsigned int *offset);
 int is_wow64_fs_redirection_disabled(void);
@@ -0,0 +1,157 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compat.h"
+#include "pagescan.h"
+
+#define PAGESCAN_NONE 0xffffffff
+
+int pagescan_init(pagescan_t *s, uint32_t capacity, unsigned int min_interval,
+	unsigned int max_interval)
+{
+	memset(s, 0, sizeof(*s));
+
+	// every region could start in a page of its own
+	s->addr = (const uint8_t **)calloc(capacity, sizeof(uint8_t *));
+	s->length = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+	s->next = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+	s->pages = (pagescan_page_t *)calloc(capacity, sizeof(pagescan_page_t));
+	if (s->addr == NULL || s->length == NULL || s->next == NULL || s->pages == NULL) {
+		pagescan_free(s);
+		return -1;
+	}
+
+	s->capacity = capacity;
+	s->min_interval = s->interval = min_interval;
+	s->max_interval = max_interval;
+	return 0;
+}
+
+void pagescan_free(pagescan_t *s)
+{
+	free((void *)s->addr);
+	free(s->length);
+	free(s->next);
+	free(s->pages);
+	memset(s, 0, sizeof(*s));
+}
+
+// not cryptographic in any way, it just has to notice changed bytes
+uint64_t pagescan_hash(const uint8_t *addr, uint32_t length)
+{
+	uint64_t h = 0xcbf29ce484222325ULL ^ length, v;
+
+	for (; length >= 8; addr += 8, length -= 8) {
+		memcpy(&v, addr, sizeof(v));
+		h = (h ^ v) * 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	for (; length != 0; addr++, length--)
+		h = (h ^ *addr) * 0x100000001b3ULL;
+	return h ^ (h >> 32);
+}
+
+// regions are combined by adding their hashes, so a region can be added to
+// a page without rehashing the others
+static uint64_t hash_page(pagescan_t *s, pagescan_page_t *page)
+{
+	uint64_t h = 0;
+
+	for (uint32_t idx = page->first; idx != PAGESCAN_NONE; idx = s->next[idx])
+		h += pagescan_hash(s->addr[idx], s->length[idx]);
+	return h;
+}
+
+// the current contents of the region are what we expect it to be
+int pagescan_add(pagescan_t *s, uint32_t idx, const uint8_t *addr,
+	uint32_t length)
+{
+	uintptr_t pagenr = (uintptr_t)addr >> PAGESCAN_PAGE_SHIFT;
+	pagescan_page_t *page = NULL;
+
+	if (idx >= s->capacity || length == 0)
+		return -1;
+
+	for (uint32_t i = 0; i < s->page_count; i++) {
+		if (s->pages[i].page == pagenr) {
+			page = &s->pages[i];
+			break;
+		}
+	}
+
+	s->addr[idx] = addr;
+	s->length[idx] = length;
+
+	if (page == NULL) {
+		if (s->page_count == s->capacity)
+			return -1;
+		page = &s->pages[s->page_count];
+		page->page = pagenr;
+		page->hash = pagescan_hash(addr, length);
+		page->first = idx;
+		s->next[idx] = PAGESCAN_NONE;
+
+		// the page has to be complete before the scanner can see it
+		memory_barrier();
+		s->page_count++;
+	}
+	else {
+		s->next[idx] = page->first;
+		memory_barrier();
+		page->first = idx;
+		page->hash += pagescan_hash(addr, length);
+	}
+
+	// new hooks, look sooner
+	s->interval = s->min_interval;
+	return 0;
+}
+
+// hashes all pages, calls changed() for every region in a changed page and
+// then accepts the new contents of that page, so a modification is reported
+// once; returns the amount of changed pages
+unsigned int pagescan_scan(pagescan_t *s, pagescan_changed_t changed, void *ctx)
+{
+	unsigned int ret = 0;
+	uint32_t count = s->page_count;
+
+	for (uint32_t i = 0; i < count; i++) {
+		pagescan_page_t *page = &s->pages[i];
+		uint64_t h = hash_page(s, page);
+
+		if (h == page->hash)
+			continue;
+
+		for (uint32_t idx = page->first; idx != PAGESCAN_NONE; idx = s->next[idx])
+			changed(ctx, idx);
+
+		page->hash = h;
+		ret++;
+	}
+
+	s->scans++;
+	s->pages_changed += ret;
+
+	// back off while nothing happens
+	if (ret != 0)
+		s->interval = s->min_interval;
+	else if (s->interval < s->max_interval)
+		s->interval = MIN(s->interval * 2, s->max_interval);
+
+	return ret;
+}
@@ -0,0 +1,78 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Page Scanner API
+//
+// Keeps track of a set of memory regions (our hooks) grouped by the page
+// they start in.  Every page has a hash over the expected contents of its
+// regions, so a scan hashes the current contents once and only pages with a
+// changed hash are reported to the caller for the full comparison.  The
+// interval between scans backs off while nothing changes.
+//
+// Write-watch (GetWriteWatch) would be cheaper still, but it only works for
+// MEM_WRITE_WATCH allocations, not for mapped images.
+//
+
+#ifndef __PAGESCAN_H
+#define __PAGESCAN_H
+
+#include "compat.h"
+
+#define PAGESCAN_PAGE_SHIFT 12
+
+// called for every region in a page whose hash changed
+typedef void (*pagescan_changed_t)(void *ctx, uint32_t idx);
+
+typedef struct _pagescan_page_t {
+	uintptr_t page;
+	uint64_t hash;
+	uint32_t first;
+} pagescan_page_t;
+
+typedef struct _pagescan_t {
+	uint32_t capacity;
+
+	// per region, indexed by the caller's index
+	const uint8_t **addr;
+	uint32_t *length;
+	uint32_t *next;
+
+	pagescan_page_t *pages;
+	volatile uint32_t page_count;
+
+	unsigned int min_interval;
+	unsigned int max_interval;
+	unsigned int interval;
+
+	// statistics
+	uint64_t scans;
+	uint64_t pages_changed;
+} pagescan_t;
+
+int pagescan_init(pagescan_t *s, uint32_t capacity, unsigned int min_interval,
+	unsigned int max_interval);
+void pagescan_free(pagescan_t *s);
+
+int pagescan_add(pagescan_t *s, uint32_t idx, const uint8_t *addr,
+	uint32_t length);
+unsigned int pagescan_scan(pagescan_t *s, pagescan_changed_t changed, void *ctx);
+
+uint64_t pagescan_hash(const uint8_t *addr, uint32_t length);
+
+#endif
@@ -0,0 +1,228 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compat.h"
+#include "pathtrie.h"
+
+static __inline uint16_t fold(uint16_t ch)
+{
+	if (ch >= 'A' && ch <= 'Z')
+		return ch + ('a' - 'A');
+	if (ch >= 0xc0 && ch <= 0xde && ch != 0xd7)
+		return ch + 0x20;
+	return ch;
+}
+
+static __inline uint32_t edge_hash(uint32_t parent, uint16_t ch)
+{
+	return (parent * 0x9e3779b1) ^ (ch * 0x85ebca6b);
+}
+
+static uint32_t find_child(const pathtrie_t *t, uint32_t parent, uint16_t ch)
+{
+	uint32_t mask = t->edge_size - 1;
+	uint32_t idx = edge_hash(parent, ch) & mask;
+
+	while (t->edges[idx].child != 0) {
+		if (t->edges[idx].parent == parent && t->edges[idx].ch == ch)
+			return t->edges[idx].child;
+		idx = (idx + 1) & mask;
+	}
+	return 0;
+}
+
+static void insert_edge(pathtrie_edge_t *edges, uint32_t size,
+	const pathtrie_edge_t *edge)
+{
+	uint32_t idx = edge_hash(edge->parent, edge->ch) & (size - 1);
+
+	while (edges[idx].child != 0)
+		idx = (idx + 1) & (size - 1);
+	edges[idx] = *edge;
+}
+
+static int grow_edges(pathtrie_t *t)
+{
+	uint32_t size = t->edge_size * 2;
+	pathtrie_edge_t *edges = calloc(size, sizeof(pathtrie_edge_t));
+
+	if (edges == NULL)
+		return -1;
+
+	for (uint32_t i = 0; i < t->edge_size; i++) {
+		if (t->edges[i].child != 0)
+			insert_edge(edges, size, &t->edges[i]);
+	}
+
+	free(t->edges);
+	t->edges = edges;
+	t->edge_size = size;
+	return 0;
+}
+
+static uint32_t add_child(pathtrie_t *t, uint32_t parent, uint16_t ch)
+{
+	pathtrie_edge_t edge;
+
+	// keep the hash table at most half full
+	if (2 * (t->edge_count + 1) > t->edge_size && grow_edges(t) < 0)
+		return 0;
+
+	if (t->node_count == t->node_size) {
+		uint8_t *flags = realloc(t->flags, t->node_size * 2);
+		if (flags == NULL)
+			return 0;
+		t->flags = flags;
+		t->node_size *= 2;
+	}
+
+	edge.parent = parent;
+	edge.child = t->node_count;
+	edge.ch = ch;
+	insert_edge(t->edges, t->edge_size, &edge);
+	t->edge_count++;
+
+	t->flags[t->node_count] = 0;
+	return t->node_count++;
+}
+
+int pathtrie_init(pathtrie_t *t)
+{
+	memset(t, 0, sizeof(*t));
+
+	t->node_size = 64;
+	t->flags = calloc(t->node_size, 1);
+	t->edge_size = 128;
+	t->edges = calloc(t->edge_size, sizeof(pathtrie_edge_t));
+	if (t->flags == NULL || t->edges == NULL) {
+		pathtrie_free(t);
+		return -1;
+	}
+
+	// the root
+	t->node_count = 1;
+	return 0;
+}
+
+void pathtrie_free(pathtrie_t *t)
+{
+	free(t->flags);
+	free(t->edges);
+	memset(t, 0, sizeof(*t));
+}
+
+int pathtrie_add(pathtrie_t *t, const wchar_t *pattern, uint32_t length,
+	int flags)
+{
+	uint32_t node = 0;
+
+	for (uint32_t i = 0; i < length; i++) {
+		uint16_t ch = fold((uint16_t)pattern[i]);
+		uint32_t child = find_child(t, node, ch);
+
+		if (child == 0) {
+			child = add_child(t, node, ch);
+			if (child == 0)
+				return -1;
+		}
+		node = child;
+	}
+
+	t->flags[node] |= (uint8_t)flags;
+	t->pattern_count++;
+	return 0;
+}
+
+// decodes one character, patterns are limited to the basic multilingual
+// plane like the paths they're matched against
+static int utf8_decode(const uint8_t *p, uint32_t size, uint16_t *out)
+{
+	if (p[0] < 0x80) {
+		*out = p[0];
+		return 1;
+	}
+	if ((p[0] & 0xe0) == 0xc0 && size >= 2 && (p[1] & 0xc0) == 0x80) {
+		*out = ((p[0] & 0x1f) << 6) | (p[1] & 0x3f);
+		return 2;
+	}
+	if ((p[0] & 0xf0) == 0xe0 && size >= 3 && (p[1] & 0xc0) == 0x80 &&
+			(p[2] & 0xc0) == 0x80) {
+		*out = ((p[0] & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+		return 3;
+	}
+	return -1;
+}
+
+int pathtrie_load(pathtrie_t *t, const char *list, uint32_t size)
+{
+	const uint8_t *p = (const uint8_t *)list, *end = p + size;
+	wchar_t pattern[1024];
+	int count = 0;
+
+	while (p < end) {
+		const uint8_t *eol = p;
+		uint32_t length = 0;
+		int flags = PATHTRIE_EXACT;
+
+		while (eol < end && *eol != '\n')
+			eol++;
+
+		if (*p != '#') {
+			while (p < eol && *p != '\r') {
+				int n;
+				if (length == sizeof(pattern) / sizeof(pattern[0]))
+					return -1;
+				n = utf8_decode(p, (uint32_t)(eol - p), (uint16_t *)&pattern[length]);
+				if (n < 0)
+					return -1;
+				p += n;
+				length++;
+			}
+
+			if (length != 0 && pattern[length - 1] == '*') {
+				length--;
+				flags = PATHTRIE_BEGINS_WITH;
+				// a lone * would ignore every single file
+				if (length == 0)
+					return -1;
+			}
+			if (length != 0) {
+				if (pathtrie_add(t, pattern, length, flags) < 0)
+					return -1;
+				count++;
+			}
+		}
+
+		p = eol + 1;
+	}
+	return count;
+}
+
+int pathtrie_match(const pathtrie_t *t, const wchar_t *path, uint32_t length)
+{
+	uint32_t node = 0;
+
+	for (uint32_t i = 0; i < length; i++) {
+		if (t->flags[node] & PATHTRIE_BEGINS_WITH)
+			return 1;
+		node = find_child(t, node, fold((uint16_t)path[i]));
+		if (node == 0)
+			return 0;
+	}
+	return t->flags[node] != 0;
+}
@@ -0,0 +1,77 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Path Prefix Trie
+//
+// Matches a path against any amount of patterns at once, in time linear in
+// the length of the path.  Patterns are either matched as a whole, or as
+// the beginning of a path.  Matching is case-insensitive for ASCII and
+// Latin-1, like the wcsnicmp() based list it replaces.
+//
+// Children are not kept per node; every edge is an entry in one hash table
+// keyed by (parent node, character), which keeps the trie compact no matter
+// how many children a node has.  Once built, the trie can be matched
+// against from any thread without locking.
+//
+
+#ifndef __PATHTRIE_H
+#define __PATHTRIE_H
+
+#include "compat.h"
+
+// pattern flags
+#define PATHTRIE_EXACT 1
+#define PATHTRIE_BEGINS_WITH 2
+
+typedef struct _pathtrie_edge_t {
+	uint32_t parent;
+	uint32_t child;
+	uint16_t ch;
+} pathtrie_edge_t;
+
+typedef struct _pathtrie_t {
+	// per node, which patterns end here
+	uint8_t *flags;
+	uint32_t node_count;
+	uint32_t node_size;
+
+	// parent 0 is the root, child 0 marks an unused entry
+	pathtrie_edge_t *edges;
+	uint32_t edge_count;
+	uint32_t edge_size;
+
+	uint32_t pattern_count;
+} pathtrie_t;
+
+int pathtrie_init(pathtrie_t *t);
+void pathtrie_free(pathtrie_t *t);
+
+int pathtrie_add(pathtrie_t *t, const wchar_t *pattern, uint32_t length,
+	int flags);
+
+// adds a list of UTF-8 patterns, one per line; a pattern ending in '*' is
+// matched as the beginning of a path, lines starting with '#' are ignored;
+// returns the amount of patterns added or -1 on a malformed line, a line of
+// more than 1024 characters or a lone '*', in which case the patterns before
+// it have been added already
+int pathtrie_load(pathtrie_t *t, const char *list, uint32_t size);
+
+int pathtrie_match(const pathtrie_t *t, const wchar_t *path, uint32_t length);
+
+#endif
@@ -0,0 +1,353 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compat.h"
+#include "payload.h"
+
+#define OPEN_SIZE 16
+#define DATA_SIZE 16
+#define CLOSE_SIZE 24
+
+static void put_u16(uint8_t *p, uint16_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t value)
+{
+	put_u16(p, (uint16_t)value);
+	put_u16(p + 2, (uint16_t)(value >> 16));
+}
+
+static void put_u64(uint8_t *p, uint64_t value)
+{
+	put_u32(p, (uint32_t)value);
+	put_u32(p + 4, (uint32_t)(value >> 32));
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+	return get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+int payload_init(payload_t *p, uint32_t queue_size, uint64_t stream_cap,
+	uint64_t total_cap)
+{
+	memset(p, 0, sizeof(*p));
+	if (pipeq_init(&p->queue, queue_size) < 0)
+		return -1;
+	p->next_id = 1;
+	p->stream_cap = stream_cap;
+	p->total_cap = total_cap;
+	return 0;
+}
+
+void payload_free(payload_t *p)
+{
+	pipeq_free(&p->queue);
+}
+
+static uint32_t slot_of(uint16_t kind, uint64_t handle)
+{
+	// handles are multiples of four
+	uint64_t h = (handle >> 2) * 0x9e3779b97f4a7c15ull + kind;
+	return (uint32_t)(h >> 40) & (PAYLOAD_MAX_STREAMS - 1);
+}
+
+static payload_stream_t *find_stream(payload_t *p, uint16_t kind,
+	uint64_t handle)
+{
+	uint32_t slot = slot_of(kind, handle);
+
+	for (uint32_t i = 0; i < PAYLOAD_MAX_STREAMS; i++) {
+		payload_stream_t *s = &p->streams[slot];
+		if (s->id == 0)
+			break;
+		if (s->kind == kind && s->handle == handle && !s->closing)
+			return s;
+		slot = (slot + 1) & (PAYLOAD_MAX_STREAMS - 1);
+	}
+	return NULL;
+}
+
+// a closing stream is only found by its id, as its handle may have been
+// reused for a new stream already
+static payload_stream_t *find_stream_id(payload_t *p, uint16_t kind,
+	uint64_t handle, uint32_t id)
+{
+	uint32_t slot = slot_of(kind, handle);
+
+	for (uint32_t i = 0; i < PAYLOAD_MAX_STREAMS; i++) {
+		payload_stream_t *s = &p->streams[slot];
+		if (s->id == 0)
+			break;
+		if (s->id == id)
+			return s;
+		slot = (slot + 1) & (PAYLOAD_MAX_STREAMS - 1);
+	}
+	return NULL;
+}
+
+static payload_stream_t *add_stream(payload_t *p, uint16_t kind,
+	uint64_t handle)
+{
+	uint32_t slot = slot_of(kind, handle);
+
+	for (uint32_t i = 0; i < PAYLOAD_MAX_STREAMS; i++) {
+		payload_stream_t *s = &p->streams[slot];
+		if (s->id == 0) {
+			memset(s, 0, sizeof(*s));
+			s->id = p->next_id++;
+			s->kind = kind;
+			s->handle = handle;
+			return s;
+		}
+		slot = (slot + 1) & (PAYLOAD_MAX_STREAMS - 1);
+	}
+	return NULL;
+}
+
+// frees the slot of a stream and moves the ones after it which belong
+// closer to their home slot, so lookups don't need tombstones
+static void del_stream(payload_t *p, payload_stream_t *s)
+{
+	uint32_t hole = (uint32_t)(s - p->streams);
+	uint32_t slot = hole;
+
+	for (uint32_t i = 1; i < PAYLOAD_MAX_STREAMS; i++) {
+		uint32_t home;
+
+		slot = (slot + 1) & (PAYLOAD_MAX_STREAMS - 1);
+		if (p->streams[slot].id == 0)
+			break;
+
+		// leave entries whose home lies cyclically in (hole, slot]
+		home = slot_of(p->streams[slot].kind, p->streams[slot].handle);
+		if (((slot - home) & (PAYLOAD_MAX_STREAMS - 1)) <
+				((slot - hole) & (PAYLOAD_MAX_STREAMS - 1)))
+			continue;
+
+		p->streams[hole] = p->streams[slot];
+		hole = slot;
+	}
+	p->streams[hole].id = 0;
+}
+
+static void header(uint8_t *out, uint8_t type)
+{
+	memset(out, 0, PAYLOAD_HEADER_SIZE - 4);
+	out[0] = type;
+}
+
+// queues the close frame and frees the slot, with the lock held
+static void close_stream(payload_t *p, payload_stream_t *s)
+{
+	uint8_t head[PAYLOAD_HEADER_SIZE - 4 + CLOSE_SIZE];
+
+	header(head, PAYLOAD_FRAME_CLOSE);
+	put_u32(head + 4, s->id);
+	put_u32(head + 8, 0);
+	put_u64(head + 12, s->seen[PAYLOAD_OUT]);
+	put_u64(head + 20, s->seen[PAYLOAD_IN]);
+	pipeq_push2(&p->queue, head, sizeof(head), NULL, 0);
+	del_stream(p, s);
+}
+
+void payload_data(payload_t *p, uint16_t kind, uint64_t handle,
+	int direction, const void *data, uint32_t length)
+{
+	uint8_t head[PAYLOAD_HEADER_SIZE - 4 + DATA_SIZE];
+	const uint8_t *ptr = (const uint8_t *)data;
+	payload_stream_t *s;
+	uint64_t offset, keep;
+	uint32_t id;
+
+	if (length == 0 || (direction != PAYLOAD_OUT && direction != PAYLOAD_IN))
+		return;
+
+	spin_lock(&p->lock);
+
+	s = find_stream(p, kind, handle);
+	if (s == NULL) {
+		s = add_stream(p, kind, handle);
+		if (s == NULL) {
+			spin_unlock(&p->lock);
+			atomic_add64(&p->dropped, length);
+			return;
+		}
+
+		// queued under the lock, so it always comes before the data
+		header(head, PAYLOAD_FRAME_OPEN);
+		put_u32(head + 4, s->id);
+		put_u16(head + 8, kind);
+		put_u16(head + 10, 0);
+		put_u64(head + 12, handle);
+		pipeq_push2(&p->queue, head, PAYLOAD_HEADER_SIZE - 4 + OPEN_SIZE, NULL, 0);
+	}
+
+	offset = s->seen[direction];
+	s->seen[direction] += length;
+
+	keep = length;
+	if (s->kept[direction] + keep > p->stream_cap)
+		keep = p->stream_cap - MIN(s->kept[direction], p->stream_cap);
+	if (p->total_kept + keep > p->total_cap)
+		keep = p->total_cap - MIN(p->total_kept, p->total_cap);
+	s->kept[direction] += keep;
+	p->total_kept += keep;
+	id = s->id;
+	if (keep != 0)
+		s->writers++;
+
+	spin_unlock(&p->lock);
+
+	if (keep != length)
+		atomic_add64(&p->dropped, length - keep);
+	if (keep == 0)
+		return;
+
+	// the data itself is copied without holding the lock, the receiver
+	// puts it in place by its offset
+	while (keep != 0) {
+		uint32_t n = (uint32_t)MIN(keep, PAYLOAD_CHUNK);
+
+		header(head, PAYLOAD_FRAME_DATA);
+		put_u32(head + 4, id);
+		head[8] = (uint8_t)direction;
+		memset(head + 9, 0, 3);
+		put_u64(head + 12, offset);
+
+		if (pipeq_push2(&p->queue, head, sizeof(head), ptr, n) < 0) {
+			atomic_add64(&p->dropped, keep);
+			break;
+		}
+
+		ptr += n;
+		offset += n;
+		keep -= n;
+	}
+
+	// the slot may have moved while the lock wasn't held
+	spin_lock(&p->lock);
+	s = find_stream_id(p, kind, handle, id);
+	if (s != NULL && --s->writers == 0 && s->closing)
+		close_stream(p, s);
+	spin_unlock(&p->lock);
+}
+
+// the close frame must not overtake data still being queued by another
+// thread, the receiver drops data of streams it doesn't know (anymore)
+void payload_close(payload_t *p, uint16_t kind, uint64_t handle)
+{
+	payload_stream_t *s;
+
+	spin_lock(&p->lock);
+
+	s = find_stream(p, kind, handle);
+	if (s != NULL && s->writers != 0)
+		s->closing = 1;
+	else if (s != NULL)
+		close_stream(p, s);
+
+	spin_unlock(&p->lock);
+}
+
+uint32_t payload_take(payload_t *p, uint8_t *out, uint32_t max)
+{
+	return pipeq_take(&p->queue, out, max);
+}
+
+int payload_empty(payload_t *p)
+{
+	return pipeq_empty(&p->queue);
+}
+
+void payload_events_header(uint8_t *out, uint32_t length)
+{
+	put_u32(out, PAYLOAD_HEADER_SIZE - 4 + length);
+	header(out + 4, PAYLOAD_FRAME_EVENTS);
+}
+
+int payload_parse(const uint8_t *buf, uint32_t len, payload_frame_t *f)
+{
+	uint32_t size;
+	const uint8_t *body;
+
+	if (len < 4)
+		return 0;
+
+	size = get_u32(buf);
+	if (size < PAYLOAD_HEADER_SIZE - 4 || size > PAYLOAD_MAX_FRAME)
+		return -1;
+	if (len - 4 < size)
+		return 0;
+
+	memset(f, 0, sizeof(*f));
+	f->type = buf[4];
+	body = buf + PAYLOAD_HEADER_SIZE;
+	size -= PAYLOAD_HEADER_SIZE - 4;
+
+	switch (f->type) {
+	case PAYLOAD_FRAME_EVENTS:
+		f->data = body;
+		f->size = size;
+		break;
+
+	case PAYLOAD_FRAME_OPEN:
+		if (size != OPEN_SIZE)
+			return -1;
+		f->stream = get_u32(body);
+		f->kind = get_u16(body + 4);
+		f->handle = get_u64(body + 8);
+		break;
+
+	case PAYLOAD_FRAME_DATA:
+		if (size < DATA_SIZE || body[4] > PAYLOAD_IN)
+			return -1;
+		f->stream = get_u32(body);
+		f->direction = body[4];
+		f->offset = get_u64(body + 8);
+		f->data = body + DATA_SIZE;
+		f->size = size - DATA_SIZE;
+		break;
+
+	case PAYLOAD_FRAME_CLOSE:
+		if (size != CLOSE_SIZE)
+			return -1;
+		f->stream = get_u32(body);
+		f->length[PAYLOAD_OUT] = get_u64(body + 8);
+		f->length[PAYLOAD_IN] = get_u64(body + 16);
+		break;
+
+	default:
+		return -1;
+	}
+
+	return (int)(PAYLOAD_HEADER_SIZE + size);
+}
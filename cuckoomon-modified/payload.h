@@ -0,0 +1,148 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Payload Stream API
+//
+// Bulk data (socket payloads, InternetReadFile() buffers, crypto buffers)
+// is sent next to the API events over the same TCP connection instead of
+// being truncated into the events themselves.  With payload-stream set the
+// monitor announces "BSONMUX\n" instead of "BSON\n", after which everything
+// it sends is a sequence of frames, all integers little-endian:
+//
+//   u32 length      of everything following this field
+//   u8  type        PAYLOAD_FRAME_*
+//   u8  reserved[3]
+//
+// PAYLOAD_FRAME_EVENTS  the next piece of the BSON event stream, the
+//                       pieces put together are what "BSON\n" would carry
+// PAYLOAD_FRAME_OPEN    u32 stream, u16 kind, u16 reserved, u64 handle
+//                       a new stream for the socket/handle, sent before
+//                       its first data
+// PAYLOAD_FRAME_DATA    u32 stream, u8 direction, u8 reserved[3],
+//                       u64 offset, data
+//                       offset is the position of the data in this
+//                       direction of the stream
+// PAYLOAD_FRAME_CLOSE   u32 stream, u32 reserved, u64 length[2]
+//                       the handle was closed, length holds the amount of
+//                       bytes that went by in either direction, including
+//                       those which weren't sent because of the caps;
+//                       sent after all of the stream's data frames
+//
+// Payload frames are small and only go out while there are no events
+// waiting, so a large download doesn't hold up the event stream.  Every
+// direction of a stream keeps its first stream_cap bytes and all streams
+// together at most total_cap bytes; the rest is only accounted for.
+//
+
+#ifndef __PAYLOAD_H
+#define __PAYLOAD_H
+
+#include "compat.h"
+#include "pipeq.h"
+
+#define PAYLOAD_FRAME_EVENTS 0
+#define PAYLOAD_FRAME_OPEN 1
+#define PAYLOAD_FRAME_DATA 2
+#define PAYLOAD_FRAME_CLOSE 3
+
+#define PAYLOAD_HEADER_SIZE 8
+
+// what kind of handle a stream belongs to
+#define PAYLOAD_SOCKET 1
+#define PAYLOAD_INTERNET 2
+#define PAYLOAD_CRYPTO 3
+
+// sent / written / plaintext going into encryption, and received / read /
+// plaintext coming out of decryption
+#define PAYLOAD_OUT 0
+#define PAYLOAD_IN 1
+
+// payload data is split up in frames of at most this size
+#define PAYLOAD_CHUNK (16 * 1024)
+
+// anything larger is not a frame we sent
+#define PAYLOAD_MAX_FRAME (1024 * 1024)
+
+// power of two
+#define PAYLOAD_MAX_STREAMS 1024
+
+typedef struct _payload_stream_t {
+	uint64_t handle;
+	// zero for a free slot
+	uint32_t id;
+	uint16_t kind;
+	uint64_t seen[2];
+	uint64_t kept[2];
+
+	// threads still queueing data of this stream; a close that comes in
+	// meanwhile only sets closing and the last of them queues it
+	uint32_t writers;
+	int closing;
+} payload_stream_t;
+
+typedef struct _payload_t {
+	pipeq_t queue;
+	spinlock_t lock;
+
+	payload_stream_t streams[PAYLOAD_MAX_STREAMS];
+	uint32_t next_id;
+
+	uint64_t stream_cap;
+	uint64_t total_cap;
+	uint64_t total_kept;
+
+	// bytes not queued because of the caps, a full queue or too many
+	// streams
+	volatile uint64_t dropped;
+} payload_t;
+
+int payload_init(payload_t *p, uint32_t queue_size, uint64_t stream_cap,
+	uint64_t total_cap);
+void payload_free(payload_t *p);
+
+void payload_data(payload_t *p, uint16_t kind, uint64_t handle,
+	int direction, const void *data, uint32_t length);
+void payload_close(payload_t *p, uint16_t kind, uint64_t handle);
+
+// takes whole frames, up to max bytes, ready to be sent
+uint32_t payload_take(payload_t *p, uint8_t *out, uint32_t max);
+int payload_empty(payload_t *p);
+
+// writes the header of an events frame carrying length bytes
+void payload_events_header(uint8_t *out, uint32_t length);
+
+typedef struct _payload_frame_t {
+	uint8_t type;
+	uint32_t stream;
+	uint16_t kind;
+	uint8_t direction;
+	uint64_t handle;
+	uint64_t offset;
+	uint64_t length[2];
+
+	// the events or payload data
+	const uint8_t *data;
+	uint32_t size;
+} payload_frame_t;
+
+// parses the frame at the start of buf, returns its size, 0 if buf doesn't
+// hold all of it yet or -1 if it's malformed
+int payload_parse(const uint8_t *buf, uint32_t len, payload_frame_t *f);
+
+#endif
@@ -0,0 +1,84 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "compat.h"
+#include "phasetimer.h"
+
+void phasetimer_start(phasetimer_t *t, uint64_t now)
+{
+	memset(t, 0, sizeof(*t));
+	t->start = t->last = now;
+}
+
+void phasetimer_mark(phasetimer_t *t, const char *name, uint64_t now)
+{
+	if (t->count == PHASETIMER_MAX)
+		t->durations[PHASETIMER_MAX - 1] += now - t->last;
+	else {
+		t->names[t->count] = name;
+		t->durations[t->count++] = now - t->last;
+	}
+	t->last = now;
+}
+
+static uint64_t to_usecs(uint64_t ticks, uint64_t frequency)
+{
+	if (frequency == 0)
+		return 0;
+	// split up so ticks * 1000000 can't overflow
+	return ticks / frequency * 1000000 + ticks % frequency * 1000000 / frequency;
+}
+
+uint64_t phasetimer_usecs(const phasetimer_t *t, int phase, uint64_t frequency)
+{
+	if (phase < 0)
+		return to_usecs(t->last - t->start, frequency);
+	if ((uint32_t)phase >= t->count)
+		return 0;
+	return to_usecs(t->durations[phase], frequency);
+}
+
+int phasetimer_format(const phasetimer_t *t, uint64_t frequency, char *buf,
+	uint32_t size)
+{
+	uint32_t off = 0;
+	int len;
+
+	if (size == 0)
+		return -1;
+	buf[0] = 0;
+
+	for (uint32_t i = 0; i < t->count; i++) {
+		len = snprintf(buf + off, size - off, "%s=%llu,", t->names[i],
+			(unsigned long long)phasetimer_usecs(t, (int)i, frequency));
+		if (len < 0 || (uint32_t)len >= size - off) {
+			buf[off] = 0;
+			return -1;
+		}
+		off += len;
+	}
+
+	len = snprintf(buf + off, size - off, "total=%llu",
+		(unsigned long long)phasetimer_usecs(t, -1, frequency));
+	if (len < 0 || (uint32_t)len >= size - off) {
+		buf[off] = 0;
+		return -1;
+	}
+	return (int)(off + len);
+}
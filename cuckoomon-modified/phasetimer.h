@@ -0,0 +1,56 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Phase Timer
+//
+// Records how long each step of a sequence (e.g., the initialization in
+// DllMain) takes.  The caller supplies the counter values and their
+// frequency, so any high-resolution clock will do.  Every mark ends the
+// phase that started at the previous mark.
+//
+
+#ifndef __PHASETIMER_H
+#define __PHASETIMER_H
+
+#include "compat.h"
+
+#define PHASETIMER_MAX 32
+
+typedef struct _phasetimer_t {
+	uint64_t start;
+	uint64_t last;
+	uint32_t count;
+	const char *names[PHASETIMER_MAX];
+	uint64_t durations[PHASETIMER_MAX];
+} phasetimer_t;
+
+void phasetimer_start(phasetimer_t *t, uint64_t now);
+
+// marks beyond PHASETIMER_MAX are added to the last phase
+void phasetimer_mark(phasetimer_t *t, const char *name, uint64_t now);
+
+// microseconds spent in the given phase, or all of them for -1
+uint64_t phasetimer_usecs(const phasetimer_t *t, int phase, uint64_t frequency);
+
+// writes "name=usecs,...,total=usecs", returns the length or -1 if it
+// didn't fit; buf is always zero-terminated
+int phasetimer_format(const phasetimer_t *t, uint64_t frequency, char *buf,
+	uint32_t size);
+
+#endif
@@ -0,0 +1,144 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compat.h"
+#include "pidset.h"
+
+static __inline uint32_t first_slot(uint32_t pid)
+{
+	// the low two bits of a pid are always zero
+	return ((pid >> 2) * 0x9e3779b1) >> 24 & (PIDSET_SIZE - 1);
+}
+
+static int find_slot(const pidset_t *s, uint32_t pid)
+{
+	uint32_t idx = first_slot(pid);
+
+	for (uint32_t i = 0; i < PIDSET_SIZE; i++) {
+		uint32_t value = s->slots[idx];
+		if (value == pid)
+			return (int)idx;
+		if (value == 0)
+			break;
+		idx = (idx + 1) & (PIDSET_SIZE - 1);
+	}
+	return -1;
+}
+
+int pidset_contains(const pidset_t *s, uint32_t pid)
+{
+	if (pid == 0 || pid == PIDSET_REMOVED)
+		return 0;
+	return find_slot(s, pid) >= 0;
+}
+
+int pidset_add(pidset_t *s, uint32_t pid)
+{
+	uint32_t idx;
+	int ret = 0;
+
+	if (pid == 0 || pid == PIDSET_REMOVED)
+		return -1;
+
+	spin_lock(&s->lock);
+
+	if (find_slot(s, pid) < 0) {
+		if (s->count == PIDSET_MAX) {
+			ret = -1;
+		}
+		else {
+			// with at most half of the slots in use, a free one is found
+			idx = first_slot(pid);
+			while (s->slots[idx] != 0 && s->slots[idx] != PIDSET_REMOVED)
+				idx = (idx + 1) & (PIDSET_SIZE - 1);
+			s->slots[idx] = pid;
+			s->count++;
+		}
+	}
+
+	spin_unlock(&s->lock);
+	return ret;
+}
+
+int pidset_remove(pidset_t *s, uint32_t pid)
+{
+	int idx;
+
+	if (pid == 0 || pid == PIDSET_REMOVED)
+		return -1;
+
+	spin_lock(&s->lock);
+
+	// the slot can't become empty, that would cut the probe chain of
+	// whatever pids were placed after it
+	idx = find_slot(s, pid);
+	if (idx >= 0) {
+		s->slots[idx] = PIDSET_REMOVED;
+		s->count--;
+	}
+
+	// nothing left to find, get rid of the removed markers
+	if (s->count == 0)
+		memset((void *)s->slots, 0, sizeof(s->slots));
+
+	spin_unlock(&s->lock);
+	return idx >= 0 ? 0 : -1;
+}
+
+static int parse_pid(const char *arg, unsigned int length, uint32_t *pid)
+{
+	uint64_t value = 0;
+
+	while (length != 0 && *arg == ' ') {
+		arg++;
+		length--;
+	}
+	while (length != 0 && (arg[length - 1] == '\r' || arg[length - 1] == ' '))
+		length--;
+
+	if (length == 0 || length > 10)
+		return -1;
+
+	for (unsigned int i = 0; i < length; i++) {
+		if (arg[i] < '0' || arg[i] > '9')
+			return -1;
+		value = value * 10 + (arg[i] - '0');
+	}
+	// ten digits can go past 32 bits
+	if (value > UINT32_MAX)
+		return -1;
+	*pid = (uint32_t)value;
+	return 0;
+}
+
+int pidset_command(pidset_t *s, const char *cmd, unsigned int length)
+{
+	uint32_t pid;
+
+	if (length > 12 && !memcmp(cmd, "pid-protect ", 12)) {
+		if (parse_pid(cmd + 12, length - 12, &pid) < 0)
+			return -1;
+		return pidset_add(s, pid) < 0 ? -1 : 1;
+	}
+	if (length > 14 && !memcmp(cmd, "pid-unprotect ", 14)) {
+		if (parse_pid(cmd + 14, length - 14, &pid) < 0)
+			return -1;
+		return pidset_remove(s, pid) < 0 ? -1 : 1;
+	}
+	return 0;
+}
@@ -0,0 +1,59 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// PID Set
+//
+// Open-addressed set of process identifiers.  Lookups don't take a lock, so
+// hooks like NtOpenProcess can consult it on every call; additions and
+// removals are serialized among each other.  A zeroed pidset_t is an empty
+// set, process identifier 0 can't be stored.
+//
+// The following commands are understood by pidset_command():
+// pid-protect <pid>    -> add <pid>
+// pid-unprotect <pid>  -> remove <pid>
+//
+
+#ifndef __PIDSET_H
+#define __PIDSET_H
+
+#include "compat.h"
+
+// twice the amount of pids we hold at most, so probe chains stay short
+#define PIDSET_SIZE 256
+#define PIDSET_MAX (PIDSET_SIZE / 2)
+
+// slot that used to hold a pid; pids are multiples of four, so this is
+// never a real one
+#define PIDSET_REMOVED 0xffffffff
+
+typedef struct _pidset_t {
+	volatile uint32_t slots[PIDSET_SIZE];
+	uint32_t count;
+	spinlock_t lock;
+} pidset_t;
+
+int pidset_add(pidset_t *s, uint32_t pid);
+int pidset_remove(pidset_t *s, uint32_t pid);
+int pidset_contains(const pidset_t *s, uint32_t pid);
+
+// returns 1 if cmd was a pid command that succeeded, 0 if it isn't a pid
+// command at all and -1 on errors
+int pidset_command(pidset_t *s, const char *cmd, unsigned int length);
+
+#endif
@@ -20,176 +20,242 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "ntapi.h"
 #include "hooking.h"
 #include "pipe.h"
-#include "utf8.h"
 #include "misc.h"
+#include "pipeq.h"
+#include "pipefmt.h"
 
 const char *g_pipe_name;
 
-static int _pipe_utf8x(char **out, unsigned short x)
+// queued notifications, sent by _pipe_thread
+#define PIPE_QUEUE_SIZE 0x10000
+
+static pipeq_t g_pipe_queue;
+static char *g_pipe_batch;
+static HANDLE g_pipe_event;
+static HANDLE g_pipe_thread_handle;
+
+// held while talking to the analyzer, so messages arrive in order
+static CRITICAL_SECTION g_pipe_send_lock;
+
+// persistent connection for batches, if the analyzer supports it
+static HANDLE g_pipe_handle = INVALID_HANDLE_VALUE;
+static int g_pipe_use_batches;
+
+static int g_pipe_async;
+
+static const wchar_t *_pipe_unicode_string(const void *str, int *length)
 {
-    unsigned char buf[3];
-    int len = utf8_encode(x, buf);
-    if(*out != NULL) {
-        memcpy(*out, buf, len);
-        *out += len;
-    }
-    return len;
+	const UNICODE_STRING *ustr = (const UNICODE_STRING *)str;
+	*length = ustr->Length / sizeof(wchar_t);
+	return ustr->Buffer;
 }
 
-static int _pipe_ascii(char **out, const char *s, int len)
+static int _pipe_object_path(wchar_t *out, const void *obj)
 {
-    int ret = 0;
-    while (len-- != 0) {
-        ret += _pipe_utf8x(out, *(unsigned char *) s++);
-    }
-    return ret;
+	const OBJECT_ATTRIBUTES *objattr = (const OBJECT_ATTRIBUTES *)obj;
+	wchar_t path[MAX_PATH_PLUS_TOLERANCE];
+
+	if (objattr->ObjectName == NULL)
+		return -1;
+
+	path_from_object_attributes(objattr, path, (unsigned int)MAX_PATH_PLUS_TOLERANCE);
+	ensure_absolute_unicode_path(out, path);
+	return 0;
 }
 
-static int _pipe_unicode(char **out, const wchar_t *s, int len)
+static void _pipe_absolute_path(wchar_t *out, const wchar_t *path)
 {
-    int ret = 0;
-    while (len-- != 0) {
-        ret += _pipe_utf8x(out, *(unsigned short *) s++);
-    }
-    return ret;
+	ensure_absolute_unicode_path(out, path);
 }
 
-static int _pipe_sprintf(char *out, const char *fmt, va_list args)
+static const pipefmt_ops_t g_pipe_ops = {
+	&_pipe_unicode_string,
+	&_pipe_object_path,
+	&_pipe_absolute_path,
+};
+
+// notifications the analyzer only takes note of; FILE_DEL and SERVICE are not
+// among them, the analyzer has to act on those (dump the file, inject into
+// services.exe) before the call goes through
+static int _pipe_is_async(const char *buf, int len)
 {
-    int ret = 0;
-    while (*fmt != 0) {
-        if(*fmt != '%') {
-            ret += _pipe_utf8x(&out, *fmt++);
-            continue;
-        }
-        if(*++fmt == 'z') {
-            const char *s = va_arg(args, const char *);
-            if(s == NULL) return -1;
-
-            ret += _pipe_ascii(&out, s, (int)strlen(s));
-        }
-		else if (*fmt == 'c') {
-			char buf[2];
-			buf[0] = va_arg(args, char);
-			buf[1] = '\0';
-			ret += _pipe_ascii(&out, buf, 1);
-		}
-        else if(*fmt == 'Z') {
-            const wchar_t *s = va_arg(args, const wchar_t *);
-            if(s == NULL) return -1;
-
-            ret += _pipe_unicode(&out, s, lstrlenW(s));
-        }
-		else if (*fmt == 'F') {
-			const wchar_t *s = va_arg(args, const wchar_t *);
-			wchar_t *absolutepath = malloc(32768 * sizeof(wchar_t));
-			if (s == NULL) return -1;
-			if (absolutepath) {
-				ensure_absolute_unicode_path(absolutepath, s);
-				ret += _pipe_unicode(&out, absolutepath, lstrlenW(absolutepath));
-				free(absolutepath);
-			}
-			else {
-				return -1;
-			}
-		}
-		else if (*fmt == 's') {
-            int len = va_arg(args, int);
-            const char *s = va_arg(args, const char *);
-            if(s == NULL) return -1;
-
-			ret += _pipe_ascii(&out, s, len < 0 ? (int)strlen(s) : len);
-        }
-        else if(*fmt == 'S') {
-            int len = va_arg(args, int);
-            const wchar_t *s = va_arg(args, const wchar_t *);
-            if(s == NULL) return -1;
-
-            ret += _pipe_unicode(&out, s, len < 0 ? lstrlenW(s) : len);
-        }
-        else if(*fmt == 'o') {
-            UNICODE_STRING *str = va_arg(args, UNICODE_STRING *);
-            if(str == NULL) return -1;
-
-            ret += _pipe_unicode(&out, str->Buffer,
-                str->Length / sizeof(wchar_t));
-        }
-        else if(*fmt == 'O') {
-            OBJECT_ATTRIBUTES *obj = va_arg(args, OBJECT_ATTRIBUTES *);
-            if(obj == NULL || obj->ObjectName == NULL) return -1;
-
-            wchar_t path[MAX_PATH_PLUS_TOLERANCE];
-			wchar_t *absolutepath = malloc(32768 * sizeof(wchar_t));
-			if (absolutepath) {
-				path_from_object_attributes(obj, path, (unsigned int)MAX_PATH_PLUS_TOLERANCE);
-
-				ensure_absolute_unicode_path(absolutepath, path);
-
-				ret += _pipe_unicode(&out, absolutepath, lstrlenW(absolutepath));
-				free(absolutepath);
-			}
-			else {
-				ret += _pipe_unicode(&out, L"", 0);
-			}
-        }
-        else if(*fmt == 'd') {
-            char s[32];
-            sprintf(s, "%d", va_arg(args, int));
-			ret += _pipe_ascii(&out, s, (int)strlen(s));
-        }
-        else if(*fmt == 'x') {
-            char s[16];
-            sprintf(s, "%x", va_arg(args, int));
-			ret += _pipe_ascii(&out, s, (int)strlen(s));
-        }
-		else if (*fmt == 'p') {
-			char s[18];
-			sprintf(s, "%p", va_arg(args, void *));
-			ret += _pipe_ascii(&out, s, (int)strlen(s));
-		}
-		else {
-			const char *msg = "-- UNKNOWN FORMAT STRING -- ";
-			ret += _pipe_ascii(&out, msg, (int)strlen(msg));
+	static const char *prefixes[] = { "FILE_NEW:", "FILE_MOVE:", "FILE_RANGES:",
+		"INFO:" };
+
+	for (int i = 0; i < ARRAYSIZE(prefixes); i++) {
+		int plen = (int)strlen(prefixes[i]);
+		if (len >= plen && !memcmp(buf, prefixes[i], plen))
+			return 1;
+	}
+	return 0;
+}
+
+static int _pipe_send(const char *buf, int len)
+{
+	int ret = -1;
+#ifdef CUCKOODBG
+	char filename[64];
+	snprintf(filename, sizeof(filename), "c:\\pipe%u.log", GetCurrentProcessId());
+	FILE *f = fopen(filename, "ab");
+	if (f) {
+		fwrite(buf, len, 1, f);
+		fclose(f);
+		ret = 0;
+	}
+#else
+	char response[64];
+	DWORD outlen = 0;
+
+	// we're not interested in the response, a long one is fine as well
+	if (CallNamedPipe(g_pipe_name, (LPVOID)buf, len, response, sizeof(response),
+		&outlen, NMPWAIT_WAIT_FOREVER) != 0 || GetLastError() == ERROR_MORE_DATA)
+		ret = 0;
+#endif
+	return ret;
+}
+
+static int _pipe_send_frame(void *ctx, const char *msg, uint32_t len)
+{
+	_pipe_send(msg, (int)len);
+	return 0;
+}
+
+static int _pipe_send_batch(const char *buf, DWORD len)
+{
+	DWORD written;
+
+	if (g_pipe_handle == INVALID_HANDLE_VALUE) {
+		DWORD mode = PIPE_READMODE_MESSAGE;
+
+		g_pipe_handle = CreateFileA(g_pipe_name, GENERIC_READ | GENERIC_WRITE,
+			0, NULL, OPEN_EXISTING, 0, NULL);
+		if (g_pipe_handle == INVALID_HANDLE_VALUE &&
+				GetLastError() == ERROR_PIPE_BUSY &&
+				WaitNamedPipeA(g_pipe_name, PIPE_MAX_TIMEOUT)) {
+			g_pipe_handle = CreateFileA(g_pipe_name, GENERIC_READ | GENERIC_WRITE,
+				0, NULL, OPEN_EXISTING, 0, NULL);
 		}
-        fmt++;
-    }
-    return ret;
+		if (g_pipe_handle == INVALID_HANDLE_VALUE)
+			return -1;
+		SetNamedPipeHandleState(g_pipe_handle, &mode, NULL, NULL);
+	}
+
+	if (WriteFile(g_pipe_handle, buf, len, &written, NULL) && written == len)
+		return 0;
+
+	// try to reconnect with the next batch
+	CloseHandle(g_pipe_handle);
+	g_pipe_handle = INVALID_HANDLE_VALUE;
+	return -1;
+}
+
+// sends everything that has been queued, must hold g_pipe_send_lock
+static void _pipe_drain(void)
+{
+	uint8_t *frames = (uint8_t *)g_pipe_batch + PIPEQ_BATCH_PREFIX_LEN;
+	uint32_t len;
+
+	while ((len = pipeq_take(&g_pipe_queue, frames, PIPE_QUEUE_SIZE)) != 0) {
+		if (g_pipe_use_batches &&
+				!_pipe_send_batch(g_pipe_batch, PIPEQ_BATCH_PREFIX_LEN + len))
+			continue;
+
+		// one message at a time, the way the analyzer always got them
+		pipeq_parse(frames, len, &_pipe_send_frame, NULL);
+	}
+}
+
+static DWORD WINAPI _pipe_thread(LPVOID param)
+{
+	hook_disable();
+
+	while (1) {
+		WaitForSingleObject(g_pipe_event, INFINITE);
+
+		EnterCriticalSection(&g_pipe_send_lock);
+		_pipe_drain();
+		LeaveCriticalSection(&g_pipe_send_lock);
+	}
+
+	return 0;
+}
+
+// from here on notifications are sent in the background, if batches is set
+// they're sent over a persistent connection, many per message
+int pipe_init(int batches)
+{
+	if (pipeq_init(&g_pipe_queue, PIPE_QUEUE_SIZE) < 0)
+		return -1;
+
+	g_pipe_batch = malloc(PIPEQ_BATCH_PREFIX_LEN + PIPE_QUEUE_SIZE);
+	if (g_pipe_batch == NULL)
+		return -1;
+	memcpy(g_pipe_batch, PIPEQ_BATCH_PREFIX, PIPEQ_BATCH_PREFIX_LEN);
+
+	InitializeCriticalSection(&g_pipe_send_lock);
+
+	g_pipe_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (g_pipe_event == NULL)
+		return -1;
+
+	g_pipe_thread_handle = CreateThread(NULL, 0, &_pipe_thread, NULL, 0, NULL);
+	if (g_pipe_thread_handle == NULL)
+		return -1;
+
+	g_pipe_use_batches = batches;
+	g_pipe_async = 1;
+	return 0;
+}
+
+// sends all queued notifications right away
+void pipe_flush(void)
+{
+	lasterror_t lasterror;
+
+	if (g_pipe_async == 0)
+		return;
+
+	get_lasterrors(&lasterror);
+	EnterCriticalSection(&g_pipe_send_lock);
+	_pipe_drain();
+	LeaveCriticalSection(&g_pipe_send_lock);
+	set_lasterrors(&lasterror);
 }
 
 // reminder: %s doesn't follow sprintf semantics, use %z instead
 int pipe(const char *fmt, ...)
 {
-    va_list args;
+	va_list args;
 	int len;
 	int ret = -1;
 	lasterror_t lasterror;
-
-	va_start(args, fmt);
+	pipefmt_buf_t msg;
 
 	get_lasterrors(&lasterror);
-	len = _pipe_sprintf(NULL, fmt, args);
-    if (len > 0) {
-        char *buf = calloc(1, len + 1);
-        _pipe_sprintf(buf, fmt, args);
 
-#ifdef CUCKOODBG
-		char filename[64];
-		snprintf(filename, sizeof(filename), "c:\\pipe%u.log", GetCurrentProcessId());
-		FILE *f = fopen(filename, "ab");
-		if (f) {
-			fwrite(buf, len, 1, f);
-			fclose(f);
+	pipefmt_init(&msg);
+	va_start(args, fmt);
+	len = pipefmt_format(&msg, &g_pipe_ops, fmt, args);
+	va_end(args);
+
+	if (len > 0) {
+		if (g_pipe_async && _pipe_is_async(msg.buf, len) &&
+				!pipeq_push(&g_pipe_queue, msg.buf, len)) {
+			SetEvent(g_pipe_event);
 			ret = 0;
 		}
-#else
-		if (CallNamedPipe(g_pipe_name, buf, len, buf, len,
-			(unsigned long *)&len, NMPWAIT_WAIT_FOREVER) != 0)
-			ret = 0;
-#endif
-		free(buf);
-    }
-
-	va_end(args);
+		else if (g_pipe_async) {
+			// anything queued before this message goes first
+			EnterCriticalSection(&g_pipe_send_lock);
+			_pipe_drain();
+			ret = _pipe_send(msg.buf, len);
+			LeaveCriticalSection(&g_pipe_send_lock);
+		}
+		else {
+			ret = _pipe_send(msg.buf, len);
+		}
+	}
+	pipefmt_free(&msg);
 
 	set_lasterrors(&lasterror);
 
@@ -198,19 +264,29 @@ int pipe(const char *fmt, ...)
 
 int pipe2(void *out, int *outlen, const char *fmt, ...)
 {
-    va_list args;
-    va_start(args, fmt);
-    int len = _pipe_sprintf(NULL, fmt, args);
+	va_list args;
+	int len;
 	int ret = -1;
-    if(len > 0) {
-        char *buf = calloc(1, len + 1);
-        _pipe_sprintf(buf, fmt, args);
-        va_end(args);
-
-        if(CallNamedPipe(g_pipe_name, buf, len, out, *outlen,
-                (DWORD *) outlen, NMPWAIT_WAIT_FOREVER) != 0)
-            ret = 0;
-		free(buf);
-    }
-    return ret;
+	pipefmt_buf_t msg;
+
+	pipefmt_init(&msg);
+	va_start(args, fmt);
+	len = pipefmt_format(&msg, &g_pipe_ops, fmt, args);
+	va_end(args);
+
+	if (len > 0) {
+		if (g_pipe_async) {
+			EnterCriticalSection(&g_pipe_send_lock);
+			_pipe_drain();
+		}
+
+		if (CallNamedPipe(g_pipe_name, msg.buf, len, out, *outlen,
+				(DWORD *)outlen, NMPWAIT_WAIT_FOREVER) != 0)
+			ret = 0;
+
+		if (g_pipe_async)
+			LeaveCriticalSection(&g_pipe_send_lock);
+	}
+	pipefmt_free(&msg);
+	return ret;
 }
@@ -33,6 +33,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 int pipe(const char *fmt, ...);
 int pipe2(void *out, int *outlen, const char *fmt, ...);
 
+// FILE_NEW, FILE_MOVE and INFO notifications are queued once this has been
+// called, every other message first sends whatever is queued
+int pipe_init(int batches);
+void pipe_flush(void);
+
 #define PIPE_MAX_TIMEOUT 10000
 
 extern const char *g_pipe_name;
@@ -0,0 +1,236 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "compat.h"
+#include "pipefmt.h"
+
+void pipefmt_init(pipefmt_buf_t *b)
+{
+	b->buf = b->stack;
+	b->length = 0;
+	b->size = sizeof(b->stack);
+	b->failed = 0;
+	b->path = NULL;
+}
+
+void pipefmt_free(pipefmt_buf_t *b)
+{
+	if (b->buf != b->stack)
+		free(b->buf);
+	free(b->path);
+	pipefmt_init(b);
+}
+
+// makes room for another count bytes plus the terminator
+static int reserve(pipefmt_buf_t *b, uint32_t count)
+{
+	uint32_t size = b->size;
+	char *buf;
+
+	if (b->length + count < b->size)
+		return 0;
+	if (b->failed)
+		return -1;
+
+	while (b->length + count >= size)
+		size *= 2;
+
+	if (b->buf == b->stack) {
+		buf = malloc(size);
+		if (buf != NULL)
+			memcpy(buf, b->stack, b->length);
+	}
+	else {
+		buf = realloc(b->buf, size);
+	}
+
+	if (buf == NULL) {
+		b->failed = 1;
+		return -1;
+	}
+	b->buf = buf;
+	b->size = size;
+	return 0;
+}
+
+static __inline void put_utf8(pipefmt_buf_t *b, unsigned short c)
+{
+	unsigned char *out = (unsigned char *)b->buf + b->length;
+
+	if (c < 0x80) {
+		*out = (unsigned char)c;
+		b->length++;
+	}
+	else if (c < 0x800) {
+		out[0] = 0xc0 | ((c >> 6) & 0x1f);
+		out[1] = 0x80 | (c & 0x3f);
+		b->length += 2;
+	}
+	else {
+		out[0] = 0xe0 | ((c >> 12) & 0x0f);
+		out[1] = 0x80 | ((c >> 6) & 0x3f);
+		out[2] = 0x80 | (c & 0x3f);
+		b->length += 3;
+	}
+}
+
+static void put_ascii(pipefmt_buf_t *b, const char *s, int len)
+{
+	// every character takes at most two bytes
+	if (reserve(b, 2 * len) < 0)
+		return;
+	while (len-- != 0)
+		put_utf8(b, *(const unsigned char *)s++);
+}
+
+static void put_unicode(pipefmt_buf_t *b, const wchar_t *s, int len)
+{
+	if (reserve(b, 3 * len) < 0)
+		return;
+	while (len-- != 0)
+		put_utf8(b, *(const unsigned short *)s++);
+}
+
+static int unicode_length(const wchar_t *s)
+{
+	const wchar_t *p = s;
+	while (*p != 0)
+		p++;
+	return (int)(p - s);
+}
+
+static wchar_t *path_buffer(pipefmt_buf_t *b)
+{
+	if (b->path == NULL)
+		b->path = malloc(PIPEFMT_PATH_SIZE * sizeof(wchar_t));
+	return b->path;
+}
+
+int pipefmt_format(pipefmt_buf_t *b, const pipefmt_ops_t *ops,
+	const char *fmt, va_list args)
+{
+	char s[32];
+
+	b->length = 0;
+	b->failed = 0;
+
+	while (*fmt != 0) {
+		if (*fmt != '%') {
+			const char *start = fmt;
+			while (*fmt != 0 && *fmt != '%')
+				fmt++;
+			put_ascii(b, start, (int)(fmt - start));
+			continue;
+		}
+
+		switch (*++fmt) {
+		case 'z': {
+			const char *str = va_arg(args, const char *);
+			if (str == NULL)
+				return -1;
+			put_ascii(b, str, (int)strlen(str));
+			break;
+		}
+		case 'c':
+			s[0] = (char)va_arg(args, int);
+			put_ascii(b, s, 1);
+			break;
+		case 'Z': {
+			const wchar_t *str = va_arg(args, const wchar_t *);
+			if (str == NULL)
+				return -1;
+			put_unicode(b, str, unicode_length(str));
+			break;
+		}
+		case 'F': {
+			const wchar_t *str = va_arg(args, const wchar_t *);
+			wchar_t *path = path_buffer(b);
+			if (str == NULL || path == NULL)
+				return -1;
+			ops->absolute_path(path, str);
+			put_unicode(b, path, unicode_length(path));
+			break;
+		}
+		case 's': {
+			int len = va_arg(args, int);
+			const char *str = va_arg(args, const char *);
+			if (str == NULL)
+				return -1;
+			put_ascii(b, str, len < 0 ? (int)strlen(str) : len);
+			break;
+		}
+		case 'S': {
+			int len = va_arg(args, int);
+			const wchar_t *str = va_arg(args, const wchar_t *);
+			if (str == NULL)
+				return -1;
+			put_unicode(b, str, len < 0 ? unicode_length(str) : len);
+			break;
+		}
+		case 'o': {
+			const void *obj = va_arg(args, const void *);
+			const wchar_t *str;
+			int len;
+			if (obj == NULL)
+				return -1;
+			// an empty UNICODE_STRING may well have no buffer
+			str = ops->unicode_string(obj, &len);
+			if (str != NULL)
+				put_unicode(b, str, len);
+			break;
+		}
+		case 'O': {
+			const void *obj = va_arg(args, const void *);
+			wchar_t *path = path_buffer(b);
+			if (obj == NULL)
+				return -1;
+			// without memory for the path, the message goes out without it
+			if (path != NULL) {
+				if (ops->object_path(path, obj) < 0)
+					return -1;
+				put_unicode(b, path, unicode_length(path));
+			}
+			break;
+		}
+		case 'd':
+			put_ascii(b, s, sprintf(s, "%d", va_arg(args, int)));
+			break;
+		case 'x':
+			put_ascii(b, s, sprintf(s, "%x", va_arg(args, int)));
+			break;
+		case 'p':
+			put_ascii(b, s, sprintf(s, "%p", va_arg(args, void *)));
+			break;
+		default: {
+			const char *msg = "-- UNKNOWN FORMAT STRING -- ";
+			put_ascii(b, msg, (int)strlen(msg));
+			// a trailing % is not followed by anything we could skip
+			if (*fmt == 0)
+				fmt--;
+			break;
+		}
+		}
+		fmt++;
+	}
+
+	if (b->failed || reserve(b, 0) < 0)
+		return -1;
+	b->buf[b->length] = 0;
+	return (int)b->length;
+}
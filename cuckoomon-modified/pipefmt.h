@@ -0,0 +1,85 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Pipe Message Formatter
+//
+// Formats pipe messages in a single pass, straight into a buffer which
+// lives on the stack of the caller and only moves to the heap for long
+// messages.  Strings are encoded as UTF-8.  The following format
+// specifiers are understood:
+//
+// %z  -> char *, zero-terminated
+// %Z  -> wchar_t *, zero-terminated
+// %s  -> int length, char *, length -1 means zero-terminated
+// %S  -> int length, wchar_t *, length -1 means zero-terminated
+// %o  -> UNICODE_STRING *
+// %O  -> OBJECT_ATTRIBUTES *, written as absolute path
+// %F  -> wchar_t *, written as absolute path
+// %d, %x, %p, %c -> like sprintf
+//
+// A NULL string makes the whole message fail.  The Windows specific
+// arguments (%o, %O and %F) are resolved through pipefmt_ops_t, so this
+// module itself doesn't depend on the Windows API.
+//
+
+#ifndef __PIPEFMT_H
+#define __PIPEFMT_H
+
+#include <stdarg.h>
+#include "compat.h"
+
+// messages up to this size don't touch the heap
+#define PIPEFMT_STACK_SIZE 512
+
+// in characters, the size of the buffer %O and %F resolve paths into
+#define PIPEFMT_PATH_SIZE 32768
+
+typedef struct _pipefmt_buf_t {
+	char *buf;
+	uint32_t length;
+	uint32_t size;
+	int failed;
+
+	// the scratch buffer for absolute paths, allocated once per message
+	wchar_t *path;
+
+	char stack[PIPEFMT_STACK_SIZE];
+} pipefmt_buf_t;
+
+typedef struct _pipefmt_ops_t {
+	// %o, returns the buffer of a UNICODE_STRING, and its length in
+	// characters, or NULL, which is logged as an empty string
+	const wchar_t *(*unicode_string)(const void *str, int *length);
+
+	// %O, writes the absolute path of an OBJECT_ATTRIBUTES to out, returns
+	// -1 if it has no object name
+	int (*object_path)(wchar_t *out, const void *obj);
+
+	// %F, writes the absolute form of path to out
+	void (*absolute_path)(wchar_t *out, const wchar_t *path);
+} pipefmt_ops_t;
+
+void pipefmt_init(pipefmt_buf_t *b);
+void pipefmt_free(pipefmt_buf_t *b);
+
+// returns the length of the zero-terminated message in b->buf, or -1
+int pipefmt_format(pipefmt_buf_t *b, const pipefmt_ops_t *ops,
+	const char *fmt, va_list args);
+
+#endif
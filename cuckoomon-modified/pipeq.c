@@ -0,0 +1,167 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compat.h"
+#include "pipeq.h"
+
+int pipeq_init(pipeq_t *q, uint32_t size)
+{
+	memset(q, 0, sizeof(*q));
+	q->buf = (uint8_t *)malloc(size);
+	if (q->buf == NULL)
+		return -1;
+	q->size = size;
+	return 0;
+}
+
+void pipeq_free(pipeq_t *q)
+{
+	free(q->buf);
+	memset(q, 0, sizeof(*q));
+}
+
+static void put_u32(uint8_t *p, uint32_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+	p[2] = (uint8_t)(value >> 16);
+	p[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// copies len bytes to the ring at offset off from its head
+static void ring_write(pipeq_t *q, uint32_t off, const void *data,
+	uint32_t len)
+{
+	uint32_t pos = (q->head + off) % q->size;
+	uint32_t first = MIN(len, q->size - pos);
+
+	memcpy(q->buf + pos, data, first);
+	memcpy(q->buf, (const uint8_t *)data + first, len - first);
+}
+
+static void ring_read(const pipeq_t *q, uint32_t off, void *out, uint32_t len)
+{
+	uint32_t pos = (q->head + off) % q->size;
+	uint32_t first = MIN(len, q->size - pos);
+
+	memcpy(out, q->buf + pos, first);
+	memcpy((uint8_t *)out + first, q->buf, len - first);
+}
+
+// returns -1 if the queue is full, the caller should then send the
+// message itself
+int pipeq_push(pipeq_t *q, const char *msg, uint32_t len)
+{
+	return pipeq_push2(q, msg, len, NULL, 0);
+}
+
+// queues a message which is made up of a header and a body, without the
+// caller having to put them together first
+int pipeq_push2(pipeq_t *q, const void *head, uint32_t headlen,
+	const void *body, uint32_t bodylen)
+{
+	uint32_t len = headlen + bodylen;
+	uint8_t size[4];
+	int ret = -1;
+
+	spin_lock(&q->lock);
+	if (len >= headlen && q->size - q->used >= 4 &&
+			len <= q->size - q->used - 4) {
+		put_u32(size, len);
+		ring_write(q, q->used, size, 4);
+		ring_write(q, q->used + 4, head, headlen);
+		if (bodylen != 0)
+			ring_write(q, q->used + 4 + headlen, body, bodylen);
+		q->used += 4 + len;
+		ret = 0;
+	}
+	else {
+		q->dropped++;
+	}
+	spin_unlock(&q->lock);
+	return ret;
+}
+
+// moves as many whole frames as fit in max bytes to out, returns the amount
+// of bytes; with max being the size of the queue everything fits
+uint32_t pipeq_take(pipeq_t *q, uint8_t *out, uint32_t max)
+{
+	uint32_t off = 0;
+
+	spin_lock(&q->lock);
+
+	while (off < q->used) {
+		uint8_t size[4];
+		uint32_t frame;
+
+		ring_read(q, off, size, 4);
+		frame = 4 + get_u32(size);
+		if (off + frame > max)
+			break;
+		off += frame;
+	}
+
+	ring_read(q, 0, out, off);
+	q->used -= off;
+	// an empty queue starts over at the beginning of the buffer
+	q->head = q->used == 0 ? 0 : (q->head + off) % q->size;
+
+	spin_unlock(&q->lock);
+	return off;
+}
+
+int pipeq_empty(pipeq_t *q)
+{
+	return q->used == 0;
+}
+
+int pipeq_is_batch(const char *msg, uint32_t len)
+{
+	return len >= PIPEQ_BATCH_PREFIX_LEN &&
+		!memcmp(msg, PIPEQ_BATCH_PREFIX, PIPEQ_BATCH_PREFIX_LEN);
+}
+
+// walks the frames of a batch (without the prefix), returns the amount of
+// messages or -1 if the frames are malformed
+int pipeq_parse(const uint8_t *frames, uint32_t len, pipeq_message_t cb,
+	void *ctx)
+{
+	uint32_t off = 0;
+	int ret = 0;
+
+	while (off < len) {
+		uint32_t size;
+
+		if (len - off < 4)
+			return -1;
+		size = get_u32(frames + off);
+		if (size > len - off - 4)
+			return -1;
+
+		ret++;
+		if (cb(ctx, (const char *)frames + off + 4, size))
+			break;
+		off += 4 + size;
+	}
+	return ret;
+}
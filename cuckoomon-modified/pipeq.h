@@ -0,0 +1,65 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Pipe Queue API
+//
+// Notifications which don't need an answer from the analyzer are queued
+// here by pipe(), a background thread sends them in batches.  A batch is
+// a single pipe message of the form "BATCH:" followed by frames, every
+// frame being a 32-bit little-endian length and the message itself.
+//
+
+#ifndef __PIPEQ_H
+#define __PIPEQ_H
+
+#include "compat.h"
+
+#define PIPEQ_BATCH_PREFIX "BATCH:"
+#define PIPEQ_BATCH_PREFIX_LEN 6
+
+// frames are kept in a ring buffer, so taking a batch doesn't move what's
+// left in the queue; a frame may wrap around the end of buf
+typedef struct _pipeq_t {
+	uint8_t *buf;
+	uint32_t size;
+	uint32_t head;
+	uint32_t used;
+	spinlock_t lock;
+
+	// messages that didn't fit
+	uint32_t dropped;
+} pipeq_t;
+
+// called for every message in a batch, nonzero stops parsing
+typedef int (*pipeq_message_t)(void *ctx, const char *msg, uint32_t len);
+
+int pipeq_init(pipeq_t *q, uint32_t size);
+void pipeq_free(pipeq_t *q);
+
+int pipeq_push(pipeq_t *q, const char *msg, uint32_t len);
+int pipeq_push2(pipeq_t *q, const void *head, uint32_t headlen,
+	const void *body, uint32_t bodylen);
+uint32_t pipeq_take(pipeq_t *q, uint8_t *out, uint32_t max);
+int pipeq_empty(pipeq_t *q);
+
+int pipeq_is_batch(const char *msg, uint32_t len);
+int pipeq_parse(const uint8_t *frames, uint32_t len, pipeq_message_t cb,
+	void *ctx);
+
+#endif
@@ -0,0 +1,144 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "compat.h"
+#include "rangeset.h"
+
+void rangeset_init(rangeset_t *s)
+{
+	s->count = 0;
+	s->valid = 1;
+}
+
+void rangeset_invalidate(rangeset_t *s)
+{
+	s->valid = 0;
+}
+
+// index of the first range which ends at or after offset
+static uint32_t lower_bound(const rangeset_t *s, uint64_t offset)
+{
+	uint32_t lo = 0, hi = s->count;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (s->ranges[mid].end < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// joins the two neighbours with the smallest gap in between
+static void coarsen(rangeset_t *s)
+{
+	uint64_t best = UINT64_MAX;
+	uint32_t idx = 0;
+
+	for (uint32_t i = 0; i + 1 < s->count; i++) {
+		uint64_t gap = s->ranges[i + 1].start - s->ranges[i].end;
+		if (gap < best) {
+			best = gap;
+			idx = i;
+		}
+	}
+
+	s->ranges[idx].end = s->ranges[idx + 1].end;
+	memmove(&s->ranges[idx + 1], &s->ranges[idx + 2],
+		(s->count - idx - 2) * sizeof(range_t));
+	s->count--;
+}
+
+void rangeset_add(rangeset_t *s, uint64_t offset, uint64_t length)
+{
+	uint64_t end;
+	uint32_t first, last;
+
+	if (length == 0)
+		return;
+
+	end = offset + length;
+	if (end < offset)
+		end = UINT64_MAX;
+
+	// the common case, a file being written front to back
+	if (s->count != 0 && s->ranges[s->count - 1].end == offset) {
+		s->ranges[s->count - 1].end = end;
+		return;
+	}
+
+	// ranges [first, last) touch the new one and are merged into it
+	first = lower_bound(s, offset);
+	last = first;
+	while (last < s->count && s->ranges[last].start <= end)
+		last++;
+
+	if (first != last) {
+		s->ranges[first].start = MIN(s->ranges[first].start, offset);
+		s->ranges[first].end = MAX(s->ranges[last - 1].end, end);
+		memmove(&s->ranges[first + 1], &s->ranges[last],
+			(s->count - last) * sizeof(range_t));
+		s->count -= last - first - 1;
+		return;
+	}
+
+	if (s->count == RANGESET_MAX) {
+		coarsen(s);
+		// the join may have swallowed the spot we were going to use
+		rangeset_add(s, offset, end - offset);
+		return;
+	}
+
+	memmove(&s->ranges[first + 1], &s->ranges[first],
+		(s->count - first) * sizeof(range_t));
+	s->ranges[first].start = offset;
+	s->ranges[first].end = end;
+	s->count++;
+}
+
+uint64_t rangeset_bytes(const rangeset_t *s)
+{
+	uint64_t ret = 0;
+
+	for (uint32_t i = 0; i < s->count; i++)
+		ret += s->ranges[i].end - s->ranges[i].start;
+	return ret;
+}
+
+int rangeset_format(const rangeset_t *s, char *out, uint32_t size)
+{
+	uint32_t off = 0;
+
+	if (s->valid == 0 || size == 0)
+		return -1;
+
+	out[0] = 0;
+	for (uint32_t i = 0; i < s->count; i++) {
+		int len = snprintf(out + off, size - off, "%s%llu-%llu",
+			i != 0 ? "," : "", (unsigned long long)s->ranges[i].start,
+			(unsigned long long)s->ranges[i].end);
+		if (len < 0 || (uint32_t)len >= size - off) {
+			out[off] = 0;
+			return -1;
+		}
+		off += len;
+	}
+	return (int)off;
+}
@@ -0,0 +1,60 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Sorted set of byte ranges
+//
+// Keeps track of which parts of a file have been written to.  Adjacent and
+// overlapping ranges are merged as they come in.  The set has a fixed
+// capacity: once it's full the two ranges with the smallest gap between
+// them are joined, so the set may grow to cover a few bytes which weren't
+// written, but never loses any that were.
+//
+
+#ifndef __RANGESET_H
+#define __RANGESET_H
+
+#include "compat.h"
+
+#define RANGESET_MAX 64
+
+typedef struct _range_t {
+	// [start, end)
+	uint64_t start;
+	uint64_t end;
+} range_t;
+
+typedef struct _rangeset_t {
+	uint32_t count;
+	// cleared when the caller lost track of a write
+	int valid;
+	range_t ranges[RANGESET_MAX];
+} rangeset_t;
+
+void rangeset_init(rangeset_t *s);
+void rangeset_invalidate(rangeset_t *s);
+void rangeset_add(rangeset_t *s, uint64_t offset, uint64_t length);
+
+// total amount of bytes covered
+uint64_t rangeset_bytes(const rangeset_t *s);
+
+// writes the ranges as "start-end,start-end" (end exclusive, decimal) and
+// returns the length, or -1 if they don't fit or the set isn't valid
+int rangeset_format(const rangeset_t *s, char *out, uint32_t size);
+
+#endif
@@ -0,0 +1,142 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compat.h"
+#include "sha256.h"
+
+static const uint32_t k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void transform(uint32_t state[8], const uint8_t *block)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, h;
+
+	for (int i = 0; i < 16; i++) {
+		w[i] = ((uint32_t)block[i * 4] << 24) | (block[i * 4 + 1] << 16) |
+			(block[i * 4 + 2] << 8) | block[i * 4 + 3];
+	}
+	for (int i = 16; i < 64; i++) {
+		uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	a = state[0]; b = state[1]; c = state[2]; d = state[3];
+	e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+	for (int i = 0; i < 64; i++) {
+		uint32_t t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) +
+			((e & f) ^ (~e & g)) + k[i] + w[i];
+		uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) +
+			((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha256_init(sha256_t *s)
+{
+	static const uint32_t iv[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	memcpy(s->state, iv, sizeof(iv));
+	s->length = 0;
+}
+
+void sha256_update(sha256_t *s, const void *data, size_t length)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	uint32_t used = (uint32_t)(s->length % SHA256_BLOCK_SIZE);
+
+	s->length += length;
+
+	// top up a partial block first
+	if (used != 0) {
+		uint32_t n = SHA256_BLOCK_SIZE - used;
+		if (length < n) {
+			memcpy(s->block + used, p, length);
+			return;
+		}
+		memcpy(s->block + used, p, n);
+		transform(s->state, s->block);
+		p += n;
+		length -= n;
+	}
+
+	// whole blocks straight from the caller's buffer
+	while (length >= SHA256_BLOCK_SIZE) {
+		transform(s->state, p);
+		p += SHA256_BLOCK_SIZE;
+		length -= SHA256_BLOCK_SIZE;
+	}
+
+	memcpy(s->block, p, length);
+}
+
+void sha256_final(sha256_t *s, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	uint32_t used = (uint32_t)(s->length % SHA256_BLOCK_SIZE);
+	uint64_t bits = s->length * 8;
+
+	s->block[used++] = 0x80;
+	if (used > SHA256_BLOCK_SIZE - 8) {
+		memset(s->block + used, 0, SHA256_BLOCK_SIZE - used);
+		transform(s->state, s->block);
+		used = 0;
+	}
+	memset(s->block + used, 0, SHA256_BLOCK_SIZE - 8 - used);
+	for (int i = 0; i < 8; i++)
+		s->block[SHA256_BLOCK_SIZE - 1 - i] = (uint8_t)(bits >> (i * 8));
+	transform(s->state, s->block);
+
+	for (int i = 0; i < 8; i++) {
+		digest[i * 4] = (uint8_t)(s->state[i] >> 24);
+		digest[i * 4 + 1] = (uint8_t)(s->state[i] >> 16);
+		digest[i * 4 + 2] = (uint8_t)(s->state[i] >> 8);
+		digest[i * 4 + 3] = (uint8_t)s->state[i];
+	}
+}
+
+void sha256_hex(const uint8_t digest[SHA256_DIGEST_SIZE], char *out)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+		out[i * 2] = hex[digest[i] >> 4];
+		out[i * 2 + 1] = hex[digest[i] & 15];
+	}
+	out[SHA256_DIGEST_SIZE * 2] = 0;
+}
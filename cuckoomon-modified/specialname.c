@@ -0,0 +1,205 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compat.h"
+#include "specialname.h"
+
+static __inline wchar_t fold(wchar_t ch)
+{
+	return ch >= 'A' && ch <= 'Z' ? ch + ('a' - 'A') : ch;
+}
+
+static int compare(const wchar_t *a, uint32_t alen, const wchar_t *b,
+	uint32_t blen)
+{
+	uint32_t length = MIN(alen, blen);
+
+	for (uint32_t i = 0; i < length; i++) {
+		wchar_t x = fold(a[i]), y = fold(b[i]);
+		if (x != y)
+			return x < y ? -1 : 1;
+	}
+	return alen == blen ? 0 : alen < blen ? -1 : 1;
+}
+
+static uint32_t unicode_length(const wchar_t *s)
+{
+	const wchar_t *p = s;
+	while (*p != 0)
+		p++;
+	return (uint32_t)(p - s);
+}
+
+static wchar_t *duplicate(const wchar_t *s, uint32_t length, uint32_t extra)
+{
+	wchar_t *ret = malloc((length + extra + 1) * sizeof(wchar_t));
+	if (ret != NULL) {
+		memcpy(ret, s, length * sizeof(wchar_t));
+		ret[length] = 0;
+	}
+	return ret;
+}
+
+static int find(const specialname_map_t *m, const wchar_t *target,
+	uint32_t length, uint32_t *pos)
+{
+	uint32_t lo = 0, hi = m->count;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		const specialname_t *e = &m->entries[mid];
+		int r = compare(target, length, e->target, e->target_length);
+		if (r == 0) {
+			*pos = mid;
+			return 1;
+		}
+		if (r < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	*pos = lo;
+	return 0;
+}
+
+// like the drive letter loop this replaces, the first name for a target wins
+int specialname_add(specialname_map_t *m, const wchar_t *target,
+	const wchar_t *name)
+{
+	uint32_t target_length = unicode_length(target), pos;
+	specialname_t e;
+
+	if (find(m, target, target_length, &pos))
+		return 0;
+	if (m->count == SPECIALNAME_MAX || target_length == 0)
+		return -1;
+
+	e.target = duplicate(target, target_length, 0);
+	e.target_length = target_length;
+	e.name_length = unicode_length(name);
+	e.name = duplicate(name, e.name_length, 0);
+	if (e.target == NULL || e.name == NULL) {
+		free(e.target);
+		free(e.name);
+		return -1;
+	}
+
+	memmove(&m->entries[pos + 1], &m->entries[pos],
+		(m->count - pos) * sizeof(specialname_t));
+	m->entries[pos] = e;
+	m->count++;
+	m->max_target_length = MAX(m->max_target_length, target_length);
+	return 0;
+}
+
+int specialname_set_windir(specialname_map_t *m, const wchar_t *windir)
+{
+	uint32_t length = unicode_length(windir);
+
+	if (specialname_add(m, L"\\systemroot", windir) < 0)
+		return -1;
+
+	m->system32 = duplicate(windir, length, 9);
+	m->sysnative = duplicate(windir, length, 10);
+	if (m->system32 == NULL || m->sysnative == NULL)
+		return -1;
+
+	memcpy(m->system32 + length, L"\\system32", 10 * sizeof(wchar_t));
+	memcpy(m->sysnative + length, L"\\sysnative", 11 * sizeof(wchar_t));
+	m->system32_length = length + 9;
+	m->sysnative_length = length + 10;
+	return 0;
+}
+
+void specialname_free(specialname_map_t *m)
+{
+	for (uint32_t i = 0; i < m->count; i++) {
+		free(m->entries[i].target);
+		free(m->entries[i].name);
+	}
+	free(m->system32);
+	free(m->sysnative);
+	memset(m, 0, sizeof(*m));
+}
+
+const specialname_t *specialname_match(const specialname_map_t *m,
+	const wchar_t *path, uint32_t length)
+{
+	uint32_t end = MIN(length, m->max_target_length), pos;
+
+	// try every prefix that ends at a component boundary, longest first,
+	// so \Device\HarddiskVolume1 doesn't match \Device\HarddiskVolume10
+	for (uint32_t k = end; k != 0; k--) {
+		if (k != length && path[k] != '\\')
+			continue;
+		if (find(m, path, k, &pos))
+			return &m->entries[pos];
+	}
+	return NULL;
+}
+
+uint32_t specialname_skip_prefix(const wchar_t *path, int *is_globalroot)
+{
+	*is_globalroot = 0;
+
+	if (path[0] == '\\' && path[1] == '?' && path[2] == '?' && path[3] == '\\') {
+		*is_globalroot = 1;
+		return 4;
+	}
+	if (path[0] == '\\' && path[1] == '\\' && path[2] == '?' && path[3] == '\\' &&
+			!compare(path + 4, MIN(unicode_length(path + 4), 10), L"globalroot", 10)) {
+		*is_globalroot = 1;
+		return 14;
+	}
+	return 0;
+}
+
+static int replace(wchar_t *path, uint32_t length, uint32_t size,
+	uint32_t old_length, const wchar_t *with, uint32_t with_length)
+{
+	uint32_t new_length = length - old_length + with_length;
+
+	if (new_length + 1 > size)
+		return -1;
+
+	memmove(path + with_length, path + old_length,
+		(length - old_length + 1) * sizeof(wchar_t));
+	memcpy(path, with, with_length * sizeof(wchar_t));
+	return (int)new_length;
+}
+
+int specialname_rewrite(const specialname_map_t *m, wchar_t *path,
+	uint32_t length, uint32_t size)
+{
+	const specialname_t *e = specialname_match(m, path, length);
+
+	if (e == NULL)
+		return -1;
+	return replace(path, length, size, e->target_length, e->name, e->name_length);
+}
+
+int specialname_sysnative(const specialname_map_t *m, wchar_t *path,
+	uint32_t length, uint32_t size)
+{
+	uint32_t n = m->system32_length;
+
+	if (n == 0 || length < n || (length != n && path[n] != '\\') ||
+			compare(path, n, m->system32, n) != 0)
+		return -1;
+	return replace(path, length, size, n, m->sysnative, m->sysnative_length);
+}
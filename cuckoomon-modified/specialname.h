@@ -0,0 +1,76 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Special Name Map
+//
+// Maps NT device names (e.g., \Device\HarddiskVolume1) and \systemroot to
+// the DOS names the analyzer expects (C: and C:\Windows).  The entries are
+// kept sorted with their lengths cached, so a lookup is a binary search
+// per path component instead of a wcsnicmp() against every entry, and
+// paths are rewritten in the buffer that holds them.
+//
+
+#ifndef __SPECIALNAME_H
+#define __SPECIALNAME_H
+
+#include "compat.h"
+
+// 26 drive letters plus \systemroot
+#define SPECIALNAME_MAX 27
+
+typedef struct _specialname_t {
+	wchar_t *target;
+	uint32_t target_length;
+	wchar_t *name;
+	uint32_t name_length;
+} specialname_t;
+
+typedef struct _specialname_map_t {
+	// sorted by target, case-insensitively
+	specialname_t entries[SPECIALNAME_MAX];
+	uint32_t count;
+	uint32_t max_target_length;
+
+	// <windows directory>\system32 and \sysnative
+	wchar_t *system32;
+	uint32_t system32_length;
+	wchar_t *sysnative;
+	uint32_t sysnative_length;
+} specialname_map_t;
+
+int specialname_add(specialname_map_t *m, const wchar_t *target,
+	const wchar_t *name);
+int specialname_set_windir(specialname_map_t *m, const wchar_t *windir);
+void specialname_free(specialname_map_t *m);
+
+// the longest target that path starts with, up to a path separator
+const specialname_t *specialname_match(const specialname_map_t *m,
+	const wchar_t *path, uint32_t length);
+
+// offset behind a \??\ or \\?\globalroot prefix, if any
+uint32_t specialname_skip_prefix(const wchar_t *path, int *is_globalroot);
+
+// in place, path has room for size characters including the terminator;
+// both return the new length, or -1 if nothing was rewritten
+int specialname_rewrite(const specialname_map_t *m, wchar_t *path,
+	uint32_t length, uint32_t size);
+int specialname_sysnative(const specialname_map_t *m, wchar_t *path,
+	uint32_t length, uint32_t size);
+
+#endif
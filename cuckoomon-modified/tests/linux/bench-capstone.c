@@ -0,0 +1,168 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// What keeping a capstone handle open costs, with capstone built the way
+// the monitor uses it (x86 only, diet, reduced instruction set, see
+// capstone-config.mk): the time cs_open() takes, the memory it holds on to
+// and the time taken by the few hundred lde() calls placing the hooks.
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "capstone/include/capstone.h"
+
+#define HOOKS 300
+
+static size_t g_live, g_peak;
+
+// every block is prefixed with its size so free() can account for it
+static void *count_malloc(size_t size)
+{
+	size_t *p = malloc(size + sizeof(size_t));
+	if (p == NULL)
+		return NULL;
+	*p = size;
+	g_live += size;
+	if (g_live > g_peak)
+		g_peak = g_live;
+	return p + 1;
+}
+
+static void *count_calloc(size_t n, size_t size)
+{
+	void *p = count_malloc(n * size);
+	if (p != NULL)
+		memset(p, 0, n * size);
+	return p;
+}
+
+static void count_free(void *ptr)
+{
+	size_t *p = (size_t *)ptr;
+	if (p == NULL)
+		return;
+	g_live -= p[-1];
+	free(p - 1);
+}
+
+static void *count_realloc(void *ptr, size_t size)
+{
+	void *p = count_malloc(size);
+	if (p != NULL && ptr != NULL) {
+		size_t old = ((size_t *)ptr)[-1];
+		memcpy(p, ptr, old < size ? old : size);
+		count_free(ptr);
+	}
+	return p;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// typical function starts, as found in the DLLs we hook
+static const unsigned char g_prologue32[] = {
+	0x8b, 0xff, 0x55, 0x8b, 0xec, 0x83, 0xec, 0x10, 0x53, 0x56, 0x57,
+	0xb8, 0x52, 0x00, 0x00, 0x00, 0xba, 0x00, 0x03, 0xfe, 0x7f, 0xff, 0x12,
+};
+
+static const unsigned char g_prologue64[] = {
+	0x48, 0x89, 0x5c, 0x24, 0x08, 0x57, 0x48, 0x83, 0xec, 0x20, 0x48, 0x8b,
+	0x05, 0x10, 0x20, 0x30, 0x00, 0x4c, 0x8b, 0xd1, 0xb8, 0x55, 0x00, 0x00,
+	0x00, 0x0f, 0x05, 0xc3,
+};
+
+// the length of every instruction in the first bytes, like
+// hook_create_trampoline() does
+static int place_hooks(csh handle, const unsigned char *code, size_t size)
+{
+	int total = 0;
+
+	for (int hook = 0; hook < HOOKS; hook++) {
+		size_t off = 0;
+		while (off < 16) {
+			cs_insn *insn;
+			if (cs_disasm(handle, code + off, size - off, 0x1000 + off, 1, &insn) != 1)
+				break;
+			off += insn->size;
+			total += insn->size;
+			cs_free(insn, 1);
+		}
+	}
+	return total;
+}
+
+static void measure(const char *name, cs_mode mode, int detail,
+	const unsigned char *code, size_t size)
+{
+	csh handle;
+	double t0, t1, t2, t3;
+	size_t held;
+
+	g_live = g_peak = 0;
+
+	t0 = now();
+	assert(cs_open(CS_ARCH_X86, mode, &handle) == CS_ERR_OK);
+	if (detail)
+		cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
+	t1 = now();
+	held = g_live;
+
+	assert(place_hooks(handle, code, size) > 0);
+	t2 = now();
+
+	cs_close(&handle);
+	t3 = now();
+
+	printf("%s: cs_open %.1fus, holds %zu bytes, %d hooks %.1fus "
+		"(peak %zu bytes), cs_close %.1fus, left %zu bytes\n", name,
+		(t1 - t0) * 1e6, held, HOOKS, (t2 - t1) * 1e6, g_peak,
+		(t3 - t2) * 1e6, g_live);
+}
+
+int main()
+{
+	cs_opt_mem mem = {count_malloc, count_calloc, count_realloc, count_free,
+		vsnprintf};
+	csh handle;
+	double t0;
+	int rounds = 10000;
+
+	assert(cs_option(0, CS_OPT_MEM, (size_t)&mem) == CS_ERR_OK);
+
+	// the first open includes whatever capstone sets up once
+	measure("x86 (first)", CS_MODE_32, 0, g_prologue32, sizeof(g_prologue32));
+	measure("x86", CS_MODE_32, 0, g_prologue32, sizeof(g_prologue32));
+	measure("x64 detail", CS_MODE_64, 1, g_prologue64, sizeof(g_prologue64));
+
+	// what opening the handle again costs, once per DLL load that needs
+	// hooks when it's released after placing them
+	t0 = now();
+	for (int i = 0; i < rounds; i++) {
+		assert(cs_open(CS_ARCH_X86, CS_MODE_32, &handle) == CS_ERR_OK);
+		cs_close(&handle);
+	}
+	printf("cs_open + cs_close: %.2fus\n", (now() - t0) * 1e6 / rounds);
+	return 0;
+}
@@ -0,0 +1,128 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compares restore_hooks_on_range() as it used to be (walking every region)
+// with the lookup through the sorted index, on a table of 2048 regions.
+
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "hookregion.h"
+
+#define REGIONS 2048
+#define STRIDE 0x1000
+#define ITERATIONS 200000
+
+static region_table_t g_table;
+
+// the loop restore_hooks_on_range() used before the index
+static unsigned int restore_linear(uintptr_t start, uintptr_t end)
+{
+	unsigned int ret = 0;
+
+	for (uint32_t idx = 0; idx < g_table.count; idx++) {
+		uint8_t *addr = g_table.addr[idx];
+		uint32_t length = g_table.length[idx];
+
+		if ((uintptr_t)addr < start || (uintptr_t)addr + length > end)
+			continue;
+		if (!memcmp(region_orig(&g_table, idx), addr, length)) {
+			memcpy(addr, region_our(&g_table, idx), length);
+			ret++;
+		}
+	}
+	return ret;
+}
+
+static unsigned int restore_indexed(uintptr_t start, uintptr_t end)
+{
+	uint32_t found[64], pos = region_range_begin(&g_table, start);
+	unsigned int count, ret = 0;
+
+	count = region_find_range(&g_table, &pos, end, found, 64);
+	while (count != 0) {
+		for (unsigned int i = 0; i < count; i++)
+			ret += region_restore(&g_table, found[i]);
+		if (count < 64)
+			break;
+		count = region_find_range(&g_table, &pos, end, found, 64);
+	}
+	return ret;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(const char *name, uintptr_t start, uintptr_t end,
+	unsigned int iterations)
+{
+	double t0, t1, t2;
+	unsigned int a = 0, b = 0;
+
+	t0 = now();
+	for (unsigned int i = 0; i < iterations; i++)
+		a += restore_linear(start, end);
+	t1 = now();
+	for (unsigned int i = 0; i < iterations; i++)
+		b += restore_indexed(start, end);
+	t2 = now();
+
+	assert(a == b);
+	printf("%-20s linear %10.1f ns/call, indexed %10.1f ns/call\n", name,
+		(t1 - t0) * 1e9 / iterations, (t2 - t1) * 1e9 / iterations);
+}
+
+int main()
+{
+	uint8_t *mem = mmap(NULL, REGIONS * STRIDE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	uintptr_t base = (uintptr_t)mem, size = REGIONS * STRIDE;
+	char name[32];
+
+	assert(mem != MAP_FAILED);
+	assert(region_init(&g_table, REGIONS, REGIONS * 16, REGIONS * 32, 500, 4000) == 0);
+
+	for (int i = 0; i < REGIONS; i++) {
+		uint8_t *addr = mem + i * STRIDE + 0x40, orig[16];
+		memset(orig, 0x8b, 16);
+		addr[0] = 0xe9;
+		sprintf(name, "Function%d", i);
+		assert(region_add(&g_table, name, addr, orig, addr, 16) == i);
+	}
+
+	// both must restore the same regions
+	memset(mem + 7 * STRIDE + 0x40, 0x8b, 16);
+	memset(mem + 9 * STRIDE + 0x40, 0x8b, 16);
+	assert(restore_indexed(base, base + size) == 2);
+	memset(mem + 7 * STRIDE + 0x40, 0x8b, 16);
+	assert(restore_linear(base, base + size) == 1);
+
+	bench("unrelated range", base + size + STRIDE, base + size + 2 * STRIDE, ITERATIONS);
+	bench("page without hook", base + 5 * STRIDE + 0x100, base + 6 * STRIDE, ITERATIONS);
+	bench("page with a hook", base + 5 * STRIDE, base + 6 * STRIDE, ITERATIONS);
+	bench("whole module", base, base + size, ITERATIONS / 100);
+
+	region_free(&g_table);
+	munmap(mem, size);
+	return 0;
+}
@@ -0,0 +1,566 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The logging pipeline of the monitor without a Windows guest: loq()'s
+// portable half (logenc.c, bson, utf8.c) runs on N threads behind the same
+// lock, the documents go through the repeat folding into the 16MB log
+// buffer and a log thread sends that to a local socket, just like log.c
+// does.  Reports events and bytes per second, per-call latency and the
+// amount of allocations per call.
+//
+// bench-loq [threads] [calls per thread] [trace.bson]
+//
+// Without a trace the calls follow a fixed mix of APIs; a trace (a .bson
+// file written by tools/logrecv or tools/logreplay gen, or any other
+// capture of a "BSON\n" log connection) is replayed call by call instead,
+// each thread starting over at its end.
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "logenc.h"
+#include "hookctl.h"
+
+#define BUFFERSIZE (16 * 1024 * 1024)
+#define MAX_INDEX 1024
+
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t g_writing_log_buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static char *g_buffer;
+static volatile int g_idx;
+static int g_sock[2];
+static volatile int g_stop;
+
+// the auto-reset event which wakes up the log thread
+static pthread_mutex_t g_flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_flush_cond = PTHREAD_COND_INITIALIZER;
+static int g_flush;
+
+static bson g_bson[1];
+static logenc_t g_enc;
+static lastlog_t lastlog;
+static char logtbl_explained[MAX_INDEX];
+static unsigned short logtbl_slot[MAX_INDEX];
+static double g_start;
+
+static volatile uint64_t g_allocs, g_frees;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size)
+{
+	atomic_add64(&g_allocs, 1);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	atomic_add64(&g_allocs, 1);
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	atomic_add64(&g_allocs, 1);
+	return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+	if (ptr != NULL)
+		atomic_add64(&g_frees, 1);
+	__real_free(ptr);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *log_thread(void *param)
+{
+	struct timespec ts;
+
+	while (!g_stop) {
+		pthread_mutex_lock(&g_flush_mutex);
+		if (!g_flush) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += 500 * 1000000;
+			ts.tv_sec += ts.tv_nsec / 1000000000;
+			ts.tv_nsec %= 1000000000;
+			pthread_cond_timedwait(&g_flush_cond, &g_flush_mutex, &ts);
+		}
+		g_flush = 0;
+		pthread_mutex_unlock(&g_flush_mutex);
+
+		pthread_mutex_lock(&g_writing_log_buffer_mutex);
+		while (g_idx > 0) {
+			int written = (int)send(g_sock[0], g_buffer, g_idx, 0);
+			if (written < 0)
+				continue;
+			if (written < g_idx)
+				memmove(g_buffer, g_buffer + written, g_idx - written);
+			g_idx -= written;
+		}
+		pthread_mutex_unlock(&g_writing_log_buffer_mutex);
+	}
+	return NULL;
+}
+
+static void log_flush(void)
+{
+	pthread_mutex_lock(&g_flush_mutex);
+	g_flush = 1;
+	pthread_cond_signal(&g_flush_cond);
+	pthread_mutex_unlock(&g_flush_mutex);
+	while (g_idx)
+		usleep(50 * 1000);
+}
+
+static void log_raw_direct(const char *buf, size_t length)
+{
+	size_t copiedlen = 0;
+	size_t copylen;
+
+	while (copiedlen != length) {
+		pthread_mutex_lock(&g_writing_log_buffer_mutex);
+		copylen = MIN(length - copiedlen, (size_t)(BUFFERSIZE - g_idx));
+		memcpy(&g_buffer[g_idx], &buf[copiedlen], copylen);
+		g_idx += (int)copylen;
+		copiedlen += copylen;
+		pthread_mutex_unlock(&g_writing_log_buffer_mutex);
+		if (copiedlen != length)
+			log_flush();
+	}
+}
+
+// the receiving end only counts
+static void *reader_thread(void *param)
+{
+	static char buf[256 * 1024];
+	uint64_t *received = param;
+	ssize_t length;
+
+	while ((length = read(g_sock[1], buf, sizeof(buf))) > 0)
+		*received += length;
+	return NULL;
+}
+
+// the info document with the argument names, the first time an API is seen
+static void explain(int index, const char *category, const char *name,
+	const char *fmt, va_list args)
+{
+	char key[4];
+	int argnum = 2;
+	bson b[1];
+
+	logtbl_explained[index] = 1;
+	logtbl_slot[index] = (unsigned short)(hookctl_bind(name, category) + 1);
+
+	bson_init(b);
+	bson_append_int(b, "I", index);
+	bson_append_string(b, "name", name);
+	bson_append_string(b, "type", "info");
+	bson_append_string(b, "category", category);
+	bson_append_start_array(b, "args");
+	bson_append_string(b, "0", "is_success");
+	bson_append_string(b, "1", "retval");
+	for (; *fmt != 0; fmt++) {
+		logenc_num(key, sizeof(key), argnum++);
+		bson_append_string(b, key, va_arg(args, const char *));
+		// the values are skipped by bench_loq(), we only need the names
+		if (strchr("SUbBcCaA", *fmt) != NULL)
+			(void)va_arg(args, void *);
+		(void)va_arg(args, void *);
+	}
+	bson_append_finish_array(b);
+	bson_finish(b);
+	log_raw_direct(bson_data(b), bson_size(b));
+	bson_destroy(b);
+}
+
+// up to the arguments array, returns the compare offset
+static unsigned int call_begin(int index, int slot, int tid, int is_success,
+	uintptr_t return_value)
+{
+	unsigned int compare_offset;
+
+	bson_init(g_bson);
+	logenc_begin(&g_enc, g_bson, slot);
+	bson_append_int(g_bson, "I", index);
+	bson_append_long(g_bson, "C", 0x401000 + index * 16);
+	bson_append_long(g_bson, "R", 0x401000);
+	bson_append_long(g_bson, "P", 0x400000);
+	bson_append_int(g_bson, "T", tid);
+	bson_append_int(g_bson, "t", (int)((now() - g_start) * 1000));
+	bson_append_int(g_bson, "r", 0);
+
+	compare_offset = (unsigned int)(g_bson->cur - bson_data(g_bson));
+
+	bson_append_start_array(g_bson, "args");
+	bson_append_int(g_bson, "0", is_success);
+	logenc_key(&g_enc, 1);
+	logenc_ptr(&g_enc, return_value);
+	return compare_offset;
+}
+
+static void call_end(unsigned int compare_offset)
+{
+	bson_append_finish_array(g_bson);
+	logenc_finish(&g_enc);
+	bson_finish(g_bson);
+	logenc_repeat(&lastlog, bson_data(g_bson), bson_size(g_bson),
+		compare_offset, &log_raw_direct);
+	bson_destroy(g_bson);
+}
+
+// loq() with every specifier from logenc.c, without any repeat counts in
+// the format string
+static void bench_loq(int tid, int index, const char *category,
+	const char *name, int is_success, uintptr_t return_value,
+	const char *fmt, ...)
+{
+	va_list args;
+	unsigned int compare_offset;
+	uint64_t start_cycles;
+	int slot, argnum = 2;
+
+	slot = (int)logtbl_slot[index] - 1;
+	if (slot >= 0 && !hookctl_is_logging(slot)) {
+		hookctl_account(slot, 0, 0);
+		return;
+	}
+
+	start_cycles = read_cycles();
+
+	pthread_mutex_lock(&g_mutex);
+
+	if (logtbl_explained[index] == 0) {
+		va_start(args, fmt);
+		explain(index, category, name, fmt, args);
+		va_end(args);
+		slot = (int)logtbl_slot[index] - 1;
+	}
+
+	va_start(args, fmt);
+	compare_offset = call_begin(index, slot, tid, is_success, return_value);
+	for (; *fmt != 0; fmt++) {
+		(void)va_arg(args, const char *);
+		logenc_key(&g_enc, argnum++);
+		if (logenc_arg(&g_enc, *fmt, &args) < 0) {
+			fprintf(stderr, "unknown format specifier %c\n", *fmt);
+			exit(1);
+		}
+	}
+	va_end(args);
+	call_end(compare_offset);
+
+	hookctl_account(slot, read_cycles() - start_cycles, 1);
+
+	pthread_mutex_unlock(&g_mutex);
+}
+
+static const wchar_t *g_paths[] = {
+	L"C:\\Windows\\System32\\kernel32.dll",
+	L"C:\\Users\\user\\AppData\\Local\\Temp\\sample.exe",
+	L"C:\\Users\\user\\Documents\\\x0424\x0430\x0439\x043b.docx",
+	L"\\??\\C:\\ProgramData\\Microsoft\\Crypto\\RSA\\MachineKeys",
+};
+
+static const wchar_t *g_values[] = {
+	L"ProductName", L"InstallDate", L"Shell", L"ProxyEnable",
+};
+
+// the mix of a typical sample: mostly reads, file opens and registry
+// queries, some sleep loops which get folded and the odd resolve
+static void synthetic_call(int tid, unsigned int r, const char *data)
+{
+	unsigned int pick = r % 100;
+	void *handle = (void *)(uintptr_t)(0x100 + (r >> 8) % 0x400);
+	size_t length = 16 + (r >> 4) % 4096;
+	int info = 1;
+
+	if (pick < 40)
+		bench_loq(tid, 10, "filesystem", "NtReadFile", 1, 0, "pbB",
+			"FileHandle", handle, "Buffer", length, data,
+			"Length", &length, data);
+	else if (pick < 60)
+		bench_loq(tid, 11, "filesystem", "NtCreateFile", 1, 0, "PhuhI",
+			"FileHandle", &handle, "DesiredAccess", 0x80100080,
+			"FileName", g_paths[r % 4], "CreateDisposition", 1,
+			"StatusInformation", &info);
+	else if (pick < 80)
+		bench_loq(tid, 12, "registry", "RegQueryValueExW", 1, 0, "puiS",
+			"Handle", handle, "ValueName", g_values[r % 4], "Type", 1,
+			"Data", 8, "Windows");
+	else if (pick < 95)
+		bench_loq(tid, 13, "system", "NtDelayExecution", 1, 0, "l",
+			"Milliseconds", (void *)(uintptr_t)100);
+	else
+		bench_loq(tid, 14, "system", "LdrGetProcedureAddress", 1, 0, "psl",
+			"ModuleHandle", (void *)0x77000000, "FunctionName",
+			"VirtualAllocEx", "Ordinal", (void *)0);
+}
+
+static const char *g_trace;
+static size_t g_trace_size;
+
+// the arguments of a recorded call go through the logenc primitive that
+// matches their BSON type
+static void replay_call(int tid, const char *doc)
+{
+	bson b[1];
+	bson_iterator it, args;
+	unsigned int compare_offset;
+	uint64_t start_cycles;
+	int index, slot, is_success = 1;
+	int64_t return_value = 0;
+
+	bson_init_finished_data(b, (char *)doc, 0);
+	if (bson_find(&it, b, "I") != BSON_INT)
+		return;
+	index = bson_iterator_int(&it);
+	if (index < 0 || index >= MAX_INDEX || bson_find(&args, b, "args") != BSON_ARRAY)
+		return;
+
+	slot = (int)logtbl_slot[index] - 1;
+	if (slot >= 0 && !hookctl_is_logging(slot)) {
+		hookctl_account(slot, 0, 0);
+		return;
+	}
+
+	start_cycles = read_cycles();
+	pthread_mutex_lock(&g_mutex);
+
+	bson_iterator_subiterator(&args, &it);
+	if (bson_iterator_next(&it) == BSON_INT)
+		is_success = bson_iterator_int(&it);
+	if (bson_iterator_next(&it) != BSON_EOO)
+		return_value = bson_iterator_long(&it);
+
+	compare_offset = call_begin(index, slot, tid, is_success,
+		(uintptr_t)return_value);
+	for (int argnum = 2; bson_iterator_next(&it) != BSON_EOO; argnum++) {
+		logenc_key(&g_enc, argnum);
+		switch (bson_iterator_type(&it)) {
+		case BSON_INT:
+			logenc_int32(&g_enc, bson_iterator_int(&it));
+			break;
+		case BSON_LONG:
+			logenc_int64(&g_enc, bson_iterator_long(&it));
+			break;
+		case BSON_STRING:
+			logenc_string(&g_enc, bson_iterator_string(&it), -1);
+			break;
+		case BSON_BINDATA:
+			// strings are logged as binary as well, the capture limit of
+			// the 'c' specifier keeps them whole
+			logenc_buffer(&g_enc, LOGENC_LARGE_BUFFER_MAX,
+				bson_iterator_bin_data(&it), bson_iterator_bin_len(&it));
+			break;
+		default:
+			bson_append_element(g_bson, g_enc.key, &it);
+			break;
+		}
+	}
+	call_end(compare_offset);
+
+	hookctl_account(slot, read_cycles() - start_cycles, 1);
+	pthread_mutex_unlock(&g_mutex);
+}
+
+// info documents go out once, as they are, everything else is a call
+static void replay_doc(int tid, const char *doc)
+{
+	bson b[1];
+	bson_iterator it;
+	int index;
+
+	bson_init_finished_data(b, (char *)doc, 0);
+	if (bson_find(&it, b, "type") == BSON_EOO) {
+		replay_call(tid, doc);
+		return;
+	}
+	if (strcmp(bson_iterator_string(&it), "info") ||
+			bson_find(&it, b, "I") != BSON_INT)
+		return;
+	index = bson_iterator_int(&it);
+	if (index < 0 || index >= MAX_INDEX)
+		return;
+
+	pthread_mutex_lock(&g_mutex);
+	if (logtbl_explained[index] == 0) {
+		const char *name = "", *category = "";
+		logtbl_explained[index] = 1;
+		if (bson_find(&it, b, "name") == BSON_STRING)
+			name = bson_iterator_string(&it);
+		if (bson_find(&it, b, "category") == BSON_STRING)
+			category = bson_iterator_string(&it);
+		logtbl_slot[index] = (unsigned short)(hookctl_bind(name, category) + 1);
+		log_raw_direct(doc, bson_size(b));
+	}
+	pthread_mutex_unlock(&g_mutex);
+}
+
+typedef struct _worker_t {
+	pthread_t thread;
+	int tid;
+	long calls;
+	uint32_t *latency;
+} worker_t;
+
+static void *worker_thread(void *param)
+{
+	worker_t *w = param;
+	static char data[4096 + 16];
+	unsigned int r = w->tid * 2654435761u + 1;
+	size_t offset = 0;
+
+	for (long i = 0; i < w->calls; i++) {
+		double t0 = now();
+		if (g_trace != NULL) {
+			int32_t length;
+			if (offset + 4 > g_trace_size)
+				offset = 0;
+			memcpy(&length, g_trace + offset, 4);
+			if (length < 5 || offset + length > g_trace_size) {
+				offset = 0;
+				memcpy(&length, g_trace, 4);
+			}
+			replay_doc(w->tid, g_trace + offset);
+			offset += length;
+		}
+		else {
+			r ^= r << 13; r ^= r >> 17; r ^= r << 5;
+			synthetic_call(w->tid, r, data);
+		}
+		w->latency[i] = (uint32_t)MIN((now() - t0) * 1e9, 4e9);
+	}
+	return NULL;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static int load_trace(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	char *buf;
+	long size;
+	int32_t length;
+
+	if (f == NULL || fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 5) {
+		fprintf(stderr, "can't read %s\n", path);
+		return -1;
+	}
+	rewind(f);
+	buf = malloc(size);
+	if (buf == NULL || fread(buf, 1, size, f) != (size_t)size)
+		return -1;
+	fclose(f);
+
+	// captures of a log connection start with the protocol line
+	g_trace = buf;
+	g_trace_size = size;
+	if (!memcmp(buf, "BSON\n", 5)) {
+		g_trace += 5;
+		g_trace_size -= 5;
+	}
+
+	memcpy(&length, g_trace, 4);
+	if (g_trace_size < 5 || length < 5 || length > (int32_t)g_trace_size) {
+		fprintf(stderr, "%s isn't a BSON log\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int threads = argc > 1 ? atoi(argv[1]) : 4;
+	long calls = argc > 2 ? atol(argv[2]) : 200000;
+	pthread_t logger, reader;
+	uint64_t received = 0, allocs, frees;
+	worker_t *workers;
+	uint32_t *latency;
+	double elapsed;
+
+	if (threads < 1 || calls < 1) {
+		fprintf(stderr, "usage: %s [threads] [calls per thread] [trace.bson]\n",
+			argv[0]);
+		return 1;
+	}
+	if (argc > 3 && load_trace(argv[3]) < 0)
+		return 1;
+
+	g_buffer = malloc(BUFFERSIZE);
+	latency = malloc(sizeof(uint32_t) * threads * calls);
+	workers = calloc(threads, sizeof(worker_t));
+	assert(g_buffer != NULL && latency != NULL && workers != NULL);
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, g_sock) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	pthread_create(&logger, NULL, &log_thread, NULL);
+	pthread_create(&reader, NULL, &reader_thread, &received);
+
+	allocs = g_allocs;
+	frees = g_frees;
+	g_start = now();
+	for (int i = 0; i < threads; i++) {
+		workers[i].tid = 1000 + i;
+		workers[i].calls = calls;
+		workers[i].latency = latency + i * calls;
+		pthread_create(&workers[i].thread, NULL, &worker_thread, &workers[i]);
+	}
+	for (int i = 0; i < threads; i++)
+		pthread_join(workers[i].thread, NULL);
+	logenc_repeat_flush(&lastlog, &log_raw_direct);
+	allocs = g_allocs - allocs;
+	frees = g_frees - frees;
+
+	log_flush();
+	g_stop = 1;
+	log_flush();
+	pthread_join(logger, NULL);
+	shutdown(g_sock[0], SHUT_WR);
+	pthread_join(reader, NULL);
+	elapsed = now() - g_start;
+
+	long total = threads * calls;
+	qsort(latency, total, sizeof(uint32_t), &compare_latency);
+	printf("%d threads, %ld calls: %.0f events/s, %.1f MB/s, "
+		"p50 %u ns, p99 %u ns, %.2f allocs/call (%.2f frees)\n",
+		threads, total, total / elapsed, received / elapsed / 1e6,
+		latency[total / 2], latency[total * 99 / 100],
+		(double)allocs / total, (double)frees / total);
+	return 0;
+}
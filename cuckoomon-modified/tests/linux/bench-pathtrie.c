@@ -0,0 +1,135 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compares the linear wcsnicmp() walk is_ignored_file_unicode() used to do
+// with the trie, for 10000 patterns as they'd come from an environment
+// baseline.
+
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+#include "pathtrie.h"
+
+#define PATTERNS 10000
+#define PATHS 1000
+#define ITERATIONS 20
+
+typedef struct {
+	wchar_t text[96];
+	uint32_t length;
+	int begins_with;
+} pattern_t;
+
+static pattern_t g_patterns[PATTERNS];
+static pattern_t g_paths[PATHS];
+
+static void widen(pattern_t *p, const char *s)
+{
+	p->length = 0;
+	while (*s != 0)
+		p->text[p->length++] = (unsigned char)*s++;
+	p->text[p->length] = 0;
+}
+
+static int nicmp(const wchar_t *a, const wchar_t *b, uint32_t length)
+{
+	for (uint32_t i = 0; i < length; i++) {
+		wchar_t x = a[i], y = b[i];
+		if (x >= 'A' && x <= 'Z')
+			x += 'a' - 'A';
+		if (y >= 'A' && y <= 'Z')
+			y += 'a' - 'A';
+		if (x != y)
+			return x - y;
+	}
+	return 0;
+}
+
+// the loop of is_ignored_file_unicode() before the trie
+static int match_linear(const wchar_t *fname, uint32_t length)
+{
+	for (int i = 0; i < PATTERNS; i++) {
+		pattern_t *f = &g_patterns[i];
+		if (!f->begins_with && length == f->length &&
+				!nicmp(fname, f->text, length))
+			return 1;
+		if (f->begins_with && length >= f->length &&
+				!nicmp(fname, f->text, f->length))
+			return 1;
+	}
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main()
+{
+	pathtrie_t t;
+	char s[96];
+	double t0, t1, t2;
+	int hits_linear = 0, hits_trie = 0;
+
+	assert(pathtrie_init(&t) == 0);
+	for (int i = 0; i < PATTERNS; i++) {
+		snprintf(s, sizeof(s), "\\??\\C:\\Program Files\\Vendor%d\\Product%d\\%s%d",
+			i % 97, i % 13, i % 4 == 0 ? "cache\\" : "data", i);
+		widen(&g_patterns[i], s);
+		g_patterns[i].begins_with = i % 4 == 0;
+		assert(pathtrie_add(&t, g_patterns[i].text, g_patterns[i].length,
+			g_patterns[i].begins_with ? PATHTRIE_BEGINS_WITH : PATHTRIE_EXACT) == 0);
+	}
+
+	// a third hits, the others resemble the patterns but don't match
+	for (int i = 0; i < PATHS; i++) {
+		int p = (i * 7919) % PATTERNS;
+		if (i % 3 == 0)
+			snprintf(s, sizeof(s), "\\??\\c:\\PROGRAM FILES\\vendor%d\\product%d\\%s%d%s",
+				p % 97, p % 13, p % 4 == 0 ? "CACHE\\" : "DATA", p,
+				p % 4 == 0 ? "\\entry.bin" : "");
+		else
+			snprintf(s, sizeof(s), "\\??\\C:\\Program Files\\Vendor%d\\Product%d\\log%d.txt",
+				p % 97, p % 13, i);
+		widen(&g_paths[i], s);
+	}
+
+	t0 = now();
+	for (int it = 0; it < ITERATIONS; it++)
+		for (int i = 0; i < PATHS; i++)
+			hits_linear += match_linear(g_paths[i].text, g_paths[i].length);
+	t1 = now();
+	for (int it = 0; it < ITERATIONS; it++)
+		for (int i = 0; i < PATHS; i++)
+			hits_trie += pathtrie_match(&t, g_paths[i].text, g_paths[i].length);
+	t2 = now();
+
+	assert(hits_linear == hits_trie);
+	assert(hits_trie == ITERATIONS * ((PATHS + 2) / 3));
+
+	printf("%d patterns, %u nodes, %u KB\n", PATTERNS, t.node_count,
+		(t.node_size + t.edge_size * (unsigned int)sizeof(pathtrie_edge_t)) / 1024);
+	printf("linear: %8.0f ns/lookup\n", (t1 - t0) * 1e9 / (ITERATIONS * PATHS));
+	printf("trie:   %8.0f ns/lookup\n", (t2 - t1) * 1e9 / (ITERATIONS * PATHS));
+
+	pathtrie_free(&t);
+	return 0;
+}
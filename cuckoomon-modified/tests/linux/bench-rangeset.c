@@ -0,0 +1,74 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Cost of tracking the written ranges per NtWriteFile: a log file being
+// appended to, a file being written in scattered blocks (e.g., a torrent
+// style download or a database) and random small writes which overflow
+// the set and make it coarsen.
+
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+#include "rangeset.h"
+
+#define WRITES 1000000
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, const rangeset_t *s, double t)
+{
+	printf("%-10s %6.1f ns/write, %2u ranges, %llu bytes\n", name,
+		t * 1e9 / WRITES, s->count, (unsigned long long)rangeset_bytes(s));
+}
+
+int main()
+{
+	static rangeset_t s;
+	unsigned int seed = 1;
+	double t0;
+
+	rangeset_init(&s);
+	t0 = now();
+	for (uint64_t i = 0; i < WRITES; i++)
+		rangeset_add(&s, i * 100, 100);
+	report("append", &s, now() - t0);
+	assert(s.count == 1);
+
+	// 32 blocks of 1MB, filled in round robin
+	rangeset_init(&s);
+	t0 = now();
+	for (uint64_t i = 0; i < WRITES; i++)
+		rangeset_add(&s, (i % 32) * 0x100000 + (i / 32) * 4096 % 0x100000, 4096);
+	report("blocks", &s, now() - t0);
+
+	rangeset_init(&s);
+	t0 = now();
+	for (uint64_t i = 0; i < WRITES; i++) {
+		seed = seed * 1103515245 + 12345;
+		rangeset_add(&s, (uint64_t)seed * 16, 16);
+	}
+	report("random", &s, now() - t0);
+	assert(s.count <= RANGESET_MAX);
+
+	return 0;
+}
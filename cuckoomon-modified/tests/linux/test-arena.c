@@ -0,0 +1,150 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define GRAN 0x10000
+
+// addresses in [g_blocked_lo, g_blocked_hi) are considered taken
+static uintptr_t g_blocked_lo, g_blocked_hi;
+
+static void *reserve(void *addr, size_t size)
+{
+	void *ret;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+	if ((uintptr_t)addr + size > g_blocked_lo && (uintptr_t)addr < g_blocked_hi)
+		return NULL;
+
+	if (addr != NULL)
+		flags |= MAP_FIXED_NOREPLACE;
+
+	ret = mmap(addr, size, PROT_READ | PROT_WRITE | PROT_EXEC, flags, -1, 0);
+	if (ret == MAP_FAILED)
+		return NULL;
+
+	// older kernels ignore MAP_FIXED_NOREPLACE and treat it as a hint
+	if (addr != NULL && ret != addr) {
+		munmap(ret, size);
+		return NULL;
+	}
+	return ret;
+}
+
+static void release(void *addr, size_t size)
+{
+	munmap(addr, size);
+}
+
+static void *fail_reserve(void *addr, size_t size)
+{
+	return NULL;
+}
+
+int main()
+{
+	arena_t a;
+	unsigned char *near = (unsigned char *)(uintptr_t)0x300000000000ULL;
+	unsigned char *far = (unsigned char *)(uintptr_t)0x340000000000ULL;
+	unsigned char *p, *q, *r, *blocks[200];
+
+	arena_init(&a, &reserve, &release, GRAN);
+
+	// reach checks
+	assert(arena_in_reach(NULL, near, 16));
+	assert(arena_in_reach(near, near + 0x70000000, 16));
+	assert(arena_in_reach(near + 0x70000000, near, 16));
+	assert(!arena_in_reach(near, near + 0x80000000ULL, 16));
+	assert(!arena_in_reach(near, near + ARENA_REACH - 8, 16));
+
+	// allocations are packed densely near the target
+	p = arena_alloc(&a, near, 332, 0);
+	q = arena_alloc(&a, near, 332, 0);
+	assert(p != NULL && q != NULL);
+	assert(((uintptr_t)p & (ARENA_MIN_ALIGN - 1)) == 0);
+	assert(q == p + 336);
+	assert(arena_in_reach(near, p, 336) && arena_in_reach(near, q, 336));
+	assert(a.reserved == GRAN);
+	memset(p, 0xcc, 332);
+	memset(q, 0xcc, 332);
+
+	for (int i = 0; i < 200; i++) {
+		blocks[i] = arena_alloc(&a, near + i * 0x1000, 332, 0);
+		assert(blocks[i] != NULL);
+		assert(arena_in_reach(near + i * 0x1000, blocks[i], 332));
+	}
+	// 202 * 336 bytes need two chunks only
+	assert(a.reserved == 2 * GRAN);
+
+	// a target far away gets its own chunk
+	r = arena_alloc(&a, far, 64, 0);
+	assert(r != NULL && arena_in_reach(far, r, 64) && !arena_in_reach(near, r, 64));
+	assert(a.reserved == 3 * GRAN);
+
+	// freed blocks are reused, but only if they're in reach
+	arena_free(&a, q, 332);
+	assert(arena_alloc(&a, far, 332, 0) != q);
+	assert(arena_alloc(&a, near, 332, 0) == q);
+
+	// aligned allocations
+	p = arena_alloc(&a, near, 16, 0);
+	q = arena_alloc(&a, near, 64, 64);
+	assert(((uintptr_t)q & 63) == 0 && q > p);
+
+	// the tail of the most recent allocation goes back to its chunk,
+	// otherwise it's kept in a free list
+	p = arena_alloc(&a, near, 128, 0);
+	arena_shrink(&a, p, 128, 20);
+	q = arena_alloc(&a, near, 16, 0);
+	assert(q == p + 32);
+	arena_shrink(&a, p, 32, 16);
+	assert(arena_alloc(&a, near, 16, 0) == p + 16);
+
+	// the search moves outwards when the memory around the target is taken
+	unsigned char *target = (unsigned char *)(uintptr_t)0x380000000000ULL;
+	g_blocked_lo = (uintptr_t)target - 4 * GRAN;
+	g_blocked_hi = (uintptr_t)target + 4 * GRAN;
+	unsigned int attempts = a.reserve_attempts;
+	p = arena_alloc(&a, target, 100, 0);
+	assert(p != NULL && arena_in_reach(target, p, 100));
+	assert((uintptr_t)p + 100 <= g_blocked_lo || (uintptr_t)p >= g_blocked_hi);
+	assert(a.reserve_attempts - attempts > 4);
+
+	// large allocations span several granularity units
+	p = arena_alloc(&a, near, 3 * GRAN, 0);
+	assert(p != NULL);
+	memset(p, 0x90, 3 * GRAN);
+
+	arena_destroy(&a);
+
+	// nothing is ever returned if memory can't be reserved
+	arena_init(&a, &fail_reserve, NULL, GRAN);
+	assert(arena_alloc(&a, near, 16, 0) == NULL);
+	assert(arena_alloc(&a, NULL, 16, 0) == NULL);
+	arena_destroy(&a);
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include "bson.h"
+#include "tools/bsoncheck.h"
+
+static uint8_t g_doc[4096];
+static uint32_t g_size;
+
+static void finish(bson *b)
+{
+	bson_finish(b);
+	g_size = (uint32_t)bson_size(b);
+	assert(g_size <= sizeof(g_doc));
+	memcpy(g_doc, bson_data(b), g_size);
+	bson_destroy(b);
+}
+
+// where the value of the element with the given key starts
+static uint8_t *value_of(const char *key)
+{
+	uint8_t *p = memmem(g_doc + 4, g_size - 4, key, strlen(key) + 1);
+
+	assert(p != NULL);
+	return p + strlen(key) + 1;
+}
+
+static void set_int32(uint8_t *p, int32_t value)
+{
+	memcpy(p, &value, 4);
+}
+
+// a call record like log.c writes them
+static void call(void)
+{
+	bson b[1];
+
+	bson_init(b);
+	bson_append_int(b, "I", 10);
+	bson_append_int(b, "T", 1234);
+	bson_append_int(b, "t", 100);
+	bson_append_start_array(b, "args");
+	bson_append_int(b, "0", 1);
+	bson_append_string(b, "1", "C:\\file.txt");
+	bson_append_binary(b, "2", BSON_BIN_BINARY, "\x00\x01\x02", 3);
+	bson_append_start_object(b, "3");
+	bson_append_long(b, "low", 0x12345678);
+	bson_append_double(b, "d", 1.5);
+	bson_append_finish_object(b);
+	bson_append_finish_array(b);
+	finish(b);
+}
+
+static void walk(const char *data, const char *end)
+{
+	bson_iterator it;
+	int type;
+
+	bson_iterator_from_buffer(&it, data);
+	while ((type = bson_iterator_next(&it)) != BSON_EOO) {
+		const char *value = bson_iterator_value(&it);
+
+		assert(value < end);
+		if (type == BSON_STRING)
+			assert(value + 4 + strlen(bson_iterator_string(&it)) < end);
+		else if (type == BSON_BINDATA)
+			assert(bson_iterator_bin_data(&it) + bson_iterator_bin_len(&it) <= end);
+		else if (type == BSON_OBJECT || type == BSON_ARRAY)
+			walk(value, end);
+	}
+}
+
+// {"a": {"a": ... {}}} with depth objects below the top one
+static uint32_t nested(int depth)
+{
+	uint32_t off = 0, size = 5 + 8 * (uint32_t)depth;
+
+	for (int i = 0; i < depth; i++, size -= 8) {
+		set_int32(g_doc + off, (int32_t)size);
+		memcpy(g_doc + off + 4, "\x03" "a", 3);
+		off += 7;
+	}
+	set_int32(g_doc + off, 5);
+	memset(g_doc + off + 4, 0, 1 + depth);
+	return 5 + 8 * (uint32_t)depth;
+}
+
+int main()
+{
+	bson b[1];
+
+	call();
+	assert(bsoncheck(g_doc, g_size) == 0);
+
+	// the outer size against the buffer and the trailing NUL
+	assert(bsoncheck(g_doc, g_size - 1) < 0);
+	assert(bsoncheck(g_doc, 4) < 0);
+	set_int32(g_doc, 4);
+	assert(bsoncheck(g_doc, g_size) < 0);
+	call();
+	g_doc[g_size - 1] = 1;
+	assert(bsoncheck(g_doc, g_size) < 0);
+
+	// the __process__ notification followed by {I:0, C:<array of 0x7ffffff0>}
+	bson_init(b);
+	bson_append_int(b, "I", 0);
+	bson_append_start_array(b, "C");
+	bson_append_int(b, "0", 1);
+	bson_append_finish_array(b);
+	finish(b);
+	assert(bsoncheck(g_doc, g_size) == 0);
+	set_int32(value_of("C"), 0x7ffffff0);
+	assert(bsoncheck(g_doc, g_size) < 0);
+
+	// nested lengths reaching past their parent, though not past the buffer
+	call();
+	set_int32(value_of("args"), (int32_t)g_size);
+	assert(bsoncheck(g_doc, sizeof(g_doc)) < 0);
+	call();
+	set_int32(value_of("3"), 0x7ffffff0);
+	assert(bsoncheck(g_doc, g_size) < 0);
+	call();
+	set_int32(value_of("3"), 4);
+	assert(bsoncheck(g_doc, g_size) < 0);
+
+	// strings: length, terminator and negative sizes
+	call();
+	set_int32(value_of("1"), 0x7ffffff0);
+	assert(bsoncheck(g_doc, g_size) < 0);
+	call();
+	set_int32(value_of("1"), 0);
+	assert(bsoncheck(g_doc, g_size) < 0);
+	call();
+	set_int32(value_of("1"), 3);
+	assert(bsoncheck(g_doc, g_size) < 0);
+	call();
+	set_int32(value_of("2"), -1);
+	assert(bsoncheck(g_doc, g_size) < 0);
+	call();
+	set_int32(value_of("2"), 0x7ffffff0);
+	assert(bsoncheck(g_doc, g_size) < 0);
+
+	// unknown types, an early end and a key running into the end
+	call();
+	value_of("t")[-3] = 0x42;
+	assert(bsoncheck(g_doc, g_size) < 0);
+	call();
+	value_of("t")[-3] = BSON_EOO;
+	assert(bsoncheck(g_doc, g_size) < 0);
+	memcpy(g_doc, "\x08\x00\x00\x00\x10xx\x00", 8);
+	assert(bsoncheck(g_doc, 8) < 0);
+
+	// whatever passes after changing any byte stays within the document
+	// while the bson library walks it
+	for (uint32_t i = 0; i < g_size; i++) {
+		static const uint8_t values[] = {0x00, 0x01, 0x05, 0x7f, 0x80, 0xff};
+
+		for (uint32_t j = 0; j < sizeof(values); j++) {
+			call();
+			g_doc[i] = values[j];
+			if (bsoncheck(g_doc, g_size) == 0)
+				walk((const char *)g_doc, (const char *)g_doc + g_size);
+		}
+	}
+
+	// nesting is bounded
+	assert(bsoncheck(g_doc, nested(BSONCHECK_MAX_DEPTH)) == 0);
+	assert(bsoncheck(g_doc, nested(BSONCHECK_MAX_DEPTH + 1)) < 0);
+
+	printf("ok\n");
+	return 0;
+}
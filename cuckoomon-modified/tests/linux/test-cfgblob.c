@@ -0,0 +1,292 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include "cfgblob.h"
+
+static uint32_t g_seed = 0x12345678;
+
+static uint32_t rnd(void)
+{
+	// xorshift32, so failures reproduce
+	g_seed ^= g_seed << 13;
+	g_seed ^= g_seed >> 17;
+	g_seed ^= g_seed << 5;
+	return g_seed;
+}
+
+// walks an accepted blob and touches every byte of every value, the copy
+// is exactly size bytes so ASan/valgrind catch reads past its end
+static void check_blob(const uint8_t *data, uint32_t size)
+{
+	uint8_t *copy = malloc(size ? size : 1);
+	cfgblob_t b;
+	cfgblob_section_t s;
+	uint32_t off = 0, count = 0, prev = 0;
+
+	memcpy(copy, data, size);
+	if (cfgblob_open(&b, copy, size) == 0) {
+		assert(b.length <= size);
+		while (cfgblob_next(&b, &off, &s)) {
+			volatile uint32_t sum = 0;
+			assert(off > prev && off <= b.length);
+			assert(s.value >= (const char *)copy + CFGBLOB_HEADER_SIZE);
+			assert(s.value + s.length < (const char *)copy + b.length);
+			for (uint32_t i = 0; i < s.length; i++)
+				sum += (uint8_t)s.value[i];
+			assert(s.value[s.length] == 0);
+			prev = off;
+			count++;
+		}
+		assert(count == b.count);
+		assert(off == b.length || b.count == 0);
+	}
+	free(copy);
+}
+
+static void build(cfgblob_writer_t *w)
+{
+	assert(cfgblob_writer_init(w) == 0);
+	assert(cfgblob_write(w, CFGBLOB_PIPE, "\\\\.\\PIPE\\cuckoo", 15) == 0);
+	assert(cfgblob_write(w, CFGBLOB_FIRST_PROCESS, "1", 1) == 0);
+	assert(cfgblob_write(w, CFGBLOB_RESULTS, "", 0) == 0);
+	assert(cfgblob_write(w, CFGBLOB_HOOK_CONTROL,
+		"hook-disable NtDelayExecution\nhook-disable category:registry", 59) == 0);
+	assert(cfgblob_write(w, 0x7777, "future", 6) == 0);
+	cfgblob_finish(w);
+}
+
+static void test_roundtrip(void)
+{
+	cfgblob_writer_t w;
+	cfgblob_t b;
+	cfgblob_section_t s;
+	uint32_t off = 0, length;
+
+	build(&w);
+	assert(w.length % 4 == 0);
+	assert(cfgblob_open(&b, w.buf, w.length) == 0);
+	assert(b.count == 5 && b.minor == CFGBLOB_MINOR);
+
+	assert(cfgblob_next(&b, &off, &s) && s.id == CFGBLOB_PIPE);
+	assert(s.length == 15 && !strcmp(s.value, "\\\\.\\PIPE\\cuckoo"));
+	// values point into the blob, nothing is copied
+	assert((const uint8_t *)s.value == w.buf + CFGBLOB_HEADER_SIZE + CFGBLOB_SECTION_SIZE);
+	assert(cfgblob_next(&b, &off, &s) && s.id == CFGBLOB_FIRST_PROCESS);
+	assert(!strcmp(s.value, "1"));
+	assert(cfgblob_next(&b, &off, &s) && s.id == CFGBLOB_RESULTS);
+	assert(s.length == 0 && s.value[0] == 0);
+	assert(cfgblob_next(&b, &off, &s) && s.id == CFGBLOB_HOOK_CONTROL);
+	assert(s.length == 59 && strchr(s.value, '\n') != NULL);
+	// unknown sections are handed out as well, the caller skips them
+	assert(cfgblob_next(&b, &off, &s) && s.id == 0x7777);
+	assert(!cfgblob_next(&b, &off, &s));
+	assert(!cfgblob_next(&b, &off, &s));
+
+	assert(!strcmp(cfgblob_find(&b, CFGBLOB_FIRST_PROCESS, &length), "1"));
+	assert(length == 1);
+	assert(cfgblob_find(&b, CFGBLOB_HOST_IP, NULL) == NULL);
+
+	// trailing bytes after the blob are fine, e.g., a preallocated file
+	{
+		uint8_t *big = calloc(1, w.length + 100);
+		memcpy(big, w.buf, w.length);
+		assert(cfgblob_open(&b, big, w.length + 100) == 0);
+		free(big);
+	}
+
+	cfgblob_writer_free(&w);
+
+	// an empty config is valid
+	assert(cfgblob_writer_init(&w) == 0);
+	cfgblob_finish(&w);
+	assert(cfgblob_open(&b, w.buf, w.length) == 0 && b.count == 0);
+	off = 0;
+	assert(!cfgblob_next(&b, &off, &s));
+	cfgblob_writer_free(&w);
+}
+
+static void test_malformed(void)
+{
+	cfgblob_writer_t w;
+	cfgblob_t b;
+	uint8_t *p;
+
+	build(&w);
+	p = w.buf;
+
+	assert(cfgblob_open(&b, NULL, 100) < 0);
+	assert(cfgblob_open(&b, p, CFGBLOB_HEADER_SIZE - 1) < 0);
+	// truncated anywhere
+	for (uint32_t size = 0; size < w.length; size++)
+		assert(cfgblob_open(&b, p, size) < 0);
+
+	// bad magic and version
+	p[0] = 'X';
+	assert(cfgblob_open(&b, p, w.length) < 0);
+	p[0] = 'C';
+	p[4] = CFGBLOB_VERSION + 1;
+	assert(cfgblob_open(&b, p, w.length) < 0);
+	p[4] = CFGBLOB_VERSION;
+	// a newer minor version is fine
+	p[6] = 9;
+	assert(cfgblob_open(&b, p, w.length) == 0 && b.minor == 9);
+
+	// one section more or less than there are
+	p[12]++;
+	assert(cfgblob_open(&b, p, w.length) < 0);
+	p[12] -= 2;
+	assert(cfgblob_open(&b, p, w.length) < 0);
+	p[12]++;
+
+	// a value length running past the end
+	p[CFGBLOB_HEADER_SIZE + 7] = 0x80;
+	assert(cfgblob_open(&b, p, w.length) < 0);
+	p[CFGBLOB_HEADER_SIZE + 7] = 0;
+
+	// missing terminator
+	p[CFGBLOB_HEADER_SIZE + CFGBLOB_SECTION_SIZE + 15] = 'x';
+	assert(cfgblob_open(&b, p, w.length) < 0);
+	p[CFGBLOB_HEADER_SIZE + CFGBLOB_SECTION_SIZE + 15] = 0;
+
+	// total length larger than the data, or beyond the limit
+	p[9]++;
+	assert(cfgblob_open(&b, p, w.length) < 0);
+	p[9]--;
+	assert(cfgblob_open(&b, p, w.length) == 0);
+
+	cfgblob_writer_free(&w);
+
+	// a huge section count doesn't make us loop for long
+	{
+		uint8_t hdr[CFGBLOB_HEADER_SIZE] = {'C', 'M', 'C', 'F', CFGBLOB_VERSION, 0,
+			0, 0, CFGBLOB_HEADER_SIZE, 0, 0, 0, 0xff, 0xff, 0xff, 0xff};
+		assert(cfgblob_open(&b, hdr, sizeof(hdr)) < 0);
+	}
+
+	// the writer refuses values the reader would reject
+	assert(cfgblob_writer_init(&w) == 0);
+	assert(cfgblob_write(&w, CFGBLOB_PIPE, "", CFGBLOB_MAX_SIZE) < 0);
+	cfgblob_writer_free(&w);
+}
+
+static void test_keys(void)
+{
+	assert(cfgblob_key_id("pipe", 4) == CFGBLOB_PIPE);
+	assert(cfgblob_key_id("hook-control", 12) == CFGBLOB_HOOK_CONTROL);
+	assert(cfgblob_key_id("pipe-batch", 10) == CFGBLOB_PIPE_BATCH);
+	assert(cfgblob_key_id("pipe-batch", 4) == CFGBLOB_PIPE);
+	assert(cfgblob_key_id("pip", 3) == 0);
+	assert(cfgblob_key_id("", 0) == 0);
+	assert(!strcmp(cfgblob_key_name(CFGBLOB_RAW_PATHS), "raw-paths"));
+	assert(cfgblob_key_name(0) == NULL);
+
+	// every id maps back onto itself
+	for (uint16_t id = 1; id <= CFGBLOB_HOOK_CONTROL; id++) {
+		const char *name = cfgblob_key_name(id);
+		assert(name != NULL);
+		assert(cfgblob_key_id(name, (uint32_t)strlen(name)) == id);
+	}
+}
+
+// mutates a valid blob in all kinds of ways, whatever the parser accepts
+// has to be safe to walk
+static void test_fuzz(void)
+{
+	cfgblob_writer_t w;
+	uint8_t buf[512];
+	uint32_t accepted = 0;
+
+	build(&w);
+	assert(w.length <= sizeof(buf) - 64);
+
+	for (int round = 0; round < 200000; round++) {
+		uint32_t size = w.length, mutations = 1 + rnd() % 4;
+		cfgblob_t b;
+
+		memcpy(buf, w.buf, w.length);
+		for (uint32_t m = 0; m < mutations; m++) {
+			uint32_t pos = rnd() % size;
+			switch (rnd() % 6) {
+			case 0:
+				buf[pos] ^= 1 << (rnd() % 8);
+				break;
+			case 1:
+				buf[pos] = (uint8_t[]){0, 1, 3, 4, 0x7f, 0x80, 0xfe, 0xff}[rnd() % 8];
+				break;
+			case 2:
+				// hit the length fields in particular
+				pos = rnd() % 2 ? 8 + rnd() % 8 : CFGBLOB_HEADER_SIZE + 4 + rnd() % 4;
+				buf[pos] = (uint8_t)rnd();
+				break;
+			case 3:
+				size = rnd() % (size + 1);
+				if (size == 0)
+					size = 1;
+				break;
+			case 4:
+				while (size < sizeof(buf) && rnd() % 4)
+					buf[size++] = (uint8_t)rnd();
+				break;
+			case 5:
+				memmove(buf + pos, buf + pos + 1, size - pos - 1);
+				size--;
+				if (size == 0)
+					size = 1;
+				break;
+			}
+		}
+
+		check_blob(buf, size);
+		if (cfgblob_open(&b, buf, size) == 0)
+			accepted++;
+	}
+
+	// purely random input, with and without a valid header in front
+	for (int round = 0; round < 100000; round++) {
+		uint32_t size = rnd() % sizeof(buf);
+		for (uint32_t i = 0; i < size; i++)
+			buf[i] = (uint8_t)rnd();
+		if (round % 2 && size >= CFGBLOB_HEADER_SIZE) {
+			memcpy(buf, w.buf, 8);
+			buf[8] = (uint8_t)size;
+			buf[9] = (uint8_t)(size >> 8);
+			buf[10] = buf[11] = 0;
+			buf[12] = (uint8_t)(rnd() % 4);
+			buf[13] = buf[14] = buf[15] = 0;
+		}
+		check_blob(buf, size);
+	}
+
+	// some of the mutations (e.g., in values or the minor version) leave
+	// a valid blob
+	assert(accepted > 0);
+	cfgblob_writer_free(&w);
+}
+
+int main()
+{
+	test_roundtrip();
+	test_malformed();
+	test_keys();
+	test_fuzz();
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include "filehash.h"
+
+static void reference(const void *data, size_t length, char *out)
+{
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	sha256_t s;
+
+	sha256_init(&s);
+	sha256_update(&s, data, length);
+	sha256_final(&s, digest);
+	sha256_hex(digest, out);
+}
+
+int main()
+{
+	static char data[100000];
+	char hex[FILEHASH_HEX_SIZE], ref[FILEHASH_HEX_SIZE];
+	filehash_t h;
+
+	for (size_t i = 0; i < sizeof(data); i++)
+		data[i] = (char)(i * 31 + (i >> 8));
+	reference(data, sizeof(data), ref);
+
+	// sequential writes of varying size
+	filehash_init(&h);
+	for (size_t off = 0, n = 1; off < sizeof(data); off += n, n = n * 3 + 1) {
+		n = MIN(n, sizeof(data) - off);
+		filehash_write(&h, off, data + off, n);
+	}
+	assert(filehash_final(&h, sizeof(data), hex) == 0);
+	assert(!strcmp(hex, ref));
+
+	// the file was truncated or extended behind our back
+	assert(filehash_final(&h, sizeof(data) - 1, hex) < 0);
+	assert(filehash_final(&h, sizeof(data) + 1, hex) < 0);
+
+	// finalizing doesn't end the hash, the handle may still be written to
+	filehash_write(&h, sizeof(data), "x", 1);
+	assert(filehash_final(&h, sizeof(data) + 1, hex) == 0);
+	assert(strcmp(hex, ref) != 0);
+
+	// empty writes and an empty file
+	filehash_init(&h);
+	filehash_write(&h, 12345, data, 0);
+	assert(filehash_final(&h, 0, hex) == 0);
+	assert(!strcmp(hex, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+
+	// a hole makes the hash unusable, even if it's filled in later
+	filehash_init(&h);
+	filehash_write(&h, 0, data, 100);
+	filehash_write(&h, 200, data + 200, 100);
+	filehash_write(&h, 100, data + 100, 100);
+	assert(h.valid == 0);
+	assert(filehash_final(&h, 300, hex) < 0);
+
+	// so does rewriting data that has already been hashed
+	filehash_init(&h);
+	filehash_write(&h, 0, data, 100);
+	filehash_write(&h, 50, data + 50, 100);
+	assert(filehash_final(&h, 150, hex) < 0);
+
+	// and writes of which we don't know where they went
+	filehash_init(&h);
+	filehash_write(&h, 0, data, 100);
+	filehash_invalidate(&h);
+	filehash_write(&h, 100, data + 100, 100);
+	assert(filehash_final(&h, 200, hex) < 0);
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,160 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include "hookctl.h"
+
+#define THREADS 4
+#define CALLS 100000
+
+static void *account_thread(void *param)
+{
+	int slot = *(int *)param;
+	for (int i = 0; i < CALLS; i++)
+		hookctl_account(slot, 10, hookctl_is_logging(slot));
+	return NULL;
+}
+
+int main()
+{
+	const char *cmd;
+	int a, b, c, d;
+
+	a = hookctl_bind("NtReadFile", "filesystem");
+	b = hookctl_bind("NtWriteFile", "filesystem");
+	c = hookctl_bind("RegOpenKeyExA", "registry");
+	assert(a == 0 && b == 1 && c == 2);
+	assert(hookctl_bind("NtReadFile", "filesystem") == a);
+	assert(hookctl_is_logging(a) && hookctl_is_logging(c));
+
+	// unknown slots are always logged
+	assert(hookctl_is_logging(-1) && hookctl_entry(-1) == NULL);
+
+	// single hook
+	cmd = "hook-disable NtReadFile\r\n";
+	assert(hookctl_command(cmd, strlen(cmd)) == HOOKCTL_CMD_OK);
+	assert(!hookctl_is_logging(a) && hookctl_is_logging(b));
+
+	// category, also applies to hooks that are bound later on
+	cmd = "hook-disable category:registry";
+	assert(hookctl_command(cmd, strlen(cmd)) == HOOKCTL_CMD_OK);
+	assert(!hookctl_is_logging(c));
+	d = hookctl_bind("RegSetValueExA", "registry");
+	assert(!hookctl_is_logging(d));
+
+	cmd = "hook-enable category:registry";
+	assert(hookctl_command(cmd, strlen(cmd)) == HOOKCTL_CMD_OK);
+	assert(hookctl_is_logging(c) && hookctl_is_logging(d));
+
+	// disabling a hook before it's ever called sticks
+	assert(hookctl_set_logging("NtDelayExecution", 0) == 0);
+	assert(!hookctl_is_logging(hookctl_bind("NtDelayExecution", "system")));
+
+	// everything
+	cmd = "hook-disable *;hook-stats\nbogus";
+	assert(hookctl_commands(cmd, strlen(cmd)) == HOOKCTL_CMD_STATS);
+	for (int i = 0; i < hookctl_count(); i++)
+		assert(!hookctl_is_logging(i));
+	assert(!hookctl_is_logging(hookctl_bind("NtCreateFile", "filesystem")));
+
+	cmd = "hook-enable *";
+	assert(hookctl_command(cmd, strlen(cmd)) == HOOKCTL_CMD_OK);
+	for (int i = 0; i < hookctl_count(); i++)
+		assert(hookctl_is_logging(i));
+
+	cmd = "hook-disable";
+	assert(hookctl_command(cmd, strlen(cmd)) == HOOKCTL_CMD_ERROR);
+	cmd = "bogus";
+	assert(hookctl_commands(cmd, strlen(cmd)) == HOOKCTL_CMD_ERROR);
+	assert(hookctl_command("", 0) == HOOKCTL_CMD_OK);
+
+	// counters are updated concurrently without a lock
+	hookctl_set_logging("NtWriteFile", 0);
+	pthread_t threads[THREADS];
+	for (int i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, &account_thread, i % 2 ? &a : &b);
+	for (int i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	hookctl_entry_t *ea = hookctl_entry(a), *eb = hookctl_entry(b);
+	assert(ea->calls == CALLS * THREADS / 2 && ea->suppressed == 0);
+	assert(ea->cycles == 10ULL * CALLS * THREADS / 2);
+	assert(eb->calls == CALLS * THREADS / 2);
+	assert(eb->suppressed == CALLS * THREADS / 2 && eb->cycles == 0);
+
+	hookctl_reset();
+	assert(ea->calls == 0 && eb->suppressed == 0);
+
+	// capture limits, the default applies until something is configured
+	hookctl_capture_t cap;
+	hookctl_capture(a, 256, 100, &cap);
+	assert(cap.head == 100 && cap.tail == 0 && cap.flags == 0);
+	hookctl_capture(a, 256, 1000, &cap);
+	assert(cap.head == 256 && cap.tail == 0);
+	hookctl_capture(-1, 256, 1000, &cap);
+	assert(cap.head == 256 && cap.tail == 0 && cap.flags == 0);
+
+	cmd = "capture-limit * 1024";
+	assert(hookctl_command(cmd, strlen(cmd)) == HOOKCTL_CMD_OK);
+	hookctl_capture(a, 256, 1000, &cap);
+	assert(cap.head == 1000 && cap.tail == 0);
+
+	cmd = "capture-limit category:filesystem 64 hash";
+	assert(hookctl_command(cmd, strlen(cmd)) == HOOKCTL_CMD_OK);
+	hookctl_capture(a, 256, 1000, &cap);
+	assert(cap.head == 64 && cap.tail == 0 && cap.flags == HOOKCTL_CAPTURE_HASH);
+
+	cmd = "capture-limit NtWriteFile 101  head-tail hash";
+	assert(hookctl_command(cmd, strlen(cmd)) == HOOKCTL_CMD_OK);
+	hookctl_capture(b, 256, 1000, &cap);
+	assert(cap.head == 51 && cap.tail == 50);
+	assert(cap.flags == (HOOKCTL_CAPTURE_HEAD_TAIL | HOOKCTL_CAPTURE_HASH));
+
+	// a broader setting doesn't override a narrower one
+	cmd = "capture-limit category:filesystem 32";
+	assert(hookctl_command(cmd, strlen(cmd)) == HOOKCTL_CMD_OK);
+	hookctl_capture(b, 256, 1000, &cap);
+	assert(cap.head == 51 && cap.tail == 50);
+	hookctl_capture(a, 256, 1000, &cap);
+	assert(cap.head == 32 && cap.flags == 0);
+
+	// zero restores the default, and settings apply to hooks seen later
+	cmd = "capture-limit NtWriteFile 0";
+	assert(hookctl_command(cmd, strlen(cmd)) == HOOKCTL_CMD_OK);
+	hookctl_capture(b, 256, 1000, &cap);
+	assert(cap.head == 256 && cap.tail == 0);
+	hookctl_capture(hookctl_bind("NtSetInformationFile", "filesystem"), 256,
+		1000, &cap);
+	assert(cap.head == 32);
+	hookctl_capture(hookctl_bind("connect", "network"), 256, 2000, &cap);
+	assert(cap.head == 1024);
+
+	cmd = "capture-limit NtWriteFile";
+	assert(hookctl_command(cmd, strlen(cmd)) == HOOKCTL_CMD_ERROR);
+	cmd = "capture-limit NtWriteFile 12x";
+	assert(hookctl_command(cmd, strlen(cmd)) == HOOKCTL_CMD_ERROR);
+	cmd = "capture-limit NtWriteFile 12 tail";
+	assert(hookctl_command(cmd, strlen(cmd)) == HOOKCTL_CMD_ERROR);
+	cmd = "capture-limit NtWriteFile 99999999999";
+	assert(hookctl_command(cmd, strlen(cmd)) == HOOKCTL_CMD_ERROR);
+
+	printf("ok\n");
+	return 0;
+}
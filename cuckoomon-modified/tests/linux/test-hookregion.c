@@ -0,0 +1,172 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include "hookregion.h"
+
+#define PAGE 0x1000
+
+static struct {
+	uint32_t idx;
+	int what;
+} g_reports[16];
+static unsigned int g_report_count;
+
+static void report(void *ctx, uint32_t idx, int what)
+{
+	g_reports[g_report_count].idx = idx;
+	g_reports[g_report_count].what = what;
+	g_report_count++;
+}
+
+// hooks the function at addr like hook_api() does, returns the region index
+static int hook(region_table_t *t, const char *funcname, uint8_t *addr)
+{
+	uint8_t orig[16];
+
+	memcpy(orig, addr, 16);
+	addr[0] = 0xe9;
+	memset(addr + 1, 0x41, 4);
+	return region_add(t, funcname, addr, orig, addr, 16);
+}
+
+int main()
+{
+	region_table_t t;
+	uint8_t *mem = mmap(NULL, 2 * PAGE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	uint8_t *a = mem + 0x100, *b = mem + 0x200, *c = mem + PAGE + 0x80;
+	uint8_t orig_a[16];
+
+	assert(mem != MAP_FAILED);
+	for (int i = 0; i < 2 * PAGE; i++)
+		mem[i] = (uint8_t)(i * 13);
+	memcpy(orig_a, a, 16);
+
+	assert(region_init(&t, 8, 64, 64, 500, 4000) == 0);
+
+	// a stub leading to the hook, plus the hook itself, share the name
+	assert(region_add(&t, "NtOpenFile", c, c, c, 5) == 0);
+	assert(hook(&t, "NtOpenFile", a) == 1);
+	assert(hook(&t, "NtReadFile", b) == 2);
+	assert(region_add(&t, NULL, c + 16, c + 16, c + 16, 6) == 3);
+	assert(t.names_used == 1 + sizeof("NtOpenFile") + sizeof("NtReadFile"));
+	assert(!strcmp(region_name(&t, 0), "NtOpenFile"));
+	assert(region_name(&t, 0) == region_name(&t, 1));
+	assert(!strcmp(region_name(&t, 2), "NtReadFile"));
+	assert(!strcmp(region_name(&t, 3), ""));
+
+	// the byte pool is exactly as large as the regions
+	assert(t.pool_used == 5 + 16 + 16 + 6);
+	assert(!memcmp(region_orig(&t, 1), orig_a, 16));
+	assert(!memcmp(region_our(&t, 1), a, 16));
+	assert(region_our(&t, 2) == region_our(&t, 1) + 16);
+
+	// no room left in the pool, and empty regions
+	assert(region_add(&t, "X", mem, mem, mem, 32) < 0);
+	assert(region_add(&t, "X", mem, mem, mem, 0) < 0);
+
+	// nothing changed
+	g_report_count = 0;
+	assert(region_scan(&t, &report, NULL) == 0 && g_report_count == 0);
+
+	// somebody removes our hook on NtOpenFile
+	memcpy(a, orig_a, 16);
+	assert(region_scan(&t, &report, NULL) == 1);
+	assert(g_report_count == 1);
+	assert(g_reports[0].idx == 1 && g_reports[0].what == REGION_REMOVED);
+
+	// and modifies the one on NtReadFile, which is reported once
+	b[3] = 0xcc;
+	g_report_count = 0;
+	region_scan(&t, &report, NULL);
+	assert(g_report_count == 1);
+	assert(g_reports[0].idx == 2 && g_reports[0].what == REGION_MODIFIED);
+	b[4] = 0xcc;
+	g_report_count = 0;
+	region_scan(&t, &report, NULL);
+	assert(g_report_count == 0);
+
+	// looking up a range outside of the regions finds nothing
+	uint32_t found[8], pos;
+	pos = region_range_begin(&t, (uintptr_t)mem + PAGE);
+	assert(region_find_range(&t, &pos, (uintptr_t)mem + 2 * PAGE, found, 8) == 0);
+	pos = region_range_begin(&t, 0);
+	assert(region_find_range(&t, &pos, (uintptr_t)mem, found, 8) == 0);
+
+	// nor one which only partially covers a region
+	pos = region_range_begin(&t, (uintptr_t)a + 1);
+	assert(region_find_range(&t, &pos, (uintptr_t)b + 16, found, 8) == 1);
+	assert(found[0] == 2);
+	pos = region_range_begin(&t, (uintptr_t)a);
+	assert(region_find_range(&t, &pos, (uintptr_t)a + 15, found, 8) == 0);
+
+	// the stubs have nothing to restore, the hooks come ordered by address
+	pos = region_range_begin(&t, 0);
+	assert(region_find_range(&t, &pos, UINTPTR_MAX, found, 8) == 2);
+	assert(found[0] == 1 && found[1] == 2);
+
+	// in batches, continuing from the sorted position
+	pos = region_range_begin(&t, 0);
+	assert(region_find_range(&t, &pos, UINTPTR_MAX, found, 1) == 1 && found[0] == 1);
+	assert(region_find_range(&t, &pos, UINTPTR_MAX, found, 1) == 1 && found[0] == 2);
+	assert(region_find_range(&t, &pos, UINTPTR_MAX, found, 1) == 0);
+
+	// NtOpenFile has its original bytes, so it gets our hook back, the
+	// modified NtReadFile is left alone
+	assert(region_restore(&t, 1) == 1);
+	assert(!memcmp(a, region_our(&t, 1), 16));
+	assert(region_restore(&t, 1) == 0);
+	assert(region_restore(&t, 2) == 0);
+	assert(b[3] == 0xcc);
+
+	// regions added later on end up in the right spot
+	assert(hook(&t, "NtClose", mem + 0x40) == 4);
+	pos = region_range_begin(&t, 0);
+	assert(region_find_range(&t, &pos, UINTPTR_MAX, found, 8) == 3);
+	assert(found[0] == 4 && found[1] == 1 && found[2] == 2);
+
+	// regions sharing an address don't get skipped between batches
+	uint8_t zero[2] = { 0, 0 };
+	assert(region_add(&t, "NtClose", mem + 0x40, zero, mem + 0x40, 2) == 5);
+	assert(region_add(&t, "NtClose", mem + 0x40, zero, mem + 0x40, 2) == 6);
+	uint32_t all[8];
+	unsigned int n = 0;
+	pos = region_range_begin(&t, 0);
+	while (region_find_range(&t, &pos, UINTPTR_MAX, found, 1) == 1)
+		all[n++] = found[0];
+	assert(n == 5 && all[0] == 6 && all[1] == 5 && all[2] == 4);
+	assert(all[3] == 1 && all[4] == 2);
+
+	// a region added between batches shifts the rest up, so one comes up
+	// twice but none is skipped
+	pos = region_range_begin(&t, 0);
+	assert(region_find_range(&t, &pos, UINTPTR_MAX, found, 2) == 2);
+	assert(found[0] == 6 && found[1] == 5);
+	assert(region_add(&t, "NtClose", mem + 0x40, zero, mem + 0x40, 1) == 7);
+	assert(region_find_range(&t, &pos, UINTPTR_MAX, found, 8) == 4);
+	assert(found[0] == 5 && found[1] == 4 && found[2] == 1 && found[3] == 2);
+
+	region_free(&t);
+	munmap(mem, 2 * PAGE);
+
+	printf("ok\n");
+	return 0;
+}
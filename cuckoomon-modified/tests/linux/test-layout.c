@@ -0,0 +1,201 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Places fake hooks the way hook_api() does (trampoline, hook data and
+// pre-trampoline from the arena, the trampoline shrunk to its real size) and
+// checks the emitted jumps byte by byte, nothing is ever executed.
+
+#include <assert.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define GRAN 0x10000
+#define FUNCS 64
+#define TRAMP_MAX_SIZE 128
+#define HOOK_DATA_SIZE 16
+#define PRE_TRAMP_SIZE 35
+
+typedef struct _fake_hook_t {
+	unsigned char *func;
+	unsigned char *tramp;
+	unsigned int tramp_size;
+	unsigned char *hook_data;
+	unsigned char *pre_tramp;
+	int is_hot;
+} fake_hook_t;
+
+static void *reserve(void *addr, size_t size)
+{
+	void *ret = mmap(addr, size, PROT_READ | PROT_WRITE | PROT_EXEC,
+		MAP_PRIVATE | MAP_ANONYMOUS | (addr ? MAP_FIXED_NOREPLACE : 0), -1, 0);
+	if (ret == MAP_FAILED)
+		return NULL;
+	if (addr != NULL && ret != addr) {
+		munmap(ret, size);
+		return NULL;
+	}
+	return ret;
+}
+
+static void release(void *addr, size_t size)
+{
+	munmap(addr, size);
+}
+
+static unsigned char *emit_jmp(unsigned char *p, const unsigned char *target)
+{
+	*p++ = 0xe9;
+	*(int32_t *)p = (int32_t)(target - (p + 4));
+	return p + 4;
+}
+
+static const unsigned char *jmp_target(const unsigned char *p)
+{
+	assert(p[0] == 0xe9);
+	return p + 5 + *(const int32_t *)(p + 1);
+}
+
+static void place_hook(arena_t *a, fake_hook_t *h)
+{
+	unsigned char *p;
+
+	// trampoline: the stolen bytes followed by a jump back
+	h->tramp = arena_alloc(a, h->func, TRAMP_MAX_SIZE, h->is_hot ? ARENA_CACHE_LINE : 0);
+	assert(h->tramp != NULL);
+	memcpy(h->tramp, h->func, 5);
+	p = emit_jmp(h->tramp + 5, h->func + 5);
+	h->tramp_size = (unsigned int)(p - h->tramp);
+	arena_shrink(a, h->tramp, TRAMP_MAX_SIZE, h->tramp_size);
+
+	h->hook_data = arena_alloc(a, h->func, HOOK_DATA_SIZE, 0);
+	assert(h->hook_data != NULL);
+
+	// pre-trampoline, ends with the jump to the trampoline
+	h->pre_tramp = arena_alloc(a, h->func, PRE_TRAMP_SIZE, 0);
+	assert(h->pre_tramp != NULL);
+	memset(h->pre_tramp, 0x90, PRE_TRAMP_SIZE - 5);
+	emit_jmp(h->pre_tramp + PRE_TRAMP_SIZE - 5, h->tramp);
+
+	// and the hook itself
+	emit_jmp(h->func, h->pre_tramp);
+}
+
+static void check_hook(fake_hook_t *h, unsigned int idx)
+{
+	// function -> pre-trampoline -> trampoline -> function + 5
+	assert(jmp_target(h->func) == h->pre_tramp);
+	assert(jmp_target(h->pre_tramp + PRE_TRAMP_SIZE - 5) == h->tramp);
+	assert(h->tramp[0] == 0x55 && h->tramp[1] == (unsigned char)idx);
+	assert(jmp_target(h->tramp + 5) == h->func + 5);
+	assert(h->tramp_size == 10);
+}
+
+static void layout(arena_layout_t *out, fake_hook_t *hooks, int hot_only)
+{
+	void *blocks[FUNCS * 3];
+	size_t sizes[FUNCS * 3];
+	unsigned int n = 0;
+
+	for (int i = 0; i < FUNCS; i++) {
+		if (hot_only && !hooks[i].is_hot)
+			continue;
+		blocks[n] = hooks[i].tramp;
+		sizes[n++] = hooks[i].tramp_size;
+		blocks[n] = hooks[i].hook_data;
+		sizes[n++] = HOOK_DATA_SIZE;
+		blocks[n] = hooks[i].pre_tramp;
+		sizes[n++] = PRE_TRAMP_SIZE;
+	}
+	assert(arena_layout(out, blocks, sizes, n) == 0);
+}
+
+static void run(fake_hook_t *hooks, unsigned char *module, int clustered,
+	arena_layout_t *hot)
+{
+	arena_t a;
+
+	arena_init(&a, &reserve, &release, GRAN);
+
+	for (int i = 0; i < FUNCS; i++) {
+		hooks[i].func = module + i * 0x100;
+		// push ebp; <idx>; nop; nop; nop; ret
+		memcpy(hooks[i].func, "\x55\x00\x90\x90\x90\xc3", 6);
+		hooks[i].func[1] = (unsigned char)i;
+		hooks[i].is_hot = clustered && (i % 8) == 0;
+	}
+
+	// hot hooks first, just like set_hooks()
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < FUNCS; i++) {
+			if (hooks[i].is_hot == (pass == 0))
+				place_hook(&a, &hooks[i]);
+		}
+	}
+
+	for (int i = 0; i < FUNCS; i++) {
+		check_hook(&hooks[i], i);
+		assert(arena_in_reach(hooks[i].func, hooks[i].pre_tramp, PRE_TRAMP_SIZE));
+		if (hooks[i].is_hot)
+			assert(((uintptr_t)hooks[i].tramp & (ARENA_CACHE_LINE - 1)) == 0);
+	}
+
+	// trampolines are shrunk, so every hook takes 16 + 16 + 48 bytes
+	assert(a.allocated == FUNCS * 80);
+	assert(a.reserved == GRAN);
+
+	for (int i = 0; i < FUNCS; i++)
+		hooks[i].is_hot = (i % 8) == 0;
+	layout(hot, hooks, 1);
+
+	arena_destroy(&a);
+}
+
+int main()
+{
+	fake_hook_t hooks[FUNCS];
+	arena_layout_t all, spread, clustered;
+	unsigned char *module = reserve((void *)(uintptr_t)0x300000000000ULL, GRAN);
+
+	assert(module != NULL);
+
+	// without clustering, the 8 hot hooks are spread over two pages
+	run(hooks, module, 0, &spread);
+
+	// with it, they are next to each other, each starting at a cache line
+	run(hooks, module, 1, &clustered);
+	layout(&all, hooks, 0);
+
+	printf("all: %u blocks, %u bytes, %u lines, %u pages\n",
+		all.blocks, (unsigned int)all.bytes, all.lines, all.pages);
+	printf("hot spread: %u lines, clustered: %u lines\n",
+		spread.lines, clustered.lines);
+
+	assert(spread.blocks == 24 && clustered.blocks == 24);
+	assert(clustered.lines == 16 && clustered.pages == 1);
+	assert(spread.lines >= clustered.lines && spread.pages == 2);
+
+	munmap(module, GRAN);
+
+	printf("ok\n");
+	return 0;
+}
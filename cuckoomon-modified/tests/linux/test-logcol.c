@@ -0,0 +1,202 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "bson.h"
+#include "tools/logcol.h"
+
+static uint8_t g_log[64 * 1024];
+static size_t g_length;
+
+static void append(bson *b)
+{
+	bson_finish(b);
+	assert(g_length + bson_size(b) <= sizeof(g_log));
+	memcpy(g_log + g_length, bson_data(b), bson_size(b));
+	g_length += bson_size(b);
+	bson_destroy(b);
+}
+
+static void info(int index, const char *name, const char *category,
+	const char *arg1, const char *arg2)
+{
+	bson b[1];
+
+	bson_init(b);
+	bson_append_int(b, "I", index);
+	bson_append_string(b, "name", name);
+	bson_append_string(b, "type", "info");
+	bson_append_string(b, "category", category);
+	bson_append_start_array(b, "args");
+	bson_append_string(b, "0", "is_success");
+	bson_append_string(b, "1", "retval");
+	bson_append_string(b, "2", arg1);
+	bson_append_start_array(b, "3");
+	bson_append_string(b, "0", arg2);
+	bson_append_string(b, "1", "path");
+	bson_append_finish_array(b);
+	bson_append_finish_array(b);
+	append(b);
+}
+
+static void call_begin(bson *b, int index, int tid, int tick)
+{
+	bson_init(b);
+	bson_append_int(b, "I", index);
+	bson_append_long(b, "C", 0x401000);
+	bson_append_int(b, "R", (int)0x80001000);
+	bson_append_long(b, "P", 0x400000);
+	bson_append_int(b, "T", tid);
+	bson_append_int(b, "t", tick);
+	bson_append_int(b, "r", 0);
+	bson_append_start_array(b, "args");
+	bson_append_int(b, "0", 1);
+	bson_append_long(b, "1", 0);
+}
+
+static void create_file(int tid, int tick, int handle, const char *path)
+{
+	bson b[1];
+
+	call_begin(b, 10, tid, tick);
+	bson_append_int(b, "2", handle);
+	bson_append_binary(b, "3", BSON_BIN_BINARY, path, strlen(path));
+	bson_append_finish_array(b);
+	append(b);
+}
+
+int main()
+{
+	char path[] = "/tmp/test-logcol-XXXXXX";
+	logcol_stats_t stats;
+	logcol_t c;
+	bson b[1];
+	int fd;
+
+	memcpy(g_log, "BSON\n", 5);
+	g_length = 5;
+
+	info(10, "NtCreateFile", "filesystem", "FileHandle", "FileName");
+	create_file(100, 1, 4, "C:\\Windows\\system32\\ntdll.dll");
+	create_file(101, 2, 8, "C:\\Users\\me\\a.txt");
+	create_file(100, 3, 12, "c:\\windows\\win.ini");
+
+	// before the info record, and something which isn't a call at all
+	call_begin(b, 11, 100, 4);
+	bson_append_finish_array(b);
+	append(b);
+	bson_init(b);
+	bson_append_string(b, "type", "debug");
+	append(b);
+
+	info(11, "RegOpenKeyExW", "registry", "Handle", "SubKey");
+	call_begin(b, 11, 100, 5);
+	bson_append_long(b, "2", -1);
+	bson_append_binary(b, "3", BSON_BIN_BINARY, "Software", 8);
+	// more than the info record knows of
+	bson_append_string(b, "4", "C:\\Windows");
+	bson_append_finish_array(b);
+	append(b);
+
+	// a string where a number was before, and a missing argument
+	call_begin(b, 10, 102, 6);
+	bson_append_string(b, "2", "C:\\Windows\\notepad.exe");
+	bson_append_finish_array(b);
+	append(b);
+
+	// index 10 described again, like for a new log connection
+	info(10, "NtCreateFile", "filesystem", "FileHandle", "FileName");
+	create_file(103, 7, 16, "C:\\Windows\\explorer.exe");
+
+	// a call whose arguments claim more than the whole log
+	size_t bad = g_length;
+	create_file(103, 8, 20, "C:\\Windows\\bad.exe");
+	uint8_t *args = memmem(g_log + bad, g_length - bad, "\x04" "args", 6);
+	assert(args != NULL);
+	memcpy(args + 6, "\xf0\xff\xff\x7f", 4);
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	assert(logcol_write(g_log, g_length, path, &stats) == 0);
+	assert(stats.documents == 12 && stats.calls == 6 && stats.unknown == 3);
+
+	assert(logcol_open(&c, path) == 0);
+	assert(c.header->calls == 6 && c.header->group_count == 3);
+
+	// groups are sorted by name, a name can come up more than once
+	const logcol_group_t *g = logcol_group(&c, "NtCreateFile");
+	assert(g == &c.groups[0] && g->rows == 4 && g->index == 10);
+	assert(c.groups[1].rows == 1 && c.groups[1].index == 10);
+	assert(!strcmp(logcol_string(&c, c.groups[1].name, NULL), "NtCreateFile"));
+	assert(!strcmp(logcol_string(&c, g->category, NULL), "filesystem"));
+	assert(logcol_group(&c, "NtCreateFil") == NULL);
+	assert(logcol_group(&c, "NtCreateFileA") == NULL);
+
+	const logcol_column_t *seq = logcol_column(&c, g, "#");
+	const logcol_column_t *thread = logcol_column(&c, g, "T");
+	const logcol_column_t *ret = logcol_column(&c, g, "R");
+	const logcol_column_t *handle = logcol_column(&c, g, "FileHandle");
+	const logcol_column_t *name = logcol_column(&c, g, "FileName");
+	assert(seq != NULL && thread != NULL && handle != NULL && name != NULL);
+	assert(logcol_column(&c, g, "SubKey") == NULL);
+	assert(logcol_values(&c, seq)[0] == 1 && logcol_values(&c, seq)[3] == 8);
+	assert(logcol_values(&c, thread)[1] == 101);
+	assert(logcol_values(&c, ret)[0] == 0x80001000);
+
+	assert(handle->kind == LOGCOL_MIXED);
+	assert(logcol_kind(&c, handle, 0) == LOGCOL_INT);
+	assert(logcol_kind(&c, handle, 3) == LOGCOL_STRING);
+	assert(logcol_values(&c, handle)[2] == 12);
+	assert(name->kind == LOGCOL_MIXED && logcol_kind(&c, name, 3) == LOGCOL_NONE);
+
+	uint32_t length;
+	const char *s = logcol_string(&c, (uint32_t)logcol_values(&c, name)[1], &length);
+	assert(length == 17 && !strcmp(s, "C:\\Users\\me\\a.txt"));
+
+	// prefix filters
+	uint64_t rows[4];
+	uint8_t *match = logcol_match_prefix(&c, "C:\\Windows\\", 0);
+	assert(logcol_filter(&c, g, name, match, rows) == 1 && rows[0] == 0);
+	assert(logcol_filter(&c, g, handle, match, rows) == 1 && rows[0] == 3);
+	free(match);
+
+	match = logcol_match_prefix(&c, "C:\\Windows\\", LOGCOL_NOCASE);
+	assert(logcol_filter(&c, g, name, match, rows) == 2);
+	assert(rows[0] == 0 && rows[1] == 2);
+	assert(logcol_filter(&c, g, seq, match, rows) == 0);
+	free(match);
+
+	// columns the info record didn't name are named by position
+	g = logcol_group(&c, "RegOpenKeyExW");
+	assert(g != NULL && g->rows == 1 && g->column_count == LOGCOL_FIXED + 5);
+	const logcol_column_t *extra = logcol_column(&c, g, "4");
+	assert(extra != NULL && extra->kind == LOGCOL_STRING);
+	assert(logcol_values(&c, logcol_column(&c, g, "Handle"))[0] == (uint64_t)-1);
+	logcol_close(&c);
+
+	// a file which was cut short
+	assert(truncate(path, 200) == 0);
+	assert(logcol_open(&c, path) < 0);
+	unlink(path);
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,245 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include "logenc.h"
+#include "hookctl.h"
+
+static logenc_t g_enc;
+
+// the argument loop of loq(), minus the argument names
+static int encode(bson *b, int slot, const char *fmt, ...)
+{
+	va_list args;
+	int argnum = 2, ret = 0;
+
+	va_start(args, fmt);
+	bson_init(b);
+	logenc_begin(&g_enc, b, slot);
+	bson_append_start_array(b, "args");
+	for (; *fmt != 0; fmt++) {
+		logenc_key(&g_enc, argnum++);
+		if (logenc_arg(&g_enc, *fmt, &args) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	bson_append_finish_array(b);
+	logenc_finish(&g_enc);
+	bson_finish(b);
+	va_end(args);
+	return ret;
+}
+
+static void arg(bson *b, const char *key, bson_iterator *it)
+{
+	bson_iterator args;
+
+	assert(bson_find(&args, b, "args") == BSON_ARRAY);
+	bson_iterator_subiterator(&args, it);
+	while (bson_iterator_next(it) != BSON_EOO)
+		if (!strcmp(bson_iterator_key(it), key))
+			return;
+	assert(0);
+}
+
+static int arg_bin(bson *b, const char *key, const char *data, int length)
+{
+	bson_iterator it;
+
+	arg(b, key, &it);
+	return bson_iterator_type(&it) == BSON_BINDATA &&
+		bson_iterator_bin_len(&it) == length &&
+		!memcmp(bson_iterator_bin_data(&it), data, length);
+}
+
+static char g_emitted[4][256];
+static size_t g_emitted_length[4];
+static int g_emit_count;
+
+static void emit(const char *buf, size_t length)
+{
+	assert(g_emit_count < 4 && length <= sizeof(g_emitted[0]));
+	memcpy(g_emitted[g_emit_count], buf, length);
+	g_emitted_length[g_emit_count++] = length;
+}
+
+// a call document as loq() builds it, with the repeat counter right before
+// the compared part
+static unsigned int call(bson *b, int tick, int value)
+{
+	unsigned int compare_offset;
+
+	bson_init(b);
+	bson_append_int(b, "I", 42);
+	bson_append_int(b, "t", tick);
+	bson_append_int(b, "r", 0);
+	compare_offset = (unsigned int)(b->cur - bson_data(b));
+	bson_append_start_array(b, "args");
+	bson_append_int(b, "0", value);
+	bson_append_finish_array(b);
+	bson_finish(b);
+	return compare_offset;
+}
+
+int main()
+{
+	char num[4], big[1000];
+	bson b[1];
+	bson_iterator it;
+
+	logenc_num(num, sizeof(num), 0);
+	assert(!strcmp(num, "0"));
+	logenc_num(num, sizeof(num), 107);
+	assert(!strcmp(num, "107"));
+	logenc_num(num, sizeof(num), 12345);
+	assert(!strcmp(num, "123"));
+
+	// strings come out as utf-8 in binary elements
+	const char *argv[] = { "a", "bc" };
+	const wchar_t *wargv[] = { L"\x20ac" };
+	int ival = 7;
+	void *ptr = (void *)0x1234;
+	assert(encode(b, -1, "sSuUiIpLaA", "hello", 3, "abcdef", L"w\xe9",
+		2, L"xyz", -5, &ival, (void *)0xdead, &ptr, 2, argv, 1, wargv) == 0);
+	assert(arg_bin(b, "2", "hello", 5));
+	assert(arg_bin(b, "3", "abc", 3));
+	assert(arg_bin(b, "4", "w\xc3\xa9", 3));
+	assert(arg_bin(b, "5", "xy", 2));
+	arg(b, "6", &it);
+	assert(bson_iterator_int(&it) == -5);
+	arg(b, "7", &it);
+	assert(bson_iterator_int(&it) == 7);
+	arg(b, "8", &it);
+	assert(bson_iterator_long(&it) == 0xdead);
+	arg(b, "9", &it);
+	assert(bson_iterator_long(&it) == 0x1234);
+	arg(b, "10", &it);
+	assert(bson_iterator_type(&it) == BSON_ARRAY);
+	arg(b, "11", &it);
+	bson_iterator sub;
+	bson_iterator_subiterator(&it, &sub);
+	assert(bson_iterator_next(&sub) == BSON_BINDATA);
+	assert(bson_iterator_bin_len(&sub) == 3);
+	assert(bson_find(&it, b, "b") == BSON_EOO);
+	bson_destroy(b);
+
+	// 64-bit integers stay 64-bit whatever the pointer size
+	assert(encode(b, -1, "qi", 0x123456789abcdef0ULL, 3) == 0);
+	arg(b, "2", &it);
+	assert(bson_iterator_type(&it) == BSON_LONG);
+	assert((uint64_t)bson_iterator_long(&it) == 0x123456789abcdef0ULL);
+	arg(b, "3", &it);
+	assert(bson_iterator_int(&it) == 3);
+	bson_destroy(b);
+
+	// NULL strings and pointers
+	assert(encode(b, -1, "suIL", NULL, NULL, NULL, NULL) == 0);
+	assert(arg_bin(b, "2", "", 0) && arg_bin(b, "3", "", 0));
+	arg(b, "4", &it);
+	assert(bson_iterator_int(&it) == 0);
+	bson_destroy(b);
+
+	// the rest is up to log.c
+	assert(encode(b, -1, "iF", 1, L"c:\\x") == -1);
+	bson_destroy(b);
+
+	// buffers are cut at the default limit of their specifier
+	for (int i = 0; i < (int)sizeof(big); i++)
+		big[i] = (char)i;
+	size_t biglen = sizeof(big);
+	assert(encode(b, -1, "bCb", sizeof(big), big, &biglen, big, 0, NULL) == 0);
+	assert(arg_bin(b, "2", big, LOGENC_BUFFER_MAX));
+	assert(arg_bin(b, "3", big, sizeof(big)));
+	assert(arg_bin(b, "4", "", 0));
+	assert(bson_find(&it, b, "b") == BSON_EOO);
+	bson_destroy(b);
+
+	// head + tail capture with a hash of the whole buffer, reported in "b"
+	int slot = hookctl_bind("NtWriteFile", "filesystem");
+	const char *cmd = "capture-limit NtWriteFile 100 head-tail hash";
+	assert(hookctl_command(cmd, strlen(cmd)) == HOOKCTL_CMD_OK);
+	assert(encode(b, slot, "ib", 1, sizeof(big), big) == 0);
+	arg(b, "3", &it);
+	assert(bson_iterator_bin_len(&it) == 100);
+	assert(!memcmp(bson_iterator_bin_data(&it), big, 50));
+	assert(!memcmp(bson_iterator_bin_data(&it) + 50, big + sizeof(big) - 50, 50));
+
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	char hex[SHA256_DIGEST_SIZE * 2 + 1];
+	sha256_t sha;
+	sha256_init(&sha);
+	sha256_update(&sha, big, sizeof(big));
+	sha256_final(&sha, digest);
+	sha256_hex(digest, hex);
+
+	bson_iterator trunc, info;
+	assert(bson_find(&it, b, "b") == BSON_OBJECT);
+	bson_iterator_subiterator(&it, &trunc);
+	assert(bson_iterator_next(&trunc) == BSON_OBJECT);
+	assert(!strcmp(bson_iterator_key(&trunc), "3"));
+	bson_iterator_subiterator(&trunc, &info);
+	assert(bson_iterator_next(&info) == BSON_LONG);
+	assert(bson_iterator_long(&info) == sizeof(big));
+	assert(bson_iterator_next(&info) == BSON_INT);
+	assert(bson_iterator_int(&info) == 50);
+	assert(bson_iterator_next(&info) == BSON_STRING);
+	assert(!strcmp(bson_iterator_string(&info), hex));
+	assert(bson_iterator_next(&trunc) == BSON_EOO);
+	bson_destroy(b);
+
+	// short buffers aren't reported
+	assert(encode(b, slot, "b", 10, big) == 0);
+	assert(arg_bin(b, "2", big, 10));
+	assert(bson_find(&it, b, "b") == BSON_EOO);
+	bson_destroy(b);
+
+	// repeated calls which only differ before the compare offset are
+	// folded into the first one's counter
+	lastlog_t last = { 0 };
+	unsigned int offset;
+
+	offset = call(b, 100, 1);
+	logenc_repeat(&last, bson_data(b), bson_size(b), offset, &emit);
+	bson_destroy(b);
+	offset = call(b, 200, 1);
+	logenc_repeat(&last, bson_data(b), bson_size(b), offset, &emit);
+	bson_destroy(b);
+	offset = call(b, 300, 1);
+	logenc_repeat(&last, bson_data(b), bson_size(b), offset, &emit);
+	bson_destroy(b);
+	assert(g_emit_count == 0);
+
+	offset = call(b, 400, 2);
+	logenc_repeat(&last, bson_data(b), bson_size(b), offset, &emit);
+	bson_destroy(b);
+	assert(g_emit_count == 1);
+	logenc_repeat_flush(&last, &emit);
+	assert(g_emit_count == 2 && last.buf == NULL);
+
+	bson_init_finished_data(b, g_emitted[0], 0);
+	assert(bson_find(&it, b, "t") == BSON_INT && bson_iterator_int(&it) == 100);
+	assert(bson_find(&it, b, "r") == BSON_INT && bson_iterator_int(&it) == 2);
+	bson_init_finished_data(b, g_emitted[1], 0);
+	assert(bson_find(&it, b, "t") == BSON_INT && bson_iterator_int(&it) == 400);
+	assert(bson_find(&it, b, "r") == BSON_INT && bson_iterator_int(&it) == 0);
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bson.h"
+#include "tools/logidx.h"
+
+#define CALLS 1000
+
+static FILE *g_fp;
+static uint64_t g_offsets[CALLS + 16];
+static uint32_t g_ticks[CALLS + 16];
+static int g_documents;
+static uint64_t g_size;
+
+static void append(bson *b, uint32_t tick)
+{
+	bson_finish(b);
+	g_offsets[g_documents] = g_size;
+	g_ticks[g_documents++] = tick;
+	g_size += bson_size(b);
+	assert(fwrite(bson_data(b), 1, bson_size(b), g_fp) == (size_t)bson_size(b));
+	bson_destroy(b);
+}
+
+static void info(int index, const char *name)
+{
+	bson b[1];
+
+	bson_init(b);
+	bson_append_int(b, "I", index);
+	bson_append_string(b, "name", name);
+	bson_append_string(b, "type", "info");
+	bson_append_string(b, "category", "test");
+	append(b, 0);
+}
+
+static void call(int index, int tid, uint32_t tick)
+{
+	bson b[1];
+
+	bson_init(b);
+	bson_append_int(b, "I", index);
+	bson_append_long(b, "C", 0x401000);
+	bson_append_int(b, "T", tid);
+	bson_append_int(b, "t", tick);
+	bson_append_int(b, "r", 0);
+	bson_append_start_array(b, "args");
+	bson_append_int(b, "0", 1);
+	bson_append_finish_array(b);
+	append(b, tick);
+}
+
+// with the arguments before the timestamp, returns the file offset of
+// their length
+static uint64_t call_args_first(int index, int tid, uint32_t tick)
+{
+	uint64_t offset;
+	bson b[1];
+
+	bson_init(b);
+	bson_append_int(b, "I", index);
+	bson_append_int(b, "T", tid);
+	bson_append_start_array(b, "args");
+	bson_append_int(b, "0", 1);
+	bson_append_finish_array(b);
+	bson_append_int(b, "t", tick);
+	bson_finish(b);
+	offset = g_size + ((const uint8_t *)memmem(bson_data(b), bson_size(b),
+		"\x04" "args", 6) - (const uint8_t *)bson_data(b)) + 6;
+	append(b, tick);
+	return offset;
+}
+
+int main()
+{
+	char log_path[] = "/tmp/test-logidx-XXXXXX", index_path[64];
+	const logidx_list_t *l;
+	logidx_stats_t stats;
+	logidx_t x;
+	int fd;
+
+	fd = mkstemp(log_path);
+	assert(fd >= 0);
+	g_fp = fdopen(fd, "wb");
+	snprintf(index_path, sizeof(index_path), "%s.idx", log_path);
+
+	assert(fwrite("BSON\n", 1, 5, g_fp) == 5);
+	g_size = 5;
+	info(1, "NtReadFile");
+	info(2, "NtWriteFile");
+
+	// three threads, a timestamp every other call, and a gap in time
+	for (int i = 0; i < CALLS; i++) {
+		if (i == CALLS / 2)
+			info(2, "NtReadFile");
+		call(1 + i % 2, 100 + i % 3, i / 2 + (i >= 600 ? 10000 : 0));
+	}
+	call(3, 100, 20000);
+	fclose(g_fp);
+
+	assert(logidx_build(log_path, index_path, 16, &stats) == 0);
+	assert(stats.documents == (uint64_t)g_documents && stats.calls == CALLS + 1);
+	assert(stats.unknown == 1);
+
+	assert(logidx_open(&x, log_path, index_path) == 0);
+	assert(x.header->log_size == g_size && x.header->stride == 16);
+
+	// by document number
+	for (int n = 0; n < g_documents; n++)
+		assert(logidx_seek_document(&x, n) == (int64_t)g_offsets[n]);
+	assert(logidx_seek_document(&x, g_documents) == -1);
+
+	// by time, the first call at or after it
+	for (uint32_t tick = 0; tick < 20005; tick += tick < 600 ? 1 : 97) {
+		int64_t expected = -1;
+		for (int n = 0; n < g_documents; n++) {
+			if (logidx_tick(&x, g_offsets[n]) != g_ticks[n])
+				assert(0);
+			if (n > 1 && n != CALLS / 2 + 2 && g_ticks[n] >= tick) {
+				expected = g_offsets[n];
+				break;
+			}
+		}
+		assert(logidx_seek_time(&x, tick) == expected);
+	}
+	assert(logidx_seek_time(&x, 20001) == -1);
+
+	// threads
+	assert(x.header->thread_count == 3);
+	l = logidx_thread(&x, 101);
+	assert(l != NULL && l->count == CALLS / 3);
+	assert(logidx_thread(&x, 99) == NULL && logidx_thread(&x, 103) == NULL);
+	l = logidx_thread(&x, 100);
+	assert(l->count == CALLS / 3 + 1 + 1 && l->t_first == 0 && l->t_last == 20000);
+	for (uint64_t i = 0; i < l->count; i++)
+		assert(logidx_tick(&x, logidx_offsets(&x, l)[i]) ==
+			(i == l->count - 1 ? 20000 : (i * 3) / 2 + (i * 3 >= 600 ? 10000 : 0)));
+	assert(logidx_list_seek_time(&x, l, 0) == 0);
+	assert(logidx_list_seek_time(&x, l, 10000) == 200);
+	assert(logidx_list_seek_time(&x, l, 20001) == l->count);
+
+	// the calls of index 2 count as NtReadFile once it's described as that
+	assert(x.header->api_count == 2);
+	l = logidx_api(&x, "NtReadFile");
+	assert(l != NULL && l->count == CALLS / 2 + CALLS / 4);
+	l = logidx_api(&x, "NtWriteFile");
+	assert(l != NULL && l->count == CALLS / 4 && l->t_first == 0);
+	assert(logidx_api(&x, "NtCreateFile") == NULL && logidx_api(&x, "") == NULL);
+	logidx_close(&x);
+
+	// the log may grow after indexing, a partial document at its end is
+	// left out
+	g_fp = fopen(log_path, "ab");
+	assert(fwrite("\x20\0\0\0\x10", 1, 5, g_fp) == 5);
+	fclose(g_fp);
+	assert(logidx_open(&x, log_path, index_path) == 0);
+	logidx_close(&x);
+	assert(logidx_build(log_path, index_path, 16, &stats) == 0);
+	assert(stats.documents == (uint64_t)g_documents);
+	assert(logidx_open(&x, log_path, index_path) == 0);
+	assert(x.header->log_size == g_size);
+	logidx_close(&x);
+
+	// but not shrink, and the index has to be complete
+	assert(truncate(log_path, 100) == 0);
+	assert(logidx_open(&x, log_path, index_path) < 0);
+	assert(logidx_build(log_path, index_path, 16, &stats) == 0);
+	assert(truncate(index_path, 100) == 0);
+	assert(logidx_open(&x, log_path, index_path) < 0);
+
+	// a document changed after indexing, with a length reaching past the
+	// log, is neither parsed by the lookups nor indexed
+	g_fp = fopen(log_path, "wb");
+	assert(fwrite("BSON\n", 1, 5, g_fp) == 5);
+	g_size = 5;
+	g_documents = 0;
+	info(1, "NtReadFile");
+	uint64_t bad = call_args_first(1, 100, 5);
+	call_args_first(1, 100, 6);
+	fclose(g_fp);
+	assert(logidx_build(log_path, index_path, 16, &stats) == 0);
+	assert(stats.calls == 2);
+
+	fd = open(log_path, O_WRONLY);
+	assert(fd >= 0 && pwrite(fd, "\xf0\xff\xff\x7f", 4, bad) == 4);
+	close(fd);
+	assert(logidx_open(&x, log_path, index_path) == 0);
+	assert(logidx_document(&x, g_offsets[1]) == 0);
+	assert(logidx_document(&x, g_offsets[2]) == g_size - g_offsets[2]);
+	assert(logidx_tick(&x, g_offsets[1]) == 0);
+	assert(logidx_tick(&x, g_offsets[2]) == 6);
+	assert(logidx_seek_time(&x, 5) == (int64_t)g_offsets[2]);
+	l = logidx_thread(&x, 100);
+	assert(l != NULL && l->count == 2);
+	assert(logidx_list_seek_time(&x, l, 6) == 1);
+	logidx_close(&x);
+
+	assert(logidx_build(log_path, index_path, 16, &stats) == 0);
+	assert(stats.documents == 3 && stats.calls == 1);
+
+	unlink(log_path);
+	unlink(index_path);
+	printf("ok\n");
+	return 0;
+}
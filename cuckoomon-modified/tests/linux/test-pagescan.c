@@ -0,0 +1,115 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include "pagescan.h"
+
+#define PAGE 0x1000
+
+static uint32_t g_seen[64];
+static unsigned int g_seen_count;
+
+static void changed(void *ctx, uint32_t idx)
+{
+	g_seen[g_seen_count++] = idx;
+}
+
+static int seen(uint32_t idx)
+{
+	for (unsigned int i = 0; i < g_seen_count; i++) {
+		if (g_seen[i] == idx)
+			return 1;
+	}
+	return 0;
+}
+
+static unsigned int scan(pagescan_t *s)
+{
+	g_seen_count = 0;
+	return pagescan_scan(s, &changed, NULL);
+}
+
+int main()
+{
+	pagescan_t s;
+	uint8_t *mem = mmap(NULL, 4 * PAGE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	assert(mem != MAP_FAILED);
+	for (int i = 0; i < 4 * PAGE; i++)
+		mem[i] = (uint8_t)(i * 7);
+
+	assert(pagescan_init(&s, 16, 500, 4000) == 0);
+
+	// two regions in the first page, one crossing into the second, one in
+	// the fourth page
+	assert(pagescan_add(&s, 0, mem + 0x10, 16) == 0);
+	assert(pagescan_add(&s, 1, mem + 0x200, 5) == 0);
+	assert(pagescan_add(&s, 2, mem + PAGE - 8, 16) == 0);
+	assert(pagescan_add(&s, 3, mem + 3 * PAGE + 0x40, 6) == 0);
+	assert(s.page_count == 2);
+	assert(pagescan_add(&s, 16, mem, 16) < 0);
+
+	// nothing changed, the interval backs off up to the maximum
+	assert(scan(&s) == 0 && g_seen_count == 0);
+	assert(s.interval == 1000);
+	assert(scan(&s) == 0 && s.interval == 2000);
+	assert(scan(&s) == 0 && s.interval == 4000);
+	assert(scan(&s) == 0 && s.interval == 4000);
+
+	// bytes outside of any region don't matter
+	mem[0x100] ^= 0xff;
+	mem[2 * PAGE + 5] ^= 0xff;
+	assert(scan(&s) == 0);
+
+	// a change in a region reports all regions of its page, once
+	mem[0x203] ^= 0xff;
+	assert(scan(&s) == 1 && g_seen_count == 3);
+	assert(seen(0) && seen(1) && seen(2) && !seen(3));
+	assert(s.interval == 500);
+	assert(scan(&s) == 0 && g_seen_count == 0);
+
+	// the part of a region in the next page belongs to its first page
+	mem[PAGE + 4] ^= 0xff;
+	assert(scan(&s) == 1 && seen(2) && !seen(3));
+
+	mem[3 * PAGE + 0x45] ^= 0xff;
+	assert(scan(&s) == 1 && g_seen_count == 1 && seen(3));
+
+	// restoring the original bytes is a change as well
+	mem[3 * PAGE + 0x45] ^= 0xff;
+	assert(scan(&s) == 1 && seen(3));
+
+	// adding a region to a known page keeps the page unchanged, and resets
+	// the interval
+	scan(&s);
+	assert(s.interval == 1000);
+	assert(pagescan_add(&s, 4, mem + 3 * PAGE + 0x80, 16) == 0);
+	assert(s.page_count == 2 && s.interval == 500);
+	assert(scan(&s) == 0);
+
+	assert(s.scans == 12 && s.pages_changed == 4);
+
+	pagescan_free(&s);
+	munmap(mem, 4 * PAGE);
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include "tools/pathnorm.h"
+
+static pathnorm_ctx_t g_ctx;
+static wchar_t g_out[PATHNORM_SIZE];
+
+static uint32_t wlen(const wchar_t *s)
+{
+	uint32_t n = 0;
+	while (s[n] != 0)
+		n++;
+	return n;
+}
+
+// normalizes in and compares the result with expected
+static int norm(const wchar_t *in, const wchar_t *expected)
+{
+	uint32_t length = pathnorm_normalize(&g_ctx, in, wlen(in), g_out);
+	return length == wlen(expected) && g_out[length] == 0 &&
+		!memcmp(g_out, expected, length * sizeof(wchar_t));
+}
+
+int main()
+{
+	pathnorm_init(&g_ctx);
+
+	// the records of log_path_map()
+	assert(pathnorm_add_mapping(&g_ctx, L"\\Device\\HarddiskVolume1", L"C:") == 0);
+	assert(pathnorm_add_mapping(&g_ctx, L"\\Device\\HarddiskVolume2", L"D:") == 0);
+	assert(pathnorm_add_mapping(&g_ctx, L"\\systemroot", L"C:\\Windows") == 0);
+	pathnorm_set_context(&g_ctx, L"C:\\Users\\bob\\Desktop\\", 21, 0);
+
+	// what the hooks see, and what ensure_absolute_unicode_path() makes of it
+	assert(norm(L"\\??\\C:\\Users\\bob\\a.txt", L"C:\\Users\\bob\\a.txt"));
+	assert(norm(L"\\??\\c:\\x", L"C:\\x"));
+	assert(norm(L"\\Device\\HarddiskVolume2\\setup.exe", L"D:\\setup.exe"));
+	assert(norm(L"\\??\\\\device\\harddiskvolume1\\a", L"C:\\a"));
+	assert(norm(L"\\\\?\\GLOBALROOT\\Device\\HarddiskVolume1\\b", L"C:\\b"));
+	assert(norm(L"\\SystemRoot\\system32\\ntdll.dll", L"C:\\Windows\\system32\\ntdll.dll"));
+	assert(norm(L"\\Device\\Afd\\Endpoint", L"\\Device\\Afd\\Endpoint"));
+	assert(norm(L"\\??\\PIPE\\lsarpc", L"\\??\\PIPE\\lsarpc"));
+	assert(norm(L"\\\\?\\C:\\a\\..\\b", L"C:\\a\\..\\b"));
+
+	// relative to the current directory
+	assert(norm(L"a.txt", L"C:\\Users\\bob\\Desktop\\a.txt"));
+	assert(norm(L".\\sub/x.dll", L"C:\\Users\\bob\\Desktop\\sub\\x.dll"));
+	assert(norm(L"..\\..\\alice\\b", L"C:\\Users\\alice\\b"));
+	assert(norm(L"..\\..\\..\\..\\..\\c", L"C:\\c"));
+	assert(norm(L"\\Windows\\win.ini", L"C:\\Windows\\win.ini"));
+	assert(norm(L"dir\\", L"C:\\Users\\bob\\Desktop\\dir\\"));
+	assert(norm(L"name. . ", L"C:\\Users\\bob\\Desktop\\name"));
+	assert(norm(L"c:/temp//x/./y", L"c:/temp//x/./y"));
+	assert(norm(L"\\\\server\\share\\..\\x", L"\\\\server\\share\\x"));
+
+	pathnorm_set_context(&g_ctx, L"D:\\", 3, 0);
+	assert(norm(L"f", L"D:\\f"));
+	assert(norm(L"..", L"D:\\"));
+	assert(norm(L"\\", L"D:\\"));
+
+	// WOW64 redirection turned off for the thread
+	pathnorm_set_context(&g_ctx, L"C:\\Windows\\System32", 19, 1);
+	assert(norm(L"drivers\\etc\\hosts", L"C:\\Windows\\sysnative\\drivers\\etc\\hosts"));
+	assert(norm(L"\\??\\C:\\Windows\\system32\\cmd.exe", L"C:\\Windows\\sysnative\\cmd.exe"));
+	assert(norm(L"\\??\\C:\\Windows\\syswow64\\cmd.exe", L"C:\\Windows\\syswow64\\cmd.exe"));
+	pathnorm_set_context(&g_ctx, L"C:\\Windows\\System32", 19, 0);
+	assert(norm(L"cmd.exe", L"C:\\Windows\\System32\\cmd.exe"));
+
+	pathnorm_free(&g_ctx);
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,144 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "pathtrie.h"
+
+static int wlen(const wchar_t *s)
+{
+	int n = 0;
+	while (s[n] != 0)
+		n++;
+	return n;
+}
+
+// swprintf() doesn't work with -fshort-wchar
+static void widen(wchar_t *out, const char *s)
+{
+	while ((*out++ = (unsigned char)*s++) != 0)
+		;
+}
+
+static int match(const pathtrie_t *t, const wchar_t *path)
+{
+	return pathtrie_match(t, path, wlen(path));
+}
+
+static void add(pathtrie_t *t, const wchar_t *pattern, int flags)
+{
+	assert(pathtrie_add(t, pattern, wlen(pattern), flags) == 0);
+}
+
+int main()
+{
+	pathtrie_t t;
+	const char list[] =
+		"# baseline of our analysis vm\n"
+		"C:\\Windows\\Prefetch\\*\r\n"
+		"\n"
+		"C:\\pagefile.sys\n"
+		"C:\\Users\\\xc3\xa9t\xc3\xa9\\ntuser.dat\n"
+		"*\n";
+	const char broken[] = "C:\\\xc3\n";
+	char huge[1025];
+
+	memset(huge, 'A', sizeof(huge));
+	assert(pathtrie_init(&t) == 0);
+
+	// the built-in list of ignore.c
+	add(&t, L"\\??\\PIPE\\lsarpc", PATHTRIE_EXACT);
+	add(&t, L"\\??\\IDE#", PATHTRIE_BEGINS_WITH);
+	add(&t, L"\\??\\STORAGE#", PATHTRIE_BEGINS_WITH);
+	add(&t, L"\\??\\MountPointManager", PATHTRIE_EXACT);
+	add(&t, L"\\??\\root#", PATHTRIE_BEGINS_WITH);
+	add(&t, L"\\Device\\", PATHTRIE_BEGINS_WITH);
+
+	assert(match(&t, L"\\??\\PIPE\\lsarpc"));
+	assert(match(&t, L"\\??\\pipe\\LSARPC"));
+	assert(!match(&t, L"\\??\\PIPE\\lsarpc2"));
+	assert(!match(&t, L"\\??\\PIPE\\lsarp"));
+	assert(match(&t, L"\\??\\IDE#"));
+	assert(match(&t, L"\\??\\ide#CdRom&Ven_VBOX"));
+	assert(!match(&t, L"\\??\\IDE"));
+	assert(match(&t, L"\\device\\HarddiskVolume1\\x"));
+	assert(!match(&t, L"\\??\\C:\\foo.txt"));
+	assert(!match(&t, L""));
+
+	// only the given length counts
+	assert(match(&t, L"\\??\\PIPE\\lsarpc\\more") == 0);
+	assert(pathtrie_match(&t, L"\\??\\PIPE\\lsarpc\\more", 15) == 1);
+
+	// Latin-1 folds, other characters have to match exactly
+	add(&t, L"C:\\\x00c9T\x00c9", PATHTRIE_EXACT);
+	assert(match(&t, L"c:\\\x00e9t\x00e9"));
+	add(&t, L"C:\\\x0416", PATHTRIE_EXACT);
+	assert(match(&t, L"c:\\\x0416"));
+	assert(!match(&t, L"c:\\\x0436"));
+
+	// an exact pattern which is also the prefix of another one
+	add(&t, L"C:\\a", PATHTRIE_EXACT);
+	add(&t, L"C:\\a\\b", PATHTRIE_BEGINS_WITH);
+	assert(match(&t, L"C:\\a"));
+	assert(!match(&t, L"C:\\a\\"));
+	assert(match(&t, L"C:\\a\\b\\c"));
+	assert(t.pattern_count == 10);
+
+	// patterns from the host
+	assert(pathtrie_load(&t, list, sizeof(list) - 1 - 2) == 3);
+	assert(match(&t, L"c:\\windows\\prefetch\\CALC.EXE-1234.pf"));
+	assert(match(&t, L"C:\\pagefile.sys"));
+	assert(!match(&t, L"C:\\pagefile.sys.bak"));
+	assert(match(&t, L"C:\\users\\\x00c9T\x00c9\\NTUSER.DAT"));
+	assert(!match(&t, L"C:\\Windows\\notepad.exe"));
+	assert(pathtrie_load(&t, broken, sizeof(broken) - 1) < 0);
+
+	// a lone * would match everything
+	assert(pathtrie_load(&t, list, sizeof(list) - 1) < 0);
+	assert(!match(&t, L"C:\\Windows\\notepad.exe"));
+
+	// a line longer than we can hold
+	assert(pathtrie_load(&t, huge, 1024) == 1);
+	assert(pathtrie_load(&t, huge, sizeof(huge)) < 0);
+	pathtrie_free(&t);
+
+	// enough patterns to grow the tables a couple of times
+	assert(pathtrie_init(&t) == 0);
+	for (int i = 0; i < 5000; i++) {
+		wchar_t pattern[64];
+		char s[64];
+		snprintf(s, sizeof(s), "C:\\dir%d\\file%d.txt", i % 50, i);
+		widen(pattern, s);
+		add(&t, pattern, i % 3 == 0 ? PATHTRIE_BEGINS_WITH : PATHTRIE_EXACT);
+	}
+	for (int i = 0; i < 5000; i++) {
+		wchar_t path[64];
+		char s[64];
+		snprintf(s, sizeof(s), "c:\\DIR%d\\FILE%d.TXTx", i % 50, i);
+		widen(path, s);
+		assert(match(&t, path) == (i % 3 == 0));
+		path[wlen(path) - 1] = 0;
+		assert(match(&t, path));
+	}
+	assert(2 * t.edge_count <= t.edge_size);
+	pathtrie_free(&t);
+
+	printf("ok\n");
+	return 0;
+}
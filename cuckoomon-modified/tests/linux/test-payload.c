@@ -0,0 +1,283 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include "payload.h"
+
+#define QUEUE_SIZE (1024 * 1024)
+
+static uint8_t g_frames[QUEUE_SIZE];
+
+// a stream which is still open gets its data without another open frame
+static int is_open(payload_t *p, uint64_t handle)
+{
+	static const uint8_t byte = 0;
+	payload_frame_t f;
+
+	payload_take(p, g_frames, sizeof(g_frames));
+	payload_data(p, PAYLOAD_SOCKET, handle, PAYLOAD_OUT, &byte, 1);
+	payload_take(p, g_frames, sizeof(g_frames));
+	assert(payload_parse(g_frames, sizeof(g_frames), &f) > 0);
+	return f.type == PAYLOAD_FRAME_DATA;
+}
+
+static int in_list(const uint64_t *list, uint32_t count, uint64_t handle)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		if (list[i] == handle)
+			return 1;
+	}
+	return 0;
+}
+static uint8_t g_stream[2][100000];
+static uint64_t g_received[2];
+
+// takes everything queued and puts the data of stream id back together
+static void reassemble(payload_t *p, uint32_t id, int *opened, int *closed,
+	uint64_t length[2])
+{
+	uint32_t len = payload_take(p, g_frames, sizeof(g_frames)), off = 0;
+	payload_frame_t f;
+
+	while (off < len) {
+		int n = payload_parse(g_frames + off, len - off, &f);
+		assert(n > 0);
+		off += n;
+
+		if (f.stream != id)
+			continue;
+
+		switch (f.type) {
+		case PAYLOAD_FRAME_OPEN:
+			assert(!*opened && f.kind == PAYLOAD_SOCKET && f.handle == 0x1234);
+			*opened = 1;
+			break;
+		case PAYLOAD_FRAME_DATA:
+			assert(*opened && !*closed);
+			assert(f.size <= PAYLOAD_CHUNK);
+			assert(f.offset + f.size <= sizeof(g_stream[0]));
+			memcpy(g_stream[f.direction] + f.offset, f.data, f.size);
+			g_received[f.direction] += f.size;
+			break;
+		case PAYLOAD_FRAME_CLOSE:
+			*closed = 1;
+			length[0] = f.length[0];
+			length[1] = f.length[1];
+			break;
+		default:
+			assert(0);
+		}
+	}
+	assert(off == len);
+}
+
+static payload_t g_payload;
+static volatile int g_stop;
+
+static void *sender(void *param)
+{
+	static uint8_t data[3 * PAYLOAD_CHUNK];
+
+	while (!g_stop)
+		payload_data(&g_payload, PAYLOAD_SOCKET, 0x88, PAYLOAD_OUT,
+			data, sizeof(data));
+	return NULL;
+}
+
+static void *closer(void *param)
+{
+	while (!g_stop) {
+		payload_close(&g_payload, PAYLOAD_SOCKET, 0x88);
+		sched_yield();
+	}
+	return NULL;
+}
+
+// a socket closed by one thread while another one is still sending on it,
+// the close frame never overtakes the data
+static void test_concurrent_close(void)
+{
+	static uint8_t closed[1 << 20];
+	static uint64_t received[1 << 20];
+	pthread_t threads[3];
+	uint32_t closes = 0;
+
+	assert(payload_init(&g_payload, QUEUE_SIZE, 1ull << 40, 1ull << 40) == 0);
+	assert(pthread_create(&threads[0], NULL, sender, NULL) == 0);
+	assert(pthread_create(&threads[1], NULL, sender, NULL) == 0);
+	assert(pthread_create(&threads[2], NULL, closer, NULL) == 0);
+
+	for (int round = 0; round < 1000000 && closes < 100; round++) {
+		uint32_t len, off = 0;
+		payload_frame_t f;
+
+		sched_yield();
+		len = payload_take(&g_payload, g_frames, sizeof(g_frames));
+		while (off < len) {
+			int n = payload_parse(g_frames + off, len - off, &f);
+			assert(n > 0 && f.stream < sizeof(closed));
+			off += n;
+
+			if (f.type == PAYLOAD_FRAME_DATA) {
+				assert(!closed[f.stream]);
+				received[f.stream] += f.size;
+			}
+			else if (f.type == PAYLOAD_FRAME_CLOSE) {
+				assert(!closed[f.stream]);
+				assert(received[f.stream] <= f.length[PAYLOAD_OUT]);
+				closed[f.stream] = 1;
+				closes++;
+			}
+		}
+	}
+
+	g_stop = 1;
+	for (int i = 0; i < 3; i++)
+		pthread_join(threads[i], NULL);
+	assert(closes >= 100);
+	payload_free(&g_payload);
+}
+
+int main()
+{
+	static payload_t p;
+	static uint8_t data[100000];
+	uint8_t frame[64];
+	uint64_t length[2];
+	payload_frame_t f;
+	int opened = 0, closed = 0;
+
+	for (uint32_t i = 0; i < sizeof(data); i++)
+		data[i] = (uint8_t)(i * 13 + (i >> 9));
+
+	// both directions of a connection, in pieces larger than a frame
+	assert(payload_init(&p, QUEUE_SIZE, 1 << 30, 1 << 30) == 0);
+	payload_data(&p, PAYLOAD_SOCKET, 0x1234, PAYLOAD_OUT, data, 100);
+	payload_data(&p, PAYLOAD_SOCKET, 0x1234, PAYLOAD_IN, data, 40000);
+	payload_data(&p, PAYLOAD_SOCKET, 0x1234, PAYLOAD_OUT, data + 100, 900);
+	payload_data(&p, PAYLOAD_SOCKET, 0x1234, PAYLOAD_IN, data + 40000, 60000);
+	payload_data(&p, PAYLOAD_SOCKET, 0x1234, PAYLOAD_IN, data, 0);
+	payload_close(&p, PAYLOAD_SOCKET, 0x1234);
+	reassemble(&p, 1, &opened, &closed, length);
+	assert(opened && closed);
+	assert(length[PAYLOAD_OUT] == 1000 && length[PAYLOAD_IN] == 100000);
+	assert(g_received[PAYLOAD_OUT] == 1000 && g_received[PAYLOAD_IN] == 100000);
+	assert(!memcmp(g_stream[PAYLOAD_OUT], data, 1000));
+	assert(!memcmp(g_stream[PAYLOAD_IN], data, 100000));
+	assert(p.dropped == 0 && payload_empty(&p));
+	payload_free(&p);
+
+	// the caps keep the start of every direction, the close still tells
+	// how much went by
+	assert(payload_init(&p, QUEUE_SIZE, 1000, 1500) == 0);
+	memset(g_stream, 0, sizeof(g_stream));
+	g_received[0] = g_received[1] = 0;
+	opened = closed = 0;
+	payload_data(&p, PAYLOAD_SOCKET, 0x1234, PAYLOAD_OUT, data, 600);
+	payload_data(&p, PAYLOAD_SOCKET, 0x1234, PAYLOAD_OUT, data + 600, 600);
+	payload_data(&p, PAYLOAD_SOCKET, 0x1234, PAYLOAD_IN, data, 800);
+	payload_close(&p, PAYLOAD_SOCKET, 0x1234);
+	reassemble(&p, 1, &opened, &closed, length);
+	assert(length[PAYLOAD_OUT] == 1200 && length[PAYLOAD_IN] == 800);
+	assert(g_received[PAYLOAD_OUT] == 1000 && g_received[PAYLOAD_IN] == 500);
+	assert(!memcmp(g_stream[PAYLOAD_OUT], data, 1000));
+	assert(!memcmp(g_stream[PAYLOAD_IN], data, 500));
+	assert(p.dropped == 200 + 300);
+
+	// the total cap is spent, a new stream only gets opened
+	payload_data(&p, PAYLOAD_INTERNET, 0x1234, PAYLOAD_IN, data, 10);
+	assert(payload_take(&p, g_frames, sizeof(g_frames)) == 4 + 4 + 16);
+	payload_free(&p);
+
+	// a full queue drops what doesn't fit, but keeps the offsets going
+	assert(payload_init(&p, 40000, 1 << 30, 1 << 30) == 0);
+	payload_data(&p, PAYLOAD_SOCKET, 0x1234, PAYLOAD_IN, data, 100000);
+	assert(p.dropped == 100000 - 2 * PAYLOAD_CHUNK);
+	payload_take(&p, g_frames, sizeof(g_frames));
+	payload_data(&p, PAYLOAD_SOCKET, 0x1234, PAYLOAD_IN, data, 10);
+	assert(payload_take(&p, g_frames, sizeof(g_frames)) == 4 + 4 + 16 + 10);
+	assert(payload_parse(g_frames, 34, &f) == 34);
+	assert(f.type == PAYLOAD_FRAME_DATA && f.offset == 100000 && f.size == 10);
+	payload_free(&p);
+
+	// streams come and go in any order, against a plain list of the open
+	// ones; handles are multiples of four like the real ones
+	assert(payload_init(&p, QUEUE_SIZE, 1 << 30, 1 << 30) == 0);
+	{
+		static uint64_t open[PAYLOAD_MAX_STREAMS];
+		uint32_t count = 0, seed = 1;
+
+		for (int i = 0; i < 200000; i++) {
+			uint64_t handle;
+
+			seed = seed * 1103515245 + 12345;
+			if (count != 0 && (count == PAYLOAD_MAX_STREAMS || (seed >> 16) % 3 == 0)) {
+				uint32_t idx = (seed >> 4) % count;
+				payload_close(&p, PAYLOAD_SOCKET, open[idx]);
+				open[idx] = open[--count];
+				continue;
+			}
+
+			handle = ((seed >> 8) % 50000) * 4;
+			if (!in_list(open, count, handle)) {
+				assert(!is_open(&p, handle));
+				open[count++] = handle;
+			}
+
+			if (i % 1000 == 0) {
+				for (uint32_t j = 0; j < count; j++)
+					assert(is_open(&p, open[j]));
+			}
+		}
+
+		// the table is full, a new stream is dropped
+		while (count < PAYLOAD_MAX_STREAMS) {
+			uint64_t handle = (100000 + count) * 4;
+			payload_data(&p, PAYLOAD_SOCKET, handle, PAYLOAD_OUT, data, 1);
+			open[count++] = handle;
+		}
+		assert(p.dropped == 0);
+		payload_data(&p, PAYLOAD_SOCKET, 4000000, PAYLOAD_OUT, data, 7);
+		assert(p.dropped == 7);
+	}
+	payload_free(&p);
+
+	// events frames, and frames that are cut short or malformed
+	payload_events_header(frame, 5);
+	memcpy(frame + PAYLOAD_HEADER_SIZE, "hello", 5);
+	assert(payload_parse(frame, 13, &f) == 13);
+	assert(f.type == PAYLOAD_FRAME_EVENTS && f.size == 5 && !memcmp(f.data, "hello", 5));
+	for (uint32_t len = 0; len < 13; len++)
+		assert(payload_parse(frame, len, &f) == 0);
+	frame[4] = 9;
+	assert(payload_parse(frame, 13, &f) < 0);
+	frame[4] = PAYLOAD_FRAME_OPEN;
+	assert(payload_parse(frame, 13, &f) < 0);
+	memcpy(frame, "\xff\xff\xff\x7f", 4);
+	assert(payload_parse(frame, 13, &f) < 0);
+	memcpy(frame, "\x02\x00\x00\x00", 4);
+	assert(payload_parse(frame, 13, &f) < 0);
+
+	test_concurrent_close();
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,66 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include "phasetimer.h"
+
+int main()
+{
+	phasetimer_t t;
+	char buf[256];
+
+	// a 10MHz counter, like QueryPerformanceCounter() on most systems
+	phasetimer_start(&t, 5000);
+	phasetimer_mark(&t, "resolve", 5000 + 120);
+	phasetimer_mark(&t, "config", 5000 + 120 + 35000);
+	phasetimer_mark(&t, "hooks", 5000 + 120 + 35000 + 10000000);
+
+	assert(t.count == 3);
+	assert(phasetimer_usecs(&t, 0, 10000000) == 12);
+	assert(phasetimer_usecs(&t, 1, 10000000) == 3500);
+	assert(phasetimer_usecs(&t, 2, 10000000) == 1000000);
+	assert(phasetimer_usecs(&t, 3, 10000000) == 0);
+	assert(phasetimer_usecs(&t, -1, 10000000) == 1003512);
+	assert(phasetimer_usecs(&t, -1, 0) == 0);
+
+	assert(phasetimer_format(&t, 10000000, buf, sizeof(buf)) ==
+		(int)strlen("resolve=12,config=3500,hooks=1000000,total=1003512"));
+	assert(!strcmp(buf, "resolve=12,config=3500,hooks=1000000,total=1003512"));
+
+	// doesn't fit, but stays terminated at a whole entry
+	assert(phasetimer_format(&t, 10000000, buf, 20) < 0);
+	assert(!strcmp(buf, "resolve=12,"));
+	assert(phasetimer_format(&t, 10000000, buf, 0) < 0);
+
+	// large counter values don't overflow
+	phasetimer_start(&t, 0);
+	phasetimer_mark(&t, "long", 0xffffffffffffull);
+	assert(phasetimer_usecs(&t, 0, 3000000000ull) == 0xffffffffffffull / 3000);
+
+	// excess marks end up in the last phase
+	phasetimer_start(&t, 0);
+	for (int i = 0; i < PHASETIMER_MAX + 5; i++)
+		phasetimer_mark(&t, "phase", (uint64_t)(i + 1) * 1000);
+	assert(t.count == PHASETIMER_MAX);
+	assert(t.durations[PHASETIMER_MAX - 1] == 6000);
+	assert(phasetimer_usecs(&t, -1, 1000000) == (PHASETIMER_MAX + 5) * 1000);
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "pidset.h"
+
+static pidset_t g_set;
+static volatile int g_stop;
+
+// pids that stay in the set the whole time, while others come and go
+static void *reader(void *param)
+{
+	while (!g_stop) {
+		for (uint32_t pid = 4; pid <= 64 * 4; pid += 4)
+			assert(pidset_contains(&g_set, pid));
+		assert(!pidset_contains(&g_set, 0x100000));
+	}
+	return NULL;
+}
+
+static void *writer(void *param)
+{
+	uint32_t base = (uint32_t)(uintptr_t)param;
+
+	for (int round = 0; round < 20000; round++) {
+		uint32_t pid = base + (round % 16) * 4;
+		assert(pidset_add(&g_set, pid) == 0);
+		assert(pidset_contains(&g_set, pid));
+		assert(pidset_remove(&g_set, pid) == 0);
+	}
+	return NULL;
+}
+
+int main()
+{
+	pidset_t s;
+	pthread_t readers[2], writers[2];
+
+	memset(&s, 0, sizeof(s));
+	assert(!pidset_contains(&s, 4));
+	assert(!pidset_contains(&s, 0));
+
+	assert(pidset_add(&s, 4) == 0);
+	assert(pidset_add(&s, 4) == 0);
+	assert(s.count == 1);
+	assert(pidset_contains(&s, 4));
+	assert(!pidset_contains(&s, 8));
+	assert(pidset_add(&s, 0) < 0);
+	assert(pidset_add(&s, PIDSET_REMOVED) < 0);
+
+	// fill it up, pids beyond PIDSET_MAX are refused
+	for (uint32_t i = 2; i <= PIDSET_MAX; i++)
+		assert(pidset_add(&s, i * 4) == 0);
+	assert(s.count == PIDSET_MAX);
+	assert(pidset_add(&s, 0x10000) < 0);
+	for (uint32_t i = 1; i <= PIDSET_MAX; i++)
+		assert(pidset_contains(&s, i * 4));
+
+	// removing one doesn't hide those probed past it
+	for (uint32_t i = 1; i <= PIDSET_MAX; i += 2)
+		assert(pidset_remove(&s, i * 4) == 0);
+	assert(pidset_remove(&s, 4) < 0);
+	for (uint32_t i = 1; i <= PIDSET_MAX; i++)
+		assert(pidset_contains(&s, i * 4) == (i % 2 == 0));
+
+	// removed slots are reused
+	for (uint32_t i = 0; i < PIDSET_MAX / 2; i++)
+		assert(pidset_add(&s, 0x10000 + i * 4) == 0);
+	assert(s.count == PIDSET_MAX);
+	assert(pidset_contains(&s, 0x10000));
+
+	// an empty set starts over without removed markers
+	for (uint32_t i = 2; i <= PIDSET_MAX; i += 2)
+		assert(pidset_remove(&s, i * 4) == 0);
+	for (uint32_t i = 0; i < PIDSET_MAX / 2; i++)
+		assert(pidset_remove(&s, 0x10000 + i * 4) == 0);
+	assert(s.count == 0);
+	for (int i = 0; i < PIDSET_SIZE; i++)
+		assert(s.slots[i] == 0);
+
+	// commands from the analyzer
+	assert(pidset_command(&s, "pid-protect 1234", 16) == 1);
+	assert(pidset_contains(&s, 1234));
+	assert(pidset_command(&s, "pid-protect  5678\r", 18) == 1);
+	assert(pidset_contains(&s, 5678));
+	assert(pidset_command(&s, "pid-unprotect 1234", 18) == 1);
+	assert(!pidset_contains(&s, 1234));
+	assert(pidset_command(&s, "pid-unprotect 1234", 18) == -1);
+	assert(pidset_command(&s, "pid-protect 12a", 15) == -1);
+	assert(pidset_command(&s, "pid-protect ", 12) == 0);
+	assert(pidset_command(&s, "pid-protect 99999999999", 23) == -1);
+	assert(pidset_command(&s, "pid-protect 9999999999", 22) == -1);
+	assert(pidset_command(&s, "pid-protect 4294967296", 22) == -1);
+	assert(!pidset_contains(&s, 1410065407) && !pidset_contains(&s, 0));
+	assert(pidset_command(&s, "pid-protect 4294967292", 22) == 1);
+	assert(pidset_contains(&s, 4294967292u));
+	// one command at a time, log_host_command() splits them
+	assert(pidset_command(&s, "pid-protect 1;hook-stats", 24) == -1);
+	assert(pidset_command(&s, "hook-stats", 10) == 0);
+
+	// lookups while other threads add and remove
+	memset(&g_set, 0, sizeof(g_set));
+	for (uint32_t pid = 4; pid <= 64 * 4; pid += 4)
+		assert(pidset_add(&g_set, pid) == 0);
+	for (int i = 0; i < 2; i++)
+		assert(pthread_create(&readers[i], NULL, reader, NULL) == 0);
+	for (int i = 0; i < 2; i++)
+		assert(pthread_create(&writers[i], NULL, writer,
+			(void *)(uintptr_t)(0x1000 + i * 0x1000)) == 0);
+	for (int i = 0; i < 2; i++)
+		pthread_join(writers[i], NULL);
+	g_stop = 1;
+	for (int i = 0; i < 2; i++)
+		pthread_join(readers[i], NULL);
+	assert(g_set.count == 64);
+
+	printf("ok\n");
+	return 0;
+}
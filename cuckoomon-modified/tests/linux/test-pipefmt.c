@@ -0,0 +1,378 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include "pipefmt.h"
+
+typedef struct {
+	uint16_t Length;
+	uint16_t MaximumLength;
+	wchar_t *Buffer;
+} UNICODE_STRING;
+
+typedef struct {
+	UNICODE_STRING *ObjectName;
+} OBJECT_ATTRIBUTES;
+
+static int g_normalized, g_reference_normalized;
+
+static int wlen(const wchar_t *s)
+{
+	int n = 0;
+	while (s[n] != 0)
+		n++;
+	return n;
+}
+
+// stand-in for ensure_absolute_unicode_path()
+static void absolute_path(wchar_t *out, const wchar_t *path)
+{
+	g_normalized++;
+	if (path[0] != 0 && path[1] == ':') {
+		memcpy(out, path, (wlen(path) + 1) * sizeof(wchar_t));
+	}
+	else {
+		memcpy(out, L"C:\\cwd\\", 7 * sizeof(wchar_t));
+		memcpy(out + 7, path, (wlen(path) + 1) * sizeof(wchar_t));
+	}
+}
+
+static const wchar_t *unicode_string(const void *str, int *length)
+{
+	const UNICODE_STRING *s = str;
+	*length = s->Length / sizeof(wchar_t);
+	return s->Buffer;
+}
+
+static int object_path(wchar_t *out, const void *obj)
+{
+	const OBJECT_ATTRIBUTES *o = obj;
+	wchar_t path[300];
+
+	if (o->ObjectName == NULL)
+		return -1;
+	memcpy(path, o->ObjectName->Buffer, o->ObjectName->Length);
+	path[o->ObjectName->Length / sizeof(wchar_t)] = 0;
+	absolute_path(out, path);
+	return 0;
+}
+
+static const pipefmt_ops_t g_ops = { &unicode_string, &object_path, &absolute_path };
+
+//
+// The two-pass formatter pipe() used before, kept as reference.  The only
+// changes are the ones needed to build it here: the Windows calls are
+// replaced by the stand-ins above, and the arguments are copied for every
+// pass, since a va_list can't be walked twice on x86-64.
+//
+
+static int _pipe_utf8x(char **out, unsigned short x)
+{
+	unsigned char buf[3];
+	int len;
+	if (x < 0x80) {
+		buf[0] = x & 0x7f;
+		len = 1;
+	}
+	else if (x < 0x800) {
+		buf[0] = 0xc0 | ((x >> 6) & 0x1f);
+		buf[1] = 0x80 | (x & 0x3f);
+		len = 2;
+	}
+	else {
+		buf[0] = 0xe0 | ((x >> 12) & 0x0f);
+		buf[1] = 0x80 | ((x >> 6) & 0x3f);
+		buf[2] = 0x80 | (x & 0x3f);
+		len = 3;
+	}
+	if (*out != NULL) {
+		memcpy(*out, buf, len);
+		*out += len;
+	}
+	return len;
+}
+
+static int _pipe_ascii(char **out, const char *s, int len)
+{
+	int ret = 0;
+	while (len-- != 0)
+		ret += _pipe_utf8x(out, *(unsigned char *)s++);
+	return ret;
+}
+
+static int _pipe_unicode(char **out, const wchar_t *s, int len)
+{
+	int ret = 0;
+	while (len-- != 0)
+		ret += _pipe_utf8x(out, *(unsigned short *)s++);
+	return ret;
+}
+
+static int _pipe_sprintf(char *out, const char *fmt, va_list args)
+{
+	int ret = 0;
+	while (*fmt != 0) {
+		if (*fmt != '%') {
+			ret += _pipe_utf8x(&out, *fmt++);
+			continue;
+		}
+		if (*++fmt == 'z') {
+			const char *s = va_arg(args, const char *);
+			if (s == NULL) return -1;
+			ret += _pipe_ascii(&out, s, (int)strlen(s));
+		}
+		else if (*fmt == 'c') {
+			char buf[2];
+			buf[0] = (char)va_arg(args, int);
+			buf[1] = '\0';
+			ret += _pipe_ascii(&out, buf, 1);
+		}
+		else if (*fmt == 'Z') {
+			const wchar_t *s = va_arg(args, const wchar_t *);
+			if (s == NULL) return -1;
+			ret += _pipe_unicode(&out, s, wlen(s));
+		}
+		else if (*fmt == 'F') {
+			const wchar_t *s = va_arg(args, const wchar_t *);
+			wchar_t *absolutepath = malloc(32768 * sizeof(wchar_t));
+			if (s == NULL) return -1;
+			if (absolutepath) {
+				absolute_path(absolutepath, s);
+				ret += _pipe_unicode(&out, absolutepath, wlen(absolutepath));
+				free(absolutepath);
+			}
+			else {
+				return -1;
+			}
+		}
+		else if (*fmt == 's') {
+			int len = va_arg(args, int);
+			const char *s = va_arg(args, const char *);
+			if (s == NULL) return -1;
+			ret += _pipe_ascii(&out, s, len < 0 ? (int)strlen(s) : len);
+		}
+		else if (*fmt == 'S') {
+			int len = va_arg(args, int);
+			const wchar_t *s = va_arg(args, const wchar_t *);
+			if (s == NULL) return -1;
+			ret += _pipe_unicode(&out, s, len < 0 ? wlen(s) : len);
+		}
+		else if (*fmt == 'o') {
+			UNICODE_STRING *str = va_arg(args, UNICODE_STRING *);
+			if (str == NULL) return -1;
+			ret += _pipe_unicode(&out, str->Buffer, str->Length / sizeof(wchar_t));
+		}
+		else if (*fmt == 'O') {
+			OBJECT_ATTRIBUTES *obj = va_arg(args, OBJECT_ATTRIBUTES *);
+			if (obj == NULL || obj->ObjectName == NULL) return -1;
+			wchar_t *absolutepath = malloc(32768 * sizeof(wchar_t));
+			if (absolutepath) {
+				object_path(absolutepath, obj);
+				ret += _pipe_unicode(&out, absolutepath, wlen(absolutepath));
+				free(absolutepath);
+			}
+			else {
+				ret += _pipe_unicode(&out, L"", 0);
+			}
+		}
+		else if (*fmt == 'd') {
+			char s[32];
+			sprintf(s, "%d", va_arg(args, int));
+			ret += _pipe_ascii(&out, s, (int)strlen(s));
+		}
+		else if (*fmt == 'x') {
+			char s[16];
+			sprintf(s, "%x", va_arg(args, int));
+			ret += _pipe_ascii(&out, s, (int)strlen(s));
+		}
+		else if (*fmt == 'p') {
+			char s[18];
+			sprintf(s, "%p", va_arg(args, void *));
+			ret += _pipe_ascii(&out, s, (int)strlen(s));
+		}
+		else {
+			const char *msg = "-- UNKNOWN FORMAT STRING -- ";
+			ret += _pipe_ascii(&out, msg, (int)strlen(msg));
+		}
+		fmt++;
+	}
+	return ret;
+}
+
+// formats with both implementations, they have to agree byte for byte;
+// returns the length
+static int check(const char *fmt, ...)
+{
+	va_list args, copy;
+	pipefmt_buf_t b;
+	char *expected = NULL;
+	int len, ref;
+
+	va_start(args, fmt);
+
+	g_normalized = 0;
+	va_copy(copy, args);
+	ref = _pipe_sprintf(NULL, fmt, copy);
+	va_end(copy);
+	if (ref >= 0) {
+		expected = calloc(1, ref + 1);
+		va_copy(copy, args);
+		_pipe_sprintf(expected, fmt, copy);
+		va_end(copy);
+	}
+
+	g_reference_normalized = g_normalized;
+
+	pipefmt_init(&b);
+	g_normalized = 0;
+	va_copy(copy, args);
+	len = pipefmt_format(&b, &g_ops, fmt, copy);
+	va_end(copy);
+	va_end(args);
+
+	assert(len == ref);
+	if (ref >= 0) {
+		assert(!memcmp(b.buf, expected, len) && b.buf[len] == 0);
+		// room is reserved for the longest encoding of every argument,
+		// so only messages well below the stack buffer size surely fit
+		if ((uint32_t)len < sizeof(b.stack) / 3)
+			assert(b.buf == b.stack);
+		if ((uint32_t)len >= sizeof(b.stack))
+			assert(b.buf != b.stack);
+	}
+
+	pipefmt_free(&b);
+	free(expected);
+	return len;
+}
+
+static int format(pipefmt_buf_t *b, const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	ret = pipefmt_format(b, &g_ops, fmt, args);
+	va_end(args);
+	return ret;
+}
+
+static uint32_t g_seed = 1;
+
+static uint32_t rnd(void)
+{
+	g_seed = g_seed * 1103515245 + 12345;
+	return g_seed >> 8;
+}
+
+int main()
+{
+	wchar_t unicode[] = { 'a', 0xe9, 0x20ac, 0x7ff, 0x800, 0xffff, 'z', 0 };
+	char ascii[] = { 'x', (char)0xe9, (char)0x7f, (char)0x80, 'y', 0 };
+	wchar_t name[] = L"\\??\\C:\\foo.txt";
+	UNICODE_STRING ustr = { sizeof(name) - sizeof(wchar_t), sizeof(name), name };
+	UNICODE_STRING empty = { 0, 0, NULL };
+	OBJECT_ATTRIBUTES obj = { &ustr }, noname = { NULL };
+	char big[2000];
+	wchar_t wbig[2000];
+	pipefmt_buf_t b;
+
+	assert(check("") == 0);
+	assert(check("PROCESS:") == 8);
+	assert(check("%z", "abc") == 3);
+	assert(check("%z", ascii) > 0);
+	assert(check("%Z", unicode) > 0);
+	assert(check("%s|%s|%s", -1, "abc", 2, "xyz", 0, "") == 7);
+	assert(check("%S|%S", -1, unicode, 3, unicode) > 0);
+	assert(check("%o", &ustr) == wlen(name));
+	assert(check("[%o]", &empty) == 2);
+	assert(check("FILE_NEW:%O", &obj) > 0);
+	assert(check("FILE_NEW:%F", L"rel\\path") == 9 + 7 + 8);
+	assert(check("FILE_NEW:%F", L"D:\\abs") == 9 + 6);
+	assert(check("%d %d %d", 0, -1, 2147483647) > 0);
+	assert(check("%x %x", 0xdeadbeef, 0) == 10);
+	assert(check("%p %p", (void *)0x1234, NULL) > 0);
+	assert(check("%c%c%c", 'a', 0xe9, '%') > 0);
+	assert(check("100%% %q") > 0);
+	assert(check("PROCESS:%d,%d,%x", 1234, 5678, 0x10) > 0);
+	assert(check("KILL:%d", 4) == 6);
+
+	// a single NULL string fails the message
+	assert(check("%z", NULL) == -1);
+	assert(check("a%Zb", NULL) == -1);
+	assert(check("%s", 3, NULL) == -1);
+	assert(check("%S", -1, NULL) == -1);
+	assert(check("%o", NULL) == -1);
+	assert(check("%O", NULL) == -1);
+	assert(check("%O", &noname) == -1);
+	assert(check("%F", NULL) == -1);
+
+	// long messages move to the heap
+	memset(big, 'q', sizeof(big) - 1);
+	big[sizeof(big) - 1] = 0;
+	for (int i = 0; i < 1999; i++)
+		wbig[i] = (wchar_t)(0x100 + i);
+	wbig[1999] = 0;
+	assert(check("%z", big) == 1999);
+	assert(check("%z%Z%z", big, wbig, big) > 4 * PIPEFMT_STACK_SIZE);
+	assert(check("%S", 600, wbig) > PIPEFMT_STACK_SIZE);
+
+	// random strings and formats
+	for (int round = 0; round < 2000; round++) {
+		wchar_t w[64];
+		char a[64];
+		int wl = rnd() % 63, al = rnd() % 63;
+
+		for (int i = 0; i < wl; i++)
+			w[i] = (wchar_t)(1 + rnd() % 0xfffe);
+		w[wl] = 0;
+		for (int i = 0; i < al; i++)
+			a[i] = (char)(1 + rnd() % 255);
+		a[al] = 0;
+
+		switch (rnd() % 4) {
+		case 0:
+			check("FILE_NEW:%Z|%z|%d", w, a, (int)rnd());
+			break;
+		case 1:
+			check("%S%s%x", (int)(rnd() % (wl + 1)), w, -1, a, (int)rnd());
+			break;
+		case 2:
+			check("FILE_MOVE:%F::%F", w, w);
+			break;
+		default:
+			check("%z%z%z%z%z%z%z%z%z%z", a, a, a, a, a, a, a, a, a, a);
+			break;
+		}
+	}
+
+	// the reference normalized every path twice, we do it once
+	check("FILE_MOVE:%F::%O", L"a", &obj);
+	assert(g_normalized == 2 && g_reference_normalized == 4);
+
+	// the buffer can be reused for the next message
+	pipefmt_init(&b);
+	assert(format(&b, "%z", big) == 1999 && b.buf != b.stack);
+	assert(format(&b, "INFO:%d", 5) == 6 && !strcmp(b.buf, "INFO:5"));
+	pipefmt_free(&b);
+	assert(b.buf == b.stack && b.path == NULL);
+
+	printf("ok\n");
+	return 0;
+}
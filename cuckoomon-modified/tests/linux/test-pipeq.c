@@ -0,0 +1,195 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "pipeq.h"
+
+static char g_seen[64][32];
+static unsigned int g_seen_count;
+
+static int collect(void *ctx, const char *msg, uint32_t len)
+{
+	memcpy(g_seen[g_seen_count], msg, len);
+	g_seen[g_seen_count][len] = 0;
+	g_seen_count++;
+	return 0;
+}
+
+static int stop_after_one(void *ctx, const char *msg, uint32_t len)
+{
+	(*(int *)ctx)++;
+	return 1;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static pipeq_t g_queue;
+static int g_sock[2];
+static volatile int g_done;
+
+// stand-in for _pipe_thread, sends whatever is queued as one batch
+static void *sender(void *param)
+{
+	uint8_t batch[PIPEQ_BATCH_PREFIX_LEN + 256];
+
+	memcpy(batch, PIPEQ_BATCH_PREFIX, PIPEQ_BATCH_PREFIX_LEN);
+	while (1) {
+		int done = g_done;
+		uint32_t len = pipeq_take(&g_queue, batch + PIPEQ_BATCH_PREFIX_LEN, 256);
+		if (len != 0) {
+			uint32_t total = PIPEQ_BATCH_PREFIX_LEN + len;
+			assert(write(g_sock[0], &total, 4) == 4);
+			assert(write(g_sock[0], batch, total) == total);
+		}
+		else if (done) {
+			break;
+		}
+	}
+	close(g_sock[0]);
+	return NULL;
+}
+
+static void test_end_to_end(void)
+{
+	pthread_t thread;
+	char msg[32];
+	uint8_t buf[PIPEQ_BATCH_PREFIX_LEN + 256];
+	uint32_t total;
+	int batches = 0;
+
+	assert(pipeq_init(&g_queue, 256) == 0);
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, g_sock) == 0);
+	assert(pthread_create(&thread, NULL, sender, NULL) == 0);
+
+	g_seen_count = 0;
+	for (int i = 0; i < 64; i++) {
+		int len = sprintf(msg, "FILE_NEW:c:\\f%d", i);
+		while (pipeq_push(&g_queue, msg, len) < 0)
+			;
+	}
+	g_done = 1;
+
+	// every message arrives once and in order, however they were batched
+	while (read(g_sock[1], &total, 4) == 4) {
+		uint32_t off = 0;
+		while (off < total) {
+			ssize_t r = read(g_sock[1], buf + off, total - off);
+			assert(r > 0);
+			off += r;
+		}
+		assert(pipeq_is_batch((char *)buf, total));
+		assert(pipeq_parse(buf + PIPEQ_BATCH_PREFIX_LEN,
+			total - PIPEQ_BATCH_PREFIX_LEN, &collect, NULL) > 0);
+		batches++;
+	}
+
+	pthread_join(thread, NULL);
+	close(g_sock[1]);
+
+	assert(g_seen_count == 64);
+	for (int i = 0; i < 64; i++) {
+		sprintf(msg, "FILE_NEW:c:\\f%d", i);
+		assert(!strcmp(g_seen[i], msg));
+	}
+	assert(batches >= 1 && batches < 64);
+	pipeq_free(&g_queue);
+}
+
+int main()
+{
+	pipeq_t q;
+	uint8_t out[64];
+	int count = 0;
+
+	assert(pipeq_init(&q, 32) == 0);
+	assert(pipeq_empty(&q));
+
+	assert(pipeq_push(&q, "INFO:a", 6) == 0);
+	assert(pipeq_push(&q, "FILE_NEW:bc", 11) == 0);
+	assert(q.used == 4 + 6 + 4 + 11);
+
+	// doesn't fit, the caller sends it synchronously
+	assert(pipeq_push(&q, "FILE_MOVE:x::y", 14) < 0);
+	assert(q.dropped == 1);
+
+	// only whole frames are taken
+	assert(pipeq_take(&q, out, 12) == 10);
+	assert(out[0] == 6 && out[1] == 0 && !memcmp(out + 4, "INFO:a", 6));
+	assert(q.used == 15);
+	assert(pipeq_take(&q, out, 4) == 0);
+	assert(pipeq_take(&q, out, sizeof(out)) == 15);
+	assert(pipeq_empty(&q));
+	assert(pipeq_take(&q, out, sizeof(out)) == 0);
+
+	// framing round trip
+	assert(pipeq_push(&q, "INFO:a", 6) == 0);
+	assert(pipeq_push(&q, "", 0) == 0);
+	assert(pipeq_push(&q, "FILE_NEW:bc", 11) == 0);
+	uint32_t len = pipeq_take(&q, out, sizeof(out));
+	g_seen_count = 0;
+	assert(pipeq_parse(out, len, &collect, NULL) == 3);
+	assert(!strcmp(g_seen[0], "INFO:a"));
+	assert(!strcmp(g_seen[1], ""));
+	assert(!strcmp(g_seen[2], "FILE_NEW:bc"));
+
+	assert(pipeq_parse(out, len, &stop_after_one, &count) == 1 && count == 1);
+
+	// truncated frames are rejected
+	assert(pipeq_parse(out, len - 1, &collect, NULL) < 0);
+	assert(pipeq_parse(out, 3, &collect, NULL) < 0);
+	assert(pipeq_parse(out, 0, &collect, NULL) == 0);
+
+	// frames wrapping around the end of the ring, headers included; one
+	// frame always stays queued so the head keeps moving
+	char prev[16] = "INFO:";
+	int prevlen = 5, wrapped = 0;
+	assert(pipeq_push(&q, prev, prevlen) == 0);
+	for (int i = 0; i < 32; i++) {
+		char msg[16];
+		int mlen = sprintf(msg, "INFO:%d", i * 37);
+		uint32_t head = q.head;
+		assert(pipeq_push(&q, msg, mlen) == 0);
+		assert(pipeq_take(&q, out, 4 + prevlen + 3) == 4 + (uint32_t)prevlen);
+		assert(get_u32(out) == (uint32_t)prevlen);
+		assert(!memcmp(out + 4, prev, prevlen));
+		assert(q.used == 4 + (uint32_t)mlen);
+		wrapped += q.head < head;
+		memcpy(prev, msg, mlen);
+		prevlen = mlen;
+	}
+	assert(wrapped > 4);
+	assert(pipeq_take(&q, out, sizeof(out)) == 4 + (uint32_t)prevlen);
+	assert(pipeq_empty(&q) && q.head == 0);
+
+	assert(pipeq_is_batch("BATCH:", 6));
+	assert(!pipeq_is_batch("BATCH", 5));
+	assert(!pipeq_is_batch("INFO:BATCH:", 11));
+	pipeq_free(&q);
+
+	test_end_to_end();
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,121 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include "rangeset.h"
+
+#define SPACE 4096
+
+static uint8_t g_written[SPACE];
+
+// every written byte is covered, and the set is sorted and merged
+static void check(const rangeset_t *s, int exact)
+{
+	uint8_t covered[SPACE];
+
+	memset(covered, 0, sizeof(covered));
+	for (uint32_t i = 0; i < s->count; i++) {
+		assert(s->ranges[i].start < s->ranges[i].end);
+		assert(s->ranges[i].end <= SPACE);
+		if (i != 0)
+			assert(s->ranges[i - 1].end < s->ranges[i].start);
+		memset(covered + s->ranges[i].start, 1,
+			s->ranges[i].end - s->ranges[i].start);
+	}
+
+	for (int i = 0; i < SPACE; i++) {
+		if (g_written[i])
+			assert(covered[i]);
+		else if (exact)
+			assert(!covered[i]);
+	}
+}
+
+int main()
+{
+	rangeset_t s;
+	char buf[4096];
+	unsigned int seed = 1;
+
+	rangeset_init(&s);
+	assert(rangeset_format(&s, buf, sizeof(buf)) == 0);
+	assert(!strcmp(buf, ""));
+
+	// appends collapse into a single range
+	for (int i = 0; i < 100; i++)
+		rangeset_add(&s, i * 512, 512);
+	assert(s.count == 1 && s.ranges[0].start == 0 && s.ranges[0].end == 51200);
+
+	// disjoint, touching, overlapping and swallowing writes
+	rangeset_init(&s);
+	rangeset_add(&s, 1000, 100);
+	rangeset_add(&s, 0, 10);
+	rangeset_add(&s, 500, 0);
+	assert(s.count == 2);
+	rangeset_add(&s, 10, 5);
+	assert(s.count == 2 && s.ranges[0].end == 15);
+	rangeset_add(&s, 1050, 100);
+	assert(s.count == 2 && s.ranges[1].start == 1000 && s.ranges[1].end == 1150);
+	rangeset_add(&s, 200, 10);
+	rangeset_add(&s, 300, 10);
+	assert(s.count == 4);
+	assert(rangeset_format(&s, buf, sizeof(buf)) > 0);
+	assert(!strcmp(buf, "0-15,200-210,300-310,1000-1150"));
+	assert(rangeset_bytes(&s) == 15 + 10 + 10 + 150);
+	rangeset_add(&s, 5, 1000);
+	assert(s.count == 1 && s.ranges[0].start == 0 && s.ranges[0].end == 1150);
+
+	// doesn't fit, or was invalidated
+	assert(rangeset_format(&s, buf, 4) < 0);
+	assert(!strcmp(buf, ""));
+	rangeset_invalidate(&s);
+	assert(rangeset_format(&s, buf, sizeof(buf)) < 0);
+
+	// offsets near the end of the address space
+	rangeset_init(&s);
+	rangeset_add(&s, UINT64_MAX - 10, 100);
+	assert(s.count == 1 && s.ranges[0].end == UINT64_MAX);
+
+	// random writes against a byte map, exact while the set has room
+	for (int round = 0; round < 200; round++) {
+		int max_writes = round < 100 ? 20 : 400;
+
+		rangeset_init(&s);
+		memset(g_written, 0, sizeof(g_written));
+
+		for (int i = 0; i < max_writes; i++) {
+			uint32_t off, len;
+
+			seed = seed * 1103515245 + 12345;
+			off = (seed >> 8) % SPACE;
+			seed = seed * 1103515245 + 12345;
+			len = (seed >> 8) % (round % 2 ? 8 : 200);
+			if (off + len > SPACE)
+				len = SPACE - off;
+
+			rangeset_add(&s, off, len);
+			memset(g_written + off, 1, len);
+			check(&s, max_writes <= RANGESET_MAX);
+			assert(s.count <= RANGESET_MAX);
+		}
+	}
+
+	printf("ok\n");
+	return 0;
+}
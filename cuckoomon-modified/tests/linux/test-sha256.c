@@ -0,0 +1,81 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include "sha256.h"
+
+static void digest_of(const void *data, size_t length, char *out)
+{
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	sha256_t s;
+
+	sha256_init(&s);
+	sha256_update(&s, data, length);
+	sha256_final(&s, digest);
+	sha256_hex(digest, out);
+}
+
+int main()
+{
+	static char buf[1000000];
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	char hex[SHA256_DIGEST_SIZE * 2 + 1], ref[SHA256_DIGEST_SIZE * 2 + 1];
+	const char *msg;
+	sha256_t s;
+
+	// FIPS 180-4 example vectors
+	digest_of("", 0, hex);
+	assert(!strcmp(hex, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+
+	digest_of("abc", 3, hex);
+	assert(!strcmp(hex, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+
+	msg = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	digest_of(msg, strlen(msg), hex);
+	assert(!strcmp(hex, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"));
+
+	msg = "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+		"hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu";
+	digest_of(msg, strlen(msg), hex);
+	assert(!strcmp(hex, "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"));
+
+	memset(buf, 'a', sizeof(buf));
+	digest_of(buf, sizeof(buf), hex);
+	assert(!strcmp(hex, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"));
+
+	// feeding the same data in arbitrary pieces gives the same digest,
+	// including pieces which straddle the block and padding boundaries
+	for (size_t length = 0; length < 300; length++) {
+		for (size_t i = 0; i < length; i++)
+			buf[i] = (char)(i * 7 + length);
+		digest_of(buf, length, ref);
+
+		for (size_t step = 1; step < 70; step += 5) {
+			sha256_init(&s);
+			for (size_t off = 0; off < length; off += step)
+				sha256_update(&s, buf + off, MIN(step, length - off));
+			sha256_final(&s, digest);
+			sha256_hex(digest, hex);
+			assert(!strcmp(hex, ref));
+		}
+	}
+
+	printf("ok\n");
+	return 0;
+}
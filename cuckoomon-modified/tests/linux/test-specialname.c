@@ -0,0 +1,133 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include "specialname.h"
+
+static uint32_t wlen(const wchar_t *s)
+{
+	uint32_t n = 0;
+	while (s[n] != 0)
+		n++;
+	return n;
+}
+
+static int weq(const wchar_t *a, const wchar_t *b)
+{
+	return wlen(a) == wlen(b) && !memcmp(a, b, wlen(a) * sizeof(wchar_t));
+}
+
+// what ensure_absolute_unicode_path() does before asking Windows
+static int rewrite(const specialname_map_t *m, const wchar_t *in, wchar_t *out,
+	uint32_t size)
+{
+	int is_globalroot;
+	const wchar_t *p = in + specialname_skip_prefix(in, &is_globalroot);
+
+	memcpy(out, p, (wlen(p) + 1) * sizeof(wchar_t));
+	return specialname_rewrite(m, out, wlen(out), size);
+}
+
+int main()
+{
+	specialname_map_t m;
+	wchar_t buf[128];
+	int is_globalroot;
+
+	memset(&m, 0, sizeof(m));
+
+	// the way QueryDosDevice() lists them, in drive letter order
+	assert(specialname_add(&m, L"\\Device\\HarddiskVolume1", L"C:") == 0);
+	assert(specialname_add(&m, L"\\Device\\CdRom0", L"D:") == 0);
+	assert(specialname_add(&m, L"\\Device\\HarddiskVolume10", L"E:") == 0);
+	assert(specialname_add(&m, L"\\Device\\LanmanRedirector\\;Z:0000000000012345\\server\\share", L"Z:") == 0);
+	// a second letter for a device, the first one is kept
+	assert(specialname_add(&m, L"\\device\\harddiskvolume1", L"S:") == 0);
+	assert(specialname_set_windir(&m, L"C:\\Windows") == 0);
+	assert(m.count == 5);
+
+	assert(m.max_target_length == 57);
+
+	// prefixes
+	assert(specialname_skip_prefix(L"\\??\\C:\\x", &is_globalroot) == 4 && is_globalroot);
+	assert(specialname_skip_prefix(L"\\\\?\\GLOBALROOT\\Device\\x", &is_globalroot) == 14 && is_globalroot);
+	assert(specialname_skip_prefix(L"\\\\?\\globalroot", &is_globalroot) == 14 && is_globalroot);
+	assert(specialname_skip_prefix(L"\\\\?\\global", &is_globalroot) == 0 && !is_globalroot);
+	assert(specialname_skip_prefix(L"\\\\?\\C:\\x", &is_globalroot) == 0 && !is_globalroot);
+	assert(specialname_skip_prefix(L"C:\\x", &is_globalroot) == 0 && !is_globalroot);
+	assert(specialname_skip_prefix(L"", &is_globalroot) == 0);
+
+	// device names, case-insensitively and only on whole components
+	assert(rewrite(&m, L"\\Device\\HarddiskVolume1\\Windows\\x.dll", buf, 128) == 16);
+	assert(weq(buf, L"C:\\Windows\\x.dll"));
+	assert(rewrite(&m, L"\\??\\\\DEVICE\\HARDDISKVOLUME1\\a", buf, 128) == 4);
+	assert(weq(buf, L"C:\\a"));
+	assert(rewrite(&m, L"\\\\?\\globalroot\\Device\\HarddiskVolume10\\a", buf, 128) == 4);
+	assert(weq(buf, L"E:\\a"));
+	assert(rewrite(&m, L"\\Device\\HarddiskVolume1", buf, 128) == 2);
+	assert(weq(buf, L"C:"));
+	assert(rewrite(&m, L"\\Device\\HarddiskVolume100\\a", buf, 128) == -1);
+	assert(weq(buf, L"\\Device\\HarddiskVolume100\\a"));
+	assert(rewrite(&m, L"\\Device\\CdRom0\\setup.exe", buf, 128) == 12);
+	assert(weq(buf, L"D:\\setup.exe"));
+	assert(rewrite(&m, L"\\Device\\LanmanRedirector\\;Z:0000000000012345\\server\\share\\doc.txt", buf, 128) == 10);
+	assert(weq(buf, L"Z:\\doc.txt"));
+	assert(rewrite(&m, L"\\Device\\LanmanRedirector\\other\\share", buf, 128) == -1);
+	assert(rewrite(&m, L"\\Device\\Afd\\Endpoint", buf, 128) == -1);
+	assert(rewrite(&m, L"\\??\\C:\\a", buf, 128) == -1);
+
+	// \systemroot
+	assert(rewrite(&m, L"\\SystemRoot\\system32\\ntdll.dll", buf, 128) == 29);
+	assert(weq(buf, L"C:\\Windows\\system32\\ntdll.dll"));
+	assert(rewrite(&m, L"\\??\\\\systemroot", buf, 128) == 10);
+	assert(weq(buf, L"C:\\Windows"));
+	assert(rewrite(&m, L"\\systemrootx\\a", buf, 128) == -1);
+
+	// the result has to fit, including the terminator
+	assert(rewrite(&m, L"\\SystemRoot\\abc", buf, 15) == 14);
+	assert(rewrite(&m, L"\\SystemRoot\\abc", buf, 14) == -1);
+	assert(weq(buf, L"\\SystemRoot\\abc"));
+
+	// sysnative redirection
+	memcpy(buf, L"c:\\windows\\System32\\drivers\\etc\\hosts", 38 * sizeof(wchar_t));
+	assert(specialname_sysnative(&m, buf, wlen(buf), 128) == 38);
+	assert(weq(buf, L"C:\\Windows\\sysnative\\drivers\\etc\\hosts"));
+	memcpy(buf, L"C:\\Windows\\system32", 20 * sizeof(wchar_t));
+	assert(specialname_sysnative(&m, buf, wlen(buf), 128) == 20);
+	assert(weq(buf, L"C:\\Windows\\sysnative"));
+	memcpy(buf, L"C:\\Windows\\system32x\\a", 23 * sizeof(wchar_t));
+	assert(specialname_sysnative(&m, buf, wlen(buf), 128) == -1);
+	memcpy(buf, L"C:\\Windows\\syswow64\\a", 22 * sizeof(wchar_t));
+	assert(specialname_sysnative(&m, buf, wlen(buf), 128) == -1);
+	memcpy(buf, L"C:\\Windows\\system32", 20 * sizeof(wchar_t));
+	assert(specialname_sysnative(&m, buf, wlen(buf), 20) == -1);
+
+	assert(specialname_match(&m, L"\\Device\\CdRom0", 14)->name[0] == 'D');
+	assert(specialname_match(&m, L"\\Device\\CdRom0", 13) == NULL);
+
+	specialname_free(&m);
+
+	// an empty map, e.g. before initialization
+	assert(rewrite(&m, L"\\Device\\HarddiskVolume1\\a", buf, 128) == -1);
+	memcpy(buf, L"C:\\Windows\\system32", 20 * sizeof(wchar_t));
+	assert(specialname_sysnative(&m, buf, wlen(buf), 128) == -1);
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,154 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "vclock.h"
+
+#define THREADS 4
+#define SKIPS 100000
+
+static vclock_t g_clock;
+static volatile int g_done;
+
+static void *skip_thread(void *param)
+{
+	for (int i = 0; i < SKIPS; i++)
+		vclock_skip(&g_clock, 3);
+	return NULL;
+}
+
+// the virtual counter never goes backwards while others skip time
+static void *read_thread(void *param)
+{
+	int64_t last = 0;
+
+	for (int64_t real = 0; !g_done; real++) {
+		int64_t now = vclock_counter(&g_clock, real, 10000000);
+		assert(now >= last);
+		last = now;
+	}
+	return NULL;
+}
+
+int main()
+{
+	vclock_t c = { 0 };
+
+	assert(vclock_skip(&c, 0) == 0 && vclock_skip(&c, -5) == 0);
+	assert(vclock_skip(&c, 25 * VCLOCK_UNITS_PER_MS + 9999) ==
+		25 * VCLOCK_UNITS_PER_MS + 9999);
+	assert(vclock_time(&c, 1000) == 1000 + 259999);
+
+	// partial milliseconds don't count yet
+	assert(vclock_ticks(&c, 100) == 125);
+	vclock_skip(&c, 1);
+	assert(vclock_ticks(&c, 100) == 126);
+
+	// tick counts wrap the same way as a 64-bit tick count truncated
+	assert(vclock_ticks(&c, 0xfffffff0) == 10);
+	vclock_skip(&c, 0x1ffffffffLL * VCLOCK_UNITS_PER_MS);
+	uint64_t skipped_ms = (uint64_t)vclock_skipped(&c) / VCLOCK_UNITS_PER_MS;
+	for (uint64_t real = 0xfffffff0; real < 0x100000010ULL; real++)
+		assert(vclock_ticks(&c, (uint32_t)real) == (uint32_t)(real + skipped_ms));
+	assert(vclock_ticks64(&c, 0xfffffff0) == 0xfffffff0 + skipped_ms);
+	assert((uint32_t)vclock_ticks64(&c, 1234) == vclock_ticks(&c, 1234));
+
+	// performance counters, including some which would overflow when
+	// multiplying first
+	vclock_t d = { 0 };
+	vclock_skip(&d, 15 * VCLOCK_UNITS_PER_SEC + 5000000);
+	assert(vclock_counter(&d, 7, 10000000) == 7 + 155000000);
+	assert(vclock_counter(&d, 0, 1000) == 15500);
+	assert(vclock_counter(&d, 0, 3579545) == 15 * 3579545LL + 3579545 / 2);
+
+	vclock_skip(&d, 24LL * 3600 * VCLOCK_UNITS_PER_SEC);
+	assert(vclock_counter(&d, 0, 3000000000LL) ==
+		(24LL * 3600 + 15) * 3000000000LL + 1500000000LL);
+
+	// dilation is off for factors up to one and for zero or odd intervals
+	vclock_t e = { 0 };
+	assert(vclock_dilate(12345, 0) == 12345 && vclock_dilate(12345, 1) == 12345);
+	assert(vclock_dilate(0, 10) == 0 && vclock_dilate(-1, 10) == -1);
+	vclock_wait_begin(&e, 0, 1);
+	vclock_wait_end(&e, 12345, 1);
+	assert(vclock_skipped(&e) == 0 && e.waits == 0);
+
+	// a timed out wait, the real timeout is rounded down
+	assert(vclock_dilate(12345, 10) == 1234);
+	vclock_wait_begin(&e, 1000, 10);
+	vclock_wait_end(&e, 1000 + 1234, 10);
+	assert(vclock_skipped(&e) == 1234 * 9);
+
+	// the time between waits isn't dilated, nor an interrupt time that
+	// comes in late
+	vclock_wait_begin(&e, 5000, 10);
+	vclock_wait_end(&e, 5100, 10);
+	assert(vclock_skipped(&e) == 1234 * 9 + 900);
+	vclock_wait_begin(&e, 6000, 10);
+	vclock_wait_begin(&e, 5990, 10);
+	vclock_wait_end(&e, 6010, 10);
+	vclock_wait_end(&e, 6005, 10);
+	assert(vclock_skipped(&e) == 1234 * 9 + 900 + 90);
+
+	// hours of sleeping in one minute chunks fit into minutes of real time,
+	// and the virtual clock covers all of it
+	vclock_t f = { 0 };
+	int64_t real = 0, minute = 60LL * VCLOCK_UNITS_PER_SEC;
+	for (int i = 0; i < 180; i++) {
+		vclock_wait_begin(&f, real, 12);
+		real += vclock_dilate(minute, 12);
+		vclock_wait_end(&f, real, 12);
+	}
+	assert(real == 15 * minute);
+	assert(vclock_time(&f, real) == 180 * minute);
+
+	// two threads waiting a minute each at the same time move the clock by
+	// a minute, the clock runs faster while any of them waits
+	vclock_t g = { 0 };
+	int64_t second = VCLOCK_UNITS_PER_SEC;
+	vclock_wait_begin(&g, 0, 12);
+	vclock_wait_begin(&g, 0, 12);
+	vclock_wait_end(&g, 5 * second, 12);
+	vclock_wait_end(&g, 5 * second, 12);
+	assert(vclock_time(&g, 5 * second) == minute);
+
+	// overlapping ones: 0-5s and 2-7s, then 7-8s without any wait
+	vclock_t h = { 0 };
+	vclock_wait_begin(&h, 0, 12);
+	vclock_wait_begin(&h, 2 * second, 12);
+	vclock_wait_end(&h, 5 * second, 12);
+	vclock_wait_end(&h, 7 * second, 12);
+	assert(vclock_time(&h, 7 * second) == 7 * 12 * second);
+	assert(vclock_time(&h, 8 * second) == 7 * 12 * second + second);
+
+	// concurrent skips don't get lost
+	pthread_t skippers[THREADS], reader;
+	pthread_create(&reader, NULL, &read_thread, NULL);
+	for (int i = 0; i < THREADS; i++)
+		pthread_create(&skippers[i], NULL, &skip_thread, NULL);
+	for (int i = 0; i < THREADS; i++)
+		pthread_join(skippers[i], NULL);
+	g_done = 1;
+	pthread_join(reader, NULL);
+	assert(vclock_skipped(&g_clock) == 3LL * SKIPS * THREADS);
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,150 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "bson.h"
+#include "bsoncheck.h"
+
+// the length of the NUL terminated string at data, -1 if it isn't
+static int64_t cstring_length(const uint8_t *data, uint32_t len)
+{
+	const uint8_t *nul = memchr(data, 0, len);
+
+	return nul == NULL ? -1 : nul - data;
+}
+
+// a length prefixed string, returns its size including the prefix
+static int64_t string_size(const uint8_t *data, uint32_t len)
+{
+	int32_t size;
+
+	if (len < 4)
+		return -1;
+	memcpy(&size, data, 4);
+	if (size < 1 || (uint32_t)size > len - 4 || data[4 + size - 1] != 0)
+		return -1;
+	return 4 + (int64_t)size;
+}
+
+static int64_t document_size(const uint8_t *data, uint32_t len, int depth);
+
+// the size of the value of an element of the given type
+static int64_t value_size(int type, const uint8_t *data, uint32_t len, int depth)
+{
+	int64_t size, inner;
+	int32_t binlen;
+
+	switch (type) {
+	case BSON_UNDEFINED: case BSON_NULL: case BSON_MINKEY: case BSON_MAXKEY:
+		return 0;
+	case BSON_BOOL:
+		size = 1;
+		break;
+	case BSON_INT:
+		size = 4;
+		break;
+	case BSON_DOUBLE: case BSON_DATE: case BSON_TIMESTAMP: case BSON_LONG:
+		size = 8;
+		break;
+	case BSON_OID:
+		size = 12;
+		break;
+	case BSON_STRING: case BSON_CODE: case BSON_SYMBOL:
+		return string_size(data, len);
+	case BSON_OBJECT: case BSON_ARRAY:
+		return document_size(data, len, depth + 1);
+	case BSON_BINDATA:
+		if (len < 5)
+			return -1;
+		memcpy(&binlen, data, 4);
+		if (binlen < 0)
+			return -1;
+		size = 5 + (int64_t)binlen;
+		break;
+	case BSON_REGEX:
+		size = cstring_length(data, len);
+		if (size < 0)
+			return -1;
+		inner = cstring_length(data + size + 1, len - (uint32_t)size - 1);
+		if (inner < 0)
+			return -1;
+		return size + 1 + inner + 1;
+	case BSON_DBREF:
+		size = string_size(data, len);
+		if (size < 0)
+			return -1;
+		size += 12;
+		break;
+	case BSON_CODEWSCOPE:
+		// total size, code string, scope document
+		if (len < 4)
+			return -1;
+		memcpy(&binlen, data, 4);
+		if (binlen < 4 || (uint32_t)binlen > len)
+			return -1;
+		size = string_size(data + 4, (uint32_t)binlen - 4);
+		if (size < 0)
+			return -1;
+		inner = document_size(data + 4 + size, (uint32_t)(binlen - 4 - size),
+			depth + 1);
+		if (inner < 0 || 4 + size + inner != binlen)
+			return -1;
+		return binlen;
+	default:
+		return -1;
+	}
+
+	return size > len ? -1 : size;
+}
+
+// the size of the document at data after checking all of its elements
+static int64_t document_size(const uint8_t *data, uint32_t len, int depth)
+{
+	uint32_t off = 4, end;
+	int32_t size;
+
+	if (depth > BSONCHECK_MAX_DEPTH || len < 5)
+		return -1;
+	memcpy(&size, data, 4);
+	if (size < 5 || (uint32_t)size > len || data[size - 1] != 0)
+		return -1;
+
+	// the elements, each lying before the terminating NUL
+	end = (uint32_t)size - 1;
+	while (off < end) {
+		int type = data[off++];
+		int64_t key, value;
+
+		key = cstring_length(data + off, end - off);
+		if (type == BSON_EOO || key < 0)
+			return -1;
+		off += (uint32_t)key + 1;
+
+		value = value_size(type, data + off, end - off, depth);
+		if (value < 0)
+			return -1;
+		off += (uint32_t)value;
+	}
+
+	return size;
+}
+
+int bsoncheck(const uint8_t *data, uint32_t len)
+{
+	return document_size(data, len, 0) < 0 ? -1 : 0;
+}
@@ -0,0 +1,42 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Bounded BSON Validation
+//
+// The bson library trusts every length it finds in a document, so a log
+// with a corrupted nested length makes bson_iterator_next() and friends
+// read far past the buffer.  The host tools run bsoncheck() over every
+// document before any bson_iterator or bson_find() use; it walks all the
+// elements, recursing into objects and arrays, and checks that each one
+// lies within its parent.
+//
+
+#ifndef __BSONCHECK_H
+#define __BSONCHECK_H
+
+#include <stdint.h>
+
+// objects nested deeper than this are rejected rather than recursed into
+#define BSONCHECK_MAX_DEPTH 32
+
+// returns 0 if the document at the start of data is well-formed and fits
+// into the len bytes available, -1 otherwise
+int bsoncheck(const uint8_t *data, uint32_t len);
+
+#endif
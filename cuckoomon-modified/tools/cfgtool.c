@@ -0,0 +1,177 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Converts between the INI config and the binary one (see cfgblob.h).
+//
+// cfgtool encode <in.ini> <out.cfg>
+//   every key=value line becomes a section, unknown keys are an error
+// cfgtool decode <in.cfg>
+//   prints the sections as INI to stdout; a value spanning multiple lines
+//   is printed as one key=value line per line, which is how the monitor
+//   treats repeated hook-control keys anyway
+//
+
+#include <stdio.h>
+#include "cfgblob.h"
+
+static char *read_file(const char *fname, uint32_t *size)
+{
+	FILE *fp = fopen(fname, "rb");
+	char *buf;
+	long length;
+
+	if (fp == NULL) {
+		perror(fname);
+		return NULL;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	length = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	buf = malloc(length + 1);
+	if (buf == NULL || fread(buf, 1, length, fp) != (size_t)length) {
+		fprintf(stderr, "%s: unable to read\n", fname);
+		free(buf);
+		fclose(fp);
+		return NULL;
+	}
+	buf[length] = 0;
+	fclose(fp);
+
+	*size = (uint32_t)length;
+	return buf;
+}
+
+static int encode(const char *infile, const char *outfile)
+{
+	cfgblob_writer_t w;
+	char *ini, *line, *next;
+	uint32_t size;
+	FILE *fp;
+	int lineno = 0, ret = 1;
+
+	ini = read_file(infile, &size);
+	if (ini == NULL)
+		return 1;
+
+	if (cfgblob_writer_init(&w) < 0) {
+		free(ini);
+		return 1;
+	}
+
+	for (line = ini; line != NULL && *line != 0; line = next) {
+		char *eq, *end;
+		uint16_t id;
+
+		lineno++;
+		next = strchr(line, '\n');
+		end = next != NULL ? next : line + strlen(line);
+		if (next != NULL)
+			next++;
+		if (end != line && end[-1] == '\r')
+			end--;
+		*end = 0;
+
+		// the monitor skips lines without a '=' as well
+		eq = strchr(line, '=');
+		if (eq == NULL)
+			continue;
+
+		id = cfgblob_key_id(line, (uint32_t)(eq - line));
+		if (id == 0) {
+			fprintf(stderr, "%s:%d: unknown key %.*s\n", infile, lineno,
+				(int)(eq - line), line);
+			goto out;
+		}
+
+		if (cfgblob_write(&w, id, eq + 1, (uint32_t)(end - eq - 1)) < 0) {
+			fprintf(stderr, "%s:%d: config too large\n", infile, lineno);
+			goto out;
+		}
+	}
+
+	cfgblob_finish(&w);
+
+	fp = fopen(outfile, "wb");
+	if (fp == NULL) {
+		perror(outfile);
+		goto out;
+	}
+	if (fwrite(w.buf, 1, w.length, fp) == w.length)
+		ret = 0;
+	else
+		fprintf(stderr, "%s: unable to write\n", outfile);
+	fclose(fp);
+
+out:
+	cfgblob_writer_free(&w);
+	free(ini);
+	return ret;
+}
+
+static int decode(const char *infile)
+{
+	cfgblob_t blob;
+	cfgblob_section_t s;
+	uint32_t size, off = 0;
+	char *data;
+
+	data = read_file(infile, &size);
+	if (data == NULL)
+		return 1;
+
+	if (cfgblob_open(&blob, data, size) < 0) {
+		fprintf(stderr, "%s: not a valid config\n", infile);
+		free(data);
+		return 1;
+	}
+
+	while (cfgblob_next(&blob, &off, &s)) {
+		const char *name = cfgblob_key_name(s.id);
+		const char *value = s.value, *end = s.value + s.length;
+
+		if (name == NULL) {
+			printf("# unknown section %u, %u bytes\n", s.id, s.length);
+			continue;
+		}
+
+		do {
+			const char *nl = memchr(value, '\n', end - value);
+			const char *eol = nl != NULL ? nl : end;
+			printf("%s=%.*s\n", name, (int)(eol - value), value);
+			value = nl != NULL ? nl + 1 : end;
+		} while (value != end);
+	}
+
+	free(data);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 4 && !strcmp(argv[1], "encode"))
+		return encode(argv[2], argv[3]);
+	if (argc == 3 && !strcmp(argv[1], "decode"))
+		return decode(argv[2]);
+
+	fprintf(stderr, "usage: %s encode <in.ini> <out.cfg>\n"
+		"       %s decode <in.cfg>\n", argv[0], argv[0]);
+	return 1;
+}
@@ -0,0 +1,809 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bson.h"
+#include "bsoncheck.h"
+#include "logcol.h"
+
+// like the log table in log.c
+#define MAX_INDEX 256
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+
+// the string dictionary; the strings point into the log unless owned
+typedef struct _dict_t {
+	uint32_t *slots;
+	uint32_t slot_count;
+
+	const char **data;
+	uint32_t *length;
+	uint32_t *hash;
+	uint8_t *owned;
+	uint32_t count;
+	uint32_t size;
+	uint64_t bytes;
+} dict_t;
+
+typedef struct _colbuf_t {
+	uint32_t name;
+	uint32_t kind;
+	uint8_t *kinds;
+	uint64_t *values;
+} colbuf_t;
+
+typedef struct _groupbuf_t {
+	uint32_t index;
+	uint32_t name;
+	uint32_t category;
+	uint32_t column_count;
+	colbuf_t *columns;
+	uint64_t rows;
+	uint64_t capacity;
+	uint64_t offset;
+} groupbuf_t;
+
+typedef struct _writer_t {
+	dict_t dict;
+	groupbuf_t *groups;
+	uint32_t group_count;
+	uint32_t group_size;
+
+	// group of every log index, according to the last info record
+	int current[MAX_INDEX];
+} writer_t;
+
+static uint32_t hash_string(const char *s, uint32_t length)
+{
+	uint32_t h = 2166136261u;
+	for (uint32_t i = 0; i < length; i++)
+		h = (h ^ (uint8_t)s[i]) * 16777619;
+	return h;
+}
+
+static int dict_grow(dict_t *d)
+{
+	uint32_t count = d->slot_count ? d->slot_count * 2 : 1024;
+	uint32_t *slots = calloc(count, sizeof(uint32_t));
+
+	if (slots == NULL)
+		return -1;
+	for (uint32_t id = 0; id < d->count; id++) {
+		uint32_t i = d->hash[id] & (count - 1);
+		while (slots[i] != 0)
+			i = (i + 1) & (count - 1);
+		slots[i] = id + 1;
+	}
+	free(d->slots);
+	d->slots = slots;
+	d->slot_count = count;
+	return 0;
+}
+
+// returns the id of the string, or -1
+static int64_t dict_intern(dict_t *d, const char *s, uint32_t length, int copy)
+{
+	uint32_t h = hash_string(s, length), i, id;
+
+	if (d->count * 2 >= d->slot_count && dict_grow(d) < 0)
+		return -1;
+
+	for (i = h & (d->slot_count - 1); d->slots[i] != 0;
+			i = (i + 1) & (d->slot_count - 1)) {
+		id = d->slots[i] - 1;
+		if (d->hash[id] == h && d->length[id] == length &&
+				!memcmp(d->data[id], s, length))
+			return id;
+	}
+
+	if (d->count == d->size) {
+		uint32_t size = d->size ? d->size * 2 : 1024;
+		const char **data = realloc(d->data, size * sizeof(char *));
+		if (data != NULL)
+			d->data = data;
+		uint32_t *len = realloc(d->length, size * sizeof(uint32_t));
+		if (len != NULL)
+			d->length = len;
+		uint32_t *hash = realloc(d->hash, size * sizeof(uint32_t));
+		if (hash != NULL)
+			d->hash = hash;
+		uint8_t *owned = realloc(d->owned, size);
+		if (owned != NULL)
+			d->owned = owned;
+		if (data == NULL || len == NULL || hash == NULL || owned == NULL)
+			return -1;
+		d->size = size;
+	}
+
+	id = d->count;
+	d->owned[id] = 0;
+	if (copy) {
+		char *p = malloc(length + 1);
+		if (p == NULL)
+			return -1;
+		memcpy(p, s, length);
+		p[length] = 0;
+		s = p;
+		d->owned[id] = 1;
+	}
+	d->data[id] = s;
+	d->length[id] = length;
+	d->hash[id] = h;
+	d->slots[i] = id + 1;
+	d->bytes += length + 1;
+	d->count++;
+	return id;
+}
+
+static void dict_free(dict_t *d)
+{
+	for (uint32_t id = 0; id < d->count; id++)
+		if (d->owned[id])
+			free((char *)d->data[id]);
+	free(d->slots);
+	free(d->data);
+	free(d->length);
+	free(d->hash);
+	free(d->owned);
+}
+
+static int group_reserve(groupbuf_t *g, uint64_t rows)
+{
+	uint64_t capacity;
+
+	if (rows <= g->capacity)
+		return 0;
+
+	capacity = g->capacity ? g->capacity * 2 : 64;
+	while (capacity < rows)
+		capacity *= 2;
+	for (uint32_t i = 0; i < g->column_count; i++) {
+		colbuf_t *col = &g->columns[i];
+		uint8_t *kinds = realloc(col->kinds, capacity);
+		if (kinds == NULL)
+			return -1;
+		col->kinds = kinds;
+		uint64_t *values = realloc(col->values, capacity * sizeof(uint64_t));
+		if (values == NULL)
+			return -1;
+		col->values = values;
+	}
+	g->capacity = capacity;
+	return 0;
+}
+
+// adds a column, the rows so far don't have a value for it
+static int group_add_column(groupbuf_t *g, uint32_t name)
+{
+	colbuf_t *columns = realloc(g->columns,
+		(g->column_count + 1) * sizeof(colbuf_t));
+	colbuf_t *col;
+
+	if (columns == NULL)
+		return -1;
+	g->columns = columns;
+	col = &columns[g->column_count];
+	col->name = name;
+	col->kinds = calloc(g->capacity ? g->capacity : 1, 1);
+	col->values = calloc(g->capacity ? g->capacity : 1, sizeof(uint64_t));
+	if (col->kinds == NULL || col->values == NULL) {
+		free(col->kinds);
+		free(col->values);
+		return -1;
+	}
+	g->column_count++;
+	return 0;
+}
+
+static int column_name(writer_t *w, groupbuf_t *g, uint32_t position)
+{
+	char name[16];
+	int64_t id;
+
+	snprintf(name, sizeof(name), "%u", position);
+	id = dict_intern(&w->dict, name, (uint32_t)strlen(name), 1);
+	return id < 0 ? -1 : group_add_column(g, (uint32_t)id);
+}
+
+static const char *g_fixed[LOGCOL_FIXED] = { "#", "T", "t", "C", "R", "P", "r" };
+
+static groupbuf_t *new_group(writer_t *w, int index, uint32_t name,
+	uint32_t category)
+{
+	groupbuf_t *g;
+
+	if (w->group_count == w->group_size) {
+		uint32_t size = w->group_size ? w->group_size * 2 : 64;
+		groupbuf_t *groups = realloc(w->groups, size * sizeof(groupbuf_t));
+		if (groups == NULL)
+			return NULL;
+		w->groups = groups;
+		w->group_size = size;
+	}
+
+	g = &w->groups[w->group_count];
+	memset(g, 0, sizeof(*g));
+	g->index = index;
+	g->name = name;
+	g->category = category;
+	for (int i = 0; i < LOGCOL_FIXED; i++) {
+		int64_t id = dict_intern(&w->dict, g_fixed[i], (uint32_t)strlen(g_fixed[i]), 0);
+		if (id < 0 || group_add_column(g, (uint32_t)id) < 0)
+			return NULL;
+	}
+	w->current[index] = w->group_count++;
+	return g;
+}
+
+static int64_t intern_iterator(dict_t *d, const bson_iterator *it)
+{
+	if (bson_iterator_type(it) == BSON_BINDATA)
+		return dict_intern(d, bson_iterator_bin_data(it),
+			bson_iterator_bin_len(it), 0);
+	return dict_intern(d, bson_iterator_string(it),
+		bson_iterator_string_len(it) - 1, 0);
+}
+
+// { "I": index, "name": .., "type": "info", "category": .., "args": [
+//   "is_success", "retval", name or [name, type], .. ] }
+static int handle_info(writer_t *w, int index, bson_iterator *it)
+{
+	int64_t name = -1, category = -1, id;
+	bson_iterator args, arg;
+	int have_args = 0;
+	groupbuf_t *g;
+
+	while (bson_iterator_next(it) != BSON_EOO) {
+		const char *key = bson_iterator_key(it);
+		if (!strcmp(key, "name") && bson_iterator_type(it) == BSON_STRING)
+			name = intern_iterator(&w->dict, it);
+		else if (!strcmp(key, "category") && bson_iterator_type(it) == BSON_STRING)
+			category = intern_iterator(&w->dict, it);
+		else if (!strcmp(key, "args") && bson_iterator_type(it) == BSON_ARRAY) {
+			bson_iterator_subiterator(it, &args);
+			have_args = 1;
+		}
+	}
+	if (category < 0)
+		category = dict_intern(&w->dict, "", 0, 0);
+	if (name < 0 || category < 0)
+		return -1;
+
+	g = new_group(w, index, (uint32_t)name, (uint32_t)category);
+	if (g == NULL)
+		return -1;
+
+	for (uint32_t position = 0; have_args &&
+			bson_iterator_next(&args) != BSON_EOO; position++) {
+		id = -1;
+		if (bson_iterator_type(&args) == BSON_STRING) {
+			id = intern_iterator(&w->dict, &args);
+		}
+		else if (bson_iterator_type(&args) == BSON_ARRAY) {
+			bson_iterator_subiterator(&args, &arg);
+			if (bson_iterator_next(&arg) == BSON_STRING)
+				id = intern_iterator(&w->dict, &arg);
+		}
+
+		// unnamed ones are named after their position
+		if (id < 0 ? column_name(w, g, position) < 0 :
+				group_add_column(g, (uint32_t)id) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static uint64_t unsigned_value(const bson_iterator *it)
+{
+	if (bson_iterator_type(it) == BSON_INT)
+		return (uint32_t)bson_iterator_int(it);
+	if (bson_iterator_type(it) == BSON_LONG)
+		return (uint64_t)bson_iterator_long(it);
+	return 0;
+}
+
+static int set_argument(writer_t *w, colbuf_t *col, uint64_t row,
+	const bson_iterator *it)
+{
+	int64_t id;
+
+	switch (bson_iterator_type(it)) {
+	case BSON_INT:
+		col->kinds[row] = LOGCOL_INT;
+		col->values[row] = (uint64_t)(int64_t)bson_iterator_int(it);
+		break;
+	case BSON_LONG:
+		col->kinds[row] = LOGCOL_LONG;
+		col->values[row] = (uint64_t)bson_iterator_long(it);
+		break;
+	case BSON_STRING:
+	case BSON_BINDATA:
+		id = intern_iterator(&w->dict, it);
+		if (id < 0)
+			return -1;
+		col->kinds[row] = LOGCOL_STRING;
+		col->values[row] = (uint64_t)id;
+		break;
+	default:
+		col->kinds[row] = LOGCOL_OTHER;
+		break;
+	}
+	return 0;
+}
+
+// { "I": index, "C": .., "R": .., "P": .., "T": .., "t": .., "r": ..,
+//   "args": [is_success, retval, ..] }
+static int handle_call(writer_t *w, groupbuf_t *g, uint64_t seq,
+	bson_iterator *it)
+{
+	uint64_t row = g->rows;
+	bson_iterator args;
+
+	if (group_reserve(g, row + 1) < 0)
+		return -1;
+	for (uint32_t i = 0; i < g->column_count; i++) {
+		g->columns[i].kinds[row] = i < LOGCOL_FIXED ? LOGCOL_LONG : LOGCOL_NONE;
+		g->columns[i].values[row] = 0;
+	}
+	g->columns[LOGCOL_SEQ].values[row] = seq;
+
+	while (bson_iterator_next(it) != BSON_EOO) {
+		const char *key = bson_iterator_key(it);
+		int fixed = -1;
+
+		if (key[0] != 0 && key[1] == 0) {
+			for (int i = LOGCOL_THREAD; i < LOGCOL_FIXED; i++)
+				if (g_fixed[i][0] == key[0])
+					fixed = i;
+		}
+		if (fixed >= 0) {
+			g->columns[fixed].values[row] = unsigned_value(it);
+			continue;
+		}
+		if (strcmp(key, "args") || bson_iterator_type(it) != BSON_ARRAY)
+			continue;
+
+		bson_iterator_subiterator(it, &args);
+		for (uint32_t column = LOGCOL_FIXED;
+				bson_iterator_next(&args) != BSON_EOO; column++) {
+			// more arguments than the info record named
+			if (column == g->column_count) {
+				if (column_name(w, g, column - LOGCOL_FIXED) < 0)
+					return -1;
+			}
+			if (set_argument(w, &g->columns[column], row, &args) < 0)
+				return -1;
+		}
+	}
+	g->rows++;
+	return 0;
+}
+
+static int compare_groups(const void *a, const void *b, void *param)
+{
+	const groupbuf_t *x = a, *y = b;
+	const dict_t *d = param;
+	uint32_t lx = d->length[x->name], ly = d->length[y->name];
+	int ret = memcmp(d->data[x->name], d->data[y->name], MIN(lx, ly));
+
+	if (ret == 0)
+		ret = lx < ly ? -1 : lx > ly;
+	if (ret == 0)
+		ret = x->index < y->index ? -1 : x->index > y->index;
+	return ret;
+}
+
+static int write_padding(FILE *fp, uint64_t length)
+{
+	static const uint8_t zero[8];
+	return length % 8 == 0 || fwrite(zero, 1, 8 - length % 8, fp) == 8 - length % 8 ? 0 : -1;
+}
+
+static int write_file(writer_t *w, const char *path, uint64_t calls,
+	uint64_t *size)
+{
+	logcol_header_t header;
+	dict_t *d = &w->dict;
+	uint64_t pos, offset;
+	FILE *fp;
+	int ret = 0;
+
+	qsort_r(w->groups, w->group_count, sizeof(groupbuf_t), &compare_groups, d);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, LOGCOL_MAGIC, sizeof(header.magic));
+	header.group_count = w->group_count;
+	header.string_count = d->count;
+	header.calls = calls;
+
+	// lay everything out first
+	pos = ALIGN8(sizeof(header));
+	header.strings = pos;
+	pos = ALIGN8(pos + (d->count + 1) * sizeof(uint64_t) + d->bytes);
+	header.groups = pos;
+	pos += w->group_count * sizeof(logcol_group_t);
+	for (uint32_t i = 0; i < w->group_count; i++) {
+		groupbuf_t *g = &w->groups[i];
+
+		g->offset = pos;
+		pos += g->column_count * sizeof(logcol_column_t);
+		for (uint32_t j = 0; j < g->column_count; j++) {
+			colbuf_t *col = &g->columns[j];
+
+			col->kind = g->rows ? col->kinds[0] : LOGCOL_NONE;
+			for (uint64_t row = 1; row < g->rows; row++) {
+				if (col->kinds[row] != col->kind) {
+					col->kind = LOGCOL_MIXED;
+					break;
+				}
+			}
+			if (col->kind == LOGCOL_MIXED)
+				pos += ALIGN8(g->rows);
+			pos += g->rows * sizeof(uint64_t);
+		}
+	}
+	header.size = pos;
+
+	fp = fopen(path, "wb");
+	if (fp == NULL) {
+		perror(path);
+		return -1;
+	}
+	setvbuf(fp, NULL, _IOFBF, 1024 * 1024);
+
+	ret |= fwrite(&header, sizeof(header), 1, fp) != 1;
+	ret |= write_padding(fp, sizeof(header));
+
+	offset = header.strings + (d->count + 1) * sizeof(uint64_t);
+	for (uint32_t id = 0; id <= d->count; id++) {
+		ret |= fwrite(&offset, sizeof(offset), 1, fp) != 1;
+		if (id < d->count)
+			offset += d->length[id] + 1;
+	}
+	// zero-terminated, for the convenience of the readers
+	for (uint32_t id = 0; id < d->count; id++) {
+		ret |= fwrite(d->data[id], 1, d->length[id], fp) != d->length[id];
+		ret |= fputc(0, fp) == EOF;
+	}
+	ret |= write_padding(fp, offset);
+
+	for (uint32_t i = 0; i < w->group_count; i++) {
+		groupbuf_t *g = &w->groups[i];
+		logcol_group_t group;
+
+		group.index = g->index;
+		group.name = g->name;
+		group.category = g->category;
+		group.column_count = g->column_count;
+		group.rows = g->rows;
+		group.columns = g->offset;
+		ret |= fwrite(&group, sizeof(group), 1, fp) != 1;
+	}
+
+	for (uint32_t i = 0; i < w->group_count; i++) {
+		groupbuf_t *g = &w->groups[i];
+
+		pos = g->offset + g->column_count * sizeof(logcol_column_t);
+		for (uint32_t j = 0; j < g->column_count; j++) {
+			colbuf_t *col = &g->columns[j];
+			logcol_column_t column;
+
+			column.name = col->name;
+			column.kind = col->kind;
+			column.kinds = 0;
+			if (col->kind == LOGCOL_MIXED) {
+				column.kinds = pos;
+				pos += ALIGN8(g->rows);
+			}
+			column.values = pos;
+			pos += g->rows * sizeof(uint64_t);
+			ret |= fwrite(&column, sizeof(column), 1, fp) != 1;
+		}
+		for (uint32_t j = 0; j < g->column_count; j++) {
+			colbuf_t *col = &g->columns[j];
+
+			if (col->kind == LOGCOL_MIXED) {
+				ret |= fwrite(col->kinds, 1, g->rows, fp) != g->rows;
+				ret |= write_padding(fp, g->rows);
+			}
+			ret |= fwrite(col->values, sizeof(uint64_t), g->rows, fp) != g->rows;
+		}
+	}
+
+	ret |= fclose(fp) != 0;
+	if (ret != 0) {
+		fprintf(stderr, "unable to write %s\n", path);
+		return -1;
+	}
+	*size = header.size;
+	return 0;
+}
+
+int logcol_write(const uint8_t *log, size_t length, const char *path,
+	logcol_stats_t *stats)
+{
+	writer_t w;
+	size_t offset = 0;
+	int ret = 0;
+
+	memset(&w, 0, sizeof(w));
+	memset(stats, 0, sizeof(*stats));
+	for (int i = 0; i < MAX_INDEX; i++)
+		w.current[i] = -1;
+
+	if (length >= 5 && !memcmp(log, "BSON\n", 5))
+		offset = 5;
+
+	while (ret == 0 && offset + 4 <= length) {
+		bson_iterator it;
+		int32_t size;
+		int index;
+
+		memcpy(&size, log + offset, 4);
+		if (size < 5 || (size_t)size > length - offset) {
+			fprintf(stderr, "truncated document at offset %zu\n", offset);
+			break;
+		}
+
+		if (bsoncheck(log + offset, (uint32_t)size) < 0) {
+			fprintf(stderr, "malformed document at offset %zu\n", offset);
+			offset += size;
+			stats->documents++;
+			stats->unknown++;
+			continue;
+		}
+
+		// "I" comes first, followed by "name" for the info records
+		bson_iterator_from_buffer(&it, (const char *)log + offset);
+		offset += size;
+		stats->documents++;
+		if (bson_iterator_next(&it) != BSON_INT || strcmp(bson_iterator_key(&it), "I") ||
+				(index = bson_iterator_int(&it)) < 0 || index >= MAX_INDEX) {
+			stats->unknown++;
+			continue;
+		}
+
+		bson_iterator first = it;
+		if (bson_iterator_next(&first) == BSON_STRING &&
+				!strcmp(bson_iterator_key(&first), "name")) {
+			ret = handle_info(&w, index, &it);
+		}
+		else if (w.current[index] < 0) {
+			stats->unknown++;
+		}
+		else {
+			ret = handle_call(&w, &w.groups[w.current[index]],
+				stats->documents - 1, &it);
+			stats->calls++;
+		}
+	}
+
+	if (ret == 0)
+		ret = write_file(&w, path, stats->calls, &stats->size);
+	else
+		fprintf(stderr, "out of memory\n");
+
+	for (uint32_t i = 0; i < w.group_count; i++) {
+		for (uint32_t j = 0; j < w.groups[i].column_count; j++) {
+			free(w.groups[i].columns[j].kinds);
+			free(w.groups[i].columns[j].values);
+		}
+		free(w.groups[i].columns);
+	}
+	free(w.groups);
+	dict_free(&w.dict);
+	return ret;
+}
+
+static int in_bounds(const logcol_t *c, uint64_t offset, uint64_t count,
+	uint64_t size)
+{
+	return offset <= c->size && count <= (c->size - offset) / size;
+}
+
+static int validate(const logcol_t *c)
+{
+	const logcol_header_t *h = c->header;
+
+	if (!in_bounds(c, h->strings, (uint64_t)h->string_count + 1, sizeof(uint64_t)) ||
+			h->strings % 8 != 0 ||
+			!in_bounds(c, h->groups, h->group_count, sizeof(logcol_group_t)) ||
+			h->groups % 8 != 0)
+		return -1;
+
+	for (uint32_t id = 0; id < h->string_count; id++) {
+		uint64_t start = c->string_offsets[id], end = c->string_offsets[id + 1];
+		if (start >= end || end > c->size || c->base[end - 1] != 0)
+			return -1;
+	}
+
+	for (uint32_t i = 0; i < h->group_count; i++) {
+		const logcol_group_t *g = &c->groups[i];
+		const logcol_column_t *cols;
+
+		if (g->name >= h->string_count || g->category >= h->string_count ||
+				g->column_count < LOGCOL_FIXED || g->columns % 8 != 0 ||
+				!in_bounds(c, g->columns, g->column_count, sizeof(logcol_column_t)))
+			return -1;
+
+		cols = (const logcol_column_t *)(c->base + g->columns);
+		for (uint32_t j = 0; j < g->column_count; j++) {
+			if (cols[j].name >= h->string_count || cols[j].values % 8 != 0 ||
+					!in_bounds(c, cols[j].values, g->rows, sizeof(uint64_t)))
+				return -1;
+			if (cols[j].kind == LOGCOL_MIXED && !in_bounds(c, cols[j].kinds, g->rows, 1))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+int logcol_open(logcol_t *c, const char *path)
+{
+	struct stat st;
+	void *base;
+	int fd;
+
+	memset(c, 0, sizeof(*c));
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(logcol_header_t)) {
+		fprintf(stderr, "%s isn't a columnar log\n", path);
+		close(fd);
+		return -1;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	c->base = base;
+	c->size = st.st_size;
+	c->header = base;
+	if (memcmp(c->header->magic, LOGCOL_MAGIC, sizeof(c->header->magic)) ||
+			c->header->size != c->size) {
+		fprintf(stderr, "%s isn't a columnar log\n", path);
+		logcol_close(c);
+		return -1;
+	}
+	c->string_offsets = (const uint64_t *)(c->base + c->header->strings);
+	c->groups = (const logcol_group_t *)(c->base + c->header->groups);
+	if (validate(c) < 0) {
+		fprintf(stderr, "%s is corrupt\n", path);
+		logcol_close(c);
+		return -1;
+	}
+	return 0;
+}
+
+void logcol_close(logcol_t *c)
+{
+	if (c->base != NULL)
+		munmap((void *)c->base, c->size);
+	memset(c, 0, sizeof(*c));
+}
+
+const char *logcol_string(const logcol_t *c, uint32_t id, uint32_t *length)
+{
+	if (id >= c->header->string_count)
+		return NULL;
+	if (length != NULL)
+		*length = (uint32_t)(c->string_offsets[id + 1] - c->string_offsets[id] - 1);
+	return (const char *)c->base + c->string_offsets[id];
+}
+
+static int compare_name(const logcol_t *c, uint32_t id, const char *name,
+	size_t length)
+{
+	uint32_t l = 0;
+	const char *s = logcol_string(c, id, &l);
+	int ret = memcmp(s, name, MIN(l, length));
+	return ret != 0 ? ret : l < length ? -1 : l > length;
+}
+
+const logcol_group_t *logcol_group(const logcol_t *c, const char *name)
+{
+	uint32_t lo = 0, hi = c->header->group_count;
+	size_t length = strlen(name);
+
+	// the first group of that name
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (compare_name(c, c->groups[mid].name, name, length) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == c->header->group_count ||
+			compare_name(c, c->groups[lo].name, name, length) != 0)
+		return NULL;
+	return &c->groups[lo];
+}
+
+const logcol_column_t *logcol_column(const logcol_t *c,
+	const logcol_group_t *g, const char *name)
+{
+	const logcol_column_t *cols = (const logcol_column_t *)(c->base + g->columns);
+	size_t length = strlen(name);
+
+	for (uint32_t i = 0; i < g->column_count; i++)
+		if (compare_name(c, cols[i].name, name, length) == 0)
+			return &cols[i];
+	return NULL;
+}
+
+uint8_t *logcol_match_prefix(const logcol_t *c, const char *prefix,
+	uint32_t flags)
+{
+	uint32_t count = c->header->string_count;
+	size_t length = strlen(prefix);
+	uint8_t *match = calloc(count / 8 + 1, 1);
+
+	if (match == NULL)
+		return NULL;
+
+	for (uint32_t id = 0; id < count; id++) {
+		uint32_t l = 0;
+		const char *s = logcol_string(c, id, &l);
+
+		if (l < length)
+			continue;
+		if ((flags & LOGCOL_NOCASE) ? !strncasecmp(s, prefix, length) :
+				!memcmp(s, prefix, length))
+			match[id / 8] |= 1 << (id % 8);
+	}
+	return match;
+}
+
+uint64_t logcol_filter(const logcol_t *c, const logcol_group_t *g,
+	const logcol_column_t *col, const uint8_t *match, uint64_t *rows)
+{
+	const uint64_t *values = logcol_values(c, col);
+	uint64_t strings = c->header->string_count, count = 0;
+
+	if (col->kind == LOGCOL_STRING) {
+		// no branches, the compiler gets to vectorize the loads
+		for (uint64_t row = 0; row < g->rows; row++) {
+			uint64_t id = values[row] < strings ? values[row] : 0;
+			rows[count] = row;
+			count += values[row] < strings && (match[id / 8] >> (id % 8)) & 1;
+		}
+	}
+	else if (col->kind == LOGCOL_MIXED) {
+		const uint8_t *kinds = c->base + col->kinds;
+		for (uint64_t row = 0; row < g->rows; row++) {
+			uint64_t id = values[row] < strings ? values[row] : 0;
+			rows[count] = row;
+			count += kinds[row] == LOGCOL_STRING && values[row] < strings &&
+				(match[id / 8] >> (id % 8)) & 1;
+		}
+	}
+	return count;
+}
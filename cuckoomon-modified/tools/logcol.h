@@ -0,0 +1,157 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Columnar Logs
+//
+// The BSON stream of one process turned into columns which can be filtered
+// without decoding any documents.  Every API (every info record) gets a
+// column group with one row per call.  Its first columns are the fields
+// every call has: the position of the call in the log ("#"), "T", "t",
+// "C", "R", "P" and "r"; one column per argument follows, named like the
+// info record names it.  Strings, including the binary utf-8 ones the
+// monitor logs, are dictionary encoded: a column only holds the id of the
+// string, and every distinct string is stored once for the whole file.
+//
+// The file is meant to be mapped as it is, all offsets are relative to its
+// start and every section is 8 byte aligned:
+//
+//   logcol_header_t
+//   uint64_t string offsets[string_count + 1], followed by the strings
+//   logcol_group_t[group_count], sorted by API name
+//   per group: logcol_column_t[column_count], the kinds of the columns
+//     which hold more than one kind of value (uint8_t[rows]) and the
+//     values (uint64_t[rows]) of all of them
+//
+// Looking for, e.g., every NtCreateFile of a file below some directory
+// then takes a pass over the dictionary to mark the strings with that
+// prefix and a pass over one column of one group.
+//
+
+#ifndef __LOGCOL_H
+#define __LOGCOL_H
+
+#include "compat.h"
+
+#define LOGCOL_MAGIC "LOGCOL1"
+
+// kinds of values
+#define LOGCOL_NONE 0
+#define LOGCOL_INT 1
+#define LOGCOL_LONG 2
+#define LOGCOL_STRING 3
+#define LOGCOL_OTHER 4
+#define LOGCOL_MIXED 0xff
+
+// the columns every group starts with
+#define LOGCOL_SEQ 0
+#define LOGCOL_THREAD 1
+#define LOGCOL_TIME 2
+#define LOGCOL_CALLER 3
+#define LOGCOL_RETADDR 4
+#define LOGCOL_PARENT 5
+#define LOGCOL_REPEATED 6
+#define LOGCOL_FIXED 7
+
+// for logcol_match_prefix()
+#define LOGCOL_NOCASE 1
+
+typedef struct _logcol_header_t {
+	char magic[8];
+	uint32_t group_count;
+	uint32_t string_count;
+	uint64_t strings;
+	uint64_t groups;
+	uint64_t calls;
+	uint64_t size;
+} logcol_header_t;
+
+typedef struct _logcol_group_t {
+	uint32_t index;
+	// string ids
+	uint32_t name;
+	uint32_t category;
+	uint32_t column_count;
+	uint64_t rows;
+	uint64_t columns;
+} logcol_group_t;
+
+typedef struct _logcol_column_t {
+	uint32_t name;
+	// LOGCOL_MIXED if the kinds differ between rows
+	uint32_t kind;
+	// zero unless kind is LOGCOL_MIXED
+	uint64_t kinds;
+	uint64_t values;
+} logcol_column_t;
+
+typedef struct _logcol_t {
+	const uint8_t *base;
+	size_t size;
+	const logcol_header_t *header;
+	const uint64_t *string_offsets;
+	const logcol_group_t *groups;
+} logcol_t;
+
+typedef struct _logcol_stats_t {
+	uint64_t documents;
+	uint64_t calls;
+	// calls of an index no info record described, other documents that
+	// aren't calls and malformed ones
+	uint64_t unknown;
+	uint64_t size;
+} logcol_stats_t;
+
+// converts the log (optionally starting with the "BSON\n" protocol line)
+// to a columnar file at path
+int logcol_write(const uint8_t *log, size_t length, const char *path,
+	logcol_stats_t *stats);
+
+int logcol_open(logcol_t *c, const char *path);
+void logcol_close(logcol_t *c);
+
+const char *logcol_string(const logcol_t *c, uint32_t id, uint32_t *length);
+const logcol_group_t *logcol_group(const logcol_t *c, const char *name);
+const logcol_column_t *logcol_column(const logcol_t *c,
+	const logcol_group_t *g, const char *name);
+
+static __inline const uint64_t *logcol_values(const logcol_t *c,
+	const logcol_column_t *col)
+{
+	return (const uint64_t *)(c->base + col->values);
+}
+
+static __inline int logcol_kind(const logcol_t *c, const logcol_column_t *col,
+	uint64_t row)
+{
+	if (col->kind != LOGCOL_MIXED)
+		return col->kind;
+	return c->base[col->kinds + row];
+}
+
+// bitmap over the string ids, set for those starting with prefix; free()
+// it when done
+uint8_t *logcol_match_prefix(const logcol_t *c, const char *prefix,
+	uint32_t flags);
+
+// stores the rows of the group whose strings in col are set in match to
+// rows (room for g->rows entries), returns how many there are
+uint64_t logcol_filter(const logcol_t *c, const logcol_group_t *g,
+	const logcol_column_t *col, const uint8_t *match, uint64_t *rows);
+
+#endif
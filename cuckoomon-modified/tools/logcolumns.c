@@ -0,0 +1,173 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Converts BSON logs to the columnar format of logcol.h and queries them.
+//
+// logcolumns convert <in.bson> <out.col>
+// logcolumns list <file.col>
+//   the APIs in the file, with their amount of calls and their columns
+// logcolumns filter <file.col> <api> <column> <prefix> [nocase]
+//   the calls of <api> whose <column> is a string starting with <prefix>,
+//   e.g. logcolumns filter x.col NtCreateFile FileName C:\Windows\System32
+//
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "logcol.h"
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int do_convert(const char *in, const char *out)
+{
+	logcol_stats_t stats;
+	struct stat st;
+	const uint8_t *log;
+	double start;
+	int fd, ret;
+
+	fd = open(in, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+		perror(in);
+		return 1;
+	}
+	log = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (log == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	start = now();
+	ret = logcol_write(log, st.st_size, out, &stats);
+	munmap((void *)log, st.st_size);
+	if (ret < 0)
+		return 1;
+
+	printf("%llu documents, %llu calls, %llu unknown; %llu -> %llu bytes "
+		"in %.2fs\n", (unsigned long long)stats.documents,
+		(unsigned long long)stats.calls, (unsigned long long)stats.unknown,
+		(unsigned long long)st.st_size, (unsigned long long)stats.size,
+		now() - start);
+	return 0;
+}
+
+static const char *g_kinds[] = { "none", "int", "long", "string", "other" };
+
+static int do_list(const char *path)
+{
+	logcol_t c;
+
+	if (logcol_open(&c, path) < 0)
+		return 1;
+
+	for (uint32_t i = 0; i < c.header->group_count; i++) {
+		const logcol_group_t *g = &c.groups[i];
+		const logcol_column_t *cols =
+			(const logcol_column_t *)(c.base + g->columns);
+
+		printf("%s (%s, %u): %llu calls\n", logcol_string(&c, g->name, NULL),
+			logcol_string(&c, g->category, NULL), g->index,
+			(unsigned long long)g->rows);
+		for (uint32_t j = LOGCOL_FIXED; j < g->column_count; j++)
+			printf("    %s %s\n", logcol_string(&c, cols[j].name, NULL),
+				cols[j].kind == LOGCOL_MIXED ? "mixed" : g_kinds[cols[j].kind]);
+	}
+	printf("%llu calls, %u strings\n", (unsigned long long)c.header->calls,
+		c.header->string_count);
+	logcol_close(&c);
+	return 0;
+}
+
+static int do_filter(const char *path, const char *api, const char *column,
+	const char *prefix, uint32_t flags)
+{
+	const logcol_group_t *g;
+	const logcol_column_t *col, *cols;
+	uint64_t *rows, count = 0;
+	uint8_t *match;
+	double start;
+	logcol_t c;
+
+	if (logcol_open(&c, path) < 0)
+		return 1;
+
+	start = now();
+	match = logcol_match_prefix(&c, prefix, flags);
+	rows = NULL;
+	if (match == NULL)
+		return 1;
+
+	// the same API can have been described more than once
+	for (g = logcol_group(&c, api); g != NULL &&
+			g < c.groups + c.header->group_count &&
+			!strcmp(logcol_string(&c, g->name, NULL), api); g++) {
+		col = logcol_column(&c, g, column);
+		if (col == NULL)
+			continue;
+		rows = realloc(rows, (g->rows + 1) * sizeof(uint64_t));
+		if (rows == NULL)
+			return 1;
+
+		cols = (const logcol_column_t *)(c.base + g->columns);
+		uint64_t n = logcol_filter(&c, g, col, match, rows);
+		for (uint64_t i = 0; i < n; i++) {
+			uint64_t row = rows[i];
+			printf("%llu T=%llu t=%llu %s\n",
+				(unsigned long long)logcol_values(&c, &cols[LOGCOL_SEQ])[row],
+				(unsigned long long)logcol_values(&c, &cols[LOGCOL_THREAD])[row],
+				(unsigned long long)logcol_values(&c, &cols[LOGCOL_TIME])[row],
+				logcol_string(&c, (uint32_t)logcol_values(&c, col)[row], NULL));
+		}
+		count += n;
+	}
+	fprintf(stderr, "%llu matches in %.3fs\n", (unsigned long long)count,
+		now() - start);
+
+	free(rows);
+	free(match);
+	logcol_close(&c);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 4 && !strcmp(argv[1], "convert"))
+		return do_convert(argv[2], argv[3]);
+	if (argc == 3 && !strcmp(argv[1], "list"))
+		return do_list(argv[2]);
+	if ((argc == 6 || (argc == 7 && !strcmp(argv[6], "nocase"))) &&
+			!strcmp(argv[1], "filter"))
+		return do_filter(argv[2], argv[3], argv[4], argv[5],
+			argc == 7 ? LOGCOL_NOCASE : 0);
+
+	fprintf(stderr, "usage: %s convert <in.bson> <out.col>\n"
+		"       %s list <file.col>\n"
+		"       %s filter <file.col> <api> <column> <prefix> [nocase]\n",
+		argv[0], argv[0], argv[0]);
+	return 1;
+}
@@ -0,0 +1,662 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bson.h"
+#include "bsoncheck.h"
+#include "logidx.h"
+
+// like the log table in log.c
+#define MAX_INDEX 256
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+
+typedef struct _listbuf_t {
+	uint64_t key;
+	const char *name;
+	uint64_t *offsets;
+	uint64_t count;
+	uint64_t size;
+	uint32_t t_first;
+	uint32_t t_last;
+	uint64_t position;
+} listbuf_t;
+
+typedef struct _lists_t {
+	listbuf_t *lists;
+	uint32_t count;
+	uint32_t size;
+} lists_t;
+
+typedef struct _builder_t {
+	logidx_block_t *blocks;
+	uint64_t block_count;
+	uint64_t block_size;
+
+	lists_t threads;
+	lists_t apis;
+
+	// threads by id, open addressing with the list number + 1
+	uint32_t *slots;
+	uint32_t slot_count;
+
+	// API of every log index, according to the last info record
+	int current[MAX_INDEX];
+} builder_t;
+
+static listbuf_t *new_list(lists_t *l, uint64_t key, const char *name)
+{
+	listbuf_t *list;
+
+	if (l->count == l->size) {
+		uint32_t size = l->size ? l->size * 2 : 64;
+		listbuf_t *lists = realloc(l->lists, size * sizeof(listbuf_t));
+		if (lists == NULL)
+			return NULL;
+		l->lists = lists;
+		l->size = size;
+	}
+	list = &l->lists[l->count++];
+	memset(list, 0, sizeof(*list));
+	list->key = key;
+	list->name = name;
+	return list;
+}
+
+static int list_add(listbuf_t *list, uint64_t offset, uint32_t tick)
+{
+	if (list->count == list->size) {
+		uint64_t size = list->size ? list->size * 2 : 256;
+		uint64_t *offsets = realloc(list->offsets, size * sizeof(uint64_t));
+		if (offsets == NULL)
+			return -1;
+		list->offsets = offsets;
+		list->size = size;
+	}
+	if (list->count == 0)
+		list->t_first = tick;
+	list->t_last = tick;
+	list->offsets[list->count++] = offset;
+	return 0;
+}
+
+static uint32_t hash_thread(uint32_t tid)
+{
+	return tid * 2654435761u;
+}
+
+static listbuf_t *thread_list(builder_t *b, uint32_t tid)
+{
+	uint32_t i;
+
+	if (b->threads.count * 2 >= b->slot_count) {
+		uint32_t count = b->slot_count ? b->slot_count * 2 : 256;
+		uint32_t *slots = calloc(count, sizeof(uint32_t));
+		if (slots == NULL)
+			return NULL;
+		for (uint32_t j = 0; j < b->threads.count; j++) {
+			i = hash_thread((uint32_t)b->threads.lists[j].key) & (count - 1);
+			while (slots[i] != 0)
+				i = (i + 1) & (count - 1);
+			slots[i] = j + 1;
+		}
+		free(b->slots);
+		b->slots = slots;
+		b->slot_count = count;
+	}
+
+	for (i = hash_thread(tid) & (b->slot_count - 1); b->slots[i] != 0;
+			i = (i + 1) & (b->slot_count - 1)) {
+		if (b->threads.lists[b->slots[i] - 1].key == tid)
+			return &b->threads.lists[b->slots[i] - 1];
+	}
+	b->slots[i] = b->threads.count + 1;
+	return new_list(&b->threads, tid, NULL);
+}
+
+// the same API described again (e.g., on a new log connection) shares the
+// list with the earlier descriptions
+static int api_list(builder_t *b, const char *name)
+{
+	for (uint32_t i = 0; i < b->apis.count; i++)
+		if (!strcmp(b->apis.lists[i].name, name))
+			return i;
+	return new_list(&b->apis, 0, name) != NULL ? (int)b->apis.count - 1 : -1;
+}
+
+static int add_block(builder_t *b, uint64_t offset)
+{
+	logidx_block_t *block;
+
+	if (b->block_count == b->block_size) {
+		uint64_t size = b->block_size ? b->block_size * 2 : 1024;
+		logidx_block_t *blocks = realloc(b->blocks, size * sizeof(logidx_block_t));
+		if (blocks == NULL)
+			return -1;
+		b->blocks = blocks;
+		b->block_size = size;
+	}
+	block = &b->blocks[b->block_count];
+	block->offset = offset;
+	block->t_low = UINT32_MAX;
+	block->t_high = b->block_count ? block[-1].t_high : 0;
+	b->block_count++;
+	return 0;
+}
+
+// { "I": index, "name": .., "type": "info", .. } or
+// { "I": index, "C": .., "R": .., "P": .., "T": .., "t": .., .. }
+static int index_document(builder_t *b, const uint8_t *doc, uint64_t offset,
+	logidx_stats_t *stats)
+{
+	logidx_block_t *block = &b->blocks[b->block_count - 1];
+	bson_iterator it;
+	uint32_t tid = 0, tick = 0;
+	listbuf_t *list;
+	bson_type type;
+	int index;
+
+	bson_iterator_from_buffer(&it, (const char *)doc);
+	if (bson_iterator_next(&it) != BSON_INT || strcmp(bson_iterator_key(&it), "I"))
+		return 0;
+	index = bson_iterator_int(&it);
+	if (index < 0 || index >= MAX_INDEX)
+		return 0;
+
+	type = bson_iterator_next(&it);
+	if (type == BSON_EOO)
+		return 0;
+	if (type == BSON_STRING && !strcmp(bson_iterator_key(&it), "name")) {
+		b->current[index] = api_list(b, bson_iterator_string(&it));
+		return b->current[index] < 0 ? -1 : 0;
+	}
+
+	do {
+		const char *key = bson_iterator_key(&it);
+		if (key[0] == 'T' && key[1] == 0)
+			tid = (uint32_t)bson_iterator_int(&it);
+		else if (key[0] == 't' && key[1] == 0)
+			tick = (uint32_t)bson_iterator_int(&it);
+	} while (bson_iterator_next(&it) != BSON_EOO);
+
+	stats->calls++;
+	block->t_low = MIN(block->t_low, tick);
+	block->t_high = MAX(block->t_high, tick);
+
+	list = thread_list(b, tid);
+	if (list == NULL || list_add(list, offset, tick) < 0)
+		return -1;
+
+	if (b->current[index] < 0) {
+		stats->unknown++;
+		return 0;
+	}
+	return list_add(&b->apis.lists[b->current[index]], offset, tick);
+}
+
+static int compare_threads(const void *a, const void *b)
+{
+	const listbuf_t *x = a, *y = b;
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static int compare_apis(const void *a, const void *b)
+{
+	const listbuf_t *x = a, *y = b;
+	return strcmp(x->name, y->name);
+}
+
+static int write_lists(FILE *fp, const lists_t *l)
+{
+	int ret = 0;
+
+	for (uint32_t i = 0; i < l->count; i++) {
+		logidx_list_t list;
+
+		list.key = l->lists[i].key;
+		list.count = l->lists[i].count;
+		list.offsets = l->lists[i].position;
+		list.t_first = l->lists[i].t_first;
+		list.t_last = l->lists[i].t_last;
+		ret |= fwrite(&list, sizeof(list), 1, fp) != 1;
+	}
+	return ret;
+}
+
+static int write_index(builder_t *b, const char *path, uint64_t log_size,
+	uint32_t stride, logidx_stats_t *stats)
+{
+	static const uint8_t zero[8];
+	logidx_header_t header;
+	uint64_t pos, names;
+	FILE *fp;
+	int ret = 0;
+
+	qsort(b->threads.lists, b->threads.count, sizeof(listbuf_t), &compare_threads);
+	qsort(b->apis.lists, b->apis.count, sizeof(listbuf_t), &compare_apis);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, LOGIDX_MAGIC, sizeof(header.magic));
+	header.stride = stride;
+	header.thread_count = b->threads.count;
+	header.api_count = b->apis.count;
+	header.log_size = log_size;
+	header.documents = stats->documents;
+	header.calls = stats->calls;
+
+	pos = ALIGN8(sizeof(header));
+	header.blocks = pos;
+	pos += b->block_count * sizeof(logidx_block_t);
+	header.threads = pos;
+	pos += b->threads.count * sizeof(logidx_list_t);
+	header.apis = pos;
+	pos += b->apis.count * sizeof(logidx_list_t);
+
+	names = pos;
+	for (uint32_t i = 0; i < b->apis.count; i++) {
+		b->apis.lists[i].key = pos;
+		pos += strlen(b->apis.lists[i].name) + 1;
+	}
+	pos = ALIGN8(pos);
+
+	for (uint32_t i = 0; i < b->threads.count; i++) {
+		b->threads.lists[i].position = pos;
+		pos += b->threads.lists[i].count * sizeof(uint64_t);
+	}
+	for (uint32_t i = 0; i < b->apis.count; i++) {
+		b->apis.lists[i].position = pos;
+		pos += b->apis.lists[i].count * sizeof(uint64_t);
+	}
+	header.size = pos;
+
+	fp = fopen(path, "wb");
+	if (fp == NULL) {
+		perror(path);
+		return -1;
+	}
+	setvbuf(fp, NULL, _IOFBF, 1024 * 1024);
+
+	ret |= fwrite(&header, sizeof(header), 1, fp) != 1;
+	ret |= fwrite(zero, 1, ALIGN8(sizeof(header)) - sizeof(header), fp) !=
+		ALIGN8(sizeof(header)) - sizeof(header);
+	ret |= fwrite(b->blocks, sizeof(logidx_block_t), b->block_count, fp) !=
+		b->block_count;
+	ret |= write_lists(fp, &b->threads);
+	ret |= write_lists(fp, &b->apis);
+
+	pos = names;
+	for (uint32_t i = 0; i < b->apis.count; i++) {
+		size_t length = strlen(b->apis.lists[i].name) + 1;
+		ret |= fwrite(b->apis.lists[i].name, 1, length, fp) != length;
+		pos += length;
+	}
+	ret |= fwrite(zero, 1, ALIGN8(pos) - pos, fp) != ALIGN8(pos) - pos;
+
+	for (uint32_t i = 0; i < b->threads.count; i++)
+		ret |= fwrite(b->threads.lists[i].offsets, sizeof(uint64_t),
+			b->threads.lists[i].count, fp) != b->threads.lists[i].count;
+	for (uint32_t i = 0; i < b->apis.count; i++)
+		ret |= fwrite(b->apis.lists[i].offsets, sizeof(uint64_t),
+			b->apis.lists[i].count, fp) != b->apis.lists[i].count;
+
+	ret |= fclose(fp) != 0;
+	if (ret != 0) {
+		fprintf(stderr, "unable to write %s\n", path);
+		return -1;
+	}
+	stats->size = header.size;
+	return 0;
+}
+
+static const uint8_t *map_file(const char *path, size_t *size)
+{
+	struct stat st;
+	void *base;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	if (st.st_size == 0) {
+		fprintf(stderr, "%s is empty\n", path);
+		close(fd);
+		return NULL;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+	*size = st.st_size;
+	return base;
+}
+
+int logidx_build(const char *log_path, const char *index_path,
+	uint32_t stride, logidx_stats_t *stats)
+{
+	const uint8_t *log;
+	size_t size, offset = 0;
+	builder_t b;
+	int ret = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	if (stride == 0)
+		stride = LOGIDX_DEFAULT_STRIDE;
+
+	log = map_file(log_path, &size);
+	if (log == NULL)
+		return -1;
+
+	// the log is only read once, front to back
+	madvise((void *)log, size, MADV_SEQUENTIAL);
+
+	memset(&b, 0, sizeof(b));
+	for (int i = 0; i < MAX_INDEX; i++)
+		b.current[i] = -1;
+
+	if (size >= 5 && !memcmp(log, "BSON\n", 5))
+		offset = 5;
+
+	while (ret == 0 && offset + 4 <= size) {
+		int32_t length;
+
+		memcpy(&length, log + offset, 4);
+		if (length < 5 || (size_t)length > size - offset) {
+			fprintf(stderr, "truncated document at offset %zu\n", offset);
+			break;
+		}
+		if (stats->documents % stride == 0 && add_block(&b, offset) < 0)
+			ret = -1;
+		else if (bsoncheck(log + offset, (uint32_t)length) < 0)
+			fprintf(stderr, "malformed document at offset %zu\n", offset);
+		else
+			ret = index_document(&b, log + offset, offset, stats);
+		stats->documents++;
+		offset += length;
+	}
+
+	// a partial document at the end isn't covered
+	if (ret == 0)
+		ret = write_index(&b, index_path, offset, stride, stats);
+	else
+		fprintf(stderr, "out of memory\n");
+
+	munmap((void *)log, size);
+	for (uint32_t i = 0; i < b.threads.count; i++)
+		free(b.threads.lists[i].offsets);
+	for (uint32_t i = 0; i < b.apis.count; i++)
+		free(b.apis.lists[i].offsets);
+	free(b.threads.lists);
+	free(b.apis.lists);
+	free(b.slots);
+	free(b.blocks);
+	return ret;
+}
+
+static int in_bounds(const logidx_t *x, uint64_t offset, uint64_t count,
+	uint64_t size)
+{
+	return offset <= x->size && count <= (x->size - offset) / size;
+}
+
+static int validate_lists(const logidx_t *x, const logidx_list_t *lists,
+	uint32_t count, int apis)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		const logidx_list_t *l = &lists[i];
+
+		if (l->offsets % 8 != 0 || !in_bounds(x, l->offsets, l->count, sizeof(uint64_t)))
+			return -1;
+		if (apis && (l->key >= x->size ||
+				memchr(x->base + l->key, 0, x->size - l->key) == NULL))
+			return -1;
+	}
+	return 0;
+}
+
+static uint64_t block_count(const logidx_t *x)
+{
+	return x->header->documents / x->header->stride +
+		(x->header->documents % x->header->stride != 0);
+}
+
+static int validate(const logidx_t *x)
+{
+	const logidx_header_t *h = x->header;
+	uint64_t blocks;
+
+	if (h->stride == 0 || h->size != x->size || h->log_size > x->log_size)
+		return -1;
+
+	blocks = block_count(x);
+	if (h->blocks % 8 != 0 || h->threads % 8 != 0 || h->apis % 8 != 0 ||
+			!in_bounds(x, h->blocks, blocks, sizeof(logidx_block_t)) ||
+			!in_bounds(x, h->threads, h->thread_count, sizeof(logidx_list_t)) ||
+			!in_bounds(x, h->apis, h->api_count, sizeof(logidx_list_t)))
+		return -1;
+
+	if (validate_lists(x, x->threads, h->thread_count, 0) < 0 ||
+			validate_lists(x, x->apis, h->api_count, 1) < 0)
+		return -1;
+	return 0;
+}
+
+int logidx_open(logidx_t *x, const char *log_path, const char *index_path)
+{
+	memset(x, 0, sizeof(*x));
+
+	x->log = map_file(log_path, &x->log_size);
+	if (x->log == NULL)
+		return -1;
+	x->base = map_file(index_path, &x->size);
+	if (x->base == NULL) {
+		logidx_close(x);
+		return -1;
+	}
+
+	x->header = (const logidx_header_t *)x->base;
+	if (x->size < sizeof(logidx_header_t) ||
+			memcmp(x->header->magic, LOGIDX_MAGIC, sizeof(x->header->magic))) {
+		fprintf(stderr, "%s isn't a log index\n", index_path);
+		logidx_close(x);
+		return -1;
+	}
+	x->blocks = (const logidx_block_t *)(x->base + x->header->blocks);
+	x->threads = (const logidx_list_t *)(x->base + x->header->threads);
+	x->apis = (const logidx_list_t *)(x->base + x->header->apis);
+	if (validate(x) < 0) {
+		fprintf(stderr, "%s is corrupt or doesn't belong to %s\n", index_path,
+			log_path);
+		logidx_close(x);
+		return -1;
+	}
+	return 0;
+}
+
+void logidx_close(logidx_t *x)
+{
+	if (x->log != NULL)
+		munmap((void *)x->log, x->log_size);
+	if (x->base != NULL)
+		munmap((void *)x->base, x->size);
+	memset(x, 0, sizeof(*x));
+}
+
+// length of the document at offset, zero if it's not a complete one
+static uint32_t document_length(const logidx_t *x, uint64_t offset)
+{
+	int32_t length;
+
+	if (offset > x->log_size || x->log_size - offset < 5)
+		return 0;
+	memcpy(&length, x->log + offset, 4);
+	if (length < 5 || (uint64_t)length > x->log_size - offset)
+		return 0;
+	return (uint32_t)length;
+}
+
+int64_t logidx_seek_document(const logidx_t *x, uint64_t n)
+{
+	uint64_t offset, length;
+
+	if (n >= x->header->documents)
+		return -1;
+
+	offset = x->blocks[n / x->header->stride].offset;
+	for (n %= x->header->stride; n != 0; n--) {
+		length = document_length(x, offset);
+		if (length == 0)
+			return -1;
+		offset += length;
+	}
+	return document_length(x, offset) ? (int64_t)offset : -1;
+}
+
+// the index may be stale, the log may have changed since, so every
+// document is checked before it's parsed
+static int document_valid(const logidx_t *x, uint64_t offset, uint32_t length)
+{
+	return length != 0 && bsoncheck(x->log + offset, length) == 0;
+}
+
+// of a document which has been checked
+static uint32_t document_tick(const logidx_t *x, uint64_t offset)
+{
+	bson_iterator it;
+
+	bson_iterator_from_buffer(&it, (const char *)x->log + offset);
+	while (bson_iterator_next(&it) != BSON_EOO) {
+		const char *key = bson_iterator_key(&it);
+		if (key[0] == 't' && key[1] == 0 && bson_iterator_type(&it) == BSON_INT)
+			return (uint32_t)bson_iterator_int(&it);
+	}
+	return 0;
+}
+
+uint32_t logidx_document(const logidx_t *x, uint64_t offset)
+{
+	uint32_t length = document_length(x, offset);
+
+	return document_valid(x, offset, length) ? length : 0;
+}
+
+uint32_t logidx_tick(const logidx_t *x, uint64_t offset)
+{
+	if (logidx_document(x, offset) == 0)
+		return 0;
+	return document_tick(x, offset);
+}
+
+// of a document which has been checked
+static int is_call(const logidx_t *x, uint64_t offset)
+{
+	bson_iterator it;
+
+	bson_iterator_from_buffer(&it, (const char *)x->log + offset);
+	if (bson_iterator_next(&it) != BSON_INT || strcmp(bson_iterator_key(&it), "I"))
+		return 0;
+	return bson_iterator_next(&it) != BSON_EOO && strcmp(bson_iterator_key(&it), "name");
+}
+
+int64_t logidx_seek_time(const logidx_t *x, uint32_t tick)
+{
+	uint64_t lo = 0, hi, offset, end;
+
+	// the first block which reaches tick, every block before it ends
+	// below it
+	hi = block_count(x);
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (x->blocks[mid].t_high < tick)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == block_count(x))
+		return -1;
+
+	offset = x->blocks[lo].offset;
+	end = x->header->log_size;
+	while (offset < end) {
+		uint32_t length = document_length(x, offset);
+		if (length == 0)
+			return -1;
+		if (document_valid(x, offset, length) && is_call(x, offset) &&
+				document_tick(x, offset) >= tick)
+			return offset;
+		offset += length;
+	}
+	return -1;
+}
+
+const logidx_list_t *logidx_thread(const logidx_t *x, uint32_t tid)
+{
+	uint32_t lo = 0, hi = x->header->thread_count;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (x->threads[mid].key < tid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == x->header->thread_count || x->threads[lo].key != tid)
+		return NULL;
+	return &x->threads[lo];
+}
+
+const logidx_list_t *logidx_api(const logidx_t *x, const char *name)
+{
+	uint32_t lo = 0, hi = x->header->api_count;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (strcmp(logidx_api_name(x, &x->apis[mid]), name) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == x->header->api_count || strcmp(logidx_api_name(x, &x->apis[lo]), name))
+		return NULL;
+	return &x->apis[lo];
+}
+
+uint64_t logidx_list_seek_time(const logidx_t *x, const logidx_list_t *l,
+	uint32_t tick)
+{
+	const uint64_t *offsets = logidx_offsets(x, l);
+	uint64_t lo = 0, hi = l->count;
+
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (logidx_tick(x, offsets[mid]) < tick)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
@@ -0,0 +1,150 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Log Index
+//
+// A sidecar file next to a BSON log (<log>.idx) which makes it possible to
+// jump into the middle of the log: BSON documents only carry their length,
+// so without it the only way to reach an event is to walk every document
+// before it.  The index is built in one streaming pass over the mapped log
+// and holds
+//
+//   - the offset of every stride-th document, together with the range of
+//     timestamps ("t") of the calls up to the next one, for seeking by
+//     document number or by time,
+//   - per thread ("T") the offsets of all its calls,
+//   - per API (by name, from the info records) the offsets of all calls.
+//
+// The offset lists are in log order, which is also the order of the
+// timestamps, so seeking by time inside one is a binary search as well.
+// Like the columnar logs (logcol.h) the index is meant to be mapped as it
+// is; all offsets in it are relative to its start, except the document
+// offsets, which are relative to the start of the log.
+//
+
+#ifndef __LOGIDX_H
+#define __LOGIDX_H
+
+#include "compat.h"
+
+#define LOGIDX_MAGIC "LOGIDX1"
+#define LOGIDX_DEFAULT_STRIDE 1024
+
+typedef struct _logidx_header_t {
+	char magic[8];
+	uint32_t stride;
+	uint32_t thread_count;
+	uint32_t api_count;
+	uint32_t reserved;
+	// the amount of the log that was indexed
+	uint64_t log_size;
+	uint64_t documents;
+	uint64_t calls;
+	// logidx_block_t[(documents + stride - 1) / stride]
+	uint64_t blocks;
+	// logidx_list_t[thread_count], sorted by thread
+	uint64_t threads;
+	// logidx_list_t[api_count], sorted by name
+	uint64_t apis;
+	uint64_t size;
+} logidx_header_t;
+
+typedef struct _logidx_block_t {
+	// of the first document of the block
+	uint64_t offset;
+	// the lowest timestamp of a call in the block, and the highest one in
+	// the block or any block before it
+	uint32_t t_low;
+	uint32_t t_high;
+} logidx_block_t;
+
+typedef struct _logidx_list_t {
+	// the thread, or the offset of the zero-terminated API name
+	uint64_t key;
+	uint64_t count;
+	// uint64_t[count]
+	uint64_t offsets;
+	// timestamps of the first and the last call
+	uint32_t t_first;
+	uint32_t t_last;
+} logidx_list_t;
+
+typedef struct _logidx_t {
+	const uint8_t *log;
+	size_t log_size;
+	const uint8_t *base;
+	size_t size;
+	const logidx_header_t *header;
+	const logidx_block_t *blocks;
+	const logidx_list_t *threads;
+	const logidx_list_t *apis;
+} logidx_t;
+
+typedef struct _logidx_stats_t {
+	uint64_t documents;
+	uint64_t calls;
+	// calls of an index no info record described
+	uint64_t unknown;
+	uint64_t size;
+} logidx_stats_t;
+
+// indexes the log at log_path (optionally starting with the "BSON\n"
+// protocol line) into index_path
+int logidx_build(const char *log_path, const char *index_path,
+	uint32_t stride, logidx_stats_t *stats);
+
+// maps the log and its index, a log which has grown since is fine
+int logidx_open(logidx_t *x, const char *log_path, const char *index_path);
+void logidx_close(logidx_t *x);
+
+// offset of the n-th document of the log, or -1 if there's none
+int64_t logidx_seek_document(const logidx_t *x, uint64_t n);
+
+// offset of the first call at or after tick, or -1 if there's none
+int64_t logidx_seek_time(const logidx_t *x, uint32_t tick);
+
+const logidx_list_t *logidx_thread(const logidx_t *x, uint32_t tid);
+const logidx_list_t *logidx_api(const logidx_t *x, const char *name);
+
+static __inline const uint64_t *logidx_offsets(const logidx_t *x,
+	const logidx_list_t *l)
+{
+	return (const uint64_t *)(x->base + l->offsets);
+}
+
+static __inline const char *logidx_api_name(const logidx_t *x,
+	const logidx_list_t *l)
+{
+	return (const char *)x->base + l->key;
+}
+
+// position in the list of the first call at or after tick, l->count if
+// there's none
+uint64_t logidx_list_seek_time(const logidx_t *x, const logidx_list_t *l,
+	uint32_t tick);
+
+// length of the complete, well-formed document at offset, zero if there's
+// none; check before parsing a document the index points at
+uint32_t logidx_document(const logidx_t *x, uint64_t offset);
+
+// the timestamp of the call at offset, zero for other documents and
+// malformed ones
+uint32_t logidx_tick(const logidx_t *x, uint64_t offset);
+
+#endif
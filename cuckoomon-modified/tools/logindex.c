@@ -0,0 +1,192 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Builds the sidecar index of a BSON log (see logidx.h) and uses it to
+// jump straight to the events of interest.
+//
+// logindex build <log.bson> [stride]
+//   writes <log.bson>.idx, with an entry for every stride-th document
+// logindex stats <log.bson>
+// logindex doc <log.bson> <n> [count]
+//   the documents from the n-th one on
+// logindex time <log.bson> <tick> [count]
+//   the calls from timestamp <tick> on
+// logindex thread <log.bson> <tid> [tick] [count]
+// logindex api <log.bson> <name> [tick] [count]
+//   the calls of one thread or API, from timestamp <tick> on
+//
+// Every document is printed as its offset, log index, thread, timestamp
+// and size.  [count] defaults to 10.
+//
+
+#include <stdio.h>
+#include <time.h>
+#include "bson.h"
+#include "logidx.h"
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// returns the length of the document, zero if it's malformed
+static uint32_t print_document(const logidx_t *x, uint64_t offset)
+{
+	bson_iterator it;
+	uint32_t length = logidx_document(x, offset);
+	int index = -1, tid = -1;
+
+	if (length == 0) {
+		printf("%llu: malformed\n", (unsigned long long)offset);
+		return 0;
+	}
+
+	bson_iterator_from_buffer(&it, (const char *)x->log + offset);
+	while (bson_iterator_next(&it) != BSON_EOO) {
+		const char *key = bson_iterator_key(&it);
+		if (!strcmp(key, "I"))
+			index = bson_iterator_int(&it);
+		else if (!strcmp(key, "T"))
+			tid = bson_iterator_int(&it);
+	}
+	printf("%llu: I=%d T=%d t=%u (%u bytes)\n", (unsigned long long)offset,
+		index, tid, logidx_tick(x, offset), length);
+	return length;
+}
+
+// the documents from offset on, up to the end of what was indexed
+static void print_documents(const logidx_t *x, int64_t offset, long count)
+{
+	uint32_t length;
+
+	for (; offset >= 0 && count > 0 &&
+			(uint64_t)offset + 4 <= x->header->log_size; count--) {
+		length = print_document(x, offset);
+		if (length == 0)
+			break;
+		offset += length;
+	}
+}
+
+static void print_list(const logidx_t *x, const logidx_list_t *l,
+	uint32_t tick, long count)
+{
+	uint64_t i = logidx_list_seek_time(x, l, tick);
+
+	for (; i < l->count && count > 0; i++, count--)
+		print_document(x, logidx_offsets(x, l)[i]);
+}
+
+static int do_build(const char *path, const char *index_path, uint32_t stride)
+{
+	logidx_stats_t stats;
+	double start = now();
+
+	if (logidx_build(path, index_path, stride, &stats) < 0)
+		return 1;
+	printf("%llu documents, %llu calls, %llu unknown; %llu bytes of index "
+		"in %.2fs\n", (unsigned long long)stats.documents,
+		(unsigned long long)stats.calls, (unsigned long long)stats.unknown,
+		(unsigned long long)stats.size, now() - start);
+	return 0;
+}
+
+static void do_stats(const logidx_t *x)
+{
+	const logidx_header_t *h = x->header;
+
+	printf("%llu of %llu bytes indexed, %llu documents, %llu calls, "
+		"stride %u\n", (unsigned long long)h->log_size,
+		(unsigned long long)x->log_size, (unsigned long long)h->documents,
+		(unsigned long long)h->calls, h->stride);
+	for (uint32_t i = 0; i < h->thread_count; i++)
+		printf("thread %llu: %llu calls, t=%u..%u\n",
+			(unsigned long long)x->threads[i].key,
+			(unsigned long long)x->threads[i].count,
+			x->threads[i].t_first, x->threads[i].t_last);
+	for (uint32_t i = 0; i < h->api_count; i++)
+		printf("%s: %llu calls, t=%u..%u\n", logidx_api_name(x, &x->apis[i]),
+			(unsigned long long)x->apis[i].count, x->apis[i].t_first,
+			x->apis[i].t_last);
+}
+
+int main(int argc, char *argv[])
+{
+	char index_path[4096];
+	const logidx_list_t *l;
+	logidx_t x;
+	int ret = 0;
+
+	if (argc < 3)
+		goto usage;
+
+	snprintf(index_path, sizeof(index_path), "%s.idx", argv[2]);
+	if (!strcmp(argv[1], "build") && argc <= 4)
+		return do_build(argv[2], index_path,
+			argc == 4 ? (uint32_t)atoi(argv[3]) : LOGIDX_DEFAULT_STRIDE);
+
+	if (logidx_open(&x, argv[2], index_path) < 0)
+		return 1;
+
+	if (!strcmp(argv[1], "stats") && argc == 3) {
+		do_stats(&x);
+	}
+	else if (!strcmp(argv[1], "doc") && (argc == 4 || argc == 5)) {
+		print_documents(&x, logidx_seek_document(&x, strtoull(argv[3], NULL, 10)),
+			argc == 5 ? atol(argv[4]) : 10);
+	}
+	else if (!strcmp(argv[1], "time") && (argc == 4 || argc == 5)) {
+		print_documents(&x, logidx_seek_time(&x, (uint32_t)strtoul(argv[3], NULL, 10)),
+			argc == 5 ? atol(argv[4]) : 10);
+	}
+	else if ((!strcmp(argv[1], "thread") || !strcmp(argv[1], "api")) &&
+			argc >= 4 && argc <= 6) {
+		if (!strcmp(argv[1], "thread"))
+			l = logidx_thread(&x, (uint32_t)strtoul(argv[3], NULL, 10));
+		else
+			l = logidx_api(&x, argv[3]);
+		if (l == NULL) {
+			fprintf(stderr, "no calls of %s %s\n", argv[1], argv[3]);
+			ret = 1;
+		}
+		else {
+			print_list(&x, l, argc >= 5 ? (uint32_t)strtoul(argv[4], NULL, 10) : 0,
+				argc == 6 ? atol(argv[5]) : 10);
+		}
+	}
+	else {
+		logidx_close(&x);
+		goto usage;
+	}
+
+	logidx_close(&x);
+	return ret;
+
+usage:
+	fprintf(stderr, "usage: %s build <log.bson> [stride]\n"
+		"       %s stats <log.bson>\n"
+		"       %s doc <log.bson> <n> [count]\n"
+		"       %s time <log.bson> <tick> [count]\n"
+		"       %s thread <log.bson> <tid> [tick] [count]\n"
+		"       %s api <log.bson> <name> [tick] [count]\n",
+		argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+	return 1;
+}
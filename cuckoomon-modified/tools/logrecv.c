@@ -0,0 +1,568 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Receives the log connections of many monitors at once and writes every
+// process' events to a file of its own.
+//
+// logrecv <port> <outdir> [connections]
+//
+// All connections are served from a single thread with epoll.  Documents
+// are parsed in place in the receive buffer, only far enough to follow the
+// "info" records describing each log index and to pick up the process
+// identifier from the __process__ notification; complete documents are
+// then written straight out of the receive buffer.  The events of a
+// connection end up in <outdir>/<peer>-<pid>.bson (-<connection> is added
+// if that exists already), in the same format as the connection carried
+// them minus the protocol line.  <outdir>/<peer>-<pid>.apis lists how many
+// times every API was logged once the connection closed.
+//
+// Every document is checked with bsoncheck() before it is parsed.  A
+// malformed one drops the connection, the documents before it are kept.
+//
+// Connections announcing "BSONMUX" (see payload.h) are taken apart, only
+// the events are kept; payloadrecv stores the payload streams as well.
+//
+// With [connections] logrecv exits once that many connections closed and
+// prints the throughput, which together with logreplay makes a benchmark.
+//
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "bson.h"
+#include "bsoncheck.h"
+#include "payload.h"
+
+// like the log table in log.c
+#define MAX_INDEX 256
+
+// the monitor never sends anything bigger than its log buffer
+#define MAX_DOCUMENT (16 * 1024 * 1024)
+
+#define BUFFER_SIZE (1024 * 1024)
+
+// reads per connection and wakeup, so one busy monitor can't starve others
+#define MAX_READS 8
+
+#define PROTOCOL_UNKNOWN -1
+#define PROTOCOL_BSON 0
+#define PROTOCOL_MUX 1
+
+typedef struct _conn_t {
+	int fd;
+	uint32_t id;
+	char peer[INET_ADDRSTRLEN];
+	int protocol;
+
+	// output file, named after the connection until the process
+	// identifier is known
+	int out;
+	int named;
+	char base[4096];
+
+	uint8_t *buf;
+	uint32_t used;
+	uint32_t size;
+
+	// the events carried by BSONMUX frames, which still need to be cut
+	// into documents
+	uint8_t *events;
+	uint32_t events_used;
+	uint32_t events_size;
+
+	// the info records
+	char *names[MAX_INDEX];
+	uint64_t calls[MAX_INDEX];
+
+	uint64_t documents;
+	uint64_t bytes;
+	uint64_t unknown;
+	uint64_t payload_bytes;
+} conn_t;
+
+static const char *g_outdir;
+static uint32_t g_next_id;
+static uint32_t g_closed;
+static uint64_t g_documents;
+static uint64_t g_bytes;
+static volatile sig_atomic_t g_stop;
+
+static int write_all(int fd, const uint8_t *buf, uint32_t len)
+{
+	while (len != 0) {
+		ssize_t r = write(fd, buf, len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;
+		buf += r;
+		len -= (uint32_t)r;
+	}
+	return 0;
+}
+
+static int open_output(conn_t *c)
+{
+	char path[4200];
+
+	snprintf(c->base, sizeof(c->base), "%s/%s-conn%u", g_outdir, c->peer, c->id);
+	snprintf(path, sizeof(path), "%s.bson", c->base);
+	c->out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (c->out < 0) {
+		fprintf(stderr, "unable to create %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// renames the output file after the process once we know it
+static void name_output(conn_t *c, uint32_t pid)
+{
+	char base[4096], from[4200], to[4200];
+
+	snprintf(base, sizeof(base), "%s/%s-%u", g_outdir, c->peer, pid);
+	snprintf(to, sizeof(to), "%s.bson", base);
+	if (access(to, F_OK) == 0) {
+		snprintf(base, sizeof(base), "%s/%s-%u-%u", g_outdir, c->peer, pid, c->id);
+		snprintf(to, sizeof(to), "%s.bson", base);
+	}
+
+	snprintf(from, sizeof(from), "%s.bson", c->base);
+	if (rename(from, to) == 0)
+		memcpy(c->base, base, sizeof(base));
+	c->named = 1;
+}
+
+static void process_notification(conn_t *c, bson_iterator *it)
+{
+	bson_iterator args;
+
+	// "args": [is_success, retval, TimeLow, TimeHigh, ProcessIdentifier, ..]
+	while (bson_iterator_next(it) != BSON_EOO) {
+		if (strcmp(bson_iterator_key(it), "args") ||
+				bson_iterator_type(it) != BSON_ARRAY)
+			continue;
+
+		bson_iterator_subiterator(it, &args);
+		while (bson_iterator_next(&args) != BSON_EOO) {
+			if (!strcmp(bson_iterator_key(&args), "4")) {
+				name_output(c, (uint32_t)bson_iterator_int(&args));
+				return;
+			}
+		}
+	}
+}
+
+static void handle_document(conn_t *c, const uint8_t *data)
+{
+	bson_iterator it;
+	int index;
+
+	// every document starts with "I", followed by "name" for the info
+	// records and by "C" for the calls, so there's no need to search
+	bson_iterator_from_buffer(&it, (const char *)data);
+	if (bson_iterator_next(&it) != BSON_INT || strcmp(bson_iterator_key(&it), "I")) {
+		c->unknown++;
+		return;
+	}
+
+	index = bson_iterator_int(&it);
+	if (index < 0 || index >= MAX_INDEX) {
+		c->unknown++;
+		return;
+	}
+
+	if (bson_iterator_next(&it) == BSON_STRING &&
+			!strcmp(bson_iterator_key(&it), "name")) {
+		free(c->names[index]);
+		c->names[index] = strdup(bson_iterator_string(&it));
+		return;
+	}
+
+	if (c->names[index] == NULL) {
+		c->unknown++;
+		return;
+	}
+
+	c->calls[index]++;
+	if (!c->named && !strcmp(c->names[index], "__process__"))
+		process_notification(c, &it);
+}
+
+// handles the complete documents at the start of data and writes them out
+// in one go, returns how many bytes were used or -1 on bad input
+static int64_t process_events(conn_t *c, const uint8_t *data, uint32_t len)
+{
+	uint32_t off = 0;
+	int bad = 0;
+
+	while (len - off >= 4) {
+		int32_t size;
+
+		memcpy(&size, data + off, 4);
+		if (size < 5 || size > MAX_DOCUMENT) {
+			bad = 1;
+			break;
+		}
+		if ((uint32_t)size > len - off)
+			break;
+		if (bsoncheck(data + off, (uint32_t)size) < 0) {
+			bad = 1;
+			break;
+		}
+
+		handle_document(c, data + off);
+		c->documents++;
+		off += (uint32_t)size;
+	}
+
+	// the documents before a bad one are kept
+	if (off != 0 && write_all(c->out, data, off) < 0) {
+		fprintf(stderr, "unable to write %s.bson: %s\n", c->base, strerror(errno));
+		return -1;
+	}
+
+	c->bytes += off;
+	return bad ? -1 : (int64_t)off;
+}
+
+// the size the receive buffer needs for the document or frame at its start
+static uint32_t needed_size(conn_t *c)
+{
+	uint32_t size;
+
+	if (c->used < 4)
+		return 0;
+	memcpy(&size, c->buf, 4);
+
+	// frame lengths don't include the length itself
+	return c->protocol == PROTOCOL_MUX ? size + 4 : size;
+}
+
+static int grow(uint8_t **buf, uint32_t *size, uint32_t needed)
+{
+	uint32_t newsize = *size;
+	uint8_t *p;
+
+	while (newsize < needed)
+		newsize *= 2;
+	if (newsize == *size)
+		return 0;
+
+	p = realloc(*buf, newsize);
+	if (p == NULL)
+		return -1;
+	*buf = p;
+	*size = newsize;
+	return 0;
+}
+
+static int add_events(conn_t *c, const uint8_t *data, uint32_t len)
+{
+	int64_t used;
+
+	if (grow(&c->events, &c->events_size, c->events_used + len) < 0)
+		return -1;
+	memcpy(c->events + c->events_used, data, len);
+	c->events_used += len;
+
+	used = process_events(c, c->events, c->events_used);
+	if (used < 0)
+		return -1;
+	memmove(c->events, c->events + used, c->events_used - used);
+	c->events_used -= (uint32_t)used;
+	return 0;
+}
+
+// the protocol line of announce_netlog()
+static int process_protocol(conn_t *c)
+{
+	uint8_t *nl = memchr(c->buf, '\n', c->used);
+	uint32_t len;
+
+	if (nl == NULL)
+		return c->used < 16 ? 0 : -1;
+
+	len = (uint32_t)(nl - c->buf) + 1;
+	if (len == 5 && !memcmp(c->buf, "BSON\n", 5))
+		c->protocol = PROTOCOL_BSON;
+	else if (len == 8 && !memcmp(c->buf, "BSONMUX\n", 8)) {
+		c->protocol = PROTOCOL_MUX;
+		c->events_size = BUFFER_SIZE;
+		c->events = malloc(c->events_size);
+		if (c->events == NULL)
+			return -1;
+	}
+	else {
+		fprintf(stderr, "%s: unknown protocol %.*s\n", c->peer, (int)len - 1, c->buf);
+		return -1;
+	}
+
+	memmove(c->buf, c->buf + len, c->used - len);
+	c->used -= len;
+	return open_output(c);
+}
+
+static int process_buffer(conn_t *c)
+{
+	uint32_t off = 0;
+
+	if (c->protocol == PROTOCOL_UNKNOWN) {
+		if (process_protocol(c) < 0)
+			return -1;
+		if (c->protocol == PROTOCOL_UNKNOWN)
+			return 0;
+	}
+
+	if (c->protocol == PROTOCOL_BSON) {
+		int64_t used = process_events(c, c->buf, c->used);
+		if (used < 0)
+			return -1;
+		off = (uint32_t)used;
+	}
+	else {
+		while (off < c->used) {
+			payload_frame_t f;
+			int n = payload_parse(c->buf + off, c->used - off, &f);
+
+			if (n == 0)
+				break;
+			if (n < 0)
+				return -1;
+
+			if (f.type == PAYLOAD_FRAME_EVENTS) {
+				if (add_events(c, f.data, f.size) < 0)
+					return -1;
+			}
+			else {
+				c->payload_bytes += (uint32_t)n;
+			}
+			off += (uint32_t)n;
+		}
+	}
+
+	memmove(c->buf, c->buf + off, c->used - off);
+	c->used -= off;
+
+	// make room for a document (or frame) bigger than the buffer
+	if (c->used == c->size) {
+		uint32_t needed = needed_size(c);
+		if (needed <= c->size || needed > MAX_DOCUMENT + 4 ||
+				grow(&c->buf, &c->size, needed) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+// returns 1 once the connection is done
+static int handle_readable(conn_t *c)
+{
+	for (int i = 0; i < MAX_READS; i++) {
+		ssize_t r = read(c->fd, c->buf + c->used, c->size - c->used);
+
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (r < 0) {
+			fprintf(stderr, "%s: %s\n", c->peer, strerror(errno));
+			return 1;
+		}
+		if (r == 0) {
+			if (c->used != 0 || c->events_used != 0)
+				fprintf(stderr, "%s: connection ended in the middle of a document\n",
+					c->peer);
+			return 1;
+		}
+
+		c->used += (uint32_t)r;
+		if (process_buffer(c) < 0) {
+			fprintf(stderr, "%s: bad data, dropping the connection\n", c->peer);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void write_stats(conn_t *c)
+{
+	char path[4200];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s.apis", c->base);
+	fp = fopen(path, "w");
+	if (fp == NULL)
+		return;
+	for (int i = 0; i < MAX_INDEX; i++) {
+		if (c->calls[i] != 0)
+			fprintf(fp, "%s\t%llu\n", c->names[i], (unsigned long long)c->calls[i]);
+	}
+	fclose(fp);
+}
+
+static void close_conn(conn_t *c)
+{
+	if (c->out >= 0) {
+		close(c->out);
+		write_stats(c);
+		printf("%s: %llu documents, %llu bytes, %llu unknown, %llu payload bytes skipped\n",
+			c->base, (unsigned long long)c->documents, (unsigned long long)c->bytes,
+			(unsigned long long)c->unknown, (unsigned long long)c->payload_bytes);
+	}
+
+	g_documents += c->documents;
+	g_bytes += c->bytes;
+	g_closed++;
+
+	close(c->fd);
+	for (int i = 0; i < MAX_INDEX; i++)
+		free(c->names[i]);
+	free(c->events);
+	free(c->buf);
+	free(c);
+}
+
+static void accept_all(int ep, int listener)
+{
+	while (1) {
+		struct sockaddr_in addr;
+		socklen_t addrlen = sizeof(addr);
+		struct epoll_event ev;
+		int fd = accept4(listener, (struct sockaddr *)&addr, &addrlen, SOCK_NONBLOCK);
+		conn_t *c;
+
+		if (fd < 0)
+			return;
+
+		c = calloc(1, sizeof(conn_t));
+		if (c == NULL || (c->buf = malloc(BUFFER_SIZE)) == NULL) {
+			free(c);
+			close(fd);
+			continue;
+		}
+
+		c->fd = fd;
+		c->id = g_next_id++;
+		c->protocol = PROTOCOL_UNKNOWN;
+		c->out = -1;
+		c->size = BUFFER_SIZE;
+		inet_ntop(AF_INET, &addr.sin_addr, c->peer, sizeof(c->peer));
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0)
+			close_conn(c);
+	}
+}
+
+static void stop(int sig)
+{
+	g_stop = 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in addr;
+	struct epoll_event ev, events[64];
+	struct sigaction sa;
+	struct timespec start, end;
+	uint32_t limit = 0;
+	int listener, ep, one = 1;
+	double seconds;
+
+	if (argc != 3 && argc != 4) {
+		fprintf(stderr, "usage: %s <port> <outdir> [connections]\n", argv[0]);
+		return 1;
+	}
+	g_outdir = argv[2];
+	if (argc == 4)
+		limit = (uint32_t)atoi(argv[3]);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = &stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)atoi(argv[1]));
+
+	listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (listener < 0)
+		return 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			listen(listener, 128) < 0) {
+		perror("listen");
+		return 1;
+	}
+
+	ep = epoll_create1(0);
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, listener, &ev) < 0) {
+		perror("epoll");
+		return 1;
+	}
+
+	while (!g_stop && (limit == 0 || g_closed < limit)) {
+		int n = epoll_wait(ep, events, 64, -1);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			perror("epoll_wait");
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			conn_t *c = events[i].data.ptr;
+
+			if (c == NULL) {
+				if (g_next_id == 0)
+					clock_gettime(CLOCK_MONOTONIC, &start);
+				accept_all(ep, listener);
+			}
+			else if (handle_readable(c)) {
+				epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+				close_conn(c);
+			}
+		}
+	}
+
+	if (limit != 0 && g_closed >= limit) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		printf("%u connections, %llu documents, %llu bytes in %.3fs: "
+			"%.0f documents/s, %.1f MB/s\n", g_closed,
+			(unsigned long long)g_documents, (unsigned long long)g_bytes, seconds,
+			g_documents / seconds, g_bytes / seconds / (1024 * 1024));
+	}
+
+	close(ep);
+	close(listener);
+	return 0;
+}
@@ -0,0 +1,310 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Feeds recorded log connections to a result server as fast as it takes
+// them, to benchmark the receiving end (e.g., logrecv).
+//
+// logreplay send <host> <port> <connections> <file> [repeat]
+//   replays <file> on that many connections at once, each sends the
+//   documents of <file> [repeat] times after its protocol line
+// logreplay gen <file> <calls>
+//   writes a synthetic log of a process making <calls> API calls, for
+//   when no recorded one is at hand
+//
+// <file> is a capture of a log connection, i.e. "BSON\n" or "BSONMUX\n"
+// followed by the data, or just the BSON documents, in which case "BSON\n"
+// is sent first.
+//
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "bson.h"
+
+static const char *g_host, *g_port;
+static const uint8_t *g_protocol, *g_data;
+static size_t g_protocol_length, g_data_length;
+static int g_repeat;
+
+static int send_all(int fd, const uint8_t *buf, size_t len)
+{
+	while (len != 0) {
+		ssize_t r = send(fd, buf, len, MSG_NOSIGNAL);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;
+		buf += r;
+		len -= (size_t)r;
+	}
+	return 0;
+}
+
+static int connect_to(const char *host, const char *port)
+{
+	struct addrinfo hints, *res;
+	int fd;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &res) != 0)
+		return -1;
+
+	fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+static void *replay_thread(void *param)
+{
+	int fd = connect_to(g_host, g_port), *ret = param;
+
+	*ret = -1;
+	if (fd < 0) {
+		perror("connect");
+		return NULL;
+	}
+
+	if (send_all(fd, g_protocol, g_protocol_length) == 0) {
+		int i;
+		for (i = 0; i < g_repeat; i++) {
+			if (send_all(fd, g_data, g_data_length) < 0)
+				break;
+		}
+		if (i == g_repeat)
+			*ret = 0;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static int do_send(int connections, const char *path)
+{
+	struct stat st;
+	struct timespec start, end;
+	pthread_t *threads;
+	const uint8_t *file;
+	int fd, *results, ret = 0;
+	double seconds, bytes;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+		perror(path);
+		return 1;
+	}
+	file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (file == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	g_data = file;
+	g_data_length = st.st_size;
+	if (g_data_length >= 5 && !memcmp(file, "BSON\n", 5))
+		g_protocol_length = 5;
+	else if (g_data_length >= 8 && !memcmp(file, "BSONMUX\n", 8))
+		g_protocol_length = 8;
+
+	if (g_protocol_length != 0) {
+		g_protocol = file;
+		g_data += g_protocol_length;
+		g_data_length -= g_protocol_length;
+	}
+	else {
+		g_protocol = (const uint8_t *)"BSON\n";
+		g_protocol_length = 5;
+	}
+
+	threads = calloc(connections, sizeof(pthread_t));
+	results = calloc(connections, sizeof(int));
+	if (threads == NULL || results == NULL)
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < connections; i++)
+		pthread_create(&threads[i], NULL, &replay_thread, &results[i]);
+	for (int i = 0; i < connections; i++) {
+		pthread_join(threads[i], NULL);
+		if (results[i] < 0)
+			ret = 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	bytes = (double)g_data_length * g_repeat * connections;
+	printf("%d connections, %.0f bytes in %.3fs: %.1f MB/s\n", connections,
+		bytes, seconds, bytes / seconds / (1024 * 1024));
+
+	free(results);
+	free(threads);
+	munmap((void *)file, st.st_size);
+	close(fd);
+	return ret;
+}
+
+static void write_doc(FILE *fp, bson *b)
+{
+	bson_finish(b);
+	fwrite(bson_data(b), 1, bson_size(b), fp);
+	bson_destroy(b);
+}
+
+static void write_info(FILE *fp, int index, const char *name,
+	const char *category, const char **args)
+{
+	bson b[1];
+	char key[16];
+
+	bson_init(b);
+	bson_append_int(b, "I", index);
+	bson_append_string(b, "name", name);
+	bson_append_string(b, "type", "info");
+	bson_append_string(b, "category", category);
+	bson_append_start_array(b, "args");
+	bson_append_string(b, "0", "is_success");
+	bson_append_string(b, "1", "retval");
+	for (int i = 0; args[i] != NULL; i++) {
+		snprintf(key, sizeof(key), "%d", i + 2);
+		bson_append_string(b, key, args[i]);
+	}
+	bson_append_finish_array(b);
+	write_doc(fp, b);
+}
+
+static void start_call(bson *b, int index, uint32_t tick)
+{
+	bson_init(b);
+	bson_append_int(b, "I", index);
+	bson_append_long(b, "C", 0x401000 + index * 16);
+	bson_append_long(b, "R", 0x401000);
+	bson_append_long(b, "P", 0x400000);
+	bson_append_int(b, "T", 1234);
+	bson_append_int(b, "t", tick);
+	bson_append_int(b, "r", 0);
+	bson_append_start_array(b, "args");
+	bson_append_int(b, "0", 1);
+	bson_append_long(b, "1", 0);
+}
+
+// a rough mix of what a typical process logs: mostly file and registry
+// accesses with a path, some reads with small buffers, the odd big one
+static int do_gen(const char *path, long calls)
+{
+	static const char *process_args[] = {"TimeLow", "TimeHigh",
+		"ProcessIdentifier", "ParentProcessIdentifier", "ModulePath", NULL};
+	static const char *file_args[] = {"FileHandle", "DesiredAccess",
+		"FileName", "CreateDisposition", NULL};
+	static const char *read_args[] = {"FileHandle", "Buffer", "Length", NULL};
+	static const char *reg_args[] = {"Handle", "Registry", "SubKey",
+		"FullName", NULL};
+	static char buffer[64 * 1024];
+	char name[128];
+	FILE *fp = fopen(path, "wb");
+	uint32_t seed = 1;
+	bson b[1];
+
+	if (fp == NULL) {
+		perror(path);
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(buffer); i++)
+		buffer[i] = (char)i;
+
+	fwrite("BSON\n", 1, 5, fp);
+
+	write_info(fp, 0, "__process__", "__notification__", process_args);
+	start_call(b, 0, 0);
+	bson_append_long(b, "2", 0x1d2c3b4a);
+	bson_append_long(b, "3", 0x01d0e0f0);
+	bson_append_long(b, "4", 4242);
+	bson_append_long(b, "5", 4000);
+	bson_append_string(b, "6", "C:\\Users\\user\\AppData\\Local\\Temp\\sample.exe");
+	bson_append_finish_array(b);
+	write_doc(fp, b);
+
+	write_info(fp, 10, "NtCreateFile", "filesystem", file_args);
+	write_info(fp, 11, "NtReadFile", "filesystem", read_args);
+	write_info(fp, 12, "RegOpenKeyExW", "registry", reg_args);
+
+	for (long i = 0; i < calls; i++) {
+		uint32_t r;
+
+		seed = seed * 1103515245 + 12345;
+		r = (seed >> 8) % 100;
+
+		if (r < 45) {
+			start_call(b, 10, (uint32_t)i);
+			bson_append_long(b, "2", 0x100 + (seed & 0xfff));
+			bson_append_long(b, "3", 0x80100080);
+			snprintf(name, sizeof(name), "C:\\Windows\\System32\\file%u.dll", seed % 500);
+			bson_append_binary(b, "4", BSON_BIN_BINARY, name, strlen(name));
+			bson_append_long(b, "5", 1);
+		}
+		else if (r < 80) {
+			start_call(b, 12, (uint32_t)i);
+			bson_append_long(b, "2", 0x80000002);
+			bson_append_binary(b, "3", BSON_BIN_BINARY, "HKEY_LOCAL_MACHINE", 18);
+			snprintf(name, sizeof(name), "Software\\Microsoft\\Windows\\Key%u", seed % 300);
+			bson_append_binary(b, "4", BSON_BIN_BINARY, name, strlen(name));
+			bson_append_binary(b, "5", BSON_BIN_BINARY, name, strlen(name));
+		}
+		else {
+			uint32_t length = r < 99 ? 256 : sizeof(buffer);
+			start_call(b, 11, (uint32_t)i);
+			bson_append_long(b, "2", 0x100 + (seed & 0xfff));
+			bson_append_binary(b, "3", BSON_BIN_BINARY, buffer, length);
+			bson_append_long(b, "4", length);
+		}
+		bson_append_finish_array(b);
+		write_doc(fp, b);
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if ((argc == 6 || argc == 7) && !strcmp(argv[1], "send")) {
+		g_host = argv[2];
+		g_port = argv[3];
+		g_repeat = argc == 7 ? atoi(argv[6]) : 1;
+		return do_send(atoi(argv[4]), argv[5]);
+	}
+	if (argc == 4 && !strcmp(argv[1], "gen"))
+		return do_gen(argv[2], atol(argv[3]));
+
+	fprintf(stderr, "usage: %s send <host> <port> <connections> <file> [repeat]\n"
+		"       %s gen <file> <calls>\n", argv[0], argv[0]);
+	return 1;
+}
@@ -0,0 +1,228 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compat.h"
+#include "pathnorm.h"
+
+void pathnorm_init(pathnorm_ctx_t *ctx)
+{
+	memset(&ctx->map, 0, sizeof(ctx->map));
+	ctx->cwd[0] = 0;
+	ctx->cwd_length = 0;
+	ctx->redirection_disabled = 0;
+}
+
+void pathnorm_free(pathnorm_ctx_t *ctx)
+{
+	specialname_free(&ctx->map);
+}
+
+int pathnorm_add_mapping(pathnorm_ctx_t *ctx, const wchar_t *device,
+	const wchar_t *dosname)
+{
+	static const wchar_t systemroot[] = L"\\systemroot";
+	uint32_t i;
+
+	for (i = 0; device[i] != 0 && i < 11; i++) {
+		wchar_t ch = device[i] >= 'A' && device[i] <= 'Z' ? device[i] + 32 : device[i];
+		if (ch != systemroot[i])
+			break;
+	}
+	// also gives us system32 and sysnative
+	if (i == 11 && device[11] == 0)
+		return specialname_set_windir(&ctx->map, dosname);
+	return specialname_add(&ctx->map, device, dosname);
+}
+
+void pathnorm_set_context(pathnorm_ctx_t *ctx, const wchar_t *cwd,
+	uint32_t length, int redirection_disabled)
+{
+	length = MIN(length, PATHNORM_SIZE - 1);
+	memcpy(ctx->cwd, cwd, length * sizeof(wchar_t));
+	ctx->cwd[length] = 0;
+	ctx->cwd_length = length;
+	ctx->redirection_disabled = redirection_disabled;
+}
+
+static int starts_with(const wchar_t *s, uint32_t length, const char *prefix)
+{
+	uint32_t i;
+
+	for (i = 0; prefix[i] != 0; i++) {
+		wchar_t ch = i < length ? s[i] : 0;
+		if (ch >= 'A' && ch <= 'Z')
+			ch += 'a' - 'A';
+		if (ch != (wchar_t)prefix[i])
+			return 0;
+	}
+	return 1;
+}
+
+static __inline int is_sep(wchar_t ch)
+{
+	return ch == '\\' || ch == '/';
+}
+
+static uint32_t copy(wchar_t *out, uint32_t pos, const wchar_t *s,
+	uint32_t length)
+{
+	length = MIN(length, PATHNORM_SIZE - 1 - pos);
+	memcpy(out + pos, s, length * sizeof(wchar_t));
+	return pos + length;
+}
+
+// like GetFullPathNameW() on a path without \\?\ prefix: appends the
+// components of s to the root in out[0..root), handling . and .. and
+// dropping trailing dots and spaces of components
+static uint32_t append_components(wchar_t *out, uint32_t root, uint32_t pos,
+	const wchar_t *s, uint32_t length)
+{
+	uint32_t i = 0;
+
+	while (i < length) {
+		uint32_t start, end;
+
+		while (i < length && is_sep(s[i]))
+			i++;
+		start = i;
+		while (i < length && !is_sep(s[i]))
+			i++;
+		end = i;
+
+		if (end - start == 1 && s[start] == '.')
+			continue;
+		if (end - start == 2 && s[start] == '.' && s[start + 1] == '.') {
+			while (pos > root && out[pos - 1] != '\\')
+				pos--;
+			if (pos > root)
+				pos--;
+			continue;
+		}
+		while (end > start && (s[end - 1] == '.' || s[end - 1] == ' '))
+			end--;
+		if (end == start)
+			continue;
+
+		if (pos == 0 || out[pos - 1] != '\\')
+			pos = copy(out, pos, L"\\", 1);
+		pos = copy(out, pos, s + start, end - start);
+	}
+
+	// a trailing separator is kept, and so is the one of a drive root
+	if ((length != 0 && is_sep(s[length - 1])) || (pos == 2 && out[1] == ':')) {
+		if (pos == 0 || out[pos - 1] != '\\')
+			pos = copy(out, pos, L"\\", 1);
+	}
+	return pos;
+}
+
+// the root of a DOS path, i.e., C: or \\server\share
+static uint32_t root_length(const wchar_t *s, uint32_t length)
+{
+	uint32_t i, seps = 0;
+
+	if (length >= 2 && s[1] == ':')
+		return 2;
+	if (length >= 2 && is_sep(s[0]) && is_sep(s[1])) {
+		for (i = 2; i < length; i++) {
+			if (is_sep(s[i]) && ++seps == 2)
+				return i;
+		}
+		return length;
+	}
+	return 0;
+}
+
+static uint32_t full_path(const pathnorm_ctx_t *ctx, const wchar_t *s,
+	uint32_t length, wchar_t *out)
+{
+	uint32_t root = root_length(s, length), pos;
+
+	if (root != 0) {
+		// absolute, or relative to the root of a drive
+		pos = copy(out, 0, s, root);
+		for (uint32_t i = 0; i < pos; i++) {
+			if (out[i] == '/')
+				out[i] = '\\';
+		}
+		return append_components(out, root, pos, s + root, length - root);
+	}
+
+	root = root_length(ctx->cwd, ctx->cwd_length);
+	if (length != 0 && is_sep(s[0])) {
+		// relative to the root of the current drive
+		pos = copy(out, 0, ctx->cwd, root);
+		return append_components(out, root, pos, s, length);
+	}
+
+	pos = copy(out, 0, ctx->cwd, ctx->cwd_length);
+	while (pos > root && out[pos - 1] == '\\')
+		pos--;
+	return append_components(out, root, pos, s, length);
+}
+
+uint32_t pathnorm_normalize(const pathnorm_ctx_t *ctx, const wchar_t *in,
+	uint32_t length, wchar_t *out)
+{
+	int is_globalroot, ret;
+	uint32_t skip, pos;
+
+	skip = specialname_skip_prefix(in, &is_globalroot);
+	if (skip > length)
+		skip = length;
+	in += skip;
+	length -= skip;
+
+	if (starts_with(in, length, "\\device\\") ||
+			starts_with(in, length, "\\systemroot")) {
+		// \\Device\\HarddiskVolumeX and \\systemroot
+		pos = copy(out, 0, in, length);
+		out[pos] = 0;
+		ret = specialname_rewrite(&ctx->map, out, pos, PATHNORM_SIZE);
+		if (ret < 0)
+			return pos;
+		pos = (uint32_t)ret;
+	}
+	else if (length > 1 && in[1] == ':') {
+		// with the \\?\ prefix, GetFullPathNameW() leaves the path alone
+		pos = copy(out, 0, in, length);
+	}
+	else if (starts_with(in, length, "\\\\?\\")) {
+		pos = copy(out, 0, in + 4, length - 4);
+	}
+	else if (is_globalroot) {
+		pos = copy(out, 0, L"\\??\\", 4);
+		pos = copy(out, pos, in, length);
+		out[pos] = 0;
+		return pos;
+	}
+	else {
+		pos = full_path(ctx, in, length, out);
+	}
+	out[pos] = 0;
+
+	if (ctx->redirection_disabled) {
+		ret = specialname_sysnative(&ctx->map, out, pos, PATHNORM_SIZE);
+		if (ret >= 0)
+			pos = (uint32_t)ret;
+	}
+
+	if (pos > 2 && out[1] == ':' && out[2] == '\\' && out[0] >= 'a' && out[0] <= 'z')
+		out[0] -= 'a' - 'A';
+	return pos;
+}
@@ -0,0 +1,62 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Offline Path Normalization
+//
+// Reproduces what ensure_absolute_unicode_path() does inside the monitor,
+// for logs written with raw-paths set: device names are mapped to drive
+// letters, relative paths are resolved against the current directory the
+// process had at the time, and system32 is redirected to sysnative for
+// threads that disabled WOW64 file system redirection.
+//
+// What can't be reproduced without the file system: short (8.3) names are
+// not expanded, and a drive relative path like C:foo is resolved against
+// the root of its drive.
+//
+
+#ifndef __PATHNORM_H
+#define __PATHNORM_H
+
+#include "compat.h"
+#include "specialname.h"
+
+// in characters, like the buffers of the monitor
+#define PATHNORM_SIZE 32768
+
+typedef struct _pathnorm_ctx_t {
+	specialname_map_t map;
+	wchar_t cwd[PATHNORM_SIZE];
+	uint32_t cwd_length;
+	int redirection_disabled;
+} pathnorm_ctx_t;
+
+void pathnorm_init(pathnorm_ctx_t *ctx);
+void pathnorm_free(pathnorm_ctx_t *ctx);
+
+// from the __pathmap__ and __pathcontext__ records
+int pathnorm_add_mapping(pathnorm_ctx_t *ctx, const wchar_t *device,
+	const wchar_t *dosname);
+void pathnorm_set_context(pathnorm_ctx_t *ctx, const wchar_t *cwd,
+	uint32_t length, int redirection_disabled);
+
+// out has room for PATHNORM_SIZE characters, returns the length
+uint32_t pathnorm_normalize(const pathnorm_ctx_t *ctx, const wchar_t *in,
+	uint32_t length, wchar_t *out);
+
+#endif
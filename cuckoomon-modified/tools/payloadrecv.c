@@ -0,0 +1,300 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Receives the log connection of a monitor running with payload-stream set
+// and takes it apart again (see payload.h).
+//
+// payloadrecv listen <port> <outdir>
+//   accepts a single connection, like the result server would
+// payloadrecv read <file> <outdir>
+//   reads a capture of such a connection
+//
+// The events end up in <outdir>/events.bson, exactly as a plain "BSON"
+// connection would have carried them.  Every payload stream is written to
+// <outdir>/<stream>-<kind>-<handle>.out and .in, with the data at the
+// offset it had in the stream; data past the caps is missing from the end,
+// data dropped for lack of queue space leaves a hole.  A line per stream
+// is printed once it's closed.  Connections announcing plain "BSON" are
+// stored as events.bson as well.
+//
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "payload.h"
+
+#define BUFFER_SIZE (PAYLOAD_MAX_FRAME + 4096)
+
+typedef struct {
+	uint16_t kind;
+	uint64_t handle;
+	int fd[2];
+	uint64_t received[2];
+} stream_t;
+
+static const char *g_outdir;
+static int g_events = -1;
+static stream_t *g_streams;
+static uint32_t g_stream_count;
+
+static const char *kind_name(uint16_t kind)
+{
+	switch (kind) {
+	case PAYLOAD_SOCKET:
+		return "socket";
+	case PAYLOAD_INTERNET:
+		return "internet";
+	case PAYLOAD_CRYPTO:
+		return "crypto";
+	}
+	return "unknown";
+}
+
+static int write_all(int fd, const uint8_t *buf, uint32_t len)
+{
+	while (len != 0) {
+		ssize_t r = write(fd, buf, len);
+		if (r <= 0)
+			return -1;
+		buf += r;
+		len -= (uint32_t)r;
+	}
+	return 0;
+}
+
+static stream_t *get_stream(uint32_t id)
+{
+	if (id == 0 || id >= g_stream_count || g_streams[id].fd[0] < 0)
+		return NULL;
+	return &g_streams[id];
+}
+
+static int open_stream(const payload_frame_t *f)
+{
+	static const char *suffix[2] = {"out", "in"};
+	char path[4096];
+	stream_t *s;
+
+	if (f->stream == 0)
+		return -1;
+
+	if (f->stream >= g_stream_count) {
+		uint32_t count = f->stream * 2;
+		stream_t *streams = realloc(g_streams, count * sizeof(stream_t));
+		if (streams == NULL)
+			return -1;
+		for (uint32_t i = g_stream_count; i < count; i++)
+			streams[i].fd[0] = streams[i].fd[1] = -1;
+		g_streams = streams;
+		g_stream_count = count;
+	}
+
+	s = &g_streams[f->stream];
+	memset(s, 0, sizeof(*s));
+	s->fd[0] = s->fd[1] = -1;
+	s->kind = f->kind;
+	s->handle = f->handle;
+
+	for (int dir = 0; dir < 2; dir++) {
+		snprintf(path, sizeof(path), "%s/%u-%s-%llx.%s", g_outdir, f->stream,
+			kind_name(f->kind), (unsigned long long)f->handle, suffix[dir]);
+		s->fd[dir] = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (s->fd[dir] < 0) {
+			fprintf(stderr, "unable to create %s: %s\n", path, strerror(errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void close_stream(const payload_frame_t *f)
+{
+	stream_t *s = get_stream(f->stream);
+
+	if (s == NULL)
+		return;
+
+	printf("%u %s 0x%llx: out %llu/%llu bytes, in %llu/%llu bytes\n",
+		f->stream, kind_name(s->kind), (unsigned long long)s->handle,
+		(unsigned long long)s->received[PAYLOAD_OUT],
+		(unsigned long long)f->length[PAYLOAD_OUT],
+		(unsigned long long)s->received[PAYLOAD_IN],
+		(unsigned long long)f->length[PAYLOAD_IN]);
+
+	close(s->fd[0]);
+	close(s->fd[1]);
+	s->fd[0] = s->fd[1] = -1;
+}
+
+static int handle_frame(const payload_frame_t *f)
+{
+	stream_t *s;
+
+	switch (f->type) {
+	case PAYLOAD_FRAME_EVENTS:
+		return write_all(g_events, f->data, f->size);
+
+	case PAYLOAD_FRAME_OPEN:
+		return open_stream(f);
+
+	case PAYLOAD_FRAME_DATA:
+		// the monitor queues the close after all of a stream's data, but
+		// the data of a stream we didn't get the open frame of is dropped
+		s = get_stream(f->stream);
+		if (s == NULL)
+			return 0;
+		if (pwrite(s->fd[f->direction], f->data, f->size,
+				(off_t)f->offset) != (ssize_t)f->size)
+			return -1;
+		s->received[f->direction] += f->size;
+		return 0;
+
+	case PAYLOAD_FRAME_CLOSE:
+		close_stream(f);
+		return 0;
+	}
+	return -1;
+}
+
+static int receive(int fd)
+{
+	static uint8_t buf[BUFFER_SIZE];
+	uint32_t used = 0;
+	char path[4096];
+	int mux;
+
+	// the protocol line
+	while (memchr(buf, '\n', used) == NULL) {
+		ssize_t r = read(fd, buf + used, 1);
+		if (r <= 0 || ++used == 16) {
+			fprintf(stderr, "no protocol line\n");
+			return 1;
+		}
+	}
+
+	if (used == 8 && !memcmp(buf, "BSONMUX\n", 8))
+		mux = 1;
+	else if (used == 5 && !memcmp(buf, "BSON\n", 5))
+		mux = 0;
+	else {
+		fprintf(stderr, "unknown protocol %.*s\n", (int)used - 1, buf);
+		return 1;
+	}
+
+	snprintf(path, sizeof(path), "%s/events.bson", g_outdir);
+	g_events = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (g_events < 0) {
+		fprintf(stderr, "unable to create %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	used = 0;
+	while (1) {
+		ssize_t r = read(fd, buf + used, sizeof(buf) - used);
+		uint32_t off = 0;
+
+		if (r < 0)
+			return 1;
+		if (r == 0)
+			break;
+		used += (uint32_t)r;
+
+		if (!mux) {
+			if (write_all(g_events, buf, used) < 0)
+				return 1;
+			used = 0;
+			continue;
+		}
+
+		while (off < used) {
+			payload_frame_t f;
+			int n = payload_parse(buf + off, used - off, &f);
+			if (n == 0)
+				break;
+			if (n < 0 || handle_frame(&f) < 0) {
+				fprintf(stderr, "bad frame\n");
+				return 1;
+			}
+			off += n;
+		}
+
+		memmove(buf, buf + off, used - off);
+		used -= off;
+	}
+
+	if (used != 0) {
+		fprintf(stderr, "connection ended in the middle of a frame\n");
+		return 1;
+	}
+
+	close(g_events);
+	return 0;
+}
+
+static int do_listen(int port)
+{
+	struct sockaddr_in addr;
+	int fd = socket(AF_INET, SOCK_STREAM, 0), client, one = 1, ret;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+
+	if (fd < 0)
+		return 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			listen(fd, 1) < 0 || (client = accept(fd, NULL, NULL)) < 0) {
+		perror("listen");
+		close(fd);
+		return 1;
+	}
+
+	ret = receive(client);
+	close(client);
+	close(fd);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 4 && !strcmp(argv[1], "listen")) {
+		g_outdir = argv[3];
+		return do_listen(atoi(argv[2]));
+	}
+	if (argc == 4 && !strcmp(argv[1], "read")) {
+		int fd = open(argv[2], O_RDONLY), ret;
+		if (fd < 0) {
+			perror(argv[2]);
+			return 1;
+		}
+		g_outdir = argv[3];
+		ret = receive(fd);
+		close(fd);
+		return ret;
+	}
+
+	fprintf(stderr, "usage: %s listen <port> <outdir>\n"
+		"       %s read <file> <outdir>\n", argv[0], argv[0]);
+	return 1;
+}
@@ -0,0 +1,194 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Stand-in for the analyzer end of the cuckoomon pipe, over a Unix socket
+// so the notification protocol can be exercised without Windows.  A Unix
+// stream socket has no message boundaries, so every pipe message is sent
+// as a 32-bit little-endian length followed by the message.
+//
+// pipe-endpoint listen <socket>
+//   prints every message received, one per line, unpacking batches;
+//   messages other than batches get "OK" as answer like CallNamedPipe()
+//   expects
+// pipe-endpoint send <socket> [-b] <message>...
+//   sends the messages one per connection, or with -b as a single batch
+//   over one connection
+//
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "pipeq.h"
+
+static int read_all(int fd, void *buf, uint32_t len)
+{
+	uint32_t off = 0;
+	while (off < len) {
+		ssize_t r = read(fd, (char *)buf + off, len - off);
+		if (r <= 0)
+			return -1;
+		off += (uint32_t)r;
+	}
+	return 0;
+}
+
+static int write_message(int fd, const void *msg, uint32_t len)
+{
+	if (write(fd, &len, 4) != 4 || write(fd, msg, len) != (ssize_t)len)
+		return -1;
+	return 0;
+}
+
+static int print_message(void *ctx, const char *msg, uint32_t len)
+{
+	printf("%s%.*s\n", (const char *)ctx, (int)len, msg);
+	return 0;
+}
+
+static int connect_to(const char *path, int listening)
+{
+	struct sockaddr_un addr;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	if (fd < 0)
+		return -1;
+	if (listening) {
+		unlink(path);
+		if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+				listen(fd, 16) < 0)
+			goto err;
+	}
+	else if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		goto err;
+	}
+	return fd;
+
+err:
+	close(fd);
+	return -1;
+}
+
+static void handle_connection(int fd)
+{
+	uint32_t len;
+	char *msg;
+
+	// a persistent connection carries any amount of messages
+	while (read_all(fd, &len, 4) == 0) {
+		msg = malloc(len);
+		if (msg == NULL || read_all(fd, msg, len) < 0) {
+			free(msg);
+			break;
+		}
+
+		if (pipeq_is_batch(msg, len)) {
+			if (pipeq_parse((uint8_t *)msg + PIPEQ_BATCH_PREFIX_LEN,
+					len - PIPEQ_BATCH_PREFIX_LEN, &print_message, "") < 0)
+				fprintf(stderr, "malformed batch of %u bytes\n", len);
+		}
+		else {
+			print_message("", msg, len);
+			write_message(fd, "OK", 2);
+		}
+		fflush(stdout);
+		free(msg);
+	}
+	close(fd);
+}
+
+static int do_listen(const char *path)
+{
+	int fd = connect_to(path, 1), client;
+
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	while ((client = accept(fd, NULL, NULL)) >= 0)
+		handle_connection(client);
+	return 0;
+}
+
+static int do_send(const char *path, int batch, int argc, char **argv)
+{
+	pipeq_t q;
+	uint8_t *frames;
+	uint32_t len;
+	int fd;
+
+	if (!batch) {
+		for (int i = 0; i < argc; i++) {
+			char answer[64];
+			fd = connect_to(path, 0);
+			if (fd < 0 || write_message(fd, argv[i], (uint32_t)strlen(argv[i])) < 0 ||
+					read_all(fd, &len, 4) < 0 || len > sizeof(answer) ||
+					read_all(fd, answer, len) < 0) {
+				perror(path);
+				return 1;
+			}
+			close(fd);
+		}
+		return 0;
+	}
+
+	if (pipeq_init(&q, 0x10000) < 0)
+		return 1;
+	for (int i = 0; i < argc; i++) {
+		if (pipeq_push(&q, argv[i], (uint32_t)strlen(argv[i])) < 0) {
+			fprintf(stderr, "batch too large\n");
+			return 1;
+		}
+	}
+
+	frames = malloc(PIPEQ_BATCH_PREFIX_LEN + q.size);
+	if (frames == NULL)
+		return 1;
+	memcpy(frames, PIPEQ_BATCH_PREFIX, PIPEQ_BATCH_PREFIX_LEN);
+	len = pipeq_take(&q, frames + PIPEQ_BATCH_PREFIX_LEN, q.size);
+
+	fd = connect_to(path, 0);
+	if (fd < 0 || write_message(fd, frames, PIPEQ_BATCH_PREFIX_LEN + len) < 0) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+	free(frames);
+	pipeq_free(&q);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 3 && !strcmp(argv[1], "listen"))
+		return do_listen(argv[2]);
+
+	if (argc >= 3 && !strcmp(argv[1], "send")) {
+		int batch = argc > 3 && !strcmp(argv[3], "-b");
+		return do_send(argv[2], batch, argc - 3 - batch, argv + 3 + batch);
+	}
+
+	fprintf(stderr, "usage: %s listen <socket>\n"
+		"       %s send <socket> [-b] <message>...\n", argv[0], argv[0]);
+	return 1;
+}
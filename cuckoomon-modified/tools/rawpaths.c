@@ -0,0 +1,399 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Normalizes the file paths of a BSON log written with raw-paths set, so
+// the result looks like a log written without it.
+//
+// rawpaths <in.bson> <out.bson>
+//
+// The monitor tags raw path arguments as ["name", "path"] in the API
+// description, and logs the drive mappings (__pathmap__) as well as every
+// change of the current directory (__pathcontext__) as it goes.  The
+// context is tracked per thread, as the WOW64 redirection state is, and a
+// thread's records are normalized against the context it logged last.
+// Malformed documents (see bsoncheck.h) are copied as they are.
+//
+
+#include <stdio.h>
+#include "bson.h"
+#include "bsoncheck.h"
+#include "pathnorm.h"
+
+// like the log table in log.c
+#define MAX_INDEX 256
+
+#define KIND_API 0
+#define KIND_PATH_MAP 1
+#define KIND_PATH_CONTEXT 2
+
+static int g_kind[MAX_INDEX];
+static uint64_t g_path_args[MAX_INDEX];
+
+static pathnorm_ctx_t g_ctx;
+
+// the context every thread logged last
+typedef struct _thread_ctx_t {
+	uint32_t tid;
+	wchar_t *cwd;
+	uint32_t length;
+	int redirection_disabled;
+} thread_ctx_t;
+
+static thread_ctx_t *g_threads;
+static uint32_t g_thread_count, g_thread_size;
+
+// the thread whose context is in g_ctx, -1 if none
+static int g_current = -1;
+static wchar_t g_path[PATHNORM_SIZE], g_normalized[PATHNORM_SIZE];
+static char g_utf8[PATHNORM_SIZE * 3];
+
+static uint32_t utf8_to_unicode(const char *s, int length, wchar_t *out)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	uint32_t ret = 0;
+
+	for (int i = 0; i < length && ret < PATHNORM_SIZE - 1; ret++) {
+		if (p[i] < 0x80) {
+			out[ret] = p[i];
+			i++;
+		}
+		else if ((p[i] & 0xe0) == 0xc0 && i + 1 < length) {
+			out[ret] = ((p[i] & 0x1f) << 6) | (p[i + 1] & 0x3f);
+			i += 2;
+		}
+		else if (i + 2 < length) {
+			out[ret] = ((p[i] & 0x0f) << 12) | ((p[i + 1] & 0x3f) << 6) | (p[i + 2] & 0x3f);
+			i += 3;
+		}
+		else {
+			break;
+		}
+	}
+	out[ret] = 0;
+	return ret;
+}
+
+static int unicode_to_utf8(const wchar_t *s, uint32_t length, char *out)
+{
+	unsigned char *p = (unsigned char *)out;
+
+	for (uint32_t i = 0; i < length; i++) {
+		unsigned short c = s[i];
+		if (c < 0x80) {
+			*p++ = (unsigned char)c;
+		}
+		else if (c < 0x800) {
+			*p++ = 0xc0 | (c >> 6);
+			*p++ = 0x80 | (c & 0x3f);
+		}
+		else {
+			*p++ = 0xe0 | (c >> 12);
+			*p++ = 0x80 | ((c >> 6) & 0x3f);
+			*p++ = 0x80 | (c & 0x3f);
+		}
+	}
+	return (int)((char *)p - out);
+}
+
+// strings are logged as binary, see log_wstring()
+static uint32_t get_unicode(bson_iterator *it, wchar_t *out)
+{
+	if (bson_iterator_type(it) == BSON_BINDATA)
+		return utf8_to_unicode(bson_iterator_bin_data(it), bson_iterator_bin_len(it), out);
+	if (bson_iterator_type(it) == BSON_STRING)
+		return utf8_to_unicode(bson_iterator_string(it),
+			(int)strlen(bson_iterator_string(it)), out);
+	out[0] = 0;
+	return 0;
+}
+
+static int arg_number(const char *key)
+{
+	return atoi(key);
+}
+
+// learns which arguments of an API are raw paths, and writes the
+// description the way it's written without raw-paths
+static void handle_info(bson *doc, bson *out, int index)
+{
+	bson_iterator it, sub, pair;
+
+	if (bson_find(&it, doc, "name") == BSON_STRING) {
+		const char *name = bson_iterator_string(&it);
+		g_kind[index] = !strcmp(name, "__pathmap__") ? KIND_PATH_MAP :
+			!strcmp(name, "__pathcontext__") ? KIND_PATH_CONTEXT : KIND_API;
+	}
+
+	bson_iterator_init(&it, doc);
+	while (bson_iterator_next(&it) != BSON_EOO) {
+		if (strcmp(bson_iterator_key(&it), "args") || bson_iterator_type(&it) != BSON_ARRAY) {
+			bson_append_element(out, NULL, &it);
+			continue;
+		}
+
+		bson_append_start_array(out, "args");
+		bson_iterator_subiterator(&it, &sub);
+		while (bson_iterator_next(&sub) != BSON_EOO) {
+			const char *name = NULL;
+			int n = arg_number(bson_iterator_key(&sub));
+
+			if (bson_iterator_type(&sub) == BSON_ARRAY) {
+				bson_iterator_subiterator(&sub, &pair);
+				if (bson_iterator_next(&pair) == BSON_STRING) {
+					name = bson_iterator_string(&pair);
+					if (bson_iterator_next(&pair) != BSON_STRING ||
+							strcmp(bson_iterator_string(&pair), "path"))
+						name = NULL;
+				}
+			}
+
+			if (name != NULL && n < 64) {
+				g_path_args[index] |= (uint64_t)1 << n;
+				bson_append_string(out, bson_iterator_key(&sub), name);
+			}
+			else {
+				bson_append_element(out, NULL, &sub);
+			}
+		}
+		bson_append_finish_array(out);
+	}
+}
+
+static int find_thread(uint32_t tid)
+{
+	for (uint32_t i = 0; i < g_thread_count; i++) {
+		if (g_threads[i].tid == tid)
+			return (int)i;
+	}
+	return -1;
+}
+
+static void set_thread_context(uint32_t tid, const wchar_t *cwd,
+	uint32_t length, int redirection_disabled)
+{
+	int i = find_thread(tid);
+	thread_ctx_t *t;
+
+	if (i < 0) {
+		if (g_thread_count == g_thread_size) {
+			uint32_t size = g_thread_size != 0 ? g_thread_size * 2 : 64;
+			thread_ctx_t *threads = realloc(g_threads, size * sizeof(*threads));
+			if (threads == NULL)
+				return;
+			g_threads = threads;
+			g_thread_size = size;
+		}
+		i = (int)g_thread_count++;
+		g_threads[i].tid = tid;
+		g_threads[i].cwd = NULL;
+	}
+
+	t = &g_threads[i];
+	free(t->cwd);
+	t->cwd = malloc((length + 1) * sizeof(wchar_t));
+	t->length = t->cwd != NULL ? length : 0;
+	if (t->cwd != NULL) {
+		memcpy(t->cwd, cwd, length * sizeof(wchar_t));
+		t->cwd[length] = 0;
+	}
+	t->redirection_disabled = redirection_disabled;
+
+	if (g_current == i)
+		g_current = -1;
+}
+
+// puts the context of the thread that logged a record in place
+static void use_thread_context(bson *doc)
+{
+	bson_iterator it;
+	int i = -1;
+
+	if (bson_find(&it, doc, "T") == BSON_INT)
+		i = find_thread((uint32_t)bson_iterator_int(&it));
+
+	if (i == g_current && i >= 0)
+		return;
+
+	if (i < 0 || g_threads[i].cwd == NULL)
+		pathnorm_set_context(&g_ctx, L"", 0, 0);
+	else
+		pathnorm_set_context(&g_ctx, g_threads[i].cwd, g_threads[i].length,
+			g_threads[i].redirection_disabled);
+	g_current = i;
+}
+
+static void handle_context(bson *doc, int kind)
+{
+	bson_iterator it, sub;
+	wchar_t first[PATHNORM_SIZE];
+	uint32_t first_length = 0, tid = 0;
+	int flag = 0;
+
+	if (bson_find(&it, doc, "args") != BSON_ARRAY)
+		return;
+
+	bson_iterator_subiterator(&it, &sub);
+	while (bson_iterator_next(&sub) != BSON_EOO) {
+		int n = arg_number(bson_iterator_key(&sub));
+		if (kind == KIND_PATH_MAP && n == 2)
+			first_length = get_unicode(&sub, first);
+		else if (kind == KIND_PATH_MAP && n == 3)
+			get_unicode(&sub, g_path);
+		else if (kind == KIND_PATH_CONTEXT && n == 2)
+			tid = (uint32_t)bson_iterator_long(&sub);
+		else if (kind == KIND_PATH_CONTEXT && n == 3)
+			first_length = get_unicode(&sub, first);
+		else if (kind == KIND_PATH_CONTEXT && n == 4)
+			flag = (int)bson_iterator_long(&sub);
+	}
+
+	if (kind == KIND_PATH_MAP)
+		pathnorm_add_mapping(&g_ctx, first, g_path);
+	else
+		set_thread_context(tid, first, first_length, flag);
+}
+
+static void handle_api(bson *doc, bson *out, int index)
+{
+	bson_iterator it, sub;
+
+	use_thread_context(doc);
+
+	bson_iterator_init(&it, doc);
+	while (bson_iterator_next(&it) != BSON_EOO) {
+		if (strcmp(bson_iterator_key(&it), "args") || bson_iterator_type(&it) != BSON_ARRAY) {
+			bson_append_element(out, NULL, &it);
+			continue;
+		}
+
+		bson_append_start_array(out, "args");
+		bson_iterator_subiterator(&it, &sub);
+		while (bson_iterator_next(&sub) != BSON_EOO) {
+			int n = arg_number(bson_iterator_key(&sub));
+			if (n < 64 && (g_path_args[index] >> n & 1)) {
+				uint32_t length = get_unicode(&sub, g_path);
+				length = pathnorm_normalize(&g_ctx, g_path, length, g_normalized);
+				bson_append_binary(out, bson_iterator_key(&sub), BSON_BIN_BINARY,
+					g_utf8, unicode_to_utf8(g_normalized, length, g_utf8));
+			}
+			else {
+				bson_append_element(out, NULL, &sub);
+			}
+		}
+		bson_append_finish_array(out);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *in, *out;
+	char *data;
+	long size, off = 0;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s <in.bson> <out.bson>\n", argv[0]);
+		return 1;
+	}
+
+	in = fopen(argv[1], "rb");
+	out = fopen(argv[2], "wb");
+	if (in == NULL || out == NULL) {
+		perror(in == NULL ? argv[1] : argv[2]);
+		return 1;
+	}
+
+	fseek(in, 0, SEEK_END);
+	size = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	data = malloc(size + 1);
+	if (data == NULL || fread(data, 1, size, in) != (size_t)size) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	// the protocol announcement of announce_netlog()
+	if (size >= 5 && !memcmp(data, "BSON\n", 5)) {
+		fwrite(data, 1, 5, out);
+		off = 5;
+	}
+
+	pathnorm_init(&g_ctx);
+
+	while (off + 4 <= size) {
+		bson doc[1], result[1];
+		bson_iterator it;
+		int32_t length;
+		int index = -1, is_info = 0;
+
+		memcpy(&length, data + off, 4);
+		if (length < 5 || off + length > size) {
+			fprintf(stderr, "truncated document at offset %ld\n", off);
+			return 1;
+		}
+
+		if (bsoncheck((const uint8_t *)data + off, (uint32_t)length) < 0) {
+			fprintf(stderr, "malformed document at offset %ld\n", off);
+			fwrite(data + off, 1, length, out);
+			off += length;
+			continue;
+		}
+
+		bson_init_finished_data(doc, data + off, 0);
+		if (bson_find(&it, doc, "I") == BSON_INT)
+			index = bson_iterator_int(&it);
+		if (bson_find(&it, doc, "type") == BSON_STRING)
+			is_info = !strcmp(bson_iterator_string(&it), "info");
+
+		if (index < 0 || index >= MAX_INDEX) {
+			fwrite(data + off, 1, length, out);
+		}
+		else if (is_info) {
+			bson_init(result);
+			handle_info(doc, result, index);
+			bson_finish(result);
+			fwrite(bson_data(result), 1, bson_size(result), out);
+			bson_destroy(result);
+		}
+		else if (g_kind[index] != KIND_API) {
+			handle_context(doc, g_kind[index]);
+			fwrite(data + off, 1, length, out);
+		}
+		else if (g_path_args[index] != 0) {
+			bson_init(result);
+			handle_api(doc, result, index);
+			bson_finish(result);
+			fwrite(bson_data(result), 1, bson_size(result), out);
+			bson_destroy(result);
+		}
+		else {
+			fwrite(data + off, 1, length, out);
+		}
+
+		off += length;
+	}
+
+	for (uint32_t i = 0; i < g_thread_count; i++)
+		free(g_threads[i].cwd);
+	free(g_threads);
+	pathnorm_free(&g_ctx);
+	free(data);
+	fclose(in);
+	fclose(out);
+	return 0;
+}
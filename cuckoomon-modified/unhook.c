@@ -23,77 +23,110 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "log.h"
 #include "misc.h"
 #include "config.h"
+#include "hookregion.h"
 
 #define UNHOOK_MAXCOUNT 2048
-#define UNHOOK_BUFSIZE 256
 
-static HANDLE g_unhook_thread_handle, g_watcher_thread_handle;
-
-// Index for adding new hooks and iterating all existing hooks.
-static uint32_t g_index = 0;
-
-// Length of this region.
-static uint32_t g_length[UNHOOK_MAXCOUNT];
+// byte pool size for both the original and our contents, most regions
+// are 16 bytes
+#define UNHOOK_POOLSIZE 0x8000
+#define UNHOOK_NAMESIZE 0x4000
 
-// Address of the region.
-static uint8_t *g_addr[UNHOOK_MAXCOUNT];
+// scan interval in milliseconds, doubled after every scan without changes
+#define UNHOOK_MIN_INTERVAL 500
+#define UNHOOK_MAX_INTERVAL 4000
 
-// Function name of the region.
-static char g_funcname[UNHOOK_MAXCOUNT][64];
+// regions looked up at once by restore_hooks_on_range()
+#define UNHOOK_RESTORE_BATCH 64
 
-// The original contents of this region, before we modified it.
-static uint8_t g_orig[UNHOOK_MAXCOUNT][UNHOOK_BUFSIZE];
-
-// The contents of this region after we modified it.
-static uint8_t g_our[UNHOOK_BUFSIZE][UNHOOK_BUFSIZE];
+static HANDLE g_unhook_thread_handle, g_watcher_thread_handle;
 
-// If the region has been modified, did we report this already?
-static uint8_t g_hook_reported[UNHOOK_MAXCOUNT];
+static region_table_t g_regions;
 
 void unhook_detect_add_region(const char *funcname, uint8_t *addr,
     const uint8_t *orig, const uint8_t *our, uint32_t length)
 {
-    if(g_index == UNHOOK_MAXCOUNT) {
-        pipe("CRITICAL:Reached maximum number of unhook detection entries!");
+    if(g_regions.capacity == 0 && region_init(&g_regions, UNHOOK_MAXCOUNT,
+            UNHOOK_POOLSIZE, UNHOOK_NAMESIZE, UNHOOK_MIN_INTERVAL,
+            UNHOOK_MAX_INTERVAL) < 0) {
+        pipe("CRITICAL:Unable to allocate the unhook detection table!");
         return;
     }
 
-    g_length[g_index] = length;
-    g_addr[g_index] = addr;
-
-    if(funcname != NULL) {
-        strcpy(g_funcname[g_index], funcname);
+    if(region_add(&g_regions, funcname, addr, orig, our, length) < 0) {
+        pipe("CRITICAL:Reached maximum number of unhook detection entries!");
     }
+}
 
-    memcpy(g_orig[g_index], orig, MIN(length, UNHOOK_BUFSIZE));
-    memcpy(g_our[g_index], our, MIN(length, UNHOOK_BUFSIZE));
-    g_index++;
+static void _unhook_report(void *ctx, uint32_t idx, int what)
+{
+	const char *funcname = region_name(&g_regions, idx);
+
+	if (is_shutting_down() == 0) {
+		if (what == REGION_MODIFIED)
+			log_hook_modification(funcname, region_our(&g_regions, idx),
+				g_regions.addr[idx], g_regions.length[idx]);
+		else
+			log_hook_removal(funcname);
+	}
 }
 
 void restore_hooks_on_range(ULONG_PTR start, ULONG_PTR end)
 {
+	uint32_t found[UNHOOK_RESTORE_BATCH], restored[UNHOOK_RESTORE_BATCH];
+	unsigned int count, restored_count;
+	uint32_t pos, last_name = UINT32_MAX;
 	lasterror_t lasterror;
 
+	if (g_regions.capacity == 0)
+		return;
+
+	// the common case, none of our hooks are in this range
+	pos = region_range_begin(&g_regions, start);
+	count = region_find_range(&g_regions, &pos, end, found, ARRAYSIZE(found));
+	if (count == 0)
+		return;
+
 	get_lasterrors(&lasterror);
 
-	__try {
-		for (uint32_t idx = 0; idx < g_index; idx++) {
-			if ((ULONG_PTR)g_addr[idx] < start || ((ULONG_PTR)g_addr[idx] + g_length[idx]) > end)
-				continue;
-			if (!memcmp(g_orig[idx], g_addr[idx], g_length[idx])) {
-				memcpy(g_addr[idx], g_our[idx], g_length[idx]);
-				log_hook_restoration(g_funcname[idx]);
+	while (count != 0) {
+		restored_count = 0;
+		for (unsigned int i = 0; i < count; i++) {
+			// one region faulting doesn't keep the others from being
+			// restored
+			__try {
+				if (region_restore(&g_regions, found[i]))
+					restored[restored_count++] = found[i];
+			}
+			__except (EXCEPTION_EXECUTE_HANDLER) {
+				;
 			}
 		}
-	}
-	__except (EXCEPTION_EXECUTE_HANDLER) {
-		;
+
+		// log once we're done with the hooked code of the batch, one
+		// record per function (the regions of a function share their
+		// interned name and lie next to each other)
+		for (unsigned int i = 0; i < restored_count; i++) {
+			uint32_t name = g_regions.name[restored[i]];
+			unsigned int j;
+			for (j = 0; j < i; j++) {
+				if (g_regions.name[restored[j]] == name)
+					break;
+			}
+			if (j == i && name != last_name)
+				log_hook_restoration(region_name(&g_regions, restored[i]));
+		}
+		if (restored_count != 0)
+			last_name = g_regions.name[restored[restored_count - 1]];
+
+		if (count < ARRAYSIZE(found))
+			break;
+		count = region_find_range(&g_regions, &pos, end, found, ARRAYSIZE(found));
 	}
 
 	set_lasterrors(&lasterror);
 }
 
-
 static DWORD WINAPI _unhook_detect_thread(LPVOID param)
 {
     static int watcher_first = 1;
@@ -101,8 +134,10 @@ static DWORD WINAPI _unhook_detect_thread(LPVOID param)
     hook_disable();
 
     while (1) {
+        unsigned int interval = g_regions.capacity ? g_regions.scan.interval : UNHOOK_MIN_INTERVAL;
+
         if(WaitForSingleObject(g_watcher_thread_handle,
-                500) != WAIT_TIMEOUT) {
+                interval) != WAIT_TIMEOUT) {
             if(watcher_first != 0) {
                 if(is_shutting_down() == 0) {
                     log_anomaly("unhook", 1, NULL,
@@ -113,29 +148,11 @@ static DWORD WINAPI _unhook_detect_thread(LPVOID param)
             raw_sleep(100);
         }
 
+		if (g_regions.capacity == 0)
+			continue;
+
 		__try {
-			for (uint32_t idx = 0; idx < g_index; idx++) {
-				int is_modification = 1;
-				// Check whether this memory region still equals what we made it.
-				if (!memcmp(g_addr[idx], g_our[idx], g_length[idx])) {
-					continue;
-				}
-
-				// If the memory region matches the original contents, then it
-				// has been restored to its original state.
-				if (!memcmp(g_orig[idx], g_addr[idx], g_length[idx]))
-					is_modification = 0;
-
-				if (g_hook_reported[idx] == 0) {
-					if (is_shutting_down() == 0) {
-						if (is_modification)
-							log_hook_modification(g_funcname[idx], g_our[idx], g_addr[idx], g_length[idx]);
-						else
-							log_hook_removal(g_funcname[idx]);
-					}
-					g_hook_reported[idx] = 1;
-				}
-			}
+			region_scan(&g_regions, &_unhook_report, NULL);
 		}
 		__except (EXCEPTION_EXECUTE_HANDLER) {
 			// cuckoo currently has no handling for FreeLibrary, so if a hooked DLL ends up
@@ -186,6 +203,7 @@ static DWORD WINAPI _terminate_event_thread(LPVOID param)
 	while (1) {
 		WaitForSingleObject(g_terminate_event_handle, INFINITE);
 		log_flush();
+		pipe_flush();
 	}
 
 	return 0;
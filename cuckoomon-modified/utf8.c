@@ -17,10 +17,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include <stdio.h>
-#include <windows.h>
-#include "alloc.h"
+#include "compat.h"
 #include "utf8.h"
 
+// lstrlenW(), which isn't there outside of Windows; wcslen() has a wider
+// wchar_t there
+static int wide_length(const wchar_t *s)
+{
+	int ret = 0;
+	while (s[ret] != 0)
+		ret++;
+	return ret;
+}
+
 int utf8_encode(unsigned short c, unsigned char *out)
 {
     if(c < 0x80) {
@@ -60,7 +69,7 @@ int utf8_strlen_ascii(const char *s, int len)
 
 int utf8_strlen_unicode(const wchar_t *s, int len)
 {
-    if(len < 0) len = lstrlenW(s);
+    if(len < 0) len = wide_length(s);
 
     int ret = 0;
     while (len-- != 0) {
@@ -87,7 +96,7 @@ char * utf8_string(const char *str, int length)
 
 char * utf8_wstring(const wchar_t *str, int length)
 {
-    if (length == -1) length = lstrlenW(str);
+    if (length == -1) length = wide_length(str);
     
     int encoded_length = utf8_strlen_unicode(str, length);
     char * utf8string = (char *) malloc(encoded_length+4);
@@ -0,0 +1,99 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vclock.h"
+
+int64_t vclock_skip(vclock_t *c, int64_t interval)
+{
+	if (interval <= 0)
+		return vclock_skipped(c);
+	return atomic_add64(&c->skipped, interval) + interval;
+}
+
+int64_t vclock_skipped(vclock_t *c)
+{
+	return atomic_read64(&c->skipped);
+}
+
+int64_t vclock_time(vclock_t *c, int64_t real)
+{
+	return real + vclock_skipped(c);
+}
+
+uint32_t vclock_ticks(vclock_t *c, uint32_t real)
+{
+	// the low 32 bits of the sum only depend on the low 32 bits of both
+	return real + (uint32_t)(vclock_skipped(c) / VCLOCK_UNITS_PER_MS);
+}
+
+uint64_t vclock_ticks64(vclock_t *c, uint64_t real)
+{
+	return real + (uint64_t)(vclock_skipped(c) / VCLOCK_UNITS_PER_MS);
+}
+
+int64_t vclock_dilate(int64_t interval, uint32_t factor)
+{
+	if (factor <= 1 || interval <= 0)
+		return interval;
+	return interval / factor;
+}
+
+// adds the dilation of the waits in progress up to now, with the lock held
+static void dilate_until(vclock_t *c, int64_t now, uint32_t factor)
+{
+	// the interrupt time was read before taking the lock, so another
+	// thread may have come in with a later one
+	if (now <= c->dilated_at)
+		return;
+	if (c->waits != 0)
+		vclock_skip(c, (now - c->dilated_at) * (factor - 1));
+	c->dilated_at = now;
+}
+
+void vclock_wait_begin(vclock_t *c, int64_t now, uint32_t factor)
+{
+	if (factor <= 1)
+		return;
+
+	spin_lock(&c->lock);
+	dilate_until(c, now, factor);
+	c->waits++;
+	spin_unlock(&c->lock);
+}
+
+void vclock_wait_end(vclock_t *c, int64_t now, uint32_t factor)
+{
+	if (factor <= 1)
+		return;
+
+	spin_lock(&c->lock);
+	dilate_until(c, now, factor);
+	if (c->waits != 0)
+		c->waits--;
+	spin_unlock(&c->lock);
+}
+
+int64_t vclock_counter(vclock_t *c, int64_t real, int64_t frequency)
+{
+	int64_t skipped = vclock_skipped(c);
+
+	// skipped * frequency overflows after a few hours with a 3GHz counter,
+	// so scale the whole seconds and the remainder separately
+	return real + skipped / VCLOCK_UNITS_PER_SEC * frequency +
+		skipped % VCLOCK_UNITS_PER_SEC * frequency / VCLOCK_UNITS_PER_SEC;
+}
@@ -0,0 +1,78 @@
+/*
+Cuckoo Sandbox - Automated Malware Analysis
+Copyright (C) 2010-2014 Cuckoo Sandbox Developers
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Virtual Clock
+//
+// Every time related hook adds the amount of time that was skipped (e.g.,
+// by not sleeping) to the real clock.  The skipped time is a single 64-bit
+// counter in 100-nanosecond units which is only ever increased, so as long
+// as the real clock doesn't go backwards neither does the virtual one, for
+// every clock derived from it.  Updates and reads are atomic, so any
+// thread may skip time while others read the clocks.
+//
+
+#ifndef __VCLOCK_H
+#define __VCLOCK_H
+
+#include "compat.h"
+
+#define VCLOCK_UNITS_PER_MS 10000
+#define VCLOCK_UNITS_PER_SEC 10000000
+
+typedef struct _vclock_t {
+	// time skipped so far, in 100-nanosecond units
+	volatile int64_t skipped;
+
+	// dilated waits in progress, and the real interrupt time up to which
+	// their dilation has been added to skipped
+	spinlock_t lock;
+	uint32_t waits;
+	int64_t dilated_at;
+} vclock_t;
+
+// adds interval (100-nanosecond units) to the skipped time, negative
+// intervals are ignored; returns the new total
+int64_t vclock_skip(vclock_t *c, int64_t interval);
+int64_t vclock_skipped(vclock_t *c);
+
+// system time as a FILETIME value
+int64_t vclock_time(vclock_t *c, int64_t real);
+
+// 32-bit millisecond tick count, wraps around like the real one
+uint32_t vclock_ticks(vclock_t *c, uint32_t real);
+
+// 64-bit millisecond tick count
+uint64_t vclock_ticks64(vclock_t *c, uint64_t real);
+
+// performance counter running at frequency counts per second
+int64_t vclock_counter(vclock_t *c, int64_t real, int64_t frequency);
+
+// Time dilation: a wait with a timeout of interval (100-nanosecond units)
+// only takes interval / factor of real time, vclock_dilate() returns the
+// real timeout to wait for.  While at least one such wait is in progress
+// the virtual clock runs factor times as fast as the real interrupt time,
+// so overlapping waits don't add up: two waits of a minute at the same time
+// move the clock by a minute, not two.  Every dilated wait is bracketed by
+// vclock_wait_begin() and vclock_wait_end(), passing the real interrupt
+// time at that moment; both are no-ops for factors up to one.
+int64_t vclock_dilate(int64_t interval, uint32_t factor);
+void vclock_wait_begin(vclock_t *c, int64_t now, uint32_t factor);
+void vclock_wait_end(vclock_t *c, int64_t now, uint32_t factor);
+
+#endif